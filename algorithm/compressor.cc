@@ -16,11 +16,6 @@ Status CompressorLZ4::Compress(char *source,
                                uint64_t size_source,
                                char **dest,
                                uint64_t *size_dest) {
-  if (size_source < 8) {
-    *dest = nullptr;
-    *size_dest = 0;
-    return Status::OK();
-  }
   uint32_t bound = LZ4_compressBound(size_source);
   *size_dest = 0;
   *dest = new char[8 + bound];
@@ -95,4 +90,30 @@ Status CompressorLZ4::Uncompress(char *source,
   return Status::OK();
 }
 
+
+Status CompressorLZ4::UncompressFrame(const char *source,
+                                      uint64_t size_source,
+                                      char *dest,
+                                      uint64_t size_dest,
+                                      uint64_t *size_frame_out,
+                                      uint64_t *size_uncompressed_out) {
+  if (size_source < 8) return Status::IOError("Invalid LZ4 frame: truncated frame header");
+  uint32_t size_frame, size_uncompressed;
+  GetFixed32(source,     &size_frame);
+  GetFixed32(source + 4, &size_uncompressed);
+  if (size_frame < 8 || size_frame > size_source) {
+    return Status::IOError("Invalid LZ4 frame: invalid compressed size");
+  }
+  if (size_uncompressed > size_dest) {
+    return Status::IOError("Invalid LZ4 frame: destination buffer is too small");
+  }
+  int ret = LZ4_decompress_safe(source + 8, dest, size_frame - 8, size_uncompressed);
+  if (ret < 0 || (uint32_t)ret != size_uncompressed) {
+    return Status::IOError("LZ4_decompress_safe() failed");
+  }
+  *size_frame_out = size_frame;
+  *size_uncompressed_out = size_uncompressed;
+  return Status::OK();
+}
+
 };
@@ -53,6 +53,17 @@ class CompressorLZ4 {
                     uint64_t *size_frame_out
                    );
 
+  // Uncompresses the single frame starting at 'source' into 'dest', which
+  // must be able to hold the uncompressed frame. Unlike Uncompress(), this
+  // method keeps no state and allocates no memory: the caller walks the
+  // frames of a value by adding 'size_frame_out' to 'source' after each call.
+  static Status UncompressFrame(const char *source,
+                                uint64_t size_source,
+                                char *dest,
+                                uint64_t size_dest,
+                                uint64_t *size_frame_out,
+                                uint64_t *size_uncompressed_out);
+
   uint64_t thread_local_handler(std::map<std::thread::id, uint64_t>& status,
                                 std::mutex& mutex,
                                 uint64_t value,
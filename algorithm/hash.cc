@@ -7,18 +7,11 @@
 namespace kdb {
 
 uint64_t MurmurHash3::HashFunction(const char *data, uint32_t len) {
-  // NOTE: You may need to change the seed, which by default is 0
-  static char hash[16];
-  static uint64_t output;
-  // NOTE: Beware, the len in MurmurHash3_x64_128 is an 'int', not a 'uint32_t'
-  MurmurHash3_x64_128(data, len, 0, hash);
-  memcpy(&output, hash, 8); 
-  return output;
+  return MurmurHash3::Compute(data, len);
 }
 
 uint64_t xxHash::HashFunction(const char *data, uint32_t len) {
-  // NOTE: You may need to change the seed, which by default is 0
-  return XXH64(data, len, 0);
+  return xxHash::Compute(data, len);
 }
 
 Hash* MakeHash(HashType ht) {
@@ -26,11 +26,21 @@ class Hash {
   virtual uint64_t MaxInputSize() = 0;
 };
 
+// The hashing functions are also exposed as static inline Compute() methods,
+// so that code templated on the hash type, such as the hot paths of the
+// storage engine, can call them directly without going through the vtable.
 class MurmurHash3: public Hash {
  public:
   MurmurHash3() {}
   virtual ~MurmurHash3() {}
   virtual uint64_t HashFunction(const char *data, uint32_t len);
+  static inline uint64_t Compute(const char *data, uint32_t len) {
+    // NOTE: You may need to change the seed, which by default is 0
+    // NOTE: Beware, the len in MurmurHash3_x64_128 is an 'int', not a 'uint32_t'
+    uint64_t hash[2];
+    MurmurHash3_x64_128(data, len, 0, hash);
+    return hash[0];
+  }
   virtual uint64_t MaxInputSize() { return std::numeric_limits<int32_t>::max(); }
 };
 
@@ -39,11 +49,40 @@ class xxHash: public Hash {
   xxHash() {}
   virtual ~xxHash() {}
   virtual uint64_t HashFunction(const char *data, uint32_t len);
+  static inline uint64_t Compute(const char *data, uint32_t len) {
+    // NOTE: You may need to change the seed, which by default is 0
+    return XXH64(data, len, 0);
+  }
   virtual uint64_t MaxInputSize() { return std::numeric_limits<int32_t>::max(); }
 };
 
 Hash* MakeHash(HashType ht);
 
+// Returns the stripe a key belongs to, out of 'num_stripes'. The seed is
+// different from the one of the hash functions used by the index, so that the
+// keys of a stripe are still spread evenly over the hashes of its index.
+inline uint32_t HashStripe(const char *data, uint64_t len, uint32_t num_stripes) {
+  if (num_stripes <= 1) return 0;
+  return XXH64(data, len, 0x9e3779b1) % num_stripes;
+}
+
+// Returns the partition a key belongs to. If the key has a tag, which is the
+// part between its first '{' and the next '}' when that part is not empty,
+// only the tag is hashed: the keys that share a tag, such as "user{42}.name"
+// and "user{42}.email", belong to the same partition.
+inline uint32_t HashPartition(const char *data, uint64_t len, uint32_t num_partitions) {
+  if (num_partitions <= 1) return 0;
+  const char *begin = static_cast<const char*>(memchr(data, '{', len));
+  if (begin != nullptr) {
+    begin += 1;
+    const char *end = static_cast<const char*>(memchr(begin, '}', data + len - begin));
+    if (end != nullptr && end > begin) {
+      return HashStripe(begin, end - begin, num_partitions);
+    }
+  }
+  return HashStripe(data, len, num_partitions);
+}
+
 } // namespace kdb
 
 #endif // KINGDB_HASH_H_
@@ -0,0 +1,133 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_KEY_FILTER_H_
+#define KINGDB_KEY_FILTER_H_
+
+#include "util/debug.h"
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <inttypes.h>
+
+#include "algorithm/xxhash.h"
+
+namespace kdb {
+
+// KeyFilter tells whether a key may have been added to it, with no false
+// negatives and about 1.5% of false positives, so that the lookups for
+// missing keys can stop before searching the structure the filter covers.
+// It is a blocked Bloom filter: all the bits of a key are in the same 64-byte
+// block, thus a lookup costs at most one cache miss. The keys are given by
+// their 64-bit hashes, which are mixed again so that the bits used by the
+// filter do not follow the ones the index is ordered by.
+// Keys cannot be removed: the filter is rebuilt instead, and it keeps working
+// beyond the number of keys it was sized for, only with more false positives.
+// KeyFilter is not thread-safe, it is protected by the locks of the structure
+// it covers. An empty filter, which was never sized, contains every key.
+class KeyFilter {
+ public:
+  KeyFilter()
+      : blocks_(nullptr),
+        num_blocks_(0),
+        num_keys_(0),
+        num_keys_max_(0) {
+  }
+  // The blocks point into the words, thus filters cannot be copied
+  KeyFilter(const KeyFilter&) = delete;
+  KeyFilter& operator=(const KeyFilter&) = delete;
+
+  // Empties the filter and sizes it for 'num_keys_max' keys
+  void Reset(uint64_t num_keys_max) {
+    num_keys_max_ = (num_keys_max > kNumKeysMin) ? num_keys_max : kNumKeysMin;
+    num_blocks_ = (num_keys_max_ * kBitsPerKey + kBitsPerBlock - 1) / kBitsPerBlock;
+    // The words are allocated with one extra block, for the blocks to be
+    // aligned on cache lines
+    words_.assign((num_blocks_ + 1) * kWordsPerBlock, 0);
+    uintptr_t address = reinterpret_cast<uintptr_t>(words_.data());
+    uintptr_t address_aligned = (address + kSizeBlock - 1) & ~(uintptr_t)(kSizeBlock - 1);
+    blocks_ = reinterpret_cast<uint64_t*>(address_aligned);
+    num_keys_ = 0;
+  }
+
+  // Empties the filter and keeps its size
+  void Clear() {
+    std::fill(words_.begin(), words_.end(), 0);
+    num_keys_ = 0;
+  }
+
+  void Add(uint64_t hash) {
+    if (num_blocks_ == 0) return;
+    uint64_t mixed = Mix(hash);
+    uint64_t *block = GetBlock(mixed);
+    uint32_t bit = mixed & (kBitsPerBlock - 1);
+    uint32_t step = ((mixed >> 9) & (kBitsPerBlock - 1)) | 1;
+    for (uint32_t i = 0; i < kNumProbes; i++) {
+      block[bit >> 6] |= (uint64_t)1 << (bit & 63);
+      bit = (bit + step) & (kBitsPerBlock - 1);
+    }
+    num_keys_ += 1;
+  }
+
+  bool MayContain(uint64_t hash) const {
+    if (num_blocks_ == 0) return true;
+    uint64_t mixed = Mix(hash);
+    const uint64_t *block = GetBlock(mixed);
+    uint32_t bit = mixed & (kBitsPerBlock - 1);
+    uint32_t step = ((mixed >> 9) & (kBitsPerBlock - 1)) | 1;
+    for (uint32_t i = 0; i < kNumProbes; i++) {
+      if ((block[bit >> 6] & ((uint64_t)1 << (bit & 63))) == 0) return false;
+      bit = (bit + step) & (kBitsPerBlock - 1);
+    }
+    return true;
+  }
+
+  // Returns true once the filter holds the number of keys it was sized for,
+  // which is when it should be rebuilt larger
+  bool IsFull() const { return num_blocks_ > 0 && num_keys_ >= num_keys_max_; }
+  uint64_t num_keys() const { return num_keys_; }
+  uint64_t num_keys_max() const { return num_keys_max_; }
+  uint64_t size() const { return words_.size() * sizeof(uint64_t); }
+
+  // Hash of a key for the filters that are not keyed by the hashes of an
+  // index. The seed differs from the ones of the index and of the partitions.
+  static uint64_t HashKey(const char *data, uint64_t len) {
+    return XXH64(data, len, 0x85ebca6b);
+  }
+
+ private:
+  static const uint64_t kBitsPerKey = 10;
+  static const uint32_t kNumProbes = 6;
+  static const uint64_t kSizeBlock = 64;
+  static const uint64_t kBitsPerBlock = kSizeBlock * 8;
+  static const uint64_t kWordsPerBlock = kSizeBlock / sizeof(uint64_t);
+  static const uint64_t kNumKeysMin = 1024;
+
+  // Finalizer of MurmurHash3
+  static uint64_t Mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  // The block is picked with the upper bits, and the bits inside the block
+  // with the lower ones
+  uint64_t* GetBlock(uint64_t mixed) const {
+    uint64_t index = ((mixed >> 32) * num_blocks_) >> 32;
+    return blocks_ + index * kWordsPerBlock;
+  }
+
+  std::vector<uint64_t> words_;
+  uint64_t *blocks_;
+  uint64_t num_blocks_;
+  uint64_t num_keys_;
+  uint64_t num_keys_max_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_KEY_FILTER_H_
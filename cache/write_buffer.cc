@@ -6,23 +6,114 @@
 
 namespace kdb {
 
+// Returns once the orders that are in the buffers when it is called have been
+// flushed and indexed by the storage engine, using the same tickets as the
+// synchronous writes.
 void WriteBuffer::Flush() {
   if (IsStopRequested()) return;
-  log::debug("LOCK", "2 lock");
-  std::unique_lock<std::mutex> lock_flush(mutex_flush_level2_);
-  // NOTE: Doing the flushing and waiting twice, in case the two buffers,
-  // 'live' and 'copy', have items. This is a quick hack and a better
-  // solution should be investigated.
-  for (auto i = 0; i < 2; i++) {
-    cv_flush_.notify_one();
-    cv_flush_done_.wait_for(lock_flush, std::chrono::milliseconds(db_options_.write_buffer__close_timeout));
+  uint64_t ticket;
+  {
+    log::debug("LOCK", "3 lock");
+    std::unique_lock<std::mutex> lock_swap(mutex_indices_level3_);
+    if (buffers_[im_live_].empty() && buffers_[im_copy_].empty()) return;
+    ticket = buffers_[im_live_].empty() ? sequence_copy_ : sequence_live_;
+    log::debug("LOCK", "3 unlock");
   }
+  WaitUntilDurable(ticket);
   log::trace("WriteBuffer::Flush()", "end");
 }
 
+void WriteBuffer::LockWrites() {
+  log::debug("LOCK", "1 lock");
+  mutex_live_write_level1_.lock();
+}
+
+void WriteBuffer::UnlockWrites() {
+  mutex_live_write_level1_.unlock();
+  log::debug("LOCK", "1 unlock");
+}
+
+uint64_t WriteBuffer::NextVersion() {
+  std::unique_lock<std::mutex> lock(mutex_indices_level3_);
+  return version_clock_.Next();
+}
+
+
 Status WriteBuffer::Get(ReadOptions& read_options, ByteArray* key, ByteArray** value_out) {
-  // TODO: need to fix the way the value is returned here: to create a new
-  //       memory space and then return.
+  // The value is copied out of the buffers, because the orders are deleted
+  // as soon as they have been flushed to secondary storage.
+  Value value;
+  Status s = Get(read_options, Slice(key->data(), key->size()), nullptr, &value);
+  if (!s.IsOK()) return s;
+  AllocatedByteArray *value_copy = new AllocatedByteArray(value.size());
+  memcpy(value_copy->data(), value.data(), value.size());
+  *value_out = value_copy;
+  return s;
+}
+
+
+Status WriteBuffer::Get(ReadOptions& read_options,
+                        const Slice& key,
+                        BufferPool* pool,
+                        Value* value_out,
+                        uint64_t* version_out) {
+  OrderMetadata metadata;
+  Status s = Find(read_options, key, pool, value_out, nullptr, 0, nullptr, &metadata);
+  if (s.IsOK() && version_out != nullptr) *version_out = metadata.version;
+  return s;
+}
+
+
+Status WriteBuffer::GetVersion(ReadOptions& read_options,
+                               const Slice& key,
+                               uint64_t* version_out) {
+  OrderMetadata metadata;
+  Status s = Find(read_options, key, nullptr, nullptr, nullptr, 0, nullptr, &metadata);
+  if (s.IsOK()) *version_out = metadata.version;
+  return s;
+}
+
+
+Status WriteBuffer::GetMetadata(ReadOptions& read_options,
+                                const Slice& key,
+                                uint64_t* size_value_out,
+                                uint64_t* size_value_compressed_out,
+                                uint64_t* version_out) {
+  OrderMetadata metadata;
+  Status s = Find(read_options, key, nullptr, nullptr, nullptr, 0, nullptr, &metadata);
+  if (!s.IsOK()) return s;
+  // Same as Get(): an entry still being written is not visible yet
+  if (!metadata.is_self_contained) return Status::NotFound();
+  if (size_value_out != nullptr) *size_value_out = metadata.size_value;
+  if (size_value_compressed_out != nullptr) *size_value_compressed_out = metadata.size_value_compressed;
+  if (version_out != nullptr) *version_out = metadata.version;
+  return s;
+}
+
+
+Status WriteBuffer::GetInto(ReadOptions& read_options,
+                            const Slice& key,
+                            char* buffer,
+                            uint64_t size_buffer,
+                            uint64_t* size_out) {
+  return Find(read_options, key, nullptr, nullptr, buffer, size_buffer, size_out, nullptr);
+}
+
+
+// Looks up 'key' in the buffers, and copies the value of the order found
+// either into 'value_out' if it is not null, or into 'buffer' otherwise.
+// If both are null, only the metadata of the order is returned, and the
+// entries that are still being written in several chunks are found too:
+// their version is the one of their most recent chunk.
+Status WriteBuffer::Find(ReadOptions& read_options,
+                         const Slice& key,
+                         BufferPool* pool,
+                         Value* value_out,
+                         char* buffer,
+                         uint64_t size_buffer,
+                         uint64_t* size_out,
+                         OrderMetadata* metadata_out) {
+  bool is_metadata_only = (value_out == nullptr && buffer == nullptr);
   // TODO: make sure the live buffer doesn't need to be protected by a mutex in
   //       order to be accessed -- right now I'm relying on timing, but that may
   //       be too weak to guarantee proper access
@@ -31,6 +122,7 @@ Status WriteBuffer::Get(ReadOptions& read_options, ByteArray* key, ByteArray** v
   //       or should it try to send the data from the disk and the partially
   //       available chunks in the buffer?
   if (IsStopRequested()) return Status::IOError("Cannot handle request: WriteBuffer is closing");
+  uint64_t hashed_key = KeyFilter::HashKey(key.data(), key.size());
 
   // read the "live" buffer
   mutex_live_write_level1_.lock();
@@ -38,7 +130,7 @@ Status WriteBuffer::Get(ReadOptions& read_options, ByteArray* key, ByteArray** v
   mutex_indices_level3_.lock();
   log::debug("LOCK", "3 lock");
   auto& buffer_live = buffers_[im_live_];
-  int num_items = buffer_live.size();
+  int num_items = filters_[im_live_].MayContain(hashed_key) ? buffer_live.size() : 0;
   mutex_indices_level3_.unlock();
   log::debug("LOCK", "3 unlock");
   mutex_live_write_level1_.unlock();
@@ -47,7 +139,7 @@ Status WriteBuffer::Get(ReadOptions& read_options, ByteArray* key, ByteArray** v
   Order order_found;
   for (int i = 0; i < num_items; i++) {
     auto& order = buffer_live[i];
-    if (*order.key == *key) {
+    if (key == *order.key) {
       found = true;
       order_found = order;
     }
@@ -55,13 +147,13 @@ Status WriteBuffer::Get(ReadOptions& read_options, ByteArray* key, ByteArray** v
   if (found) {
     log::debug("WriteBuffer::Get()", "found in buffer_live");
     if (   order_found.type == OrderType::Put
-        && order_found.chunk->size() == order_found.size_value) {
-      *value_out = order_found.chunk;
-      return Status::OK();
+        && (order_found.IsSelfContained() || is_metadata_only)) {
+      if (metadata_out != nullptr) CopyMetadata(order_found, metadata_out);
+      return CopyValue(order_found, pool, value_out, buffer, size_buffer, size_out);
     } else if (order_found.type == OrderType::Remove) {
       return Status::RemoveOrder();
     } else {
-      return Status::NotFound("Unable to find entry");
+      return Status::NotFound();
     }
   }
 
@@ -81,12 +173,15 @@ Status WriteBuffer::Get(ReadOptions& read_options, ByteArray* key, ByteArray** v
   log::debug("LOCK", "3 lock");
   mutex_indices_level3_.lock();
   auto& buffer_copy = buffers_[im_copy_];
+  bool may_contain_copy = filters_[im_copy_].MayContain(hashed_key);
   mutex_indices_level3_.unlock();
   log::debug("LOCK", "3 unlock");
-  for (auto& order: buffer_copy) {
-    if (*order.key == *key) {
-      found = true;
-      order_found = order;
+  if (may_contain_copy) {
+    for (auto& order: buffer_copy) {
+      if (key == *order.key) {
+        found = true;
+        order_found = order;
+      }
     }
   }
 
@@ -94,14 +189,16 @@ Status WriteBuffer::Get(ReadOptions& read_options, ByteArray* key, ByteArray** v
   if (found) log::debug("WriteBuffer::Get()", "found in buffer_copy");
   if (   found
       && order_found.type == OrderType::Put
-      && order_found.chunk->size() == order_found.size_value) {
-    *value_out = order_found.chunk;
-    s = Status::OK();
+      && (order_found.IsSelfContained() || is_metadata_only)) {
+    // The copy is done before exiting the "copy" buffer, as the orders
+    // may be deleted right after that
+    if (metadata_out != nullptr) CopyMetadata(order_found, metadata_out);
+    s = CopyValue(order_found, pool, value_out, buffer, size_buffer, size_out);
   } else if (   found
              && order_found.type == OrderType::Remove) {
     s = Status::RemoveOrder();
   } else {
-    s = Status::NotFound("Unable to find entry");
+    s = Status::NotFound();
   }
 
   // exit the "copy" buffer
@@ -116,6 +213,57 @@ Status WriteBuffer::Get(ReadOptions& read_options, ByteArray* key, ByteArray** v
 }
 
 
+void WriteBuffer::CopyMetadata(Order& order, OrderMetadata* metadata_out) {
+  metadata_out->size_value = order.size_value;
+  metadata_out->size_value_compressed = order.size_value_compressed;
+  metadata_out->version = order.version;
+  metadata_out->is_self_contained = order.IsSelfContained();
+}
+
+
+Status WriteBuffer::CopyValue(Order& order,
+                              BufferPool* pool,
+                              Value* value_out,
+                              char* buffer,
+                              uint64_t size_buffer,
+                              uint64_t* size_out) {
+  if (value_out == nullptr && buffer == nullptr) return Status::OK();
+  if (value_out == nullptr) {
+    *size_out = order.size_value;
+    return CopyValueInto(order, buffer, size_buffer);
+  }
+  char *dest = value_out->Allocate(pool, order.size_value);
+  Status s = CopyValueInto(order, dest, order.size_value);
+  if (!s.IsOK()) value_out->Reset();
+  return s;
+}
+
+
+Status WriteBuffer::CopyValueInto(Order& order, char* dest, uint64_t size_dest) {
+  if (order.size_value > size_dest) return Status::InvalidArgument("Buffer is too small");
+  if (order.size_value_compressed == 0) {
+    memcpy(dest, order.chunk->data(), order.size_value);
+    return Status::OK();
+  }
+
+  // The chunk holds the LZ4 frames of the value
+  uint64_t offset = 0, size_uncompressed_total = 0;
+  while (offset < order.chunk->size()) {
+    uint64_t size_frame, size_uncompressed;
+    Status s = CompressorLZ4::UncompressFrame(order.chunk->data() + offset,
+                                              order.chunk->size() - offset,
+                                              dest + size_uncompressed_total,
+                                              size_dest - size_uncompressed_total,
+                                              &size_frame,
+                                              &size_uncompressed);
+    if (!s.IsOK()) return s;
+    offset += size_frame;
+    size_uncompressed_total += size_uncompressed;
+  }
+  return Status::OK();
+}
+
+
 Status WriteBuffer::Put(WriteOptions& write_options, ByteArray* key, ByteArray* chunk) {
   //return Write(OrderType::Put, key, value);
   return Status::InvalidArgument("WriteBuffer::Put() is not implemented");
@@ -128,24 +276,60 @@ Status WriteBuffer::PutChunk(WriteOptions& write_options,
                                uint64_t offset_chunk,
                                uint64_t size_value,
                                uint64_t size_value_compressed,
-                               uint32_t crc32) {
+                               uint32_t crc32,
+                               uint64_t* ticket_out) {
   return WriteChunk(OrderType::Put,
                     key,
                     chunk,
                     offset_chunk,
                     size_value,
                     size_value_compressed,
-                    crc32
+                    crc32,
+                    write_options.sync,
+                    false,
+                    ticket_out
                    );
 }
 
 
-Status WriteBuffer::Remove(WriteOptions& write_options, ByteArray* key) {
-  // TODO: The storage engine is calling data() and size() on the chunk ByteArray.
-  //       The use of SimpleByteArray here is a hack to guarantee that data()
-  //       and size() won't be called on a nullptr -- this needs to be cleaned up.
-  auto empty_chunk = new SimpleByteArray(nullptr, 0);
-  return WriteChunk(OrderType::Remove, key, empty_chunk, 0, 0, 0, 0);
+Status WriteBuffer::PutChunk(WriteOptions& write_options,
+                             const Slice& key,
+                             const Slice& chunk,
+                             uint64_t offset_chunk,
+                             uint64_t size_value,
+                             uint64_t size_value_compressed,
+                             uint32_t crc32,
+                             uint64_t* ticket_out) {
+  // The byte arrays only live until the order is added, at which point their
+  // data is copied into the arena of the live buffer
+  SimpleByteArray key_slice(key.data(), key.size());
+  SimpleByteArray chunk_slice(chunk.data(), chunk.size());
+  return WriteChunk(OrderType::Put,
+                    &key_slice,
+                    &chunk_slice,
+                    offset_chunk,
+                    size_value,
+                    size_value_compressed,
+                    crc32,
+                    write_options.sync,
+                    true,
+                    ticket_out);
+}
+
+
+Status WriteBuffer::Remove(WriteOptions& write_options, ByteArray* key, uint64_t* ticket_out) {
+  Status s = Remove(write_options, Slice(key->data(), key->size()), ticket_out);
+  delete key;
+  return s;
+}
+
+
+Status WriteBuffer::Remove(WriteOptions& write_options, const Slice& key, uint64_t* ticket_out) {
+  // The storage engine is calling data() and size() on the chunk, thus
+  // removes get an empty chunk instead of a nullptr.
+  SimpleByteArray key_slice(key.data(), key.size());
+  SimpleByteArray empty_chunk(nullptr, 0);
+  return WriteChunk(OrderType::Remove, &key_slice, &empty_chunk, 0, 0, 0, 0, write_options.sync, true, ticket_out);
 }
 
 
@@ -155,31 +339,59 @@ Status WriteBuffer::WriteChunk(const OrderType& op,
                                  uint64_t offset_chunk,
                                  uint64_t size_value,
                                  uint64_t size_value_compressed,
-                                 uint32_t crc32) {
+                                 uint32_t crc32,
+                                 bool is_sync,
+                                 bool is_in_arena,
+                                 uint64_t* ticket_out) {
   if (IsStopRequested()) return Status::IOError("Cannot handle request: WriteBuffer is closing");
-  log::debug("LOCK", "1 lock");
-  std::unique_lock<std::mutex> lock_live(mutex_live_write_level1_);
-
   log::trace("WriteBuffer::WriteChunk()",
-            "Write() key:[%s] | size chunk:%d, total size value:%d offset_chunk:%" PRIu64 " sizeOfBuffer:%d",
-            key->ToString().c_str(), chunk->size(), size_value, offset_chunk, buffers_[im_live_].size());
+            "Write() key:[%s] | size chunk:%d, total size value:%d offset_chunk:%" PRIu64,
+            key->ToString().c_str(), chunk->size(), size_value, offset_chunk);
 
-  bool is_first_chunk = (offset_chunk == 0);
   bool is_large = key->size() + size_value > db_options_.storage__hstable_size;
-  buffers_[im_live_].push_back(Order{std::this_thread::get_id(),
-                                     op,
-                                     key,
-                                     chunk,
-                                     offset_chunk,
-                                     size_value,
-                                     size_value_compressed,
-                                     crc32,
-                                     is_large});
-
-  if (is_first_chunk) {
-    sizes_[im_live_] += key->size();
+  Order order{std::this_thread::get_id(),
+              op,
+              key,
+              chunk,
+              offset_chunk,
+              size_value,
+              size_value_compressed,
+              crc32,
+              is_large,
+              is_sync,
+              0,
+              is_in_arena,
+              0};
+  return WriteOrders(&order, 1, ticket_out);
+}
+
+
+Status WriteBuffer::Write(WriteOptions& write_options, std::vector<Order>& orders, uint64_t* ticket_out) {
+  // The orders of a batch only hold self-contained entries, which are never
+  // large, and the number of orders left in the batch is what allows the
+  // storage engine to identify the batch and write it contiguously.
+  if (IsStopRequested()) return Status::IOError("Cannot handle request: WriteBuffer is closing");
+  if (orders.empty()) return Status::OK();
+  for (size_t i = 0; i < orders.size(); i++) {
+    orders[i].tid = std::this_thread::get_id();
+    orders[i].is_large = false;
+    orders[i].is_sync = write_options.sync;
+    orders[i].num_batch_remaining = orders.size() - i;
   }
-  sizes_[im_live_] += chunk->size();
+  return WriteOrders(orders.data(), orders.size(), ticket_out);
+}
+
+
+Status WriteBuffer::WriteOrders(Order* orders, uint64_t num_orders, uint64_t* ticket_out) {
+  Status s = WaitForMemory();
+  if (!s.IsOK()) return s;
+
+  log::debug("LOCK", "1 lock");
+  std::unique_lock<std::mutex> lock_live(mutex_live_write_level1_);
+
+  uint64_t ticket;
+  bool is_wait;
+  AddOrders(orders, num_orders, &ticket, &is_wait);
 
   // TODO-32: Because all writes and removes transit throught this method,
   //          it is the perfect location to implement throttling. What has to
@@ -206,12 +418,12 @@ Status WriteBuffer::WriteChunk(const OrderType& op,
   /*
   if (buffers_[im_live_].size()) {
     for(auto &p: buffers_[im_live_]) {   
-      log::trace("WriteBuffer::WriteChunk()",
+      log::trace("WriteBuffer::WriteOrders()",
                 "Write() ITEM key_ptr:[%p] key:[%s] | size chunk:%d, total size value:%d offset_chunk:%" PRIu64 " sizeOfBuffer:%d sizes_[im_live_]:%d",
                 p.key, p.key->ToString().c_str(), p.chunk->size(), p.size_value, p.offset_chunk, buffers_[im_live_].size(), sizes_[im_live_]);
     }
   } else {
-    log::trace("WriteBuffer::WriteChunk()", "Write() ITEM no buffers_[im_live_]");
+    log::trace("WriteBuffer::WriteOrders()", "Write() ITEM no buffers_[im_live_]");
   }
   */
 
@@ -252,40 +464,170 @@ Status WriteBuffer::WriteChunk(const OrderType& op,
   }
   */
 
+  SwapIfFull();
+
+  lock_live.unlock();
+  log::debug("LOCK", "1 unlock");
+
+  if (ticket_out != nullptr) {
+    *ticket_out = is_wait ? ticket : 0;
+    return Status::OK();
+  }
+  if (is_wait) return WaitUntilDurable(ticket);
+  return Status::OK();
+}
+
+
+// Adds the orders to the live buffer. The caller must hold the lock of the
+// live buffer, and is given the ticket of the buffer the orders ended up in,
+// along with whether it has to wait for that ticket to be durable.
+void WriteBuffer::AddOrders(Order* orders, uint64_t num_orders, uint64_t* ticket, bool* is_wait) {
+  // The orders are added under the lock of the indices, because the flush
+  // thread can swap the buffers without holding the lock of the live buffer,
+  // and the ticket must be the sequence of the buffer the orders ended up in.
+  // All the orders are added under the same locks, thus the orders of a batch
+  // are always in the same buffer, and are visible to readers all at once.
+  // The orders to be placed in the arena still point to the data of the
+  // caller, which is copied into the arena of the buffer they are added to.
+  uint64_t size_orders = 0;
+  {
+    log::debug("LOCK", "3 lock");
+    std::unique_lock<std::mutex> lock_swap(mutex_indices_level3_);
+    for (uint64_t i = 0; i < num_orders; i++) {
+      if (orders[i].IsInArena()) {
+        orders[i].key = CopyToArena(&arenas_[im_live_], orders[i].key);
+        orders[i].chunk = CopyToArena(&arenas_[im_live_], orders[i].chunk);
+      }
+      orders[i].version = version_clock_.Next();
+      buffers_[im_live_].push_back(orders[i]);
+      filters_[im_live_].Add(KeyFilter::HashKey(orders[i].key->data(), orders[i].key->size()));
+      if (orders[i].IsFirstChunk()) {
+        sizes_[im_live_] += orders[i].key->size();
+      }
+      sizes_[im_live_] += orders[i].chunk->size();
+      size_orders += SizeOfOrder(orders[i]);
+    }
+    if (filters_[im_live_].IsFull()) RebuildFilter(im_live_);
+    *ticket = sequence_live_;
+    // Only the last chunk of an entry waits, as all the chunks of an entry
+    // are in the same buffer as the last one, or in buffers that were flushed
+    // before. This is checked while the chunk cannot be flushed and released.
+    Order& order_last = orders[num_orders - 1];
+    *is_wait = order_last.IsSync() && order_last.IsLastChunk();
+    log::debug("LOCK", "3 unlock");
+  }
+  size_charged_ += size_orders;
+  if (memory_budget_ != nullptr) memory_budget_->Charge(size_orders, true);
+}
+
+
+// Swaps the buffers if the live one is full. The caller must hold the lock
+// of the live buffer.
+void WriteBuffer::SwapIfFull() {
   if (sizes_[im_live_] > buffer_size_ || force_swap_) {
-    log::trace("WriteBuffer::WriteChunk()", "trying to swap");
+    log::trace("WriteBuffer::SwapIfFull()", "trying to swap");
     // TODO: play with the mutex_flush_, try to keep it before the
     // if(can_swap_) or inside the if(can_swap_)
     //std::unique_lock<std::mutex> lock_flush(mutex_flush_level2_);
     if (mutex_flush_level2_.try_lock()) {
       log::debug("LOCK", "2 lock");
       if (can_swap_) {
-        log::trace("WriteBuffer::WriteChunk()", "can_swap_ == true");
+        log::trace("WriteBuffer::SwapIfFull()", "can_swap_ == true");
         log::debug("LOCK", "3 lock");
         std::unique_lock<std::mutex> lock_swap(mutex_indices_level3_);
-        log::trace("WriteBuffer::WriteChunk()", "Swap buffers");
+        log::trace("WriteBuffer::SwapIfFull()", "Swap buffers");
         can_swap_ = false;
         force_swap_ = false;
         std::swap(im_live_, im_copy_);
+        sequence_copy_ = sequence_live_++;
         cv_flush_.notify_one();
         log::debug("LOCK", "3 unlock");
       } else {
-        log::trace("WriteBuffer::WriteChunk()", "can_swap_ == false");
+        log::trace("WriteBuffer::SwapIfFull()", "can_swap_ == false");
       }
       mutex_flush_level2_.unlock();
       log::debug("LOCK", "2 unlock");
     } else {
-      log::trace("WriteBuffer::WriteChunk()", "could not lock to swap");
+      log::trace("WriteBuffer::SwapIfFull()", "could not lock to swap");
     }
   } else {
-    log::trace("WriteBuffer::WriteChunk()", "will not swap");
+    log::trace("WriteBuffer::SwapIfFull()", "will not swap");
   }
+}
 
-  log::debug("LOCK", "1 unlock");
+
+// Copies a byte array and its data into an arena. The copy is never deleted:
+// SimpleByteArray does not own its data, and the memory of both goes away
+// when the arena is reset.
+ByteArray* WriteBuffer::CopyToArena(Arena* arena, ByteArray* byte_array) {
+  uint64_t size = byte_array->size();
+  char *ptr = arena->Allocate(sizeof(SimpleByteArray) + size);
+  char *data = ptr + sizeof(SimpleByteArray);
+  if (size > 0) memcpy(data, byte_array->data(), size);
+  return new (ptr) SimpleByteArray(data, size);
+}
+
+
+// Asks the flush thread to swap the buffers right away instead of waiting for
+// the flush timeout
+void WriteBuffer::RequestSwap() {
+  log::debug("LOCK", "2 lock");
+  std::unique_lock<std::mutex> lock_flush(mutex_flush_level2_);
+  sync_requested_ = true;
+  cv_flush_.notify_one();
+  log::debug("LOCK", "2 unlock");
+}
+
+
+// Backpressure: while the memory budget is exceeded and the buffers hold
+// orders, flushing them is the way to get memory back, thus the writers wait
+// for the flushes. If the memory that flushes cannot release, such as the
+// index, is over the limit by itself, no flush will make room, and the write
+// is rejected right away. Once the buffers of this partition are empty, the
+// writers are let through, as the memory left is then held by the buffers
+// of the other partitions, which their own flushes release.
+Status WriteBuffer::WaitForMemory() {
+  if (memory_budget_ == nullptr) return Status::OK();
+  while (memory_budget_->IsOverLimit() && !IsStopRequested()) {
+    if (memory_budget_->IsOverLimitUnflushable()) {
+      return Status::IOError("The memory limit of the database is reached by memory that flushes cannot release");
+    }
+    if (size_charged_ == 0) break;
+    RequestSwap();
+    memory_budget_->WaitForRoom(db_options_.write_buffer__flush_timeout);
+  }
   return Status::OK();
 }
 
 
+Status WriteBuffer::WaitUntilDurable(uint64_t ticket) {
+  // Group commit: the flush thread is asked to swap the buffers right away
+  // instead of waiting for the flush timeout, and all the writers whose
+  // orders are in the swapped buffer share the fdatasync() of that flush.
+  // The writers that arrive while a flush is in progress block on the flush
+  // lock, and their orders are all flushed together by the next one.
+  RequestSwap();
+
+  std::unique_lock<std::mutex> lock_sync(mutex_sync_);
+  while (sequence_durable_ < ticket && status_sync_.IsOK()) {
+    if (IsStopRequested()) return Status::IOError("Cannot confirm sync: WriteBuffer is closing");
+    cv_sync_.wait(lock_sync);
+  }
+  return status_sync_;
+}
+
+
+// Rebuilds the filter of a buffer with room for twice its orders. Must be
+// called with mutex_indices_level3_ held.
+void WriteBuffer::RebuildFilter(int index_buffer) {
+  KeyFilter& filter = filters_[index_buffer];
+  filter.Reset(2 * buffers_[index_buffer].size());
+  for (auto& order: buffers_[index_buffer]) {
+    filter.Add(KeyFilter::HashKey(order.key->data(), order.key->size()));
+  }
+}
+
+
 void WriteBuffer::ProcessingLoop() {
   while(true) {
     log::trace("WriteBuffer", "ProcessingLoop() - start");
@@ -294,14 +636,20 @@ void WriteBuffer::ProcessingLoop() {
     while (sizes_[im_copy_] == 0) {
       log::trace("WriteBuffer", "ProcessingLoop() - wait - %" PRIu64 " %" PRIu64, buffers_[im_copy_].size(), buffers_[im_live_].size());
       can_swap_ = true;
-      std::cv_status status = cv_flush_.wait_for(lock_flush, std::chrono::milliseconds(db_options_.write_buffer__flush_timeout));
-      if (status == std::cv_status::no_timeout) {
+      std::cv_status status = std::cv_status::no_timeout;
+      if (!sync_requested_) {
+        status = cv_flush_.wait_for(lock_flush, std::chrono::milliseconds(db_options_.write_buffer__flush_timeout));
+      }
+      bool is_sync_requested = sync_requested_;
+      sync_requested_ = false;
+      if (status == std::cv_status::no_timeout && !is_sync_requested) {
         //log::info("WriteBuffer", "ProcessingLoop() - swapped no timeout");
         break;
-      } else if (   status == std::cv_status::timeout
-                 && buffers_[im_live_].size() > 0) {
+      } else if (buffers_[im_live_].size() > 0) {
+        // The swap is done on timeout, or right away if a writer is waiting
+        // for its orders to be synced.
         // Note: I could have made it so the swap only happened here and not in
-        //       WriteChunk(), however it is simpler to have swapping code twice
+        //       WriteOrders(), however it is simpler to have swapping code twice
         //       than to have to deal with adding and removing items from the
         //       live buffer, because it would requires lots of locking --
         //       working with the copy buffer is simpler.
@@ -310,6 +658,7 @@ void WriteBuffer::ProcessingLoop() {
         can_swap_ = false;
         force_swap_ = false;
         std::swap(im_live_, im_copy_);
+        sequence_copy_ = sequence_live_++;
         break;
       } else if (IsStopRequested()) {
         return;
@@ -320,7 +669,10 @@ void WriteBuffer::ProcessingLoop() {
  
     // Notify the storage engine that the buffer can be flushed
     log::trace("BM", "WAIT: Get()-flush_buffer");
-    event_manager_->flush_buffer.StartAndBlockUntilDone(buffers_[im_copy_]);
+    Status s = event_manager_->flush_buffer.StartAndBlockUntilDone(buffers_[im_copy_]);
+    if (!s.IsOK()) {
+      log::emerg("WriteBuffer", "ProcessingLoop() - flush error: %s", s.ToString().c_str());
+    }
 
     // Wait for the index to notify the buffer manager
     log::trace("BM", "WAIT: Get()-clear_buffer");
@@ -341,12 +693,19 @@ void WriteBuffer::ProcessingLoop() {
 
     // Clear flush buffer
     log::debug("WriteBuffer::ProcessingLoop()", "clear flush buffer");
+    uint64_t size_orders = 0;
     for(auto &p: buffers_[im_copy_]) {
+      size_orders += SizeOfOrder(p);
+      if (p.IsInArena()) continue;
       delete p.key;
       delete p.chunk;
     }
     sizes_[im_copy_] = 0;
     buffers_[im_copy_].clear();
+    filters_[im_copy_].Clear();
+    arenas_[im_copy_].Reset();
+    size_charged_ -= size_orders;
+    if (memory_budget_ != nullptr) memory_budget_->Release(size_orders, true);
 
     log::trace("WriteBuffer", "ProcessingLoop() - end swap - %" PRIu64 " %" PRIu64, buffers_[im_copy_].size(), buffers_[im_live_].size());
  
@@ -371,6 +730,18 @@ void WriteBuffer::ProcessingLoop() {
     can_swap_ = true;
     mutex_copy_write_level4_.unlock();
     log::debug("LOCK", "4 unlock");
+
+    // Release the writers waiting for the orders that were just flushed.
+    // A failed sync is never retried: the kernel may already have dropped the
+    // dirty pages, thus all the following synchronous writes fail as well.
+    {
+      std::unique_lock<std::mutex> lock_sync(mutex_sync_);
+      if (!s.IsOK()) status_sync_ = s;
+      sequence_durable_ = sequence_copy_;
+      num_flushes_ += 1;
+      cv_sync_.notify_all();
+    }
+
     log::debug("LOCK", "2 unlock");
     cv_flush_done_.notify_all();
   }
@@ -8,6 +8,7 @@
 #include "util/debug.h"
 #include <inttypes.h>
 #include <thread>
+#include <atomic>
 #include <map>
 #include <array>
 #include <string>
@@ -17,16 +18,25 @@
 #include "kingdb/kdb.h"
 #include "util/order.h"
 #include "util/byte_array.h"
+#include "util/slice.h"
+#include "util/value.h"
+#include "util/buffer_pool.h"
+#include "util/arena.h"
+#include "util/memory_budget.h"
 #include "util/options.h"
+#include "algorithm/compressor.h"
+#include "algorithm/key_filter.h"
 
 namespace kdb {
 
 class WriteBuffer {
  public:
   WriteBuffer(const DatabaseOptions& db_options,
-              EventManager *event_manager)
+              EventManager *event_manager,
+              MemoryBudget *memory_budget=nullptr)
       : db_options_(db_options),
-        event_manager_(event_manager) {
+        event_manager_(event_manager),
+        memory_budget_(memory_budget) {
     stop_requested_ = false;
     im_live_ = 0;
     im_copy_ = 1;
@@ -36,21 +46,84 @@ class WriteBuffer {
     can_swap_ = true;    // prevents the double-swapping
     force_swap_ = false; // forces swapping
     buffer_size_ = db_options_.write_buffer__size;
+    sync_requested_ = false;
+    sequence_live_ = 1;
+    sequence_copy_ = 0;
+    sequence_durable_ = 0;
+    num_flushes_ = 0;
+    size_charged_ = 0;
+    for (auto& filter: filters_) filter.Reset(0); // grown as orders are added
     thread_buffer_handler_ = std::thread(&WriteBuffer::ProcessingLoop, this);
     is_closed_ = false;
   }
   ~WriteBuffer() { Close(); }
   Status Get(ReadOptions& read_options, ByteArray* key, ByteArray** value_out);
+  Status Get(ReadOptions& read_options,
+             const Slice& key,
+             BufferPool* pool,
+             Value* value_out,
+             uint64_t* version_out=nullptr);
+  // Returns the version of the most recent order for 'key', without copying
+  // its value
+  Status GetVersion(ReadOptions& read_options, const Slice& key, uint64_t* version_out);
+  // Returns the sizes and the version of the value for 'key', without copying
+  // the value. Any of the outputs can be null.
+  Status GetMetadata(ReadOptions& read_options,
+                     const Slice& key,
+                     uint64_t* size_value_out,
+                     uint64_t* size_value_compressed_out,
+                     uint64_t* version_out);
+  Status GetInto(ReadOptions& read_options,
+                 const Slice& key,
+                 char* buffer,
+                 uint64_t size_buffer,
+                 uint64_t* size_out);
   Status Put(WriteOptions& write_options, ByteArray* key, ByteArray* chunk);
+  // The keys and chunks given as slices are copied into the arena of the
+  // buffer they are added to, whereas the ones given as ByteArray are owned by
+  // the buffer, and are deleted once flushed.
+  // A synchronous write returns once its order is durable, unless
+  // 'ticket_out' is given: the write then returns as soon as the order is in
+  // the buffer, and 'ticket_out' receives the ticket to give to
+  // WaitUntilDurable(), or 0 if there is nothing to wait for. This lets the
+  // callers release their own locks before waiting for the flush.
   Status PutChunk(WriteOptions& write_options,
                   ByteArray* key,
                   ByteArray* chunk,
                   uint64_t offset_chunk,
                   uint64_t size_value,
                   uint64_t size_value_compressed,
-                  uint32_t crc32);
-  Status Remove(WriteOptions& write_options, ByteArray* key);
+                  uint32_t crc32,
+                  uint64_t* ticket_out=nullptr);
+  Status PutChunk(WriteOptions& write_options,
+                  const Slice& key,
+                  const Slice& chunk,
+                  uint64_t offset_chunk,
+                  uint64_t size_value,
+                  uint64_t size_value_compressed,
+                  uint32_t crc32,
+                  uint64_t* ticket_out=nullptr);
+  Status Remove(WriteOptions& write_options, ByteArray* key, uint64_t* ticket_out=nullptr);
+  Status Remove(WriteOptions& write_options, const Slice& key, uint64_t* ticket_out=nullptr);
+  // Adds all the orders of a batch to the write buffer atomically
+  Status Write(WriteOptions& write_options, std::vector<Order>& orders, uint64_t* ticket_out=nullptr);
+  // Blocks until the buffer of the ticket has been flushed, and synced if it
+  // held synchronous orders
+  Status WaitUntilDurable(uint64_t ticket);
+  // Returns a version more recent than the ones of all the orders added so
+  // far, for the entries that are modified without going through the buffer
+  uint64_t NextVersion();
   void Flush();
+  // Blocks the writers until UnlockWrites() is called. The buffers can still
+  // be flushed in the meantime.
+  void LockWrites();
+  void UnlockWrites();
+  // Number of buffers flushed to the storage engine since the write buffer
+  // was created. The synchronous writes share the flushes.
+  uint64_t GetNumFlushes() {
+    std::unique_lock<std::mutex> lock_sync(mutex_sync_);
+    return num_flushes_;
+  }
 
   void Close () {
     std::unique_lock<std::mutex> lock(mutex_close_);
@@ -58,6 +131,9 @@ class WriteBuffer {
     is_closed_ = true;
     Stop();
     thread_buffer_handler_.join();
+    if (memory_budget_ != nullptr) memory_budget_->Release(size_charged_.exchange(0), true);
+    std::unique_lock<std::mutex> lock_sync(mutex_sync_);
+    cv_sync_.notify_all();
   }
 
   bool IsStopRequested() { return stop_requested_; }
@@ -71,8 +147,45 @@ class WriteBuffer {
                     uint64_t offset_chunk,
                     uint64_t size_value,
                     uint64_t size_value_compressed,
-                    uint32_t crc32);
+                    uint32_t crc32,
+                    bool is_sync,
+                    bool is_in_arena,
+                    uint64_t* ticket_out);
+  Status WriteOrders(Order* orders, uint64_t num_orders, uint64_t* ticket_out);
+  void AddOrders(Order* orders, uint64_t num_orders, uint64_t* ticket, bool* is_wait);
+  void SwapIfFull();
+  void RequestSwap();
+  Status WaitForMemory();
+  static ByteArray* CopyToArena(Arena* arena, ByteArray* byte_array);
+  void RebuildFilter(int index_buffer);
+  static uint64_t SizeOfOrder(const Order& order) {
+    return sizeof(Order) + order.key->size() + order.chunk->size();
+  }
   void ProcessingLoop();
+  // Metadata of the order found by Find(), copied while the order is still
+  // protected from being flushed
+  struct OrderMetadata {
+    uint64_t size_value;
+    uint64_t size_value_compressed;
+    uint64_t version;
+    bool is_self_contained;
+  };
+  Status Find(ReadOptions& read_options,
+              const Slice& key,
+              BufferPool* pool,
+              Value* value_out,
+              char* buffer,
+              uint64_t size_buffer,
+              uint64_t* size_out,
+              OrderMetadata* metadata_out);
+  static void CopyMetadata(Order& order, OrderMetadata* metadata_out);
+  static Status CopyValue(Order& order,
+                          BufferPool* pool,
+                          Value* value_out,
+                          char* buffer,
+                          uint64_t size_buffer,
+                          uint64_t* size_out);
+  static Status CopyValueInto(Order& order, char* dest, uint64_t size_dest);
 
   DatabaseOptions db_options_;
   int im_live_;
@@ -82,7 +195,13 @@ class WriteBuffer {
   bool can_swap_;
   bool force_swap_;
   std::array<std::vector<Order>, 2> buffers_;
+  std::array<Arena, 2> arenas_; // one per buffer, reset when it is cleared
   std::array<int, 2> sizes_;
+  // One filter per buffer over the keys of its orders, so that the lookups
+  // of keys that are not in a buffer skip the linear scan of its orders.
+  // The filter of the live buffer is protected by mutex_indices_level3_, and
+  // the one of the copy buffer is cleared along with it.
+  std::array<KeyFilter, 2> filters_;
   bool is_closed_;
   std::mutex mutex_close_;
 
@@ -98,6 +217,26 @@ class WriteBuffer {
   std::condition_variable cv_flush_;
   std::condition_variable cv_flush_done_;
   std::condition_variable cv_read_;
+
+  // Group commit of synchronous writes. Each generation of the live buffer
+  // has a sequence number, which is given as a ticket to the writers of the
+  // orders it holds. Once a buffer is flushed, all the tickets up to its
+  // sequence number are durable.
+  bool sync_requested_;       // protected by mutex_flush_level2_
+  uint64_t sequence_live_;    // protected by mutex_indices_level3_
+  uint64_t sequence_copy_;    // protected by mutex_flush_level2_
+  uint64_t sequence_durable_; // protected by mutex_sync_
+  uint64_t num_flushes_;      // protected by mutex_sync_
+  Status status_sync_;        // protected by mutex_sync_
+  std::mutex mutex_sync_;
+  std::condition_variable cv_sync_;
+
+  // Gives the orders their versions as they are added to the live buffer
+  VersionClock version_clock_; // protected by mutex_indices_level3_
+
+  // Memory of the orders in both buffers, charged to the memory budget
+  MemoryBudget *memory_budget_;
+  std::atomic<uint64_t> size_charged_;
 };
 
 } // namespace kdb
@@ -0,0 +1,201 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_CHANGE_STREAM_H_
+#define KINGDB_CHANGE_STREAM_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "util/status.h"
+#include "util/byte_array.h"
+#include "util/options.h"
+#include "algorithm/coding.h"
+#include "storage/storage_engine.h"
+
+namespace kdb {
+
+// Tails the writes of a database in the order in which they were committed,
+// by reading the entries of the HSTables that the flushes have written. The
+// write path is not changed in any way: the changes are read from the same
+// files that serve the reads.
+// A database with several partitions has one sequence of changes per
+// partition, and the stream goes over the partitions in turn: the changes
+// of a given key are always in order, since a key belongs to a single
+// partition.
+// The position of the stream is a cursor, which can be saved and given to
+// KingDB::NewChangeStream() to resume from there, also after a restart. As
+// long as a stream is open, the HSTables it has not read yet are not
+// compacted. A stream created from a cursor whose changes have been compacted
+// or evicted while no stream was open returns an IOError.
+// Since the entries are read from the HSTables, KingDB::PutRange(), which
+// modifies entries in place, is not accepted while a stream is open.
+class ChangeStream {
+ public:
+  ChangeStream(const std::vector<StorageEngine*>& ses)
+      : ses_(ses),
+        positions_(ses.size()),
+        index_partition_(0),
+        key_(nullptr),
+        value_(nullptr) {
+    for (auto se: ses_) ids_pins_.push_back(se->AddChangePin());
+  }
+
+  ~ChangeStream() {
+    ClearChange();
+    for (size_t i = 0; i < ses_.size(); i++) {
+      ses_[i]->RemoveChangePin(ids_pins_[i]);
+    }
+  }
+
+  // Sets the position of the stream to 'cursor', or to the oldest change
+  // that is still available if 'cursor' is empty.
+  Status Seek(const std::string& cursor) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (cursor.empty()) {
+      for (auto& position: positions_) position = Position();
+    } else if (cursor.size() != ses_.size() * kSizePosition) {
+      return Status::InvalidArgument("Cursor does not match the number of partitions");
+    } else {
+      for (size_t i = 0; i < ses_.size(); i++) {
+        const char* buffer = cursor.data() + i * kSizePosition;
+        GetFixed64(buffer,      &positions_[i].timestamp);
+        GetFixed32(buffer +  8, &positions_[i].fileid);
+        GetFixed64(buffer + 12, &positions_[i].offset);
+        positions_[i].has_file = false;
+      }
+    }
+    for (size_t i = 0; i < ses_.size(); i++) {
+      Status s = FindFile(i);
+      if (!s.IsOK() && !s.IsNotFound()) return s;
+    }
+    return Status::OK();
+  }
+
+  // Moves to the next change. Returns NotFound if all the changes committed
+  // so far have been read, in which case Next() can be called again later.
+  Status Next() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ClearChange();
+    for (size_t k = 0; k < ses_.size(); k++) {
+      Status s = NextInPartition(index_partition_);
+      index_partition_ = (index_partition_ + 1) % ses_.size();
+      if (!s.IsNotFound()) return s;
+    }
+    return Status::NotFound("No more changes");
+  }
+
+  bool IsRemove() { return value_ == nullptr; }
+  ByteArray *GetKey() { return key_; }
+  ByteArray *GetValue() { return value_; }
+
+  // Position of the current change: timestamp and id of its HSTable, and its
+  // offset in that HSTable
+  uint64_t GetTimestamp() { return timestamp_; }
+  uint32_t GetFileId() { return fileid_; }
+  uint64_t GetOffset() { return offset_; }
+
+  // Cursor to the change after the current one
+  std::string GetCursor() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::string cursor(ses_.size() * kSizePosition, 0);
+    for (size_t i = 0; i < ses_.size(); i++) {
+      char* buffer = &cursor[i * kSizePosition];
+      EncodeFixed64(buffer,      positions_[i].timestamp);
+      EncodeFixed32(buffer +  8, positions_[i].fileid);
+      EncodeFixed64(buffer + 12, positions_[i].offset);
+    }
+    return cursor;
+  }
+
+ private:
+  // A timestamp of 0 stands for the oldest HSTable, and a fileid of 0 for an
+  // HSTable that has not been written yet.
+  struct Position {
+    Position() : timestamp(0), fileid(0), offset(0), has_file(false) {}
+    uint64_t timestamp;
+    uint32_t fileid;
+    uint64_t offset;
+    bool has_file;
+  };
+  static const uint64_t kSizePosition = 20;
+
+  Status FindFile(size_t index) {
+    Position& position = positions_[index];
+    uint64_t timestamp;
+    uint32_t fileid;
+    Status s = ses_[index]->FindChangeFile(position.timestamp, &timestamp, &fileid);
+    if (s.IsOK()) {
+      position.timestamp = timestamp;
+      position.fileid = fileid;
+      position.has_file = true;
+    }
+    ses_[index]->SetChangePin(ids_pins_[index], s.IsOK() ? position.fileid : 0);
+    return s;
+  }
+
+  Status NextInPartition(size_t index) {
+    Position& position = positions_[index];
+    StorageEngine* se = ses_[index];
+    while (true) {
+      if (!position.has_file) {
+        Status s = FindFile(index);
+        if (!s.IsOK()) return s;
+      }
+
+      uint64_t offset_end;
+      bool is_closed;
+      Status s = se->GetChangeFileExtent(position.fileid, &offset_end, &is_closed);
+      if (!s.IsOK()) return s;
+      position.offset = std::max(position.offset, se->GetHeaderSize());
+      if (position.offset >= offset_end) {
+        if (!is_closed) return Status::NotFound("No more changes");
+        position.timestamp += 1;
+        position.fileid = 0;
+        position.offset = 0;
+        position.has_file = false;
+        continue;
+      }
+
+      uint64_t offset_next;
+      s = se->GetChange(position.fileid, position.offset, offset_end, &key_, &value_, &offset_next);
+      if (!s.IsOK()) {
+        ClearChange();
+        return s;
+      }
+      if (key_ == nullptr) {
+        position.offset = offset_next;
+        continue;
+      }
+      timestamp_ = position.timestamp;
+      fileid_ = position.fileid;
+      offset_ = position.offset;
+      position.offset = offset_next;
+      return Status::OK();
+    }
+  }
+
+  void ClearChange() {
+    delete key_;
+    delete value_;
+    key_ = nullptr;
+    value_ = nullptr;
+  }
+
+  std::vector<StorageEngine*> ses_;
+  std::vector<uint64_t> ids_pins_;
+  std::vector<Position> positions_;
+  size_t index_partition_;
+  std::mutex mutex_;
+  ByteArray* key_;
+  ByteArray* value_;
+  uint64_t timestamp_;
+  uint32_t fileid_;
+  uint64_t offset_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_CHANGE_STREAM_H_
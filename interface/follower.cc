@@ -0,0 +1,151 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "interface/follower.h"
+
+namespace kdb {
+
+Status Follower::Open() {
+  std::unique_lock<std::mutex> lock(mutex_close_);
+  if (!is_closed_) return Status::OK();
+  const std::string& dbname_primary = db_options_.storage__follow;
+
+  // The options stored on disk are those the primary was created with
+  std::string filepath_dboptions = DatabaseOptions::GetPath(dbname_primary);
+  struct stat info;
+  if (stat(filepath_dboptions.c_str(), &info) != 0) {
+    return Status::IOError("Could not find the database to follow", dbname_primary.c_str());
+  }
+  Mmap mmap(filepath_dboptions, info.st_size);
+  if (!mmap.is_valid()) return Status::IOError("Mmap() constructor failed");
+  Status s = DatabaseOptionEncoder::DecodeFrom(mmap.datafile(), mmap.filesize(), &db_options_);
+  mmap.Close();
+  if (!s.IsOK()) return s;
+
+  if (mkdir(dbname_.c_str(), 0755) < 0 && errno != EEXIST) {
+    return Status::IOError("Could not create database directory", strerror(errno));
+  }
+
+  // The lock waits for a range being written by the primary to be done
+  std::string filepath_followers = DatabaseOptions::GetFollowersLockPath(dbname_primary);
+  if ((fd_followers_ = open(filepath_followers.c_str(), O_RDONLY|O_CREAT, 0644)) < 0) {
+    return Status::IOError("Could not open the lock of the followers", strerror(errno));
+  }
+  if (flock(fd_followers_, LOCK_SH) != 0) {
+    close(fd_followers_);
+    fd_followers_ = -1;
+    return Status::IOError("Could not lock the lock of the followers", strerror(errno));
+  }
+
+  // The HSTables of the primary are in its data directories and in its cold
+  // directory, while those of the follower are all in its own directory
+  uint32_t num_partitions = db_options_.storage__num_partitions;
+  std::vector<std::string> dirpaths = HSTableManager::GetDataDirectories(db_options_, dbname_primary);
+  if (!db_options_.storage__cold_directory.empty()) dirpaths.push_back(db_options_.storage__cold_directory);
+  DatabaseOptions db_options = db_options_;
+  db_options.storage__data_directories = "";
+  db_options.storage__cold_directory = "";
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    std::string dirpath = dbname_;
+    std::vector<std::string> dirpaths_source = dirpaths;
+    if (num_partitions > 1) {
+      dirpath = DatabaseOptions::GetPartitionPath(dbname_, i);
+      if (mkdir(dirpath.c_str(), 0755) < 0 && errno != EEXIST) {
+        return Status::IOError("Could not create partition directory", strerror(errno));
+      }
+      for (auto& dirpath_source: dirpaths_source) {
+        dirpath_source = DatabaseOptions::GetPartitionPath(dirpath_source, i);
+      }
+    }
+    ses_.push_back(new StorageEngine(db_options, nullptr, dirpath, true, nullptr, 0, &memory_budget_));
+    dirpaths_source_.push_back(dirpaths_source);
+  }
+
+  for (size_t i = 0; i < ses_.size(); i++) {
+    s = ses_[i]->Follow(dirpaths_source_[i]);
+    if (!s.IsOK()) {
+      log::warn("Follower::Open()", "Could not follow [%s]: %s", dbname_primary.c_str(), s.ToString().c_str());
+    }
+  }
+  log::trace("Follower::Open()", "dbname:%s primary:%s", dbname_.c_str(), dbname_primary.c_str());
+  stop_requested_ = false;
+  thread_follow_ = std::thread(&Follower::ProcessingLoopFollow, this);
+  is_closed_ = false;
+  return Status::OK();
+}
+
+
+void Follower::Close() {
+  std::unique_lock<std::mutex> lock(mutex_close_);
+  if (is_closed_) return;
+  is_closed_ = true;
+  {
+    std::unique_lock<std::mutex> lock_follow(mutex_follow_);
+    stop_requested_ = true;
+  }
+  cv_follow_.notify_all();
+  thread_follow_.join();
+  for (auto se: ses_) {
+    se->Close();
+    delete se;
+  }
+  ses_.clear();
+  dirpaths_source_.clear();
+  if (fd_followers_ >= 0) {
+    flock(fd_followers_, LOCK_UN);
+    close(fd_followers_);
+    fd_followers_ = -1;
+  }
+}
+
+
+Status Follower::Follow() {
+  std::unique_lock<std::mutex> lock(mutex_follow_);
+  for (size_t i = 0; i < ses_.size(); i++) {
+    Status s = ses_[i]->Follow(dirpaths_source_[i]);
+    if (!s.IsOK()) return s;
+  }
+  return Status::OK();
+}
+
+
+void Follower::ProcessingLoopFollow() {
+  std::chrono::milliseconds duration(db_options_.storage__statistics_polling_interval);
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_follow_);
+      cv_follow_.wait_for(lock, duration, [this]() { return stop_requested_; });
+      if (stop_requested_) return;
+    }
+    Status s = Follow();
+    if (!s.IsOK()) {
+      log::warn("Follower::ProcessingLoopFollow()", "%s", s.ToString().c_str());
+    }
+  }
+}
+
+
+bool Follower::GetProperty(const std::string& name, std::string* value) {
+  uint64_t size_hot = 0, num_hot = 0;
+  for (auto se: ses_) {
+    uint64_t sh, sc, nh, nc;
+    se->GetTierUsage(&sh, &sc, &nh, &nc);
+    size_hot += sh;
+    num_hot += nh;
+  }
+  if (name == "kingdb.storage.hot_size") {
+    *value = std::to_string(size_hot);
+  } else if (name == "kingdb.storage.cold_size") {
+    *value = "0";
+  } else if (name == "kingdb.storage.hot_files") {
+    *value = std::to_string(num_hot);
+  } else if (name == "kingdb.storage.cold_files") {
+    *value = "0";
+  } else {
+    return false;
+  }
+  return true;
+}
+
+} // namespace kdb
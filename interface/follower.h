@@ -0,0 +1,186 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_INTERFACE_FOLLOWER_H_
+#define KINGDB_INTERFACE_FOLLOWER_H_
+
+#include "util/debug.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <sys/file.h>
+
+#include "interface/interface.h"
+#include "storage/storage_engine.h"
+#include "util/status.h"
+#include "util/byte_array.h"
+#include "util/slice.h"
+#include "util/value.h"
+#include "util/write_batch.h"
+#include "util/buffer_pool.h"
+#include "util/memory_budget.h"
+#include "util/options.h"
+#include "algorithm/hash.h"
+
+namespace kdb {
+
+// A Follower is a read-only replica of a database on the same machine,
+// selected with 'db.storage.follow', which can be opened in another process
+// while the primary is running. The follower has its own database directory,
+// with one read-only storage engine per partition of the primary, and a
+// thread brings them up to date with the HSTables of the primary at every
+// 'db.storage.statistics_polling_interval': see StorageEngine::Follow().
+// Only the HSTables that the primary has closed are visible, thus the writes
+// still in the write buffer of the primary, or in an HSTable that is being
+// written, are not. As the HSTables must not change once shipped, the primary
+// does not accept PutRange() while a follower is open.
+class Follower: public Interface {
+ public:
+  Follower(const DatabaseOptions& db_options, const std::string dbname)
+      : db_options_(db_options),
+        dbname_(dbname),
+        memory_budget_(db_options.memory_limit),
+        buffer_pool_(BufferPool::kSizeCacheMaxDefault, &memory_budget_),
+        fd_followers_(-1),
+        stop_requested_(false),
+        is_closed_(true) {
+  }
+
+  virtual ~Follower() {
+    Close();
+  }
+
+  virtual Status Open() override;
+  virtual void Close() override;
+
+  virtual Status Get(ReadOptions& read_options, ByteArray* key, ByteArray** value_out) override {
+    return GetStorageEngine(key->data(), key->size())->Get(key, value_out);
+  }
+
+  virtual Status Put(WriteOptions& write_options, ByteArray *key, ByteArray *chunk) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status PutChunk(WriteOptions& write_options,
+                          ByteArray *key,
+                          ByteArray *chunk,
+                          uint64_t offset_chunk,
+                          uint64_t size_value) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status Remove(WriteOptions& write_options, ByteArray *key) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status Get(ReadOptions& read_options, const Slice& key, Value* value_out) override {
+    return GetStorageEngine(key.data(), key.size())->Get(key, &buffer_pool_, value_out);
+  }
+
+  virtual Status GetWithVersion(ReadOptions& read_options,
+                                const Slice& key,
+                                Value* value_out,
+                                uint64_t* version_out) override {
+    return GetStorageEngine(key.data(), key.size())->GetWithVersion(key, &buffer_pool_, value_out, version_out);
+  }
+
+  virtual Status Exists(ReadOptions& read_options, const Slice& key) override {
+    return GetMetadata(read_options, key, nullptr, nullptr, nullptr);
+  }
+
+  virtual Status GetMetadata(ReadOptions& read_options,
+                             const Slice& key,
+                             uint64_t* size_value_out,
+                             uint64_t* size_value_compressed_out,
+                             uint64_t* version_out) override {
+    return GetStorageEngine(key.data(), key.size())->GetMetadata(key, &buffer_pool_, size_value_out, size_value_compressed_out, version_out);
+  }
+
+  virtual Status GetInto(ReadOptions& read_options,
+                         const Slice& key,
+                         char* buffer,
+                         uint64_t size_buffer,
+                         uint64_t* size_out) override {
+    return GetStorageEngine(key.data(), key.size())->GetInto(key, &buffer_pool_, buffer, size_buffer, size_out);
+  }
+
+  virtual Status GetRange(ReadOptions& read_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          uint64_t size,
+                          Value* value_out) override {
+    return GetStorageEngine(key.data(), key.size())->GetRange(key, &buffer_pool_, offset, size, value_out);
+  }
+
+  virtual Status Put(WriteOptions& write_options, const Slice& key, const Slice& value) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status Remove(WriteOptions& write_options, const Slice& key) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status PutRange(WriteOptions& write_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          const Slice& data) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status Write(WriteOptions& write_options, WriteBatch* batch) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status Merge(WriteOptions& write_options,
+                       const Slice& key,
+                       const Slice& operand,
+                       const MergeOperator& merge_operator,
+                       std::string* value_out) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status CompareAndSwap(WriteOptions& write_options,
+                                const Slice& key,
+                                uint64_t version,
+                                const Slice& value) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Interface* NewSnapshot() override { return nullptr; }
+  virtual Iterator* NewIterator(ReadOptions& read_options) override { return nullptr; }
+  virtual bool GetProperty(const std::string& name, std::string* value) override;
+
+  // Ships the HSTables that the primary has closed since the last call,
+  // without waiting for the next polling interval
+  Status Follow();
+
+ private:
+  StorageEngine* GetStorageEngine(const char* key, uint64_t size_key) {
+    return ses_[HashPartition(key, size_key, ses_.size())];
+  }
+
+  void ProcessingLoopFollow();
+
+  kdb::DatabaseOptions db_options_;
+  std::string dbname_;
+  MemoryBudget memory_budget_;
+  BufferPool buffer_pool_;
+  std::vector<StorageEngine*> ses_;
+  // Directories of the HSTables of the primary, for each partition
+  std::vector< std::vector<std::string> > dirpaths_source_;
+  int fd_followers_; // holds the shared lock of the followers of the primary
+  std::thread thread_follow_;
+  std::mutex mutex_follow_;
+  std::condition_variable cv_follow_;
+  bool stop_requested_;
+  bool is_closed_;
+  std::mutex mutex_close_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_INTERFACE_FOLLOWER_H_
@@ -9,6 +9,10 @@
 #include "util/status.h"
 #include "util/order.h"
 #include "util/byte_array.h"
+#include "util/slice.h"
+#include "util/value.h"
+#include "util/write_batch.h"
+#include "util/merge_operator.h"
 #include "interface/iterator.h"
 
 namespace kdb {
@@ -24,8 +28,89 @@ class Interface {
                           uint64_t offset_chunk,
                           uint64_t size_value) = 0;
   virtual Status Remove(WriteOptions& write_options, ByteArray *key) = 0;
+
+  // Value-type API: the keys and values passed as Slices remain owned by the
+  // caller, and the values returned as Values are backed by pooled memory.
+  virtual Status Get(ReadOptions& read_options, const Slice& key, Value* value_out) = 0;
+  // Same as Get(), and also returns the version of the entry, which is given
+  // to CompareAndSwap(). Every write of an entry gives it a new version.
+  virtual Status GetWithVersion(ReadOptions& read_options,
+                                const Slice& key,
+                                Value* value_out,
+                                uint64_t* version_out) = 0;
+  // Returns OK if 'key' has a value, and NotFound otherwise. Same as
+  // GetMetadata() with all the outputs left null.
+  virtual Status Exists(ReadOptions& read_options, const Slice& key) = 0;
+  // Returns the size of the value of 'key', its size as stored if it is
+  // compressed (0 otherwise), and its version, without reading the value:
+  // the lookup stops at the header of the entry. Any of the outputs can be
+  // null.
+  virtual Status GetMetadata(ReadOptions& read_options,
+                             const Slice& key,
+                             uint64_t* size_value_out,
+                             uint64_t* size_value_compressed_out,
+                             uint64_t* version_out) = 0;
+  // Reads the value of 'key' directly into 'buffer', without allocating any
+  // memory for it. The size of the value is returned in 'size_out', and if
+  // the buffer is too small, InvalidArgument is returned: 'size_out' can then
+  // be used to size a larger buffer.
+  virtual Status GetInto(ReadOptions& read_options,
+                         const Slice& key,
+                         char* buffer,
+                         uint64_t size_buffer,
+                         uint64_t* size_out) = 0;
+  // Reads 'size' bytes of the value of 'key' starting at 'offset'. The range
+  // is truncated at the end of the value, and reading a range of a large
+  // compressed value only uncompresses the chunks that overlap it.
+  virtual Status GetRange(ReadOptions& read_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          uint64_t size,
+                          Value* value_out) = 0;
+  virtual Status Put(WriteOptions& write_options, const Slice& key, const Slice& value) = 0;
+  virtual Status Remove(WriteOptions& write_options, const Slice& key) = 0;
+  // Overwrites the bytes of the value of 'key' starting at 'offset' with
+  // 'data', in place and durably. Only supported for large entries that are
+  // not compressed, and for a range that is within the value. Returns
+  // Conflict while snapshots, iterators, change streams or followers are
+  // open, since they expect the entries they read to never change.
+  virtual Status PutRange(WriteOptions& write_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          const Slice& data) = 0;
+  // Applies all the puts and removes of 'batch' atomically. With
+  // WriteOptions::sync, the whole batch is made durable by a single sync.
+  virtual Status Write(WriteOptions& write_options, WriteBatch* batch) = 0;
+  // Replaces the value of 'key' with the result of 'merge_operator' applied
+  // to the current value and 'operand', atomically with respect to the other
+  // writes on 'key'. The new value is returned in 'value_out' if it is not
+  // null, and must fit in a single chunk.
+  virtual Status Merge(WriteOptions& write_options,
+                       const Slice& key,
+                       const Slice& operand,
+                       const MergeOperator& merge_operator,
+                       std::string* value_out) = 0;
+  // Writes 'value' for 'key' only if the current version of the entry is
+  // 'version'. Returns NotFound if the entry does not exist, and Conflict if
+  // it was written since 'version' was read.
+  virtual Status CompareAndSwap(WriteOptions& write_options,
+                                const Slice& key,
+                                uint64_t version,
+                                const Slice& value) = 0;
+
   virtual Interface* NewSnapshot() = 0;
   virtual Iterator* NewIterator(ReadOptions& read_options) = 0;
+
+  // Stores the value of the property 'name' into 'value' and returns true,
+  // or returns false if the property is unknown. The properties are:
+  //  - "kingdb.storage.hot_size" and "kingdb.storage.cold_size": the size in
+  //    bytes of the HSTables in each tier
+  //  - "kingdb.storage.hot_files" and "kingdb.storage.cold_files": the number
+  //    of HSTables in each tier
+  //  - "kingdb.write_buffer.flushes": the number of write buffers flushed to
+  //    the storage engine, which the synchronous writes share
+  virtual bool GetProperty(const std::string& name, std::string* value) = 0;
+
   virtual Status Open() = 0;
   virtual void Close() = 0;
 };
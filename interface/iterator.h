@@ -15,14 +15,18 @@
 
 namespace kdb {
 
+// Iterates over the entries of one or more read-only storage engines, one
+// after the other: a database with several partitions has one per partition.
 class Iterator {
  public:
   Iterator(ReadOptions& read_options,
-           StorageEngine *se_readonly,
-           std::vector<uint32_t>* fileids_iterator)
-      : se_readonly_(se_readonly),
+           const std::vector<StorageEngine*>& ses_readonly,
+           const std::vector<std::vector<uint32_t>*>& fileids_iterators)
+      : se_readonly_(ses_readonly[0]),
         read_options_(read_options),
-        fileids_iterator_(fileids_iterator) {
+        fileids_iterator_(fileids_iterators[0]),
+        ses_readonly_(ses_readonly),
+        fileids_iterators_(fileids_iterators) {
     log::trace("Iterator::ctor()", "start");
   }
 
@@ -39,6 +43,9 @@ class Iterator {
   void Begin() {
     log::trace("Iterator::Begin()", "start");
     mutex_.lock();
+    index_partition_ = 0;
+    se_readonly_ = ses_readonly_[0];
+    fileids_iterator_ = fileids_iterators_[0];
     fileid_current_ = 0;
     has_file_ = false;
     index_fileid_ = 0;
@@ -72,6 +79,14 @@ class Iterator {
       }
       log::trace("Iterator::Next()", "loop index_file:[%u] index_location:[%u]", index_fileid_, index_location_);
       if (index_fileid_ >= fileids_iterator_->size()) {
+        if (index_partition_ + 1 < ses_readonly_.size()) {
+          index_partition_ += 1;
+          se_readonly_ = ses_readonly_[index_partition_];
+          fileids_iterator_ = fileids_iterators_[index_partition_];
+          index_fileid_ = 0;
+          has_file_ = false;
+          continue;
+        }
         is_valid_ = false;
         break;
       }
@@ -89,7 +104,7 @@ class Iterator {
         if (!mmap.is_valid()) break;
         uint64_t dummy_filesize;
         bool dummy_is_file_large;
-        std::multimap<uint64_t, uint64_t> index_temp;
+        IndexMap index_temp;
         s = HSTableManager::LoadFile(mmap,
                                      fileid_current_,
                                      index_temp,
@@ -186,6 +201,9 @@ class Iterator {
   std::vector<uint64_t> locations_current_;
   bool has_file_;
   bool is_valid_;
+  std::vector<StorageEngine*> ses_readonly_;
+  std::vector<std::vector<uint32_t>*> fileids_iterators_;
+  uint32_t index_partition_;
 
   ByteArray* key_;
   ByteArray* value_;
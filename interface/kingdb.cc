@@ -7,13 +7,14 @@
 namespace kdb {
 
 Status KingDB::Get(ReadOptions& read_options, ByteArray* key, ByteArray** value_out) {
+  Partition& partition = GetPartition(key->data(), key->size());
   log::trace("KingDB Get()", "[%s]", key->ToString().c_str());
-  Status s = wb_->Get(read_options, key, value_out);
+  Status s = partition.wb->Get(read_options, key, value_out);
   if (s.IsRemoveOrder()) {
     return Status::NotFound("Unable to find entry");
   } else if (s.IsNotFound()) {
     log::trace("KingDB Get()", "not found in buffer");
-    s = se_->Get(key, value_out);
+    s = partition.se->Get(key, value_out);
     if (s.IsNotFound()) {
       log::trace("KingDB Get()", "not found in storage engine");
       return s;
@@ -31,24 +32,273 @@ Status KingDB::Get(ReadOptions& read_options, ByteArray* key, ByteArray** value_
 }
 
 
+Status KingDB::Get(ReadOptions& read_options, const Slice& key, Value* value_out) {
+  Partition& partition = GetPartition(key.data(), key.size());
+  Status s = partition.wb->Get(read_options, key, &buffer_pool_, value_out);
+  if (s.IsRemoveOrder()) {
+    return Status::NotFound("Unable to find entry");
+  } else if (s.IsNotFound()) {
+    return partition.se->Get(key, &buffer_pool_, value_out);
+  }
+  return s;
+}
+
+
+Status KingDB::GetWithVersion(ReadOptions& read_options,
+                              const Slice& key,
+                              Value* value_out,
+                              uint64_t* version_out) {
+  Partition& partition = GetPartition(key.data(), key.size());
+  Status s = partition.wb->Get(read_options, key, &buffer_pool_, value_out, version_out);
+  if (s.IsRemoveOrder()) {
+    return Status::NotFound("Unable to find entry");
+  } else if (s.IsNotFound()) {
+    return partition.se->GetWithVersion(key, &buffer_pool_, value_out, version_out);
+  }
+  return s;
+}
+
+
+Status KingDB::Exists(ReadOptions& read_options, const Slice& key) {
+  return GetMetadata(read_options, key, nullptr, nullptr, nullptr);
+}
+
+
+Status KingDB::GetMetadata(ReadOptions& read_options,
+                           const Slice& key,
+                           uint64_t* size_value_out,
+                           uint64_t* size_value_compressed_out,
+                           uint64_t* version_out) {
+  Partition& partition = GetPartition(key.data(), key.size());
+  Status s = partition.wb->GetMetadata(read_options, key, size_value_out, size_value_compressed_out, version_out);
+  if (s.IsRemoveOrder()) {
+    return Status::NotFound("Unable to find entry");
+  } else if (s.IsNotFound()) {
+    return partition.se->GetMetadata(key, &buffer_pool_, size_value_out, size_value_compressed_out, version_out);
+  }
+  return s;
+}
+
+
+Status KingDB::GetInto(ReadOptions& read_options,
+                       const Slice& key,
+                       char* buffer,
+                       uint64_t size_buffer,
+                       uint64_t* size_out) {
+  Partition& partition = GetPartition(key.data(), key.size());
+  Status s = partition.wb->GetInto(read_options, key, buffer, size_buffer, size_out);
+  if (s.IsRemoveOrder()) {
+    return Status::NotFound("Unable to find entry");
+  } else if (s.IsNotFound()) {
+    return partition.se->GetInto(key, &buffer_pool_, buffer, size_buffer, size_out);
+  }
+  return s;
+}
+
+
+Status KingDB::GetRange(ReadOptions& read_options,
+                        const Slice& key,
+                        uint64_t offset,
+                        uint64_t size,
+                        Value* value_out) {
+  Partition& partition = GetPartition(key.data(), key.size());
+  // Values in the write buffer are at most one chunk large, thus they are
+  // copied entirely and the range is taken from the copy.
+  Status s = partition.wb->Get(read_options, key, &buffer_pool_, value_out);
+  if (s.IsRemoveOrder()) {
+    return Status::NotFound("Unable to find entry");
+  } else if (s.IsNotFound()) {
+    return partition.se->GetRange(key, &buffer_pool_, offset, size, value_out);
+  } else if (s.IsOK()) {
+    if (offset > value_out->size()) {
+      value_out->Reset();
+      return Status::InvalidArgument("Offset is beyond the end of the value");
+    }
+    value_out->SetWindow(offset, std::min(size, value_out->size() - offset));
+  }
+  return s;
+}
+
+
+Status KingDB::Put(WriteOptions& write_options, const Slice& key, const Slice& value) {
+  std::unique_lock<std::mutex> lock(GetKeyLock(key.data(), key.size()));
+  ClearKeyPartial(key.data(), key.size());
+  uint64_t ticket = 0;
+  Status s = PutSlice(write_options, key, value, &ticket);
+  lock.unlock();
+  return WaitUntilDurable(GetPartition(key.data(), key.size()), s, ticket);
+}
+
+
+// Cuts the value into chunks. The lock of the key must be held.
+Status KingDB::PutSlice(WriteOptions& write_options,
+                        const Slice& key,
+                        const Slice& value,
+                        uint64_t* ticket_out) {
+  uint64_t size_value = value.size();
+  uint64_t offset = 0;
+  Status s;
+  do {
+    uint64_t size_chunk = std::min(size_value - offset, db_options_.storage__maximum_chunk_size);
+    s = PutChunkSlice(write_options, key, Slice(value.data() + offset, size_chunk), offset, size_value, ticket_out);
+    if (!s.IsOK()) break;
+    offset += size_chunk;
+  } while (offset < size_value);
+  return s;
+}
+
+
+// The orders in the write buffer hold their keys and chunks until they are
+// flushed, therefore the data of the slices has to be copied. Small chunks are
+// copied into the arena of the write buffer, and larger ones are given to the
+// write buffer as byte arrays -- except for the chunks that are compressed,
+// which are read directly from the memory of the caller by the compressor.
+Status KingDB::PutChunkSlice(WriteOptions& write_options,
+                             const Slice& key,
+                             const Slice& chunk,
+                             uint64_t offset_chunk,
+                             uint64_t size_value,
+                             uint64_t* ticket_out) {
+  Partition& partition = GetPartition(key.data(), key.size());
+  Status s = partition.se->FileSystemStatus();
+  if (!s.IsOK()) return s;
+
+  SimpleByteArray key_slice(key.data(), key.size());
+  SimpleByteArray chunk_slice(chunk.data(), chunk.size());
+  ByteArray *chunk_final = nullptr;
+  uint64_t offset_chunk_compressed;
+  uint64_t size_value_compressed;
+  uint32_t crc32;
+  s = EncodeChunk(&key_slice, &chunk_slice, offset_chunk, size_value,
+                  &chunk_final, &offset_chunk_compressed, &size_value_compressed, &crc32);
+  if (!s.IsOK()) return s;
+
+  if (chunk_final->size() <= db_options_.write_buffer__arena_max_size) {
+    s = partition.wb->PutChunk(write_options,
+                               key,
+                               Slice(chunk_final->data(), chunk_final->size()),
+                               offset_chunk_compressed,
+                               size_value,
+                               size_value_compressed,
+                               crc32,
+                               ticket_out);
+    if (chunk_final != &chunk_slice) delete chunk_final;
+    return s;
+  }
+
+  if (chunk_final == &chunk_slice) {
+    chunk_final = new AllocatedByteArray(chunk.data(), chunk.size());
+  }
+  return partition.wb->PutChunk(write_options,
+                                new AllocatedByteArray(key.data(), key.size()),
+                                chunk_final,
+                                offset_chunk_compressed,
+                                size_value,
+                                size_value_compressed,
+                                crc32,
+                                ticket_out);
+}
+
+
+Status KingDB::Remove(WriteOptions& write_options, const Slice& key) {
+  std::unique_lock<std::mutex> lock(GetKeyLock(key.data(), key.size()));
+  ClearKeyPartial(key.data(), key.size());
+  Partition& partition = GetPartition(key.data(), key.size());
+  Status s = partition.se->FileSystemStatus();
+  if (!s.IsOK()) return s;
+  uint64_t ticket = 0;
+  s = partition.wb->Remove(write_options, key, &ticket);
+  lock.unlock();
+  return WaitUntilDurable(partition, s, ticket);
+}
+
+
+Status KingDB::PutRange(WriteOptions& write_options,
+                        const Slice& key,
+                        uint64_t offset,
+                        const Slice& data) {
+  std::unique_lock<std::mutex> lock(GetKeyLock(key.data(), key.size()));
+  if (IsKeyPartial(key.data(), key.size())) {
+    return Status::Conflict("The entry is being written in several chunks");
+  }
+  Partition& partition = GetPartition(key.data(), key.size());
+  Status s = partition.se->FileSystemStatus();
+  if (!s.IsOK()) return s;
+  // The range is written to the entry held by the storage engine, thus the
+  // write buffer is checked first: a buffered remove hides that entry, and a
+  // buffered put is flushed, for the range to be written to the most recent
+  // value. The key lock prevents new orders for the key in the meantime.
+  ReadOptions read_options;
+  uint64_t version;
+  s = partition.wb->GetVersion(read_options, key, &version);
+  if (s.IsRemoveOrder()) return Status::NotFound("Unable to find entry");
+  if (s.IsOK()) {
+    partition.wb->Flush();
+    s = partition.se->FileSystemStatus();
+    if (!s.IsOK()) return s;
+  }
+  // The followers read the HSTables from other processes, and the lock of
+  // the followers is held until the range is written, for none to be opened
+  // in the meantime
+  std::string filepath_followers = DatabaseOptions::GetFollowersLockPath(dbname_);
+  int fd_followers;
+  if ((fd_followers = open(filepath_followers.c_str(), O_RDONLY|O_CREAT, 0644)) < 0) {
+    return Status::IOError("Could not open the lock of the followers", strerror(errno));
+  }
+  if (flock(fd_followers, LOCK_EX | LOCK_NB) != 0) {
+    close(fd_followers);
+    return Status::Conflict("Cannot write a range while followers are open");
+  }
+
+  // The entry gets a new version, as for any other write
+  uint64_t version_new = partition.wb->NextVersion();
+  s = partition.se->PutRange(key, &buffer_pool_, offset, data, version_new);
+  flock(fd_followers, LOCK_UN);
+  close(fd_followers);
+  return s;
+}
+
+
 Status KingDB::Put(WriteOptions& write_options, ByteArray *key, ByteArray *chunk) {
   return PutChunk(write_options, key, chunk, 0, chunk->size());
 }
 
 
+// A value can be given in several calls, each with the chunk that starts at
+// 'offset_chunk', which is how the network server writes the values as they
+// are received. The lock of the key is only held during each call, thus the
+// key is marked as partial from the first chunk to the last one, and until
+// then Merge(), CompareAndSwap() and PutRange() on the key return Conflict
+// instead of reading an incomplete value. A Put() or Remove() of the key
+// abandons the value being written, and the writer must not send the
+// remaining chunks.
 Status KingDB::PutChunk(WriteOptions& write_options,
                         ByteArray *key,
                         ByteArray *chunk,
                         uint64_t offset_chunk,
                         uint64_t size_value) {
+  // The key is owned by the write buffer once the chunk is added, thus the
+  // reference to the lock and the partition are taken first
+  std::unique_lock<std::mutex> lock(GetKeyLock(key->data(), key->size()));
+  Partition& partition = GetPartition(key->data(), key->size());
+  bool is_last_chunk = offset_chunk + chunk->size() >= size_value;
+  if (offset_chunk == 0 && !is_last_chunk) {
+    GetKeysPartial(key->data(), key->size()).insert(key->ToString());
+  } else if (is_last_chunk) {
+    ClearKeyPartial(key->data(), key->size());
+  }
+
+  uint64_t ticket = 0;
+  Status s;
   if (size_value <= db_options_.storage__maximum_chunk_size) {
-    return PutChunkValidSize(write_options, key, chunk, offset_chunk, size_value);
+    s = PutChunkValidSize(write_options, key, chunk, offset_chunk, size_value, &ticket);
+    lock.unlock();
+    return WaitUntilDurable(partition, s, ticket);
   }
 
   // 'chunk' may be deleted by the call to PutChunkValidSize()
   // and therefore it cannot be used in the loop test condition
   uint64_t size_chunk = chunk->size(); 
-  Status s;
   for (uint64_t offset = 0; offset < size_chunk; offset += db_options_.storage__maximum_chunk_size) {
     ByteArray *chunk_new;
     if (offset + db_options_.storage__maximum_chunk_size < chunk->size()) {
@@ -58,11 +308,11 @@ Status KingDB::PutChunk(WriteOptions& write_options,
       chunk_new = chunk;
       chunk_new->set_offset(offset);
     }
-    s = PutChunkValidSize(write_options, key, chunk_new, offset_chunk + offset, size_value);
+    s = PutChunkValidSize(write_options, key, chunk_new, offset_chunk + offset, size_value, &ticket);
     if (!s.IsOK()) break;
   }
-
-  return s;
+  lock.unlock();
+  return WaitUntilDurable(partition, s, ticket);
 }
 
 
@@ -70,15 +320,59 @@ Status KingDB::PutChunkValidSize(WriteOptions& write_options,
                                  ByteArray *key,
                                  ByteArray *chunk,
                                  uint64_t offset_chunk,
-                                 uint64_t size_value) {
+                                 uint64_t size_value,
+                                 uint64_t* ticket_out) {
+  Partition& partition = GetPartition(key->data(), key->size());
   Status s;
-  s = se_->FileSystemStatus();
+  s = partition.se->FileSystemStatus();
   if (!s.IsOK()) return s;
   log::trace("KingDB::PutChunkValidSize()",
             "[%s] offset_chunk:%" PRIu64,
             key->ToString().c_str(),
             offset_chunk);
 
+  ByteArray *chunk_final = nullptr;
+  uint64_t offset_chunk_compressed;
+  uint64_t size_value_compressed;
+  uint32_t crc32;
+  s = EncodeChunk(key, chunk, offset_chunk, size_value,
+                  &chunk_final, &offset_chunk_compressed, &size_value_compressed, &crc32);
+  if (!s.IsOK()) return s;
+  if (chunk_final != chunk) delete chunk;
+
+  return partition.wb->PutChunk(write_options,
+                                key,
+                                chunk_final,
+                                offset_chunk_compressed,
+                                size_value,
+                                size_value_compressed,
+                                crc32,
+                                ticket_out);
+}
+
+
+// Waits for the flush of a synchronous write, once the caller has released
+// the lock of the key, for the writes on the other keys of the same lock not
+// to wait on that flush as well.
+Status KingDB::WaitUntilDurable(Partition& partition, const Status& s, uint64_t ticket) {
+  if (!s.IsOK() || ticket == 0) return s;
+  return partition.wb->WaitUntilDurable(ticket);
+}
+
+
+// Compresses the chunk if the database uses compression, and streams the
+// chunk into the checksum of the entry. The chunk to store is returned in
+// 'chunk_out', which is a new byte array if the chunk was compressed, in which
+// case the caller remains in charge of deleting 'chunk'.
+Status KingDB::EncodeChunk(ByteArray *key,
+                           ByteArray *chunk,
+                           uint64_t offset_chunk,
+                           uint64_t size_value,
+                           ByteArray **chunk_out,
+                           uint64_t *offset_chunk_out,
+                           uint64_t *size_value_compressed_out,
+                           uint32_t *crc32_out) {
+  Status s;
   bool do_compression = true;
   uint64_t size_value_compressed = 0;
   uint64_t offset_chunk_compressed = offset_chunk;
@@ -87,7 +381,7 @@ Status KingDB::PutChunkValidSize(WriteOptions& write_options,
 
   bool is_first_chunk = (offset_chunk == 0);
   bool is_last_chunk = (chunk->size() + offset_chunk == size_value);
-  log::trace("KingDB::PutChunkValidSize()",
+  log::trace("KingDB::EncodeChunk()",
             "CompressionType:%d",
             db_options_.compression.type);
 
@@ -103,7 +397,7 @@ Status KingDB::PutChunkValidSize(WriteOptions& write_options,
       compressor_.ResetThreadLocalStorage();
     }
 
-    log::trace("KingDB::PutChunkValidSize()",
+    log::trace("KingDB::EncodeChunk()",
               "[%s] size_compressed:%" PRIu64,
               key->ToString().c_str(), compressor_.size_compressed());
 
@@ -118,7 +412,7 @@ Status KingDB::PutChunkValidSize(WriteOptions& write_options,
     if (!s.IsOK()) return s;
     chunk_compressed = new SharedAllocatedByteArray(compressed, size_compressed);
 
-    log::trace("KingDB::PutChunkValidSize()",
+    log::trace("KingDB::EncodeChunk()",
               "[%s] (%" PRIu64 ") compressed size %" PRIu64 " - offset_chunk_compressed %" PRIu64,
               key->ToString().c_str(),
               chunk->size(),
@@ -130,7 +424,6 @@ Status KingDB::PutChunkValidSize(WriteOptions& write_options,
     }
 
     chunk_final = chunk_compressed;
-    delete chunk;
   }
 
   // Compute CRC32 checksum
@@ -142,53 +435,310 @@ Status KingDB::PutChunkValidSize(WriteOptions& write_options,
   crc32_.stream(chunk_final->data(), chunk_final->size());
   if (is_last_chunk) crc32 = crc32_.get();
 
-  log::trace("KingDB PutChunkValidSize()", "[%s] size_value_compressed:%" PRIu64 " crc32:0x%" PRIx64 " END", key->ToString().c_str(), size_value_compressed, crc32);
+  log::trace("KingDB EncodeChunk()", "[%s] size_value_compressed:%" PRIu64 " crc32:0x%" PRIx64 " END", key->ToString().c_str(), size_value_compressed, crc32);
+
+  *chunk_out = chunk_final;
+  *offset_chunk_out = offset_chunk_compressed;
+  *size_value_compressed_out = size_value_compressed;
+  *crc32_out = crc32;
+  return Status::OK();
+}
+
+
+Status KingDB::Write(WriteOptions& write_options, WriteBatch* batch) {
+  // The batch is written atomically by the write buffer of a single
+  // partition, thus all its entries must belong to the same one: the keys
+  // that are to be written together can be given the same tag.
+  uint32_t index_partition = 0;
+  auto& operations = batch->operations();
+  std::set<uint32_t> indices_key_locks;
+  for (size_t i = 0; i < operations.size(); i++) {
+    indices_key_locks.insert(HashStripe(operations[i].key.data(), operations[i].key.size(), kNumKeyLocks));
+    uint32_t index = HashPartition(operations[i].key.data(), operations[i].key.size(), partitions_.size());
+    if (i == 0) {
+      index_partition = index;
+    } else if (index != index_partition) {
+      return Status::InvalidArgument("Entries of a WriteBatch must all belong to the same partition");
+    }
+  }
+  Partition& partition = partitions_[index_partition];
+  Status s = partition.se->FileSystemStatus();
+  if (!s.IsOK()) return s;
+
+  // Each entry of the batch is encoded as a self-contained order, and the
+  // batch is rejected before anything reaches the write buffer if it could
+  // not be written contiguously in a single HSTable.
+  std::vector<Order> orders;
+  orders.reserve(batch->Count());
+  uint64_t size_batch = 0;
+  for (auto& op: batch->operations()) {
+    if (op.key.size() + op.value.size() > db_options_.storage__maximum_chunk_size) {
+      s = Status::InvalidArgument("Entries of a WriteBatch must fit in a single chunk");
+      break;
+    }
+    ByteArray *key = new AllocatedByteArray(op.key.data(), op.key.size());
+    if (op.type == OrderType::Remove) {
+      orders.push_back(Order{std::this_thread::get_id(), OrderType::Remove, key, new SimpleByteArray(nullptr, 0), 0, 0, 0, 0, false, false, 0, false, 0});
+    } else {
+      ByteArray *chunk = new AllocatedByteArray(op.value.data(), op.value.size());
+      ByteArray *chunk_final;
+      uint64_t offset_chunk;
+      uint64_t size_value_compressed;
+      uint32_t crc32;
+      s = EncodeChunk(key, chunk, 0, op.value.size(),
+                      &chunk_final, &offset_chunk, &size_value_compressed, &crc32);
+      if (!s.IsOK()) {
+        delete key;
+        delete chunk;
+        break;
+      }
+      if (chunk_final != chunk) delete chunk;
+      orders.push_back(Order{std::this_thread::get_id(), OrderType::Put, key, chunk_final, offset_chunk, op.value.size(), size_value_compressed, crc32, false, false, 0, false, 0});
+    }
+    size_batch += EntryHeader::GetMaxSize() + orders.back().key->size() + orders.back().chunk->size();
+  }
+
+  if (s.IsOK() && size_batch > db_options_.storage__hstable_size - db_options_.internal__hstable_header_size) {
+    s = Status::InvalidArgument("WriteBatch does not fit in a HSTable");
+  }
+  if (!s.IsOK()) {
+    for (auto& order: orders) {
+      delete order.key;
+      delete order.chunk;
+    }
+    return s;
+  }
 
-  return wb_->PutChunk(write_options,
-                      key,
-                      chunk_final,
-                      offset_chunk_compressed,
-                      size_value,
-                      size_value_compressed,
-                      crc32);
+  // The locks of the keys are taken in order
+  std::vector< std::unique_lock<std::mutex> > locks;
+  for (auto index: indices_key_locks) {
+    locks.push_back(std::unique_lock<std::mutex>(key_locks_[index]));
+  }
+  for (auto& op: operations) ClearKeyPartial(op.key.data(), op.key.size());
+  uint64_t ticket = 0;
+  s = partition.wb->Write(write_options, orders, &ticket);
+  locks.clear();
+  return WaitUntilDurable(partition, s, ticket);
+}
+
+
+// The merged value is added to the write buffer as a regular entry, thus the
+// cost of a merge is the one of a read and a write. A merge on a key that
+// was just written, such as a counter updated at a high rate, finds the
+// current value in the write buffer.
+Status KingDB::Merge(WriteOptions& write_options,
+                     const Slice& key,
+                     const Slice& operand,
+                     const MergeOperator& merge_operator,
+                     std::string* value_out) {
+  std::unique_lock<std::mutex> lock(GetKeyLock(key.data(), key.size()));
+  if (IsKeyPartial(key.data(), key.size())) {
+    return Status::Conflict("The entry is being written in several chunks");
+  }
+  // A value written in several chunks is not read from the write buffer, thus
+  // the buffer is flushed if it holds the chunks of the current value, for
+  // the merge to read that value from the storage engine
+  Partition& partition = GetPartition(key.data(), key.size());
+  ReadOptions read_options;
+  Value value;
+  uint64_t version;
+  Status s = partition.wb->Get(read_options, key, &buffer_pool_, &value);
+  if (s.IsNotFound() && partition.wb->GetVersion(read_options, key, &version).IsOK()) {
+    partition.wb->Flush();
+  }
+  if (s.IsRemoveOrder()) {
+    s = Status::NotFound("Unable to find entry");
+  } else if (s.IsNotFound()) {
+    s = partition.se->Get(key, &buffer_pool_, &value);
+  }
+  if (!s.IsOK() && !s.IsNotFound()) return s;
+  Slice value_current = value.ToSlice();
+  std::string value_new;
+  s = merge_operator.Merge(key, s.IsOK() ? &value_current : nullptr, operand, &value_new);
+  value.Reset();
+  if (!s.IsOK()) return s;
+  if (value_new.size() > db_options_.storage__maximum_chunk_size) {
+    return Status::InvalidArgument("The merged value must fit in a single chunk");
+  }
+  uint64_t ticket = 0;
+  s = PutChunkSlice(write_options, key, value_new, 0, value_new.size(), &ticket);
+  lock.unlock();
+  s = WaitUntilDurable(partition, s, ticket);
+  if (s.IsOK() && value_out != nullptr) *value_out = std::move(value_new);
+  return s;
+}
+
+
+// The version is checked against the most recent order for the key in the
+// write buffer, which includes the entries still being written in several
+// chunks, or else against the entry in the storage engine. The lock of the key
+// is held until the new value is in the write buffer.
+Status KingDB::CompareAndSwap(WriteOptions& write_options,
+                              const Slice& key,
+                              uint64_t version,
+                              const Slice& value) {
+  std::unique_lock<std::mutex> lock(GetKeyLock(key.data(), key.size()));
+  if (IsKeyPartial(key.data(), key.size())) {
+    return Status::Conflict("The entry is being written in several chunks");
+  }
+  Partition& partition = GetPartition(key.data(), key.size());
+  Status s = partition.se->FileSystemStatus();
+  if (!s.IsOK()) return s;
+  ReadOptions read_options;
+  uint64_t version_current;
+  s = partition.wb->GetVersion(read_options, key, &version_current);
+  if (s.IsRemoveOrder()) {
+    return Status::NotFound("Unable to find entry");
+  } else if (s.IsNotFound()) {
+    s = partition.se->GetMetadata(key, &buffer_pool_, nullptr, nullptr, &version_current);
+  }
+  if (!s.IsOK()) return s;
+  if (version_current != version) {
+    return Status::Conflict("The entry was written since its version was read");
+  }
+  uint64_t ticket = 0;
+  s = PutSlice(write_options, key, value, &ticket);
+  lock.unlock();
+  return WaitUntilDurable(partition, s, ticket);
 }
 
 
 Status KingDB::Remove(WriteOptions& write_options,
                       ByteArray *key) {
+  std::unique_lock<std::mutex> lock(GetKeyLock(key->data(), key->size()));
+  ClearKeyPartial(key->data(), key->size());
+  Partition& partition = GetPartition(key->data(), key->size());
   log::trace("KingDB::Remove()", "[%s]", key->ToString().c_str());
-  Status s = se_->FileSystemStatus();
+  Status s = partition.se->FileSystemStatus();
   if (!s.IsOK()) return s;
-  return wb_->Remove(write_options, key);
+  uint64_t ticket = 0;
+  s = partition.wb->Remove(write_options, key, &ticket);
+  lock.unlock();
+  return WaitUntilDurable(partition, s, ticket);
 }
 
 
 Interface* KingDB::NewSnapshot() {
   log::trace("KingDB::NewSnapshot()", "start");
-  std::set<uint32_t>* fileids_ignore;
-  uint32_t snapshot_id;
-  Status s = se_->GetNewSnapshotData(&snapshot_id, &fileids_ignore);
-  if (!s.IsOK()) return nullptr;
-
-  log::trace("KingDB::NewSnapshot()", "Flushing 0");
-  wb_->Flush();
-  log::trace("KingDB::NewSnapshot()", "Flushing 1");
-  uint32_t fileid_end = se_->FlushCurrentFileForSnapshot();
-  log::trace("KingDB::NewSnapshot()", "Flushing 2");
-  StorageEngine *se_readonly = new StorageEngine(db_options_,
-                                                 nullptr,
-                                                 dbname_,
-                                                 true,
-                                                 fileids_ignore,
-                                                 fileid_end);
-  std::vector<uint32_t> *fileids_iterator = se_readonly->GetFileidsIterator();
+  // The writers of all the partitions are blocked while the snapshot points
+  // are taken, for the snapshot to be the same point in time across all the
+  // partitions. The write buffers are locked in the order of the partitions,
+  // and flushed, since the snapshot only reads from the HSTables.
+  std::vector<std::set<uint32_t>*> fileids_ignores;
+  std::vector<uint32_t> fileids_end;
+  std::vector<uint32_t> snapshot_ids;
+  Status s;
+  for (auto& partition: partitions_) partition.wb->LockWrites();
+  for (auto& partition: partitions_) {
+    std::set<uint32_t>* fileids_ignore;
+    uint32_t snapshot_id;
+    s = partition.se->GetNewSnapshotData(&snapshot_id, &fileids_ignore);
+    if (!s.IsOK()) break;
+    fileids_ignores.push_back(fileids_ignore);
+    snapshot_ids.push_back(snapshot_id);
+
+    log::trace("KingDB::NewSnapshot()", "Flushing 0");
+    partition.wb->Flush();
+    log::trace("KingDB::NewSnapshot()", "Flushing 1");
+    fileids_end.push_back(partition.se->FlushCurrentFileForSnapshot());
+    log::trace("KingDB::NewSnapshot()", "Flushing 2");
+  }
+  for (auto& partition: partitions_) partition.wb->UnlockWrites();
+
+  if (!s.IsOK()) {
+    log::emerg("KingDB::NewSnapshot()", "Could not create snapshot: %s", s.ToString().c_str());
+    for (size_t i = 0; i < snapshot_ids.size(); i++) {
+      partitions_[i].se->ReleaseSnapshot(snapshot_ids[i]);
+      delete fileids_ignores[i];
+    }
+    return nullptr;
+  }
+
+  std::vector<StorageEngine*> ses_live;
+  std::vector<StorageEngine*> ses_readonly;
+  std::vector<std::vector<uint32_t>*> fileids_iterators;
+  for (uint32_t i = 0; i < partitions_.size(); i++) {
+    Partition& partition = partitions_[i];
+    StorageEngine *se_readonly = new StorageEngine(partition.db_options,
+                                                   nullptr,
+                                                   GetPartitionPath(i),
+                                                   true,
+                                                   fileids_ignores[i],
+                                                   fileids_end[i],
+                                                   &memory_budget_);
+    ses_live.push_back(partition.se);
+    ses_readonly.push_back(se_readonly);
+    fileids_iterators.push_back(se_readonly->GetFileidsIterator());
+  }
   Snapshot *snapshot = new Snapshot(db_options_,
                                     dbname_,
-                                    se_,
-                                    se_readonly,
-                                    fileids_iterator,
-                                    snapshot_id);
+                                    ses_live,
+                                    ses_readonly,
+                                    fileids_iterators,
+                                    snapshot_ids,
+                                    &buffer_pool_);
   return snapshot;
 }
 
+Status KingDB::NewChangeStream(const std::string& cursor, ChangeStream** stream_out) {
+  std::vector<StorageEngine*> ses;
+  for (auto& partition: partitions_) ses.push_back(partition.se);
+  ChangeStream* stream = new ChangeStream(ses);
+  Status s = stream->Seek(cursor);
+  if (!s.IsOK()) {
+    delete stream;
+    *stream_out = nullptr;
+    return s;
+  }
+  *stream_out = stream;
+  return Status::OK();
+}
+
+Status KingDB::IngestFiles(const std::vector<std::string>& filepaths) {
+  // All the files are checked before any of them is moved
+  std::vector< std::vector<std::string> > filepaths_partitions(partitions_.size());
+  for (auto& filepath: filepaths) {
+    uint32_t index_partition;
+    Status s = partitions_[0].se->CheckFileForIngestion(filepath, partitions_.size(), &index_partition);
+    if (!s.IsOK()) return s;
+    filepaths_partitions[index_partition].push_back(filepath);
+  }
+
+  for (size_t i = 0; i < partitions_.size(); i++) {
+    if (filepaths_partitions[i].empty()) continue;
+    partitions_[i].wb->Flush();
+    Status s = partitions_[i].se->IngestFiles(filepaths_partitions[i]);
+    if (!s.IsOK()) return s;
+  }
+  return Status::OK();
+}
+
+bool KingDB::GetProperty(const std::string& name, std::string* value) {
+  uint64_t size_hot = 0, size_cold = 0, num_hot = 0, num_cold = 0;
+  for (auto& partition: partitions_) {
+    uint64_t sh, sc, nh, nc;
+    partition.se->GetTierUsage(&sh, &sc, &nh, &nc);
+    size_hot += sh;
+    size_cold += sc;
+    num_hot += nh;
+    num_cold += nc;
+  }
+  if (name == "kingdb.storage.hot_size") {
+    *value = std::to_string(size_hot);
+  } else if (name == "kingdb.storage.cold_size") {
+    *value = std::to_string(size_cold);
+  } else if (name == "kingdb.storage.hot_files") {
+    *value = std::to_string(num_hot);
+  } else if (name == "kingdb.storage.cold_files") {
+    *value = std::to_string(num_cold);
+  } else if (name == "kingdb.write_buffer.flushes") {
+    uint64_t num_flushes = 0;
+    for (auto& partition: partitions_) num_flushes += partition.wb->GetNumFlushes();
+    *value = std::to_string(num_flushes);
+  } else {
+    return false;
+  }
+  return true;
+}
+
 } // namespace kdb
@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <thread>
 #include <string>
+#include <set>
 #include <memory>
 #include <sys/file.h>
 #include <cstdint>
@@ -19,15 +20,24 @@
 #include "interface/interface.h"
 #include "cache/write_buffer.h"
 #include "storage/storage_engine.h"
+#include "storage/hstable_builder.h"
 #include "storage/format.h"
 #include "util/status.h"
 #include "util/order.h"
 #include "util/byte_array.h"
+#include "util/slice.h"
+#include "util/value.h"
+#include "util/write_batch.h"
+#include "util/merge_operator.h"
+#include "util/buffer_pool.h"
+#include "util/memory_budget.h"
 #include "util/options.h"
 #include "interface/iterator.h"
 #include "interface/snapshot.h"
+#include "interface/change_stream.h"
 
 #include "algorithm/compressor.h"
+#include "algorithm/hash.h"
 #include "algorithm/crc32c.h"
 #include "algorithm/endian.h"
 
@@ -40,6 +50,8 @@ class KingDB: public Interface {
   KingDB(const DatabaseOptions& db_options, const std::string dbname)
       : db_options_(db_options),
         dbname_(dbname),
+        memory_budget_(db_options.memory_limit),
+        buffer_pool_(BufferPool::kSizeCacheMaxDefault, &memory_budget_),
         is_closed_(true)
   {
     // Word-swapped endianness is not supported
@@ -73,6 +85,10 @@ class KingDB: public Interface {
       return Status::IOError("db.storage.maximum_chunk_size cannot be greater than the maximum input size of the compression function you chose. Fix your options.");
     }
 
+    if (db_options_.storage__num_partitions == 0) {
+      return Status::IOError("db.storage.num_partitions must be at least 1. Fix your options.");
+    }
+
     std::unique_lock<std::mutex> lock(mutex_close_);
     if (!is_closed_) return Status::IOError("The database is already open");
 
@@ -114,25 +130,71 @@ class KingDB: public Interface {
 
       Mmap mmap(filepath_dboptions, info.st_size);
       if (!mmap.is_valid()) return Status::IOError("Mmap() constructor failed");
+      std::string data_directories = db_options_.storage__data_directories;
       s = DatabaseOptionEncoder::DecodeFrom(mmap.datafile(), mmap.filesize(), &db_options_);
       if (!s.IsOK()) return s;
+
+      // The HSTables are striped over the data directories by fileid, thus
+      // any other list of directories, even a shorter one, would make some
+      // of them unreachable
+      if (   DatabaseOptions::GetDataDirectoryList(data_directories)
+          != DatabaseOptions::GetDataDirectoryList(db_options_.storage__data_directories)) {
+        flock(fd_dboptions_, LOCK_UN);
+        close(fd_dboptions_);
+        return Status::IOError("The data directories are not the ones the database was created with", db_options_.storage__data_directories.c_str());
+      }
     } else {
       // If there is no db_options file, write it
       log::trace("KingDB::Open()", "Writing db_option file");
       if ((fd_dboptions_ = open(filepath_dboptions.c_str(), O_WRONLY|O_CREAT, 0644)) < 0) {
         log::emerg("KingDB::Open()", "Could not open file [%s]: %s", filepath_dboptions.c_str(), strerror(errno));
       }
-      char buffer[DatabaseOptionEncoder::GetFixedSize()];
-      DatabaseOptionEncoder::EncodeTo(&db_options_, buffer);
-      if (write(fd_dboptions_, buffer, DatabaseOptionEncoder::GetFixedSize()) < 0) {
+      std::vector<char> buffer(DatabaseOptionEncoder::GetSize(&db_options_));
+      uint32_t size_buffer = DatabaseOptionEncoder::EncodeTo(&db_options_, buffer.data());
+      if (write(fd_dboptions_, buffer.data(), size_buffer) < 0) {
         close(fd_dboptions_);
         return Status::IOError("Could not write 'db_options' file", strerror(errno));
       }
     }
 
-    em_ = new EventManager();
-    wb_ = new WriteBuffer(db_options_, em_);
-    se_ = new StorageEngine(db_options_, em_, dbname_);
+    // The number of partitions is the one the database was created with
+    for (uint32_t i = 0; i < db_options_.storage__num_partitions; i++) {
+      std::string dirpath = GetPartitionPath(i);
+      if (   dirpath != dbname_
+          && mkdir(dirpath.c_str(), 0755) < 0
+          && errno != EEXIST) {
+        flock(fd_dboptions_, LOCK_UN);
+        close(fd_dboptions_);
+        return Status::IOError("Could not create partition directory", strerror(errno));
+      }
+    }
+
+    // The partitions have sub-directories in every data directory, which
+    // are created by the storage engines
+    if (db_options_.storage__num_partitions > 1) {
+      std::vector<std::string> dirpaths = HSTableManager::GetDataDirectories(db_options_, dbname_);
+      if (!db_options_.storage__cold_directory.empty()) dirpaths.push_back(db_options_.storage__cold_directory);
+      for (size_t i = 1; i < dirpaths.size(); i++) {
+        if (mkdir(dirpaths[i].c_str(), 0755) < 0 && errno != EEXIST) {
+          flock(fd_dboptions_, LOCK_UN);
+          close(fd_dboptions_);
+          return Status::IOError("Could not create data directory", strerror(errno));
+        }
+      }
+    }
+
+    for (uint32_t i = 0; i < db_options_.storage__num_partitions; i++) {
+      Partition partition;
+      partition.db_options = GetPartitionOptions(i);
+      partition.em = new EventManager();
+      partition.wb = new WriteBuffer(partition.db_options, partition.em, &memory_budget_);
+      partition.se = new StorageEngine(partition.db_options, partition.em, GetPartitionPath(i), false, nullptr, 0, &memory_budget_);
+      partitions_.push_back(partition);
+    }
+    id_reclaimer_ = memory_budget_.AddReclaimer([this]() { buffer_pool_.Shrink(); });
+    if (memory_budget_.IsOverLimit()) {
+      log::warn("KingDB::Open()", "db.memory_limit is too low: the database already uses %" PRIu64 " bytes after opening, and writes will be rejected", memory_budget_.usage());
+    }
     is_closed_ = false;
     return Status::OK(); 
   }
@@ -143,11 +205,15 @@ class KingDB: public Interface {
     flock(fd_dboptions_, LOCK_UN);
     close(fd_dboptions_);
     is_closed_ = true;
-    wb_->Close();
-    se_->Close();
-    delete wb_;
-    delete se_;
-    delete em_;
+    for (auto& partition: partitions_) {
+      partition.wb->Close();
+      partition.se->Close();
+      delete partition.wb;
+      delete partition.se;
+      delete partition.em;
+    }
+    partitions_.clear();
+    memory_budget_.RemoveReclaimer(id_reclaimer_);
   }
 
   virtual Status Get(ReadOptions& read_options, ByteArray* key, ByteArray** value_out) override;
@@ -158,27 +224,162 @@ class KingDB: public Interface {
                           uint64_t offset_chunk,
                           uint64_t size_value) override;
   virtual Status Remove(WriteOptions& write_options, ByteArray *key) override;
+  virtual Status Get(ReadOptions& read_options, const Slice& key, Value* value_out) override;
+  virtual Status GetWithVersion(ReadOptions& read_options,
+                                const Slice& key,
+                                Value* value_out,
+                                uint64_t* version_out) override;
+  virtual Status Exists(ReadOptions& read_options, const Slice& key) override;
+  virtual Status GetMetadata(ReadOptions& read_options,
+                             const Slice& key,
+                             uint64_t* size_value_out,
+                             uint64_t* size_value_compressed_out,
+                             uint64_t* version_out) override;
+  virtual Status GetInto(ReadOptions& read_options,
+                         const Slice& key,
+                         char* buffer,
+                         uint64_t size_buffer,
+                         uint64_t* size_out) override;
+  virtual Status GetRange(ReadOptions& read_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          uint64_t size,
+                          Value* value_out) override;
+  virtual Status Put(WriteOptions& write_options, const Slice& key, const Slice& value) override;
+  virtual Status Remove(WriteOptions& write_options, const Slice& key) override;
+  virtual Status PutRange(WriteOptions& write_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          const Slice& data) override;
+  virtual Status Write(WriteOptions& write_options, WriteBatch* batch) override;
+  virtual Status Merge(WriteOptions& write_options,
+                       const Slice& key,
+                       const Slice& operand,
+                       const MergeOperator& merge_operator,
+                       std::string* value_out) override;
+  virtual Status CompareAndSwap(WriteOptions& write_options,
+                                const Slice& key,
+                                uint64_t version,
+                                const Slice& value) override;
   virtual Interface* NewSnapshot() override;
   virtual Iterator* NewIterator(ReadOptions& read_options) override { return nullptr; };
+  virtual bool GetProperty(const std::string& name, std::string* value) override;
+
+  // Opens a stream of the changes committed from 'cursor' onwards, or from
+  // the oldest change still available if 'cursor' is empty. The stream must
+  // be deleted before the database is closed.
+  Status NewChangeStream(const std::string& cursor, ChangeStream** stream_out);
+
+  // Adds to the database the HSTables written by HSTableBuilder, which must
+  // have been built with the options of this database. The files are moved
+  // into the database, and their entries take precedence over the ones
+  // written before the call. The files of each partition are added
+  // atomically.
+  Status IngestFiles(const std::vector<std::string>& filepaths);
 
  private:
+  // Each partition is a storage engine of its own, with its own write buffer
+  // and event manager, and each key belongs to a single partition.
+  struct Partition {
+    DatabaseOptions db_options;
+    EventManager *em;
+    WriteBuffer *wb;
+    StorageEngine *se;
+  };
+
+  Partition& GetPartition(const char* key, uint64_t size_key) {
+    return partitions_[HashPartition(key, size_key, partitions_.size())];
+  }
+
+  // The writes on a key are serialized by one of these locks, which is what
+  // makes Merge() atomic: the current value cannot change between the moment
+  // it is read and the moment the merged value is added to the write buffer.
+  std::mutex& GetKeyLock(const char* key, uint64_t size_key) {
+    return key_locks_[HashStripe(key, size_key, kNumKeyLocks)];
+  }
+
+  // The keys whose value is being written by several calls to PutChunk(),
+  // which are protected by the key lock of the same index
+  std::set<std::string>& GetKeysPartial(const char* key, uint64_t size_key) {
+    return keys_partial_[HashStripe(key, size_key, kNumKeyLocks)];
+  }
+
+  bool IsKeyPartial(const char* key, uint64_t size_key) {
+    std::set<std::string>& keys_partial = GetKeysPartial(key, size_key);
+    return !keys_partial.empty() && keys_partial.count(std::string(key, size_key)) > 0;
+  }
+
+  void ClearKeyPartial(const char* key, uint64_t size_key) {
+    std::set<std::string>& keys_partial = GetKeysPartial(key, size_key);
+    if (!keys_partial.empty()) keys_partial.erase(std::string(key, size_key));
+  }
+
+  // A database with a single partition stores it in its own directory
+  std::string GetPartitionPath(uint32_t index) {
+    if (db_options_.storage__num_partitions == 1) return dbname_;
+    return DatabaseOptions::GetPartitionPath(dbname_, index);
+  }
+
+  // Same as above for the data directories, which the partitions share, and
+  // for the cache size, which they split
+  DatabaseOptions GetPartitionOptions(uint32_t index) {
+    DatabaseOptions db_options = db_options_;
+    if (db_options_.storage__num_partitions == 1) return db_options;
+    std::vector<std::string> dirpaths = HSTableManager::GetDataDirectories(db_options_, dbname_);
+    db_options.storage__data_directories = "";
+    for (size_t i = 1; i < dirpaths.size(); i++) {
+      if (i > 1) db_options.storage__data_directories += ",";
+      db_options.storage__data_directories += DatabaseOptions::GetPartitionPath(dirpaths[i], index);
+    }
+    if (!db_options.storage__cold_directory.empty()) {
+      db_options.storage__cold_directory = DatabaseOptions::GetPartitionPath(db_options.storage__cold_directory, index);
+    }
+    db_options.cache__max_size /= db_options_.storage__num_partitions;
+    return db_options;
+  }
 
+  // The synchronous writes below do not wait for their flush, and return the
+  // ticket to give to WaitUntilDurable() in 'ticket_out'
   Status PutChunkValidSize(WriteOptions& write_options,
                            ByteArray *key,
                            ByteArray *chunk,
                            uint64_t offset_chunk,
-                           uint64_t size_value);
+                           uint64_t size_value,
+                           uint64_t* ticket_out);
+  Status PutSlice(WriteOptions& write_options,
+                  const Slice& key,
+                  const Slice& value,
+                  uint64_t* ticket_out);
+  Status PutChunkSlice(WriteOptions& write_options,
+                       const Slice& key,
+                       const Slice& chunk,
+                       uint64_t offset_chunk,
+                       uint64_t size_value,
+                       uint64_t* ticket_out);
+  Status WaitUntilDurable(Partition& partition, const Status& s, uint64_t ticket);
+  Status EncodeChunk(ByteArray *key,
+                     ByteArray *chunk,
+                     uint64_t offset_chunk,
+                     uint64_t size_value,
+                     ByteArray **chunk_out,
+                     uint64_t *offset_chunk_out,
+                     uint64_t *size_value_compressed_out,
+                     uint32_t *crc32_out);
 
   kdb::DatabaseOptions db_options_;
   std::string dbname_;
-  kdb::WriteBuffer *wb_;
-  kdb::StorageEngine *se_;
-  kdb::EventManager *em_;
+  std::vector<Partition> partitions_;
   kdb::CompressorLZ4 compressor_;
   kdb::CRC32 crc32_;
+  kdb::MemoryBudget memory_budget_;
+  kdb::BufferPool buffer_pool_;
+  uint64_t id_reclaimer_;
   bool is_closed_;
   int fd_dboptions_;
   std::mutex mutex_close_;
+  static const uint32_t kNumKeyLocks = 256;
+  std::mutex key_locks_[kNumKeyLocks];
+  std::set<std::string> keys_partial_[kNumKeyLocks];
 };
 
 } // namespace kdb
@@ -0,0 +1,590 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "interface/memorydb.h"
+
+#include "algorithm/lz4.h"
+
+namespace kdb {
+
+Status MemoryDB::Open() {
+  std::unique_lock<std::mutex> lock(mutex_close_);
+  if (!is_closed_) return Status::OK();
+  if (   db_options_.compression.type != kNoCompression
+      && db_options_.compression.type != kLZ4Compression) {
+    return Status::IOError("Unknown compression algorithm");
+  }
+  hash_ = MakeHash(db_options_.hash);
+  if (hash_ == nullptr) return Status::IOError("Unknown hashing algorithm");
+  for (uint32_t i = 0; i < kNumShards; i++) {
+    Shard *shard = new Shard();
+    shard->segments[0] = new Segment();
+    shards_.push_back(shard);
+  }
+  log::trace("MemoryDB::Open()", "dbname:%s", dbname_.c_str());
+  is_closed_ = false;
+  return Status::OK();
+}
+
+
+void MemoryDB::Close() {
+  std::unique_lock<std::mutex> lock(mutex_close_);
+  if (is_closed_) return;
+  is_closed_ = true;
+  for (auto shard: shards_) {
+    for (auto& p: shard->segments) {
+      memory_budget_.Release(p.second->arena.size_allocated());
+      delete p.second;
+    }
+    delete shard;
+  }
+  shards_.clear();
+  delete hash_;
+  hash_ = nullptr;
+}
+
+
+MemoryDB::Entry* MemoryDB::FindEntry(Shard& shard,
+                                     uint64_t hashed_key,
+                                     const Slice& key,
+                                     IndexMap::iterator* it_out) {
+  auto range = shard.index.equal_range(hashed_key);
+  for (auto it = range.first; it != range.second; ++it) {
+    Entry *entry = reinterpret_cast<Entry*>(it->second);
+    if (   entry->size_key == key.size()
+        && memcmp(entry->key(), key.data(), key.size()) == 0) {
+      if (it_out != nullptr) *it_out = it;
+      return entry;
+    }
+  }
+  return nullptr;
+}
+
+
+MemoryDB::Entry* MemoryDB::AllocateEntry(Shard& shard, uint64_t size_key, uint64_t size_value_stored) {
+  uint64_t size = sizeof(Entry) + size_key + size_value_stored;
+  Segment *segment = shard.segments[shard.id_segment_current];
+  if (segment->size_used > 0 && segment->size_used + size > kSizeSegment) {
+    // The current segment is not freed by ReleaseEntry() when its last live
+    // entry is released, thus it is freed here if it has no live data left
+    if (segment->size_live == 0) FreeSegment(shard, shard.id_segment_current);
+    shard.id_segment_current += 1;
+    segment = new Segment();
+    shard.segments[shard.id_segment_current] = segment;
+  }
+  uint64_t size_allocated = segment->arena.size_allocated();
+  Entry *entry = reinterpret_cast<Entry*>(segment->arena.Allocate(size));
+  memory_budget_.Charge(segment->arena.size_allocated() - size_allocated);
+  entry->id_segment = shard.id_segment_current;
+  entry->size_key = size_key;
+  entry->size_value_stored = size_value_stored;
+  segment->size_used += size;
+  segment->size_live += size;
+  shard.size_used += size;
+  shard.size_live += size;
+  return entry;
+}
+
+
+void MemoryDB::ReleaseEntry(Shard& shard, Entry* entry) {
+  uint64_t size = entry->size();
+  uint32_t id_segment = entry->id_segment;
+  Segment *segment = shard.segments[id_segment];
+  segment->size_live -= size;
+  shard.size_live -= size;
+  if (segment->size_live == 0 && id_segment != shard.id_segment_current) {
+    FreeSegment(shard, id_segment);
+  }
+}
+
+
+void MemoryDB::FreeSegment(Shard& shard, uint32_t id_segment) {
+  Segment *segment = shard.segments[id_segment];
+  shard.size_used -= segment->size_used;
+  memory_budget_.Release(segment->arena.size_allocated());
+  delete segment;
+  shard.segments.erase(id_segment);
+}
+
+
+void MemoryDB::IndexEntry(Shard& shard, uint64_t hashed_key, Entry* entry) {
+  entry->version = shard.version_clock.Next();
+  IndexMap::iterator it;
+  Entry *entry_old = FindEntry(shard, hashed_key, Slice(entry->key(), entry->size_key), &it);
+  if (entry_old != nullptr) {
+    it->second = reinterpret_cast<uint64_t>(entry);
+    ReleaseEntry(shard, entry_old);
+  } else {
+    shard.index.insert(std::pair<uint64_t, uint64_t>(hashed_key, reinterpret_cast<uint64_t>(entry)));
+  }
+}
+
+
+Status MemoryDB::PutLocked(Shard& shard,
+                           uint64_t hashed_key,
+                           const Slice& key,
+                           const Slice& chunk,
+                           uint64_t offset_chunk,
+                           uint64_t size_value,
+                           bool is_compressed) {
+  if (offset_chunk == 0 && (is_compressed || chunk.size() == size_value)) {
+    Entry *entry = AllocateEntry(shard, key.size(), chunk.size());
+    entry->size_value = size_value;
+    entry->is_compressed = is_compressed;
+    memcpy(entry->key(), key.data(), key.size());
+    memcpy(entry->value(), chunk.data(), chunk.size());
+    IndexEntry(shard, hashed_key, entry);
+    return Status::OK();
+  }
+
+  std::string key_str = key.ToString();
+  auto it = shard.entries_incomplete.find(key_str);
+  Entry *entry = nullptr;
+  if (offset_chunk == 0) {
+    if (it != shard.entries_incomplete.end()) {
+      ReleaseEntry(shard, it->second);
+      shard.entries_incomplete.erase(it);
+    }
+    entry = AllocateEntry(shard, key.size(), size_value);
+    entry->size_value = size_value;
+    entry->is_compressed = false;
+    memcpy(entry->key(), key.data(), key.size());
+    shard.entries_incomplete[key_str] = entry;
+  } else if (it != shard.entries_incomplete.end()) {
+    entry = it->second;
+  } else {
+    return Status::InvalidArgument("The first chunk of the value was never written");
+  }
+
+  if (   entry->size_value != size_value
+      || offset_chunk > size_value
+      || chunk.size() > size_value - offset_chunk) {
+    return Status::InvalidArgument("Chunk is beyond the end of the value");
+  }
+  memcpy(entry->value() + offset_chunk, chunk.data(), chunk.size());
+  if (offset_chunk + chunk.size() == size_value) {
+    shard.entries_incomplete.erase(key_str);
+    IndexEntry(shard, hashed_key, entry);
+  }
+  return Status::OK();
+}
+
+
+void MemoryDB::RemoveLocked(Shard& shard, uint64_t hashed_key, const Slice& key) {
+  IndexMap::iterator it;
+  Entry *entry = FindEntry(shard, hashed_key, key, &it);
+  if (entry == nullptr) return;
+  shard.index.erase(it);
+  ReleaseEntry(shard, entry);
+}
+
+
+// Copies the live entries of the segment with the least live data to the
+// current segment, which frees it. The entries of a segment are found through
+// the index: this costs a pass over the index of the shard, but compactions
+// only happen after as much data as is live in the shard has been overwritten.
+void MemoryDB::CompactShard(Shard& shard) {
+  while (shard.size_used - shard.size_live > std::max(2 * kSizeSegment, shard.size_live)) {
+    uint32_t id_victim = shard.id_segment_current;
+    uint64_t size_live_min = std::numeric_limits<uint64_t>::max();
+    for (auto& p: shard.segments) {
+      if (p.first != shard.id_segment_current && p.second->size_live < size_live_min) {
+        id_victim = p.first;
+        size_live_min = p.second->size_live;
+      }
+    }
+    if (   id_victim == shard.id_segment_current
+        || shard.segments[id_victim]->size_used == size_live_min) {
+      return;
+    }
+    if (size_live_min == 0) {
+      FreeSegment(shard, id_victim);
+      continue;
+    }
+
+    // The loop stops if an iteration frees nothing, since the same victim
+    // would be picked again by the next one
+    uint64_t size_used = shard.size_used;
+    for (auto& p: shard.index) {
+      Entry *entry = reinterpret_cast<Entry*>(p.second);
+      if (entry->id_segment != id_victim) continue;
+      Entry *entry_new = AllocateEntry(shard, entry->size_key, entry->size_value_stored);
+      memcpy(entry_new + 1, entry + 1, entry->size_key + entry->size_value_stored);
+      entry_new->size_value = entry->size_value;
+      entry_new->is_compressed = entry->is_compressed;
+      entry_new->version = entry->version;
+      p.second = reinterpret_cast<uint64_t>(entry_new);
+      ReleaseEntry(shard, entry);
+    }
+    for (auto& p: shard.entries_incomplete) {
+      Entry *entry = p.second;
+      if (entry->id_segment != id_victim) continue;
+      Entry *entry_new = AllocateEntry(shard, entry->size_key, entry->size_value_stored);
+      memcpy(entry_new + 1, entry + 1, entry->size_key + entry->size_value_stored);
+      entry_new->size_value = entry->size_value;
+      entry_new->is_compressed = entry->is_compressed;
+      entry_new->version = entry->version;
+      p.second = entry_new;
+      ReleaseEntry(shard, entry);
+    }
+    if (shard.size_used >= size_used) return;
+  }
+}
+
+
+Status MemoryDB::ReadValue(Entry* entry, uint64_t offset, uint64_t size, char* buffer) {
+  if (!entry->is_compressed) {
+    memcpy(buffer, entry->value() + offset, size);
+    return Status::OK();
+  }
+  if (offset == 0 && size == entry->size_value) {
+    int ret = LZ4_decompress_safe(entry->value(), buffer, entry->size_value_stored, entry->size_value);
+    if (ret < 0 || (uint64_t)ret != entry->size_value) return Status::IOError("Could not uncompress value");
+    return Status::OK();
+  }
+  std::unique_ptr<char[]> value(new char[entry->size_value]);
+  Status s = ReadValue(entry, 0, entry->size_value, value.get());
+  if (s.IsOK()) memcpy(buffer, value.get() + offset, size);
+  return s;
+}
+
+
+bool MemoryDB::EncodeValue(const Slice& value, std::string* buffer, Slice* value_out) {
+  *value_out = value;
+  if (   db_options_.compression.type != kLZ4Compression
+      || value.size() == 0
+      || value.size() > LZ4_MAX_INPUT_SIZE) {
+    return false;
+  }
+  buffer->resize(LZ4_compressBound(value.size()));
+  int size_compressed = LZ4_compress_limitedOutput(value.data(), &(*buffer)[0], value.size(), value.size() - 1);
+  if (size_compressed <= 0) return false;
+  *value_out = Slice(buffer->data(), size_compressed);
+  return true;
+}
+
+
+// The segments are charged to the memory budget, which the buffer pool shrinks
+// for when the limit is reached. Past that point, writes are rejected.
+Status MemoryDB::CheckMemoryLimit() {
+  if (is_closed_) return Status::IOError("The database is not open");
+  if (!memory_budget_.IsOverLimit()) return Status::OK();
+  return Status::IOError("The memory limit of the database is reached");
+}
+
+
+Status MemoryDB::Get(ReadOptions& read_options, ByteArray* key, ByteArray** value_out) {
+  uint64_t hashed_key = hash_->HashFunction(key->data(), key->size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  Entry *entry = FindEntry(shard, hashed_key, Slice(key->data(), key->size()), nullptr);
+  if (entry == nullptr) return Status::NotFound("Unable to find entry");
+  AllocatedByteArray *value = new AllocatedByteArray(entry->size_value);
+  Status s = ReadValue(entry, 0, entry->size_value, value->data());
+  if (!s.IsOK()) {
+    delete value;
+    return s;
+  }
+  *value_out = value;
+  return Status::OK();
+}
+
+
+Status MemoryDB::Get(ReadOptions& read_options, const Slice& key, Value* value_out) {
+  uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  Entry *entry = FindEntry(shard, hashed_key, key, nullptr);
+  if (entry == nullptr) return Status::NotFound("Unable to find entry");
+  char *buffer = value_out->Allocate(&buffer_pool_, entry->size_value);
+  Status s = ReadValue(entry, 0, entry->size_value, buffer);
+  if (!s.IsOK()) value_out->Reset();
+  return s;
+}
+
+
+Status MemoryDB::GetWithVersion(ReadOptions& read_options,
+                                const Slice& key,
+                                Value* value_out,
+                                uint64_t* version_out) {
+  uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  Entry *entry = FindEntry(shard, hashed_key, key, nullptr);
+  if (entry == nullptr) return Status::NotFound("Unable to find entry");
+  *version_out = entry->version;
+  char *buffer = value_out->Allocate(&buffer_pool_, entry->size_value);
+  Status s = ReadValue(entry, 0, entry->size_value, buffer);
+  if (!s.IsOK()) value_out->Reset();
+  return s;
+}
+
+
+Status MemoryDB::Exists(ReadOptions& read_options, const Slice& key) {
+  return GetMetadata(read_options, key, nullptr, nullptr, nullptr);
+}
+
+
+Status MemoryDB::GetMetadata(ReadOptions& read_options,
+                             const Slice& key,
+                             uint64_t* size_value_out,
+                             uint64_t* size_value_compressed_out,
+                             uint64_t* version_out) {
+  uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  Entry *entry = FindEntry(shard, hashed_key, key, nullptr);
+  if (entry == nullptr) return Status::NotFound("Unable to find entry");
+  if (size_value_out != nullptr) *size_value_out = entry->size_value;
+  if (size_value_compressed_out != nullptr) {
+    *size_value_compressed_out = entry->is_compressed ? entry->size_value_stored : 0;
+  }
+  if (version_out != nullptr) *version_out = entry->version;
+  return Status::OK();
+}
+
+
+Status MemoryDB::GetInto(ReadOptions& read_options,
+                         const Slice& key,
+                         char* buffer,
+                         uint64_t size_buffer,
+                         uint64_t* size_out) {
+  uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  Entry *entry = FindEntry(shard, hashed_key, key, nullptr);
+  if (entry == nullptr) return Status::NotFound("Unable to find entry");
+  *size_out = entry->size_value;
+  if (entry->size_value > size_buffer) return Status::InvalidArgument("Buffer is too small for the value");
+  return ReadValue(entry, 0, entry->size_value, buffer);
+}
+
+
+Status MemoryDB::GetRange(ReadOptions& read_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          uint64_t size,
+                          Value* value_out) {
+  uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  Entry *entry = FindEntry(shard, hashed_key, key, nullptr);
+  if (entry == nullptr) return Status::NotFound("Unable to find entry");
+  if (offset > entry->size_value) return Status::InvalidArgument("Offset is beyond the end of the value");
+  size = std::min(size, entry->size_value - offset);
+  char *buffer = value_out->Allocate(&buffer_pool_, size);
+  Status s = ReadValue(entry, offset, size, buffer);
+  if (!s.IsOK()) value_out->Reset();
+  return s;
+}
+
+
+Status MemoryDB::Put(WriteOptions& write_options, ByteArray *key, ByteArray *chunk) {
+  return PutChunk(write_options, key, chunk, 0, chunk->size());
+}
+
+
+// Like KingDB, the key and chunk are owned by the database once they have
+// been accepted.
+Status MemoryDB::PutChunk(WriteOptions& write_options,
+                          ByteArray *key,
+                          ByteArray *chunk,
+                          uint64_t offset_chunk,
+                          uint64_t size_value) {
+  Status s = CheckMemoryLimit();
+  if (!s.IsOK()) return s;
+  Slice key_slice(key->data(), key->size());
+  Slice chunk_slice(chunk->data(), chunk->size());
+  std::string buffer;
+  bool is_compressed = false;
+  if (offset_chunk == 0 && chunk->size() == size_value) {
+    is_compressed = EncodeValue(Slice(chunk->data(), chunk->size()), &buffer, &chunk_slice);
+  }
+  uint64_t hashed_key = hash_->HashFunction(key->data(), key->size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  s = PutLocked(shard, hashed_key, key_slice, chunk_slice, offset_chunk, size_value, is_compressed);
+  if (!s.IsOK()) return s;
+  CompactShard(shard);
+  lock.unlock();
+  delete key;
+  delete chunk;
+  return Status::OK();
+}
+
+
+Status MemoryDB::Put(WriteOptions& write_options, const Slice& key, const Slice& value) {
+  Status s = CheckMemoryLimit();
+  if (!s.IsOK()) return s;
+  std::string buffer;
+  Slice value_stored;
+  bool is_compressed = EncodeValue(value, &buffer, &value_stored);
+  uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  s = PutLocked(shard, hashed_key, key, value_stored, 0, value.size(), is_compressed);
+  if (s.IsOK()) CompactShard(shard);
+  return s;
+}
+
+
+Status MemoryDB::Remove(WriteOptions& write_options, ByteArray *key) {
+  Status s = Remove(write_options, Slice(key->data(), key->size()));
+  if (s.IsOK()) delete key;
+  return s;
+}
+
+
+Status MemoryDB::Remove(WriteOptions& write_options, const Slice& key) {
+  if (is_closed_) return Status::IOError("The database is not open");
+  uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  RemoveLocked(shard, hashed_key, key);
+  CompactShard(shard);
+  return Status::OK();
+}
+
+
+Status MemoryDB::PutRange(WriteOptions& write_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          const Slice& data) {
+  uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  Entry *entry = FindEntry(shard, hashed_key, key, nullptr);
+  if (entry == nullptr) return Status::NotFound("Unable to find entry");
+  if (entry->is_compressed) {
+    return Status::InvalidArgument("Compressed values cannot be overwritten in place");
+  }
+  if (offset > entry->size_value || data.size() > entry->size_value - offset) {
+    return Status::InvalidArgument("Range is beyond the end of the value");
+  }
+  memcpy(entry->value() + offset, data.data(), data.size());
+  entry->version = shard.version_clock.Next();
+  return Status::OK();
+}
+
+
+// The batch is atomic: the values are compressed first, and then all the
+// operations are applied with the locks of all the shards involved held,
+// which are taken in order.
+Status MemoryDB::Write(WriteOptions& write_options, WriteBatch* batch) {
+  Status s = CheckMemoryLimit();
+  if (!s.IsOK()) return s;
+  auto& operations = batch->operations();
+  std::vector<uint64_t> hashed_keys;
+  std::vector<std::string> buffers(operations.size());
+  std::vector<Slice> values;
+  std::vector<bool> are_compressed;
+  std::set<uint32_t> indices_shards;
+  for (size_t i = 0; i < operations.size(); i++) {
+    hashed_keys.push_back(hash_->HashFunction(operations[i].key.data(), operations[i].key.size()));
+    indices_shards.insert(hashed_keys.back() % kNumShards);
+    Slice value;
+    are_compressed.push_back(EncodeValue(operations[i].value, &buffers[i], &value));
+    values.push_back(value);
+  }
+
+  std::vector< std::unique_lock<std::mutex> > locks;
+  for (auto index: indices_shards) {
+    locks.push_back(std::unique_lock<std::mutex>(shards_[index]->mutex));
+  }
+  for (size_t i = 0; i < operations.size(); i++) {
+    Shard& shard = GetShard(hashed_keys[i]);
+    if (operations[i].type == OrderType::Remove) {
+      RemoveLocked(shard, hashed_keys[i], operations[i].key);
+    } else {
+      PutLocked(shard, hashed_keys[i], operations[i].key, values[i], 0, operations[i].value.size(), are_compressed[i]);
+    }
+  }
+  for (auto index: indices_shards) {
+    CompactShard(*shards_[index]);
+  }
+  return Status::OK();
+}
+
+
+// The merge is done entirely under the lock of the shard, which is what the
+// other writes on the key are holding too.
+Status MemoryDB::Merge(WriteOptions& write_options,
+                       const Slice& key,
+                       const Slice& operand,
+                       const MergeOperator& merge_operator,
+                       std::string* value_out) {
+  Status s = CheckMemoryLimit();
+  if (!s.IsOK()) return s;
+  uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  Entry *entry = FindEntry(shard, hashed_key, key, nullptr);
+  std::string value_current;
+  Slice value_current_slice;
+  if (entry != nullptr) {
+    value_current.resize(entry->size_value);
+    s = ReadValue(entry, 0, entry->size_value, &value_current[0]);
+    if (!s.IsOK()) return s;
+    value_current_slice = Slice(value_current);
+  }
+  std::string value_new;
+  s = merge_operator.Merge(key, entry != nullptr ? &value_current_slice : nullptr, operand, &value_new);
+  if (!s.IsOK()) return s;
+  std::string buffer;
+  Slice value_stored;
+  bool is_compressed = EncodeValue(value_new, &buffer, &value_stored);
+  s = PutLocked(shard, hashed_key, key, value_stored, 0, value_new.size(), is_compressed);
+  if (!s.IsOK()) return s;
+  CompactShard(shard);
+  if (value_out != nullptr) *value_out = std::move(value_new);
+  return Status::OK();
+}
+
+
+Status MemoryDB::CompareAndSwap(WriteOptions& write_options,
+                                const Slice& key,
+                                uint64_t version,
+                                const Slice& value) {
+  Status s = CheckMemoryLimit();
+  if (!s.IsOK()) return s;
+  std::string buffer;
+  Slice value_stored;
+  bool is_compressed = EncodeValue(value, &buffer, &value_stored);
+  uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+  Shard& shard = GetShard(hashed_key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  Entry *entry = FindEntry(shard, hashed_key, key, nullptr);
+  if (entry == nullptr) return Status::NotFound("Unable to find entry");
+  if (entry->version != version) {
+    return Status::Conflict("The entry was written since its version was read");
+  }
+  s = PutLocked(shard, hashed_key, key, value_stored, 0, value.size(), is_compressed);
+  if (s.IsOK()) CompactShard(shard);
+  return s;
+}
+
+
+// The in-memory engine has a single tier, which is reported as the hot one
+bool MemoryDB::GetProperty(const std::string& name, std::string* value) {
+  uint64_t size_used = 0, num_segments = 0;
+  for (auto shard: shards_) {
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    size_used += shard->size_used;
+    num_segments += shard->segments.size();
+  }
+  if (name == "kingdb.storage.hot_size") {
+    *value = std::to_string(size_used);
+  } else if (name == "kingdb.storage.cold_size") {
+    *value = "0";
+  } else if (name == "kingdb.storage.hot_files") {
+    *value = std::to_string(num_segments);
+  } else if (name == "kingdb.storage.cold_files") {
+    *value = "0";
+  } else {
+    return false;
+  }
+  return true;
+}
+
+} // namespace kdb
@@ -0,0 +1,202 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_INTERFACE_MEMORYDB_H_
+#define KINGDB_INTERFACE_MEMORYDB_H_
+
+#include "util/debug.h"
+
+#include <thread>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <limits>
+#include <cstdint>
+#include <inttypes.h>
+
+#include "interface/interface.h"
+#include "storage/hstable_manager.h"
+#include "util/status.h"
+#include "util/byte_array.h"
+#include "util/slice.h"
+#include "util/value.h"
+#include "util/write_batch.h"
+#include "util/buffer_pool.h"
+#include "util/memory_budget.h"
+#include "util/arena.h"
+#include "util/options.h"
+#include "algorithm/hash.h"
+
+namespace kdb {
+
+// MemoryDB is the in-memory engine, selected with 'db.storage.in_memory', for
+// the deployments that use KingDB as a cache and do not need durability.
+// The entries are stored in segments, which are arenas that play the role of
+// the HSTables, and the index maps the hashed keys to the entries, as in the
+// storage engine. Writes are applied to the index right away, which gives the
+// same semantics as the write buffer, but without any flush, offset array or
+// file I/O.
+// The keys are spread over shards, each with its own lock, index and
+// segments. An overwritten or removed entry is dead space in its segment:
+// a segment is freed once all its entries are dead, and when a shard holds
+// more dead space than live data, the live entries of its sparsest segment
+// are copied forward so that the segment can be freed -- the in-memory
+// counterpart of compaction.
+// If compression is enabled, the values written in a single chunk are
+// compressed with LZ4, and the values written in several chunks are stored
+// as they are.
+class MemoryDB: public Interface {
+ public:
+  MemoryDB(const DatabaseOptions& db_options, const std::string dbname)
+      : db_options_(db_options),
+        dbname_(dbname),
+        hash_(nullptr),
+        memory_budget_(db_options.memory_limit),
+        buffer_pool_(BufferPool::kSizeCacheMaxDefault, &memory_budget_),
+        is_closed_(true) {
+  }
+
+  virtual ~MemoryDB() {
+    Close();
+  }
+
+  virtual Status Open() override;
+  virtual void Close() override;
+
+  virtual Status Get(ReadOptions& read_options, ByteArray* key, ByteArray** value_out) override;
+  virtual Status Put(WriteOptions& write_options, ByteArray *key, ByteArray *chunk) override;
+  virtual Status PutChunk(WriteOptions& write_options,
+                          ByteArray *key,
+                          ByteArray *chunk,
+                          uint64_t offset_chunk,
+                          uint64_t size_value) override;
+  virtual Status Remove(WriteOptions& write_options, ByteArray *key) override;
+  virtual Status Get(ReadOptions& read_options, const Slice& key, Value* value_out) override;
+  virtual Status GetWithVersion(ReadOptions& read_options,
+                                const Slice& key,
+                                Value* value_out,
+                                uint64_t* version_out) override;
+  virtual Status Exists(ReadOptions& read_options, const Slice& key) override;
+  virtual Status GetMetadata(ReadOptions& read_options,
+                             const Slice& key,
+                             uint64_t* size_value_out,
+                             uint64_t* size_value_compressed_out,
+                             uint64_t* version_out) override;
+  virtual Status GetInto(ReadOptions& read_options,
+                         const Slice& key,
+                         char* buffer,
+                         uint64_t size_buffer,
+                         uint64_t* size_out) override;
+  virtual Status GetRange(ReadOptions& read_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          uint64_t size,
+                          Value* value_out) override;
+  virtual Status Put(WriteOptions& write_options, const Slice& key, const Slice& value) override;
+  virtual Status Remove(WriteOptions& write_options, const Slice& key) override;
+  virtual Status PutRange(WriteOptions& write_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          const Slice& data) override;
+  virtual Status Write(WriteOptions& write_options, WriteBatch* batch) override;
+  virtual Status Merge(WriteOptions& write_options,
+                       const Slice& key,
+                       const Slice& operand,
+                       const MergeOperator& merge_operator,
+                       std::string* value_out) override;
+  virtual Status CompareAndSwap(WriteOptions& write_options,
+                                const Slice& key,
+                                uint64_t version,
+                                const Slice& value) override;
+  virtual Interface* NewSnapshot() override { return nullptr; }
+  virtual Iterator* NewIterator(ReadOptions& read_options) override { return nullptr; }
+  virtual bool GetProperty(const std::string& name, std::string* value) override;
+
+  static const uint32_t kNumShards = 16;
+  static const uint64_t kSizeSegment = 8 * 1024 * 1024;
+
+ private:
+  // An entry is stored contiguously in a segment: this header, the key, and
+  // the value. The index holds pointers to the entries.
+  struct Entry {
+    uint32_t id_segment;
+    uint32_t size_key;
+    uint64_t size_value;
+    uint64_t size_value_stored;
+    uint64_t is_compressed;
+    uint64_t version;
+
+    char* key() { return reinterpret_cast<char*>(this + 1); }
+    char* value() { return key() + size_key; }
+    uint64_t size() { return sizeof(Entry) + size_key + size_value_stored; }
+  };
+
+  struct Segment {
+    Segment() : size_used(0), size_live(0) {}
+    Arena arena;
+    uint64_t size_used;
+    uint64_t size_live;
+  };
+
+  struct Shard {
+    Shard()
+        : index(IndexMap::key_compare(), IndexMap::allocator_type(&arena_index)),
+          id_segment_current(0),
+          size_used(0),
+          size_live(0) {
+    }
+    std::mutex mutex;
+    HugePageArena arena_index; // must be declared before the index
+    IndexMap index;
+    std::map<uint32_t, Segment*> segments;
+    uint32_t id_segment_current;
+    uint64_t size_used;
+    uint64_t size_live;
+    VersionClock version_clock;
+    // Values written in several chunks are only indexed once complete
+    std::map<std::string, Entry*> entries_incomplete;
+  };
+
+  Shard& GetShard(uint64_t hashed_key) {
+    return *shards_[hashed_key % kNumShards];
+  }
+
+  // The methods below must be called with the lock of the shard held
+  Entry* FindEntry(Shard& shard, uint64_t hashed_key, const Slice& key, IndexMap::iterator* it_out);
+  Entry* AllocateEntry(Shard& shard, uint64_t size_key, uint64_t size_value_stored);
+  void ReleaseEntry(Shard& shard, Entry* entry);
+  void FreeSegment(Shard& shard, uint32_t id_segment);
+  void IndexEntry(Shard& shard, uint64_t hashed_key, Entry* entry);
+  Status PutLocked(Shard& shard,
+                   uint64_t hashed_key,
+                   const Slice& key,
+                   const Slice& chunk,
+                   uint64_t offset_chunk,
+                   uint64_t size_value,
+                   bool is_compressed);
+  void RemoveLocked(Shard& shard, uint64_t hashed_key, const Slice& key);
+  void CompactShard(Shard& shard);
+  Status ReadValue(Entry* entry, uint64_t offset, uint64_t size, char* buffer);
+
+  // Compresses 'value' into 'buffer' if compression is enabled and actually
+  // makes the value smaller, and returns in 'value_out' what is to be stored.
+  bool EncodeValue(const Slice& value, std::string* buffer, Slice* value_out);
+  Status CheckMemoryLimit();
+
+  kdb::DatabaseOptions db_options_;
+  std::string dbname_;
+  Hash* hash_;
+  MemoryBudget memory_budget_;
+  BufferPool buffer_pool_;
+  std::vector<Shard*> shards_;
+  bool is_closed_;
+  std::mutex mutex_close_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_INTERFACE_MEMORYDB_H_
@@ -12,24 +12,32 @@
 #include "interface/interface.h"
 #include "util/order.h"
 #include "util/byte_array.h"
+#include "util/slice.h"
+#include "util/value.h"
+#include "util/buffer_pool.h"
 #include "util/options.h"
+#include "algorithm/hash.h"
 
 namespace kdb {
 
+// A snapshot holds one read-only storage engine per partition of the
+// database, and the reads are routed to the partition of their key.
 class Snapshot: public Interface {
  public:
   Snapshot(const DatabaseOptions& db_options,
            const std::string dbname,
-           StorageEngine *se_live,
-           StorageEngine *se_readonly,
-           std::vector<uint32_t>* fileids_iterator,
-           uint32_t snapshot_id)
+           const std::vector<StorageEngine*>& ses_live,
+           const std::vector<StorageEngine*>& ses_readonly,
+           const std::vector<std::vector<uint32_t>*>& fileids_iterators,
+           const std::vector<uint32_t>& snapshot_ids,
+           BufferPool* buffer_pool)
       : db_options_(db_options),
         dbname_(dbname),
-        se_live_(se_live),
-        se_readonly_(se_readonly),
-        snapshot_id_(snapshot_id),
-        fileids_iterator_(fileids_iterator),
+        ses_live_(ses_live),
+        ses_readonly_(ses_readonly),
+        snapshot_ids_(snapshot_ids),
+        fileids_iterators_(fileids_iterators),
+        buffer_pool_(buffer_pool),
         is_closed_(false)
   {
   }
@@ -47,13 +55,17 @@ class Snapshot: public Interface {
     std::unique_lock<std::mutex> lock(mutex_close_);
     if (is_closed_) return;
     is_closed_ = true;
-    delete fileids_iterator_;
-    se_live_->ReleaseSnapshot(snapshot_id_);
-    delete se_readonly_;
+    // Closing the read-only storage engines deletes their fileids iterators,
+    // and releases what they charged to the memory budget
+    for (size_t i = 0; i < ses_readonly_.size(); i++) {
+      ses_readonly_[i]->Close();
+      ses_live_[i]->ReleaseSnapshot(snapshot_ids_[i]);
+      delete ses_readonly_[i];
+    }
   }
 
   virtual Status Get(ReadOptions& read_options, ByteArray* key, ByteArray** value_out) override {
-    Status s = se_readonly_->Get(key, value_out);
+    Status s = GetStorageEngine(key->data(), key->size())->Get(key, value_out);
     if (s.IsNotFound()) {
       log::trace("Snapshot::Get()", "not found in storage engine");
       return s;
@@ -84,22 +96,104 @@ class Snapshot: public Interface {
     return Status::IOError("Not supported");
   }
 
+  virtual Status Get(ReadOptions& read_options, const Slice& key, Value* value_out) override {
+    return GetStorageEngine(key.data(), key.size())->Get(key, buffer_pool_, value_out);
+  }
+
+  virtual Status GetWithVersion(ReadOptions& read_options,
+                                const Slice& key,
+                                Value* value_out,
+                                uint64_t* version_out) override {
+    return GetStorageEngine(key.data(), key.size())->GetWithVersion(key, buffer_pool_, value_out, version_out);
+  }
+
+  virtual Status Exists(ReadOptions& read_options, const Slice& key) override {
+    return GetMetadata(read_options, key, nullptr, nullptr, nullptr);
+  }
+
+  virtual Status GetMetadata(ReadOptions& read_options,
+                             const Slice& key,
+                             uint64_t* size_value_out,
+                             uint64_t* size_value_compressed_out,
+                             uint64_t* version_out) override {
+    return GetStorageEngine(key.data(), key.size())->GetMetadata(key, buffer_pool_, size_value_out, size_value_compressed_out, version_out);
+  }
+
+  virtual Status GetInto(ReadOptions& read_options,
+                         const Slice& key,
+                         char* buffer,
+                         uint64_t size_buffer,
+                         uint64_t* size_out) override {
+    return GetStorageEngine(key.data(), key.size())->GetInto(key, buffer_pool_, buffer, size_buffer, size_out);
+  }
+
+  virtual Status GetRange(ReadOptions& read_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          uint64_t size,
+                          Value* value_out) override {
+    return GetStorageEngine(key.data(), key.size())->GetRange(key, buffer_pool_, offset, size, value_out);
+  }
+
+  virtual Status Put(WriteOptions& write_options, const Slice& key, const Slice& value) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status Remove(WriteOptions& write_options, const Slice& key) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status PutRange(WriteOptions& write_options,
+                          const Slice& key,
+                          uint64_t offset,
+                          const Slice& data) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status Write(WriteOptions& write_options, WriteBatch* batch) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status Merge(WriteOptions& write_options,
+                       const Slice& key,
+                       const Slice& operand,
+                       const MergeOperator& merge_operator,
+                       std::string* value_out) override {
+    return Status::IOError("Not supported");
+  }
+
+  virtual Status CompareAndSwap(WriteOptions& write_options,
+                                const Slice& key,
+                                uint64_t version,
+                                const Slice& value) override {
+    return Status::IOError("Not supported");
+  }
+
   virtual Interface* NewSnapshot() override {
     return nullptr;
   }
 
   virtual Iterator* NewIterator(ReadOptions& read_options) override {
-    Iterator* it = new Iterator(read_options, se_readonly_, fileids_iterator_);
+    Iterator* it = new Iterator(read_options, ses_readonly_, fileids_iterators_);
     return it;
   }
 
+  virtual bool GetProperty(const std::string& name, std::string* value) override {
+    return false;
+  }
+
  private:
+  StorageEngine* GetStorageEngine(const char* key, uint64_t size_key) {
+    return ses_readonly_[HashPartition(key, size_key, ses_readonly_.size())];
+  }
+
   kdb::DatabaseOptions db_options_;
   std::string dbname_;
-  kdb::StorageEngine* se_live_;
-  kdb::StorageEngine* se_readonly_;
-  uint32_t snapshot_id_;
-  std::vector<uint32_t>* fileids_iterator_;
+  std::vector<kdb::StorageEngine*> ses_live_;
+  std::vector<kdb::StorageEngine*> ses_readonly_;
+  std::vector<uint32_t> snapshot_ids_;
+  std::vector<std::vector<uint32_t>*> fileids_iterators_;
+  BufferPool* buffer_pool_;
   bool is_closed_;
   std::mutex mutex_close_;
 };
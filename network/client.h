@@ -58,8 +58,8 @@ class Client {
   }
 
   uint64_t hash_function(const std::string& key) {
-    static char hash[16];
-    static uint64_t output;
+    char hash[16];
+    uint64_t output;
     MurmurHash3_x64_128(key.c_str(), key.size(), 0, hash);
     memcpy(&output, hash, 8); 
     return output;
@@ -320,7 +320,7 @@ class ClientTask: public Task {
 
 
   char* MakeValue2(const std::string& key, int size_value) {
-    static char hash[16];
+    char hash[16];
     MurmurHash3_x64_128(key.c_str(), key.size(), 0, hash);
     char *str = new char[size_value+1];
     str[size_value] = '\0';
@@ -335,7 +335,7 @@ class ClientTask: public Task {
   }
 
   int VerifyValue2(const std::string& key, int size_value, const char* value) {
-    static char hash[16];
+    char hash[16];
     MurmurHash3_x64_128(key.c_str(), key.size(), 0, hash);
     int i = 0;
     for (i = 0; i < size_value / 16; i++) {
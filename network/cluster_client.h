@@ -0,0 +1,317 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_CLUSTER_CLIENT_H_
+#define KINGDB_CLUSTER_CLIENT_H_
+
+#include "util/debug.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <inttypes.h>
+#include <string.h>
+#include <libmemcached/memcached.hpp>
+#include "algorithm/murmurhash3.h"
+
+#include "util/status.h"
+#include "util/logger.h"
+
+namespace kdb {
+
+// Consistent-hash ring in the style of ketama: every server is placed on a
+// 32-bit ring at 'kNumVirtualNodes' points, and a key belongs to the first
+// server found clockwise from the hash of the key. Adding or removing a
+// server only moves the keys of the arcs that this server gains or loses,
+// which is about 1/N of the keys for N servers. The points are derived from
+// the name of the server, thus all the clients using the same list of servers
+// agree on the placement of the keys, whatever the order of that list.
+class HashRing {
+ public:
+  HashRing() {}
+
+  void AddServer(const std::string& server) {
+    RemoveServer(server);
+    servers_.push_back(server);
+    // As with the MD5 digests of ketama, every 128-bit hash gives four points
+    char hash[16];
+    for (uint32_t i = 0; i < kNumVirtualNodes / 4; i++) {
+      std::string name = server + "-" + std::to_string(i);
+      MurmurHash3_x64_128(name.c_str(), name.size(), 0, hash);
+      for (uint32_t k = 0; k < 4; k++) {
+        uint32_t point;
+        memcpy(&point, hash + k*4, 4);
+        points_.push_back(std::pair<uint32_t, std::string>(point, server));
+      }
+    }
+    std::sort(points_.begin(), points_.end());
+  }
+
+  void RemoveServer(const std::string& server) {
+    auto it = std::find(servers_.begin(), servers_.end(), server);
+    if (it == servers_.end()) return;
+    servers_.erase(it);
+    points_.erase(std::remove_if(points_.begin(),
+                                 points_.end(),
+                                 [&server](const std::pair<uint32_t, std::string>& p) { return p.second == server; }),
+                  points_.end());
+  }
+
+  // Returns the server of 'key', or an empty string if the ring is empty
+  const std::string& GetServer(const char* key, uint64_t size_key) const {
+    static const std::string empty;
+    if (points_.empty()) return empty;
+    char hash[16];
+    uint32_t point;
+    MurmurHash3_x64_128(key, size_key, 0, hash);
+    memcpy(&point, hash, 4);
+    auto it = std::lower_bound(points_.begin(),
+                               points_.end(),
+                               std::pair<uint32_t, std::string>(point, std::string()));
+    if (it == points_.end()) it = points_.begin();
+    return it->second;
+  }
+
+  const std::vector<std::string>& GetServers() const { return servers_; }
+
+  static const uint32_t kNumVirtualNodes = 160;
+
+ private:
+  std::vector<std::string> servers_;
+  std::vector< std::pair<uint32_t, std::string> > points_;
+};
+
+
+// Connections to a single server, which are created as they are needed and
+// reused by the following requests. When 'size_max' connections are in use,
+// Acquire() waits until one is released.
+class ConnectionPool {
+ public:
+  ConnectionPool(const std::string& server, uint32_t size_max)
+      : server_(server),
+        size_max_(size_max),
+        num_connections_(0) {
+  }
+
+  ~ConnectionPool() {
+    for (auto memc: connections_free_) memcached_free(memc);
+  }
+
+  memcached_st* Acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !connections_free_.empty() || num_connections_ < size_max_; });
+    if (!connections_free_.empty()) {
+      memcached_st* memc = connections_free_.back();
+      connections_free_.pop_back();
+      return memc;
+    }
+    std::string config = "--SERVER=" + server_;
+    memcached_st* memc = memcached(config.c_str(), config.length());
+    if (memc == nullptr) return nullptr;
+    memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, 30000);
+    memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_POLL_TIMEOUT, 30000);
+    memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_RETRY_TIMEOUT, 100);
+    num_connections_ += 1;
+    return memc;
+  }
+
+  // A connection that had an error is not reused, since its state is unknown
+  void Release(memcached_st* memc, bool has_error) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (has_error) {
+      memcached_free(memc);
+      num_connections_ -= 1;
+    } else {
+      connections_free_.push_back(memc);
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  std::string server_;
+  uint32_t size_max_;
+  uint32_t num_connections_;
+  std::vector<memcached_st*> connections_free_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+
+// Client for a cluster of KingDB servers, which shards the keys over the
+// servers with a HashRing and keeps a ConnectionPool for each server. The
+// client can be shared by any number of threads.
+// MultiGet() sends the keys of every server as pipelined multi-gets of at
+// most 'kMaxKeysPerRequest' keys, and queries the servers in parallel.
+class ClusterClient {
+ public:
+  ClusterClient(const std::vector<std::string>& servers, uint32_t size_pool)
+      : size_pool_(size_pool) {
+    for (auto& server: servers) {
+      ring_.AddServer(server);
+      pools_[server] = new ConnectionPool(server, size_pool_);
+    }
+  }
+
+  ~ClusterClient() {
+    for (auto& p: pools_) delete p.second;
+  }
+
+  const std::string& GetServer(const std::string& key) const {
+    return ring_.GetServer(key.c_str(), key.size());
+  }
+
+  Status Get(const std::string& key, std::string* value_out) {
+    ConnectionPool* pool = GetPool(key);
+    if (pool == nullptr) return Status::IOError("No server");
+    memcached_st* memc = pool->Acquire();
+    if (memc == nullptr) return Status::IOError("Could not create connection");
+    size_t size_value;
+    uint32_t flags;
+    memcached_return_t rc;
+    char* value = memcached_get(memc, key.c_str(), key.length(), &size_value, &flags, &rc);
+    bool has_error = (value == nullptr && rc != MEMCACHED_NOTFOUND);
+    Status s;
+    if (value != nullptr) {
+      value_out->assign(value, size_value);
+      free(value);
+      s = Status::OK();
+    } else if (rc == MEMCACHED_NOTFOUND) {
+      s = Status::NotFound("key: " + key);
+    } else {
+      s = Status::IOError(key + " " + memcached_strerror(memc, rc));
+    }
+    pool->Release(memc, has_error);
+    return s;
+  }
+
+  Status Put(const std::string& key, const std::string& value) {
+    ConnectionPool* pool = GetPool(key);
+    if (pool == nullptr) return Status::IOError("No server");
+    memcached_st* memc = pool->Acquire();
+    if (memc == nullptr) return Status::IOError("Could not create connection");
+    memcached_return_t rc = memcached_set(memc, key.c_str(), key.length(), value.c_str(), value.length(), (time_t)0, (uint32_t)0);
+    Status s;
+    if (rc != MEMCACHED_SUCCESS) s = Status::IOError(key + " " + memcached_strerror(memc, rc));
+    pool->Release(memc, rc != MEMCACHED_SUCCESS);
+    return s;
+  }
+
+  Status Remove(const std::string& key) {
+    ConnectionPool* pool = GetPool(key);
+    if (pool == nullptr) return Status::IOError("No server");
+    memcached_st* memc = pool->Acquire();
+    if (memc == nullptr) return Status::IOError("Could not create connection");
+    memcached_return_t rc = memcached_delete(memc, key.c_str(), key.length(), (time_t)0);
+    bool has_error = (rc != MEMCACHED_SUCCESS && rc != MEMCACHED_NOTFOUND);
+    Status s;
+    if (rc == MEMCACHED_NOTFOUND) {
+      s = Status::NotFound("key: " + key);
+    } else if (has_error) {
+      s = Status::IOError(key + " " + memcached_strerror(memc, rc));
+    }
+    pool->Release(memc, has_error);
+    return s;
+  }
+
+  // Gets the values of 'keys' into 'values_out'. The keys that are not found
+  // are not in 'values_out', and an error on any server fails the call.
+  Status MultiGet(const std::vector<std::string>& keys,
+                  std::map<std::string, std::string>* values_out) {
+    std::map< std::string, std::vector<const std::string*> > keys_per_server;
+    for (auto& key: keys) {
+      const std::string& server = GetServer(key);
+      if (server.empty()) return Status::IOError("No server");
+      keys_per_server[server].push_back(&key);
+    }
+
+    std::vector<std::string> servers;
+    std::vector< std::vector<const std::string*>* > keys_servers;
+    for (auto& p: keys_per_server) {
+      servers.push_back(p.first);
+      keys_servers.push_back(&p.second);
+    }
+    std::vector< std::map<std::string, std::string> > values(servers.size());
+    std::vector<Status> statuses(servers.size());
+
+    // The first server is done by the calling thread
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < servers.size(); i++) {
+      threads.push_back(std::thread([&, i]() {
+        statuses[i] = MultiGetServer(servers[i], *keys_servers[i], &values[i]);
+      }));
+    }
+    if (!servers.empty()) {
+      statuses[0] = MultiGetServer(servers[0], *keys_servers[0], &values[0]);
+    }
+    for (auto& t: threads) t.join();
+
+    for (size_t i = 0; i < servers.size(); i++) {
+      if (!statuses[i].IsOK()) return statuses[i];
+      values_out->insert(values[i].begin(), values[i].end());
+    }
+    return Status::OK();
+  }
+
+  static const uint32_t kMaxKeysPerRequest = 100;
+
+ private:
+  ConnectionPool* GetPool(const std::string& key) {
+    const std::string& server = GetServer(key);
+    if (server.empty()) return nullptr;
+    return pools_.find(server)->second;
+  }
+
+  Status MultiGetServer(const std::string& server,
+                        const std::vector<const std::string*>& keys,
+                        std::map<std::string, std::string>* values_out) {
+    ConnectionPool* pool = pools_.find(server)->second;
+    memcached_st* memc = pool->Acquire();
+    if (memc == nullptr) return Status::IOError("Could not create connection");
+    std::vector<const char*> keys_request;
+    std::vector<size_t> sizes_keys;
+    char key_return[MEMCACHED_MAX_KEY];
+    size_t size_key_return;
+    size_t size_value;
+    uint32_t flags;
+    memcached_return_t rc = MEMCACHED_SUCCESS;
+
+    for (size_t offset = 0; offset < keys.size(); offset += kMaxKeysPerRequest) {
+      size_t offset_end = std::min(keys.size(), offset + kMaxKeysPerRequest);
+      keys_request.clear();
+      sizes_keys.clear();
+      for (size_t i = offset; i < offset_end; i++) {
+        keys_request.push_back(keys[i]->c_str());
+        sizes_keys.push_back(keys[i]->size());
+      }
+      rc = memcached_mget(memc, keys_request.data(), sizes_keys.data(), keys_request.size());
+      if (rc != MEMCACHED_SUCCESS) break;
+      char* value;
+      while ((value = memcached_fetch(memc, key_return, &size_key_return, &size_value, &flags, &rc))) {
+        (*values_out)[std::string(key_return, size_key_return)] = std::string(value, size_value);
+        free(value);
+      }
+      if (rc != MEMCACHED_END && rc != MEMCACHED_NOTFOUND) break;
+      rc = MEMCACHED_SUCCESS;
+    }
+
+    Status s;
+    if (rc != MEMCACHED_SUCCESS) {
+      s = Status::IOError(server + " " + memcached_strerror(memc, rc));
+      log::emerg("ClusterClient::MultiGetServer()", "%s", s.ToString().c_str());
+    }
+    pool->Release(memc, rc != MEMCACHED_SUCCESS);
+    return s;
+  }
+
+  uint32_t size_pool_;
+  HashRing ring_;
+  std::map<std::string, ConnectionPool*> pools_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_CLUSTER_CLIENT_H_
@@ -9,9 +9,12 @@ namespace kdb {
 void NetworkTask::Run(std::thread::id tid, uint64_t id) {
 
   int bytes_received_last;
-  std::regex regex_get {"get ([^\\s]*)"};
-  std::regex regex_put {"set ([^\\s]*) \\d* \\d* (\\d*)\r\n"};
+  std::regex regex_get {"gets? ([^\\s]*)"};
+  std::regex regex_put {"(?:set|append|prepend|cas) ([^\\s]*) \\d* \\d* (\\d*)(?: (\\d*))?\r\n"};
   std::regex regex_remove {"delete ([^\\s]*)"};
+  std::regex regex_counter {"(incr|decr) ([^\\s]*) ([^\\s]*)\r\n"};
+  std::regex regex_touch {"touch ([^\\s]*)"};
+  std::regex regex_meta_get {"mg ([^\\s]*)((?: [^\\s]+)*)\r\n"};
 
   uint32_t bytes_received_buffer = 0;
   uint32_t bytes_received_total  = 0;
@@ -23,6 +26,14 @@ void NetworkTask::Run(std::thread::id tid, uint64_t id) {
   bool is_command_get = false;
   bool is_command_put = false;
   bool is_command_remove = false;
+  bool is_command_counter = false;
+  bool is_command_concat = false;
+  bool is_prepend = false;
+  bool is_command_gets = false;
+  bool is_command_cas = false;
+  bool is_command_touch = false;
+  bool is_command_meta_get = false;
+  uint64_t version_cas = 0;
   char *buffer_send = new char[server_options_.size_buffer_send];
   SharedAllocatedByteArray *buffer = nullptr;
   SharedAllocatedByteArray *key = nullptr;
@@ -46,6 +57,14 @@ void NetworkTask::Run(std::thread::id tid, uint64_t id) {
       is_command_get = false;
       is_command_put = false;
       is_command_remove = false;
+      is_command_counter = false;
+      is_command_concat = false;
+      is_prepend = false;
+      is_command_gets = false;
+      is_command_cas = false;
+      is_command_touch = false;
+      is_command_meta_get = false;
+      version_cas = 0;
       size_key = 0;
     }
 
@@ -80,18 +99,36 @@ void NetworkTask::Run(std::thread::id tid, uint64_t id) {
       // Determine command type
       if (buffer->StartsWith("get", 3)) {
         is_command_get = true;
+        is_command_gets = buffer->StartsWith("gets", 4);
+      } else if (buffer->StartsWith("cas", 3)) {
+        is_command_cas = true;
       } else if (buffer->StartsWith("set", 3)) {
         is_command_put = true;
       } else if (buffer->StartsWith("delete", 6)) {
         is_command_remove = true;
         log::trace("NetworkTask", "got delete command");
+      } else if (   buffer->StartsWith("incr", 4)
+                 || buffer->StartsWith("decr", 4)) {
+        is_command_counter = true;
+      } else if (buffer->StartsWith("append", 6)) {
+        is_command_concat = true;
+      } else if (buffer->StartsWith("prepend", 7)) {
+        is_command_concat = true;
+        is_prepend = true;
+      } else if (buffer->StartsWith("touch", 5)) {
+        is_command_touch = true;
+      } else if (buffer->StartsWith("mg ", 3)) {
+        is_command_meta_get = true;
       } else if (buffer->StartsWith("quit", 4)) {
         break;
       }
 
       // Determine bytes_expected
-      if (is_command_put) {
-        uint64_t offset_end_key = 4; // skipping 'set '
+      if (is_command_put || is_command_concat || is_command_cas) {
+        uint64_t offset_key = 0;
+        while (buffer->data()[offset_key] != ' ') offset_key++;
+        offset_key++; // skipping the command, such as 'set '
+        uint64_t offset_end_key = offset_key;
         while (buffer->data()[offset_end_key] != ' ') offset_end_key++;
 
         delete key; // TODO: Should be placed at the beginning of the "if (is_new)"
@@ -99,7 +136,7 @@ void NetworkTask::Run(std::thread::id tid, uint64_t id) {
                     //       command and not just for put.
         key = new SharedAllocatedByteArray();
         *key = *buffer;
-        key->SetOffset(4, offset_end_key-4);
+        key->SetOffset(offset_key, offset_end_key-offset_key);
 
         offset_value = offset_end_key;
         while (buffer->data()[offset_value] != '\n') offset_value++;
@@ -111,6 +148,7 @@ void NetworkTask::Run(std::thread::id tid, uint64_t id) {
         std::string str_buffer(buffer->data(), offset_value);
         if (std::regex_search(str_buffer, matches, regex_put)) {
           size_value = atoi(std::string(matches[2]).c_str());
+          if (is_command_cas) version_cas = strtoull(std::string(matches[3]).c_str(), nullptr, 10);
           bytes_expected = offset_value + size_value + 2;
           std::string str_debug = std::string(matches[2]);
           log::trace("NetworkTask", "[%s] expected [%s] [%" PRIu64 "]", key->ToString().c_str(), str_debug.c_str(), bytes_expected);
@@ -152,95 +190,110 @@ void NetworkTask::Run(std::thread::id tid, uint64_t id) {
       std::smatch matches;
       std::string str_buffer = buffer->ToString();
       if (std::regex_search(str_buffer, matches, regex_get)) {
-        ByteArray *value = nullptr; // TODO: beware, possible memory leak here -- value is not deleted in case of break
-                                    // TODO: replace the pointer with a reference
-                                    //       count
-        buffer->SetOffset(4, buffer->size() - 4 - 2);
-        Status s = db_->Get(read_options, buffer, &value);
+        // A get can have several keys separated by spaces, which is how
+        // libmemcached pipelines a multi-get to a server. As in the Memcached
+        // protocol, the keys that are not found are skipped in the response
+        // of a multi-get.
+        std::vector< std::pair<uint64_t, uint64_t> > keys;
+        uint64_t offset_end_keys = buffer->size() - 2;
+        uint64_t offset_keys = is_command_gets ? 5 : 4; // skipping 'get ' or 'gets '
+        for (uint64_t offset = offset_keys; offset < offset_end_keys; offset++) {
+          if (buffer->data()[offset] == ' ') continue;
+          uint64_t offset_end_key = offset;
+          while (offset_end_key < offset_end_keys && buffer->data()[offset_end_key] != ' ') offset_end_key++;
+          keys.push_back(std::pair<uint64_t, uint64_t>(offset, offset_end_key - offset));
+          offset = offset_end_key;
+        }
+
+        bool has_error = false;
+        bool has_value = false;
+        for (auto& p: keys) {
+          SharedAllocatedByteArray key_get = *buffer;
+          key_get.SetOffset(p.first, p.second);
+
+          // A gets also returns the version of each entry, which is what
+          // the client gives back to cas
+          if (is_command_gets) {
+            Value value;
+            uint64_t version;
+            Status s = db_->GetWithVersion(read_options, Slice(key_get.data(), key_get.size()), &value, &version);
+            if (!s.IsOK()) continue;
+            has_value = true;
+            std::string header = "VALUE " + key_get.ToString() + " 0 " + std::to_string(value.size()) + " " + std::to_string(version) + "\r\n";
+            if (   send(sockfd_, header.c_str(), header.size(), 0) == -1
+                || send(sockfd_, value.data(), value.size(), 0) == -1
+                || send(sockfd_, "\r\n", 2, 0) == -1) {
+              log::emerg("NetworkTask", "Error: send() - %s", strerror(errno));
+              has_error = true;
+              break;
+            }
+            continue;
+          }
+
+          ByteArray *value = nullptr; // TODO: replace the pointer with a reference
+                                      //       count
+          Status s = db_->Get(read_options, &key_get, &value);
+          if (!s.IsOK()) {
+            log::trace("NetworkTask", "GET: [%s]", s.ToString().c_str());
+            continue;
+          }
 
-        if (s.IsOK()) {
           log::trace("NetworkTask", "GET: found");
-          int ret = snprintf(buffer_send, server_options_.size_buffer_send, "VALUE %s 0 %" PRIu64 "\r\n", buffer->ToString().c_str(), value->size());
+          has_value = true;
+          int ret = snprintf(buffer_send, server_options_.size_buffer_send, "VALUE %s 0 %" PRIu64 "\r\n", key_get.ToString().c_str(), value->size());
           if (ret < 0 || ret >= server_options_.size_buffer_send) {
             log::emerg("NetworkTask", "Network send buffer is too small"); 
           }
           log::trace("NetworkTask", "GET: buffer_send [%s]", buffer_send);
           if (send(sockfd_, buffer_send, strlen(buffer_send), 0) == -1) {
             log::trace("NetworkTask", "Error: send() - %s", strerror(errno));
+            delete value;
+            has_error = true;
             break;
           }
 
-          if (!value->is_compressed()) {
-            // is this condition really necessary? can't the 'compressed' code
-            // block also handle this as well?
-            char *chunk;
-            uint64_t size_chunk;
-            s = value->data_chunk(&chunk, &size_chunk);
-            if (!s.IsOK() && !s.IsDone()) {
-              // TODO: this won't work, as it has to be sent before
-              //       the 'VALUE' command
-              if (send(sockfd_, "SERVER_ERROR Bad CRC32\r\n", 24, 0) == -1) {
-                log::trace("NetworkTask", "Error: send() - %s", strerror(errno));
-              }
-            } else {
-              if (send(sockfd_, chunk, size_chunk, 0) == -1) {
-                log::trace("NetworkTask", "Error: send() - %s", strerror(errno));
-              }
-            }
-          } else {
-            // If the value is compressed
-            char *chunk;
-            uint64_t size_chunk;
-            while (true) {
-              s = value->data_chunk(&chunk, &size_chunk);
-              if (s.IsDone()) break;
-              if (!s.IsOK()) {
-                delete[] chunk;
-                log::trace("NetworkTask", "Error - data_chunk(): %s", s.ToString().c_str());
-                break;
-              }
-              if (send(sockfd_, chunk, size_chunk, 0) == -1) {
-                delete[] chunk;
-                log::trace("NetworkTask", "Error: send() - %s", strerror(errno));
-                break;
-              }
-              delete[] chunk;
-            }
-
-            if (!s.IsOK() && !s.IsDone()) {
-              log::emerg("NetworkTask", "Error: send()", strerror(errno));
-              //break;
+          // The value is streamed through the send buffer, which the header
+          // line is done with, so that no memory is allocated per request.
+          uint64_t size_read;
+          while (true) {
+            s = value->ReadInto(buffer_send, server_options_.size_buffer_send, &size_read);
+            if (s.IsDone()) break;
+            if (!s.IsOK()) {
+              log::trace("NetworkTask", "Error - ReadInto(): %s", s.ToString().c_str());
+              break;
             }
-          }
-
-          //if (s.IsOK() || s.IsDone()) {
-            if (send(sockfd_, "\r\nEND\r\n", 7, 0) == -1) {
-              log::emerg("NetworkTask", "Error: send()", strerror(errno));
+            if (send(sockfd_, buffer_send, size_read, 0) == -1) {
+              log::trace("NetworkTask", "Error: send() - %s", strerror(errno));
               break;
             }
-          //}
+          }
+          delete value;
 
-          /*
-          if (send(sockfd_, value->data(), value->size(), 0) == -1) {
-            log::trace("NetworkTask", "Error: send() - %s", strerror(errno));
-            break;
+          if (!s.IsOK() && !s.IsDone()) {
+            log::emerg("NetworkTask", "Error: send()", strerror(errno));
+            //break;
           }
-          if (send(sockfd_, "\r\nEND\r\n", 7, 0) == -1) {
+
+          if (send(sockfd_, "\r\n", 2, 0) == -1) {
             log::emerg("NetworkTask", "Error: send()", strerror(errno));
+            has_error = true;
             break;
           }
-          */
-        } else {
-          log::trace("NetworkTask", "GET: [%s]", s.ToString().c_str());
+        }
+        if (has_error) break;
+
+        if (!has_value && keys.size() <= 1) {
           std::string msg = "NOT_FOUND\r\n";
           if (send(sockfd_, msg.c_str(), msg.length(), 0) == -1) {
             log::emerg("NetworkTask", "Error: send() - %s", strerror(errno));
             break;
           }
+        } else if (send(sockfd_, "END\r\n", 5, 0) == -1) {
+          log::emerg("NetworkTask", "Error: send()", strerror(errno));
+          break;
         }
         is_new = true;
         is_new_buffer = true;
-        delete value;
         delete buffer;
       } else {
         log::emerg("NetworkTask", "Could not match Get command");
@@ -270,6 +323,156 @@ void NetworkTask::Run(std::thread::id tid, uint64_t id) {
         log::emerg("NetworkTask", "Could not match Remove command");
         break;
       }
+    } else if (is_command_counter) {
+      std::smatch matches;
+      std::string str_buffer = buffer->ToString();
+      if (std::regex_search(str_buffer, matches, regex_counter)) {
+        // As in Memcached, counters that do not exist are not created
+        std::string key_counter = matches[2];
+        std::string delta = matches[3];
+        std::string value;
+        Status s;
+        if (matches[1] == "incr") {
+          s = db_->Merge(write_options, key_counter, delta, IncrementOperator(false), &value);
+        } else {
+          s = db_->Merge(write_options, key_counter, delta, DecrementOperator(false), &value);
+        }
+        std::string msg;
+        if (s.IsOK()) {
+          msg = value + "\r\n";
+        } else if (s.IsNotFound()) {
+          msg = "NOT_FOUND\r\n";
+        } else if (s.IsInvalidArgument()) {
+          msg = "CLIENT_ERROR " + s.ToString() + "\r\n";
+        } else {
+          msg = "SERVER_ERROR " + s.ToString() + "\r\n";
+        }
+        if (send(sockfd_, msg.c_str(), msg.length(), 0) == -1) {
+          log::emerg("NetworkTask", "Error - send() %s", strerror(errno));
+          break;
+        }
+        is_new = true;
+        is_new_buffer = true;
+        delete buffer;
+      } else {
+        log::emerg("NetworkTask", "Could not match Incr/Decr command");
+        break;
+      }
+    } else if (is_command_touch) {
+      // Entries do not expire, thus a touch only checks that the key exists
+      std::smatch matches;
+      std::string str_buffer = buffer->ToString();
+      if (std::regex_search(str_buffer, matches, regex_touch)) {
+        std::string key_touch = matches[1];
+        Status s = db_->Exists(read_options, key_touch);
+        std::string msg;
+        if (s.IsOK()) {
+          msg = "TOUCHED\r\n";
+        } else if (s.IsNotFound()) {
+          msg = "NOT_FOUND\r\n";
+        } else {
+          msg = "SERVER_ERROR " + s.ToString() + "\r\n";
+        }
+        if (send(sockfd_, msg.c_str(), msg.length(), 0) == -1) {
+          log::emerg("NetworkTask", "Error - send() %s", strerror(errno));
+          break;
+        }
+        is_new = true;
+        is_new_buffer = true;
+        delete buffer;
+      } else {
+        log::emerg("NetworkTask", "Could not match Touch command");
+        break;
+      }
+    } else if (is_command_meta_get) {
+      // Meta get, with the flags 'v' (value), 's' (size), 'c' (cas version)
+      // and 'k' (key). Without 'v', the value is not read at all: the size
+      // and the version are taken from the metadata of the entry.
+      std::smatch matches;
+      std::string str_buffer = buffer->ToString();
+      if (std::regex_search(str_buffer, matches, regex_meta_get)) {
+        std::string key_meta = matches[1];
+        std::string flags = matches[2];
+        bool has_flag_value = (flags.find(" v") != std::string::npos);
+        Value value;
+        uint64_t size_value_meta = 0, version = 0;
+        Status s;
+        if (has_flag_value) {
+          s = db_->GetWithVersion(read_options, key_meta, &value, &version);
+          size_value_meta = value.size();
+        } else {
+          s = db_->GetMetadata(read_options, key_meta, &size_value_meta, nullptr, &version);
+        }
+        std::string msg;
+        if (s.IsOK()) {
+          std::string flags_out;
+          for (size_t i = 0; i + 1 < flags.size(); i++) {
+            if (flags[i] != ' ') continue;
+            if (flags[i+1] == 's') flags_out += " s" + std::to_string(size_value_meta);
+            if (flags[i+1] == 'c') flags_out += " c" + std::to_string(version);
+            if (flags[i+1] == 'k') flags_out += " k" + key_meta;
+          }
+          if (has_flag_value) {
+            msg = "VA " + std::to_string(size_value_meta) + flags_out + "\r\n";
+          } else {
+            msg = "HD" + flags_out + "\r\n";
+          }
+        } else if (s.IsNotFound()) {
+          msg = "EN\r\n";
+        } else {
+          msg = "SERVER_ERROR " + s.ToString() + "\r\n";
+        }
+        if (   send(sockfd_, msg.c_str(), msg.length(), 0) == -1
+            || (   s.IsOK() && has_flag_value
+                && (   send(sockfd_, value.data(), value.size(), 0) == -1
+                    || send(sockfd_, "\r\n", 2, 0) == -1))) {
+          log::emerg("NetworkTask", "Error - send() %s", strerror(errno));
+          break;
+        }
+        is_new = true;
+        is_new_buffer = true;
+        delete buffer;
+      } else {
+        log::emerg("NetworkTask", "Could not match Meta Get command");
+        break;
+      }
+    } else if (is_command_concat || is_command_cas) {
+      // The data to append, prepend or compare-and-swap is written with
+      // a single call, thus it has to fit in the receive buffer
+      std::string msg;
+      if (bytes_received_total < bytes_expected) {
+        msg = "SERVER_ERROR object too large for cache\r\n";
+      } else {
+        Slice key_concat(key->data(), key->size());
+        Slice data(buffer->data() + offset_value, size_value);
+        Status s;
+        if (is_command_cas) {
+          s = db_->CompareAndSwap(write_options, key_concat, version_cas, data);
+        } else if (is_prepend) {
+          s = db_->Merge(write_options, key_concat, data, PrependOperator(false), nullptr);
+        } else {
+          s = db_->Merge(write_options, key_concat, data, AppendOperator(false), nullptr);
+        }
+        if (s.IsOK()) {
+          msg = "STORED\r\n";
+        } else if (s.IsNotFound()) {
+          msg = is_command_cas ? "NOT_FOUND\r\n" : "NOT_STORED\r\n";
+        } else if (s.IsConflict()) {
+          msg = "EXISTS\r\n";
+        } else {
+          msg = "SERVER_ERROR " + s.ToString() + "\r\n";
+        }
+      }
+      if (send(sockfd_, msg.c_str(), msg.length(), 0) == -1) {
+        log::emerg("NetworkTask", "Error - send() %s", strerror(errno));
+        break;
+      }
+      // The rest of the data is still to be received: the connection is
+      // closed, since it cannot be resynchronized with the next command
+      if (bytes_received_total < bytes_expected) break;
+      is_new = true;
+      is_new_buffer = true;
+      delete buffer;
     } else if (is_command_put) {
       uint64_t offset_chunk;
       SharedAllocatedByteArray *chunk = buffer;
@@ -357,7 +560,13 @@ Status Server::Start(ServerOptions& server_options,
 void Server::AcceptNetworkTraffic() {
 
   // Create the database object and the thread pool
-  db_ = new kdb::KingDB(db_options_, dbname_);
+  if (db_options_.storage__in_memory) {
+    db_ = new kdb::MemoryDB(db_options_, dbname_);
+  } else if (!db_options_.storage__follow.empty()) {
+    db_ = new kdb::Follower(db_options_, dbname_);
+  } else {
+    db_ = new kdb::KingDB(db_options_, dbname_);
+  }
   Status s = db_->Open();
   if (!s.IsOK()) {
     log::emerg("Server", s.ToString().c_str()); 
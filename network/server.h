@@ -34,6 +34,8 @@
 #include "kingdb/kdb.h"
 #include "thread/threadpool.h"
 #include "interface/kingdb.h"
+#include "interface/memorydb.h"
+#include "interface/follower.h"
 #include "util/byte_array.h"
 
 
@@ -43,8 +45,8 @@ class NetworkTask: public Task {
  public:
   int sockfd_;
   kdb::ServerOptions server_options_;
-  kdb::KingDB *db_;
-  NetworkTask(int sockfd, kdb::ServerOptions server_options, kdb::KingDB* db) {
+  kdb::Interface *db_;
+  NetworkTask(int sockfd, kdb::ServerOptions server_options, kdb::Interface* db) {
     sockfd_ = sockfd;
     server_options_ = server_options;
     db_ = db;
@@ -114,7 +116,7 @@ class Server {
   int sockfd_notify_recv_;
   int sockfd_notify_send_;
 
-  kdb::KingDB* db_;
+  kdb::Interface* db_;
   ThreadPool *tp_;
 };
 
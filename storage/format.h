@@ -26,31 +26,57 @@
 
 namespace kdb {
 
-// Data format is version 1.0
+// Data format is version 1.1
+// Version 1.1 added kHasVersion. The files of version 1.0 are still
+// supported, since their entries simply have no version, but the files of
+// version 1.1 cannot be read by the code of version 1.0.
 static const uint32_t kVersionDataFormatMajor = 1;
-static const uint32_t kVersionDataFormatMinor = 0;
+static const uint32_t kVersionDataFormatMinor = 1;
+
+// Returns true if files of the given data format version can be read, which
+// is the case of all the minor versions up to the current one
+inline bool IsDataFormatVersionSupported(uint32_t major, uint32_t minor) {
+  return (major == kVersionDataFormatMajor && minor <= kVersionDataFormatMinor);
+}
 
 // 32-bit flags
 // NOTE: kEntryFirst, kEntryMiddle and kEntryLast are not used yet,
 //       they are reserved for possible future implementation.
+// NOTE: The entries of a WriteBatch are written contiguously and all have
+//       kInBatch, and the last one also has kBatchLast, which serves as the
+//       commit marker of the batch during recovery.
+// NOTE: Entries with kHasVersion have their version stored after the hash.
+//       The entries written before versions existed, and the ones written by
+//       HSTableBuilder, do not have it.
 enum EntryHeaderFlag {
   kTypeRemove    = 0x1,
   kHasPadding    = 0x2,
   kEntryFull     = 0x4,
   kEntryFirst    = 0x8,
   kEntryMiddle   = 0x10,
-  kEntryLast     = 0x20
+  kEntryLast     = 0x20,
+  kInBatch       = 0x40,
+  kBatchLast     = 0x80,
+  kHasVersion    = 0x100
 };
 
+// The entries that have no version stored in their header get one derived
+// from their location, with the highest bit set so that it cannot be equal
+// to a stored version. Such a version changes if the entry is moved by a
+// compaction, which only makes a compare-and-swap fail when it could have
+// succeeded.
+static const uint64_t kVersionFromLocation = 0x8000000000000000;
+
 
 struct EntryHeader {
-  EntryHeader() { flags = 0; }
+  EntryHeader() { flags = 0; version = 0; }
   uint32_t crc32;
   uint32_t flags;
   uint64_t size_key;
   uint64_t size_value;
   uint64_t size_value_compressed;
   uint64_t hash;
+  uint64_t version;
   int32_t size_header_serialized;
 
   void print() {
@@ -100,6 +126,37 @@ struct EntryHeader {
     return (flags & kEntryFull); 
   }
 
+  void SetInBatch(bool is_last) {
+    flags |= kInBatch;
+    if (is_last) flags |= kBatchLast;
+  }
+
+  bool IsInBatch() {
+    return (flags & kInBatch);
+  }
+
+  bool IsBatchLast() {
+    return (flags & kBatchLast);
+  }
+
+  // A version of 0 means that the entry has no version
+  void SetVersion(uint64_t v) {
+    version = v;
+    if (v != 0) {
+      flags |= kHasVersion;
+    } else {
+      flags &= ~kHasVersion;
+    }
+  }
+
+  bool HasVersion() {
+    return (flags & kHasVersion);
+  }
+
+  uint64_t GetVersion(uint64_t location) {
+    return HasVersion() ? version : (kVersionFromLocation | location);
+  }
+
   bool IsCompressed() {
     return (size_value_compressed > 0); 
   }
@@ -121,7 +178,26 @@ struct EntryHeader {
   }
 
 
+  // The compression type is fixed when a database is created, thus the
+  // decoding and encoding of entry headers are specialized on whether or not
+  // size_value_compressed is present. The hot paths of the storage engine
+  // call the specialized versions directly, and the versions taking
+  // a DatabaseOptions are only dispatching on the compression type.
+  // Upper bound on the size of a serialized header: crc32, flags, the three
+  // sizes as varints, the hash, and the version
+  static uint32_t GetMaxSize() {
+    return 4 + 5 + 10 + 10 + 10 + 8 + 8;
+  }
+
   static Status DecodeFrom(const DatabaseOptions& db_options, const char* buffer_in, uint64_t num_bytes_max, struct EntryHeader *output, uint32_t *num_bytes_read) {
+    if (db_options.compression.type != kNoCompression) {
+      return DecodeFrom<true>(buffer_in, num_bytes_max, output, num_bytes_read);
+    }
+    return DecodeFrom<false>(buffer_in, num_bytes_max, output, num_bytes_read);
+  }
+
+  template<bool kHasCompressedSize>
+  static Status DecodeFrom(const char* buffer_in, uint64_t num_bytes_max, struct EntryHeader *output, uint32_t *num_bytes_read) {
     /*
     // Dumb serialization for debugging
     log::trace("EntryHeader::DecodeFrom", "start num_bytes_max:%" PRIu64 " - sizeof(EntryHeader):%d", num_bytes_max, sizeof(struct EntryHeader));
@@ -151,7 +227,7 @@ struct EntryHeader {
     if (length_value == -1) return Status::IOError("Decoding error");
     array.AddOffset(length_value);
 
-    if (db_options.compression.type != kNoCompression) {
+    if (kHasCompressedSize) {
       int length = GetVarint64(&array, &(output->size_value_compressed));
       if (length == -1) return Status::IOError("Decoding error");
       array.AddOffset(length_value); // size_value_compressed is using length_value
@@ -162,6 +238,13 @@ struct EntryHeader {
     if (array.size() < 8) return Status::IOError("Decoding error");
     GetFixed64(array.data(), &(output->hash));
 
+    output->version = 0;
+    if (output->flags & kHasVersion) {
+      array.AddOffset(8);
+      if (array.size() < 8) return Status::IOError("Decoding error");
+      GetFixed64(array.data(), &(output->version));
+    }
+
     *num_bytes_read = num_bytes_max - array.size() + 8;
     output->size_header_serialized = *num_bytes_read;
     //log::trace("EntryHeader::DecodeFrom", "size:%u", *num_bytes_read);
@@ -169,6 +252,14 @@ struct EntryHeader {
   }
 
   static uint32_t EncodeTo(const DatabaseOptions& db_options, const struct EntryHeader *input, char* buffer) {
+    if (db_options.compression.type != kNoCompression) {
+      return EncodeTo<true>(input, buffer);
+    }
+    return EncodeTo<false>(input, buffer);
+  }
+
+  template<bool kHasCompressedSize>
+  static uint32_t EncodeTo(const struct EntryHeader *input, char* buffer) {
     /*
     // Dumb serialization for debugging
     struct EntryHeader *input_noncast = const_cast<struct EntryHeader*>(input);
@@ -187,7 +278,7 @@ struct EntryHeader {
     char *ptr_value = EncodeVarint64(ptr, input->size_value);
     int length_value = ptr_value - ptr;
     ptr = ptr_value;
-    if (db_options.compression.type != kNoCompression) {
+    if (kHasCompressedSize) {
       // size_value_compressed is stored only if the database is using compression
       //if (input->size_value_compressed != 0) {
         EncodeVarint64(ptr, input->size_value_compressed);
@@ -195,6 +286,10 @@ struct EntryHeader {
       ptr += length_value;
     }
     EncodeFixed64(ptr, input->hash);
+    if (input->flags & kHasVersion) {
+      ptr += 8;
+      EncodeFixed64(ptr, input->version);
+    }
     //log::trace("EntryHeader::EncodeTo", "size:%u", ptr - buffer + 8);
     return (ptr - buffer + 8);
   }
@@ -248,8 +343,7 @@ struct HSTableHeader {
   }
 
   bool IsFileVersionSupported() {
-    return (   version_data_format_major == kVersionDataFormatMajor
-            && version_data_format_minor == kVersionDataFormatMinor);
+    return IsDataFormatVersionSupported(version_data_format_major, version_data_format_minor);
   }
 
   bool IsFileVersionNewer() {
@@ -382,11 +476,29 @@ struct HSTableFooterIndex {
 };
 
 
+// The data directories are stored after the fixed part, as their number
+// followed by the size and the path of each of them, and the checksum covers
+// them as well. The HSTables are striped over the data directories by fileid,
+// thus a database can only be opened with the directories it was created
+// with. The files written before the data directories were stored end with
+// the fixed part, and 'storage__data_directories' is then left untouched.
 struct DatabaseOptionEncoder {
   static Status DecodeFrom(const char* buffer_in, uint64_t num_bytes_max, struct DatabaseOptions *output) {
-    if (num_bytes_max < GetFixedSize()) return Status::IOError("Decoding error");
+    // The files written before partitions were introduced are shorter, and
+    // are for databases with a single partition
+    if (num_bytes_max < GetFixedSizeWithoutPartitions()) return Status::IOError("Decoding error");
+    bool has_partitions = (num_bytes_max >= GetFixedSize());
+    bool has_directories = (num_bytes_max > GetFixedSize());
+    uint32_t size_checked;
+    if (has_directories) {
+      size_checked = num_bytes_max - 4;
+    } else if (has_partitions) {
+      size_checked = GetFixedSize() - 4;
+    } else {
+      size_checked = GetFixedSizeWithoutPartitions() - 4;
+    }
 
-    uint32_t crc32_computed = crc32c::Value(buffer_in + 4, 24);
+    uint32_t crc32_computed = crc32c::Value(buffer_in + 4, size_checked);
     uint32_t crc32_stored; 
     GetFixed32(buffer_in, &crc32_stored);
     if (crc32_computed != crc32_stored) return Status::IOError("Invalid checksum");
@@ -394,8 +506,7 @@ struct DatabaseOptionEncoder {
     uint32_t version_data_format_major, version_data_format_minor;
     GetFixed32(buffer_in +  4, &version_data_format_major);
     GetFixed32(buffer_in +  8, &version_data_format_minor);
-    if (   version_data_format_major != kVersionDataFormatMajor
-        || version_data_format_minor != kVersionDataFormatMinor) {
+    if (!IsDataFormatVersionSupported(version_data_format_major, version_data_format_minor)) {
       return Status::IOError("Data format version not supported");
     }
 
@@ -418,21 +529,66 @@ struct DatabaseOptionEncoder {
     } else {
       return Status::IOError("Unknown compression type");
     }
+
+    output->storage__num_partitions = 1;
+    if (has_partitions) GetFixed32(buffer_in + 28, &(output->storage__num_partitions));
+    if (output->storage__num_partitions == 0) return Status::IOError("Invalid number of partitions");
+
+    if (has_directories) {
+      if (num_bytes_max < GetFixedSize() + 4) return Status::IOError("Decoding error");
+      uint32_t num_directories;
+      GetFixed32(buffer_in + GetFixedSize(), &num_directories);
+      uint64_t offset = GetFixedSize() + 4;
+      std::string data_directories;
+      for (uint32_t i = 0; i < num_directories; i++) {
+        uint32_t size_dirpath;
+        if (offset + 4 > num_bytes_max) return Status::IOError("Decoding error");
+        GetFixed32(buffer_in + offset, &size_dirpath);
+        offset += 4;
+        if (offset + size_dirpath > num_bytes_max) return Status::IOError("Decoding error");
+        if (i > 0) data_directories += ",";
+        data_directories.append(buffer_in + offset, size_dirpath);
+        offset += size_dirpath;
+      }
+      output->storage__data_directories = data_directories;
+    }
     return Status::OK();
   }
 
+  // 'buffer' must have at least GetSize(input) bytes
   static uint32_t EncodeTo(const struct DatabaseOptions *input, char* buffer) {
     EncodeFixed32(buffer +  4, kVersionDataFormatMajor);
     EncodeFixed32(buffer +  8, kVersionDataFormatMinor);
     EncodeFixed64(buffer + 12, input->storage__hstable_size);
     EncodeFixed32(buffer + 20, (uint32_t)input->hash);
     EncodeFixed32(buffer + 24, (uint32_t)input->compression.type);
-    uint32_t crc32 = crc32c::Value(buffer + 4, 24);
+    EncodeFixed32(buffer + 28, input->storage__num_partitions);
+    std::vector<std::string> dirpaths = DatabaseOptions::GetDataDirectoryList(input->storage__data_directories);
+    EncodeFixed32(buffer + GetFixedSize(), dirpaths.size());
+    uint32_t offset = GetFixedSize() + 4;
+    for (auto& dirpath: dirpaths) {
+      EncodeFixed32(buffer + offset, dirpath.size());
+      memcpy(buffer + offset + 4, dirpath.c_str(), dirpath.size());
+      offset += 4 + dirpath.size();
+    }
+    uint32_t crc32 = crc32c::Value(buffer + 4, offset - 4);
     EncodeFixed32(buffer, crc32);
-    return GetFixedSize();
+    return offset;
+  }
+
+  static uint32_t GetSize(const struct DatabaseOptions *input) {
+    uint32_t size = GetFixedSize() + 4;
+    for (auto& dirpath: DatabaseOptions::GetDataDirectoryList(input->storage__data_directories)) {
+      size += 4 + dirpath.size();
+    }
+    return size;
   }
 
   static uint32_t GetFixedSize() {
+    return 32; // in bytes
+  }
+
+  static uint32_t GetFixedSizeWithoutPartitions() {
     return 28; // in bytes
   }
 
@@ -0,0 +1,130 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_FRAME_INDEX_H_
+#define KINGDB_FRAME_INDEX_H_
+
+#include "util/debug.h"
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <list>
+#include <map>
+#include <algorithm>
+#include <inttypes.h>
+
+#include "util/memory_budget.h"
+
+namespace kdb {
+
+// A compressed value is stored as a sequence of independent LZ4 frames, one
+// per chunk. The FrameIndex of a value holds the offset of each frame in the
+// stored value, and the offset in the uncompressed value of the first byte
+// that each frame holds, so that a range of the value can be read by
+// uncompressing only the frames that overlap it.
+// Both vectors have one more item than there are frames: the last items are
+// the compressed and uncompressed sizes of the whole value.
+struct FrameIndex {
+  std::vector<uint64_t> offsets_stored;
+  std::vector<uint64_t> offsets_uncompressed;
+
+  uint64_t num_frames() const { return offsets_stored.size() - 1; }
+
+  uint64_t size_frame(uint64_t frame) const {
+    return offsets_stored[frame + 1] - offsets_stored[frame];
+  }
+
+  uint64_t size_uncompressed(uint64_t frame) const {
+    return offsets_uncompressed[frame + 1] - offsets_uncompressed[frame];
+  }
+
+  // Returns the frame holding the byte at 'offset' of the uncompressed value
+  uint64_t FindFrame(uint64_t offset) const {
+    auto it = std::upper_bound(offsets_uncompressed.begin(),
+                               offsets_uncompressed.end() - 1,
+                               offset);
+    return (it - offsets_uncompressed.begin()) - 1;
+  }
+};
+
+
+// FrameIndexCache keeps the frame indices of the entries that were recently
+// read by range, keyed by the location of the entries. Only compressed
+// entries have frame indices, and PutRange() only modifies uncompressed
+// entries in place, thus the frames of an entry never move. Since a location
+// is never reused for another entry either, an index never needs to be
+// invalidated: the least recently used indices are evicted once the cache is
+// full, or all of them at once by Clear() when the memory budget is exceeded.
+class FrameIndexCache {
+ public:
+  FrameIndexCache(uint64_t num_indices_max, MemoryBudget* memory_budget=nullptr)
+      : num_indices_max_(num_indices_max),
+        memory_budget_(memory_budget) {
+  }
+
+  ~FrameIndexCache() {
+    Clear();
+  }
+
+  std::shared_ptr<FrameIndex> Get(uint64_t location) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = indices_.find(location);
+    if (it == indices_.end()) return nullptr;
+    locations_.splice(locations_.begin(), locations_, it->second.second);
+    return it->second.first;
+  }
+
+  void Put(uint64_t location, std::shared_ptr<FrameIndex> index) {
+    if (num_indices_max_ == 0) return;
+    uint64_t size_index = SizeOf(*index);
+    if (memory_budget_ != nullptr) memory_budget_->Charge(size_index);
+    uint64_t size_evicted = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (indices_.find(location) != indices_.end()) {
+        size_evicted = size_index;
+      } else {
+        while (indices_.size() >= num_indices_max_) {
+          size_evicted += SizeOf(*indices_[locations_.back()].first);
+          indices_.erase(locations_.back());
+          locations_.pop_back();
+        }
+        locations_.push_front(location);
+        indices_[location] = std::make_pair(index, locations_.begin());
+      }
+    }
+    if (memory_budget_ != nullptr) memory_budget_->Release(size_evicted);
+  }
+
+  void Clear() {
+    uint64_t size_evicted = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (auto& p: indices_) size_evicted += SizeOf(*p.second.first);
+      indices_.clear();
+      locations_.clear();
+    }
+    if (memory_budget_ != nullptr) memory_budget_->Release(size_evicted);
+  }
+
+ private:
+  // Approximation of the memory used by an index and its nodes in the map
+  // and in the list
+  static uint64_t SizeOf(const FrameIndex& index) {
+    return sizeof(FrameIndex) + 96 + 2 * sizeof(uint64_t) * index.offsets_stored.size();
+  }
+
+  uint64_t num_indices_max_;
+  MemoryBudget* memory_budget_;
+  std::mutex mutex_;
+  // The locations are ordered from the most to the least recently used, and
+  // each index points to its location in the list
+  typedef std::list<uint64_t> LocationList;
+  std::map<uint64_t, std::pair<std::shared_ptr<FrameIndex>, LocationList::iterator>> indices_;
+  LocationList locations_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_FRAME_INDEX_H_
@@ -0,0 +1,249 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_HSTABLE_BUILDER_H_
+#define KINGDB_HSTABLE_BUILDER_H_
+
+#include "util/debug.h"
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "util/status.h"
+#include "util/slice.h"
+#include "util/options.h"
+#include "util/file.h"
+#include "algorithm/hash.h"
+#include "algorithm/crc32c.h"
+#include "algorithm/compressor.h"
+#include "storage/format.h"
+#include "storage/hstable_manager.h"
+
+namespace kdb {
+
+// Writes HSTables outside of any database, for bulk loads that would
+// otherwise push every entry through the write buffer, the flushes and the
+// compactions. The HSTables have the format of the outputs of compactions,
+// with their offset arrays and footers, and the values are compressed as
+// KingDB::Put() would compress them. Once Finish() has returned, the files
+// are added to a database with KingDB::IngestFiles().
+// The options must be those of the database that will ingest the files: the
+// hashing function, the compression, the HSTable size, the maximum chunk size
+// and the number of partitions are all baked into the files. A database with
+// several partitions gets one sequence of files per partition.
+// A builder is used by a single thread, and a bulk load is parallelized by
+// running one builder per thread, with different names. If a key is added
+// several times to the same builder, the last version wins.
+class HSTableBuilder {
+ public:
+  HSTableBuilder(const DatabaseOptions& db_options,
+                 const std::string& dirpath,
+                 const std::string& name)
+      : db_options_(db_options),
+        dirpath_(dirpath),
+        name_(name),
+        sequence_(0),
+        is_finished_(false) {
+    hash_ = MakeHash(db_options_.hash);
+    tables_.resize(std::max(db_options_.storage__num_partitions, (uint32_t)1));
+  }
+
+  ~HSTableBuilder() {
+    // Files that were not finished are of no use to anyone
+    if (!is_finished_) {
+      for (auto& table: tables_) {
+        if (table.fd < 0) continue;
+        close(table.fd);
+        std::remove(table.filepath.c_str());
+      }
+    }
+    delete hash_;
+  }
+
+  Status Put(const Slice& key, const Slice& value) {
+    return AddEntry(key, value, false);
+  }
+
+  Status Remove(const Slice& key) {
+    return AddEntry(key, Slice(), true);
+  }
+
+  // Writes the offset arrays of the files in progress. The builder cannot be
+  // used after that.
+  Status Finish() {
+    if (is_finished_) return Status::OK();
+    for (auto& table: tables_) {
+      Status s = CloseTable(table);
+      if (!s.IsOK()) return s;
+    }
+    is_finished_ = true;
+    return Status::OK();
+  }
+
+  // Paths of the files written so far, in the order they were written
+  const std::vector<std::string>& GetFilepaths() { return filepaths_; }
+
+  static const uint64_t kSizeBuffer = 1024*1024;
+
+ private:
+  struct Table {
+    Table() : fd(-1), offset(0) {}
+    int fd;
+    std::string filepath;
+    std::string buffer;
+    uint64_t offset;
+    std::vector< std::pair<uint64_t, uint32_t> > offarray;
+  };
+
+  Status AddEntry(const Slice& key, const Slice& value, bool is_remove) {
+    if (hash_ == nullptr) return Status::IOError("Unknown hashing algorithm");
+    if (is_finished_) return Status::IOError("The builder is already finished");
+    if (key.size() == 0) return Status::InvalidArgument("Empty key");
+    Table& table = tables_[HashPartition(key.data(), key.size(), tables_.size())];
+
+    // The value is compressed in chunks of at most 'maximum_chunk_size', and
+    // the chunks are concatenated, as they would be for a Put()
+    Slice value_stored = value;
+    uint64_t size_value_compressed = 0;
+    if (   !is_remove
+        && value.size() > 0
+        && db_options_.compression.type != kNoCompression) {
+      compressor_.ResetThreadLocalStorage();
+      buffer_value_.clear();
+      for (uint64_t offset = 0; offset < value.size(); offset += db_options_.storage__maximum_chunk_size) {
+        uint64_t size_chunk = std::min(value.size() - offset, db_options_.storage__maximum_chunk_size);
+        char *compressed;
+        uint64_t size_compressed;
+        Status s = compressor_.Compress(const_cast<char*>(value.data()) + offset, size_chunk, &compressed, &size_compressed);
+        if (!s.IsOK()) return s;
+        buffer_value_.append(compressed, size_compressed);
+        delete[] compressed;
+      }
+      size_value_compressed = buffer_value_.size();
+      value_stored = Slice(buffer_value_.data(), buffer_value_.size());
+    }
+
+    uint64_t hashed_key = hash_->HashFunction(key.data(), key.size());
+    struct EntryHeader entry_header;
+    if (is_remove) {
+      entry_header.SetTypeRemove();
+      entry_header.crc32 = 0;
+    } else {
+      entry_header.SetTypePut();
+    }
+    entry_header.SetEntryFull();
+    entry_header.SetHasPadding(false);
+    entry_header.size_key = key.size();
+    entry_header.size_value = value.size();
+    entry_header.size_value_compressed = size_value_compressed;
+    entry_header.hash = hashed_key;
+    char buffer_header[EntryHeader::GetMaxSize()];
+    uint32_t size_header = EntryHeader::EncodeTo(db_options_, &entry_header, buffer_header);
+    if (!is_remove) {
+      // Same checksum as for the entries written by a flush
+      uint32_t crc32_data = crc32c::Value(key.data(), key.size());
+      crc32_data = crc32c::Extend(crc32_data, value_stored.data(), value_stored.size());
+      uint32_t crc32_header = crc32c::Value(buffer_header + 4, size_header - 4);
+      entry_header.crc32 = crc32c::Combine(crc32_header, crc32_data, key.size() + value_stored.size());
+      size_header = EntryHeader::EncodeTo(db_options_, &entry_header, buffer_header);
+    }
+
+    // An entry that does not fit in an empty HSTable gets a large HSTable of
+    // its own
+    uint64_t size_entry = size_header + key.size() + value_stored.size();
+    uint64_t size_max = db_options_.storage__hstable_size - db_options_.internal__hstable_header_size;
+    if (size_entry > size_max) {
+      Table table_large;
+      Status s = OpenTable(table_large, kCompactedLargeType);
+      if (s.IsOK()) s = AppendEntry(table_large, hashed_key, buffer_header, size_header, key, value_stored);
+      if (s.IsOK()) s = CloseTable(table_large, kCompactedLargeType);
+      return s;
+    }
+
+    if (table.fd >= 0 && table.offset + size_entry > db_options_.storage__hstable_size) {
+      Status s = CloseTable(table);
+      if (!s.IsOK()) return s;
+    }
+    if (table.fd < 0) {
+      Status s = OpenTable(table, kCompactedRegularType);
+      if (!s.IsOK()) return s;
+    }
+    return AppendEntry(table, hashed_key, buffer_header, size_header, key, value_stored);
+  }
+
+  // The timestamp in the header is set when the file is ingested
+  Status OpenTable(Table& table, FileType filetype) {
+    sequence_ += 1;
+    table.filepath = dirpath_ + "/" + name_ + "_" + HSTableManager::num_to_hex(sequence_);
+    if ((table.fd = open(table.filepath.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+      return Status::IOError("Could not open file", table.filepath.c_str());
+    }
+    filepaths_.push_back(table.filepath);
+    struct HSTableHeader hstheader;
+    hstheader.filetype  = filetype;
+    hstheader.timestamp = 0;
+    table.buffer.assign(db_options_.internal__hstable_header_size, 0);
+    HSTableHeader::EncodeTo(&hstheader, &table.buffer[0]);
+    table.offset = table.buffer.size();
+    table.offarray.clear();
+    return Status::OK();
+  }
+
+  Status AppendEntry(Table& table,
+                     uint64_t hashed_key,
+                     const char *buffer_header,
+                     uint32_t size_header,
+                     const Slice& key,
+                     const Slice& value) {
+    table.offarray.push_back(std::pair<uint64_t, uint32_t>(hashed_key, table.offset));
+    table.buffer.append(buffer_header, size_header);
+    table.buffer.append(key.data(), key.size());
+    table.buffer.append(value.data(), value.size());
+    table.offset += size_header + key.size() + value.size();
+    if (table.buffer.size() >= kSizeBuffer) return WriteBuffer(table);
+    return Status::OK();
+  }
+
+  Status WriteBuffer(Table& table) {
+    if (table.buffer.empty()) return Status::OK();
+    if (write(table.fd, table.buffer.data(), table.buffer.size()) != (ssize_t)table.buffer.size()) {
+      return Status::IOError("Could not write file", strerror(errno));
+    }
+    table.buffer.clear();
+    return Status::OK();
+  }
+
+  Status CloseTable(Table& table, FileType filetype=kCompactedRegularType) {
+    if (table.fd < 0) return Status::OK();
+    // The largest varints of a hashed key and an offset are 10 and 5 bytes
+    std::string buffer_offarray(table.offarray.size() * 15 + HSTableFooter::GetFixedSize(), 0);
+    uint64_t size_offarray = HSTableManager::EncodeOffsetArray(&buffer_offarray[0], table.offset, table.offarray, filetype, false, false);
+    table.buffer.append(buffer_offarray.data(), size_offarray);
+    Status s = WriteBuffer(table);
+    close(table.fd);
+    table.fd = -1;
+    log::trace("HSTableBuilder::CloseTable()", "[%s] num_entries:%zu", table.filepath.c_str(), table.offarray.size());
+    return s;
+  }
+
+  DatabaseOptions db_options_;
+  std::string dirpath_;
+  std::string name_;
+  Hash *hash_;
+  CompressorLZ4 compressor_;
+  std::vector<Table> tables_;
+  std::vector<std::string> filepaths_;
+  std::string buffer_value_;
+  uint32_t sequence_;
+  bool is_finished_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_HSTABLE_BUILDER_H_
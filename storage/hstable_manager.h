@@ -12,6 +12,7 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <sstream>
 #include <algorithm>
 #include <cstdio>
 #include <inttypes.h>
@@ -31,12 +32,21 @@
 #include "util/byte_array.h"
 #include "algorithm/crc32c.h"
 #include "util/file.h"
+#include "util/hugepage_allocator.h"
 #include "storage/resource_manager.h"
 #include "storage/format.h"
 
 
 namespace kdb {
 
+// The index of the storage engine maps hashed keys to the locations of the
+// entries. Gets do random lookups across the whole index, thus its nodes are
+// allocated from huge pages to keep the TLB misses low.
+typedef std::multimap<uint64_t,
+                      uint64_t,
+                      std::less<uint64_t>,
+                      HugePageAllocator<std::pair<const uint64_t, uint64_t>>> IndexMap;
+
 // A HSTable (Hashed String Table) is a file consisting of entries, followed by
 // an Offset Array. The entries are a sequence of bytes in the form <key, value>,
 // and for each entry, the Offset Array has one item which is the hashed key of
@@ -46,6 +56,7 @@ namespace kdb {
 class HSTableManager {
  public:
   HSTableManager() {
+    write_orders_ = nullptr;
     is_closed_ = true;
     is_read_only_ = true;
     has_file_ = false;
@@ -64,15 +75,21 @@ class HSTableManager {
         filetype_default_(filetype_default),
         prefix_(prefix),
         prefix_compaction_(prefix_compaction),
+        prefix_tiering_("tiering_"),
         dirpath_locks_(dirpath_locks),
         wait_until_can_open_new_files_(false) {
     log::trace("HSTableManager::HSTableManager()", "dbname:%s prefix:%s", dbname.c_str(), prefix.c_str());
     dbname_ = dbname;
-    hash_ = MakeHash(db_options.hash);
+    dirpaths_ = GetDataDirectories(db_options_, dbname_);
+    dirpath_cold_ = db_options_.storage__cold_directory;
+    SelectHotPaths();
     Reset();
+    is_direct_io_ = db_options_.storage__direct_io;
     if (!is_read_only_) {
-      buffer_raw_ = new char[size_block_*2];
-      buffer_index_ = new char[size_block_*2];
+      // The buffers are aligned and have an extra block, so that they can be
+      // written with direct I/O up to the end of their last block
+      buffer_raw_ = FileUtil::allocate_aligned(size_block_*2 + FileUtil::direct_io_alignment());
+      buffer_index_ = FileUtil::allocate_aligned(size_block_*2 + FileUtil::direct_io_alignment());
     }
   }
 
@@ -83,6 +100,7 @@ class HSTableManager {
   void Reset() {
     file_resource_manager.Reset();
     sequence_fileid_ = 0;
+    fileid_synced_max_ = 0;
     sequence_timestamp_ = 0;
     size_block_ = db_options_.storage__hstable_size;
     has_file_ = false;
@@ -99,10 +117,9 @@ class HSTableManager {
     is_closed_ = true;
     FlushCurrentFile();
     CloseCurrentFile();
-    delete hash_;
     if (!is_read_only_) {
-      delete[] buffer_raw_;
-      delete[] buffer_index_;
+      free(buffer_raw_);
+      free(buffer_index_);
     }
   }
 
@@ -110,8 +127,92 @@ class HSTableManager {
     return prefix_;
   }
 
+  // The HSTables are striped round-robin over the data directories by fileid,
+  // so that the directory of a file never has to be looked up. The database
+  // directory is always the first data directory.
+  static std::vector<std::string> GetDataDirectories(const DatabaseOptions& db_options,
+                                                     const std::string& dbname) {
+    std::vector<std::string> dirpaths(1, dbname);
+    for (auto& dirpath: DatabaseOptions::GetDataDirectoryList(db_options.storage__data_directories)) {
+      dirpaths.push_back(dirpath);
+    }
+    return dirpaths;
+  }
+
+  const std::vector<std::string>& GetDirpaths() {
+    return dirpaths_;
+  }
+
+  const std::string& GetDirpath(uint32_t fileid) {
+    if (!dirpath_cold_.empty() && IsFileCold(fileid)) return dirpath_cold_;
+    return dirpaths_[fileid % dirpaths_.size()];
+  }
+
+  const std::string& GetDirpathHot(uint32_t fileid) {
+    return dirpaths_[fileid % dirpaths_.size()];
+  }
+
+  // Tiered storage: when a cold directory is set, the HSTables that are no
+  // longer accessed are moved there, and the files in the cold tier are
+  // tracked in memory. Since locations only hold fileids, moving a file only
+  // changes the directory its filepath is built with.
+  bool HasColdTier() {
+    return !dirpath_cold_.empty();
+  }
+
+  bool IsFileCold(uint32_t fileid) {
+    std::unique_lock<std::mutex> lock(mutex_cold_);
+    return (fileids_cold_.find(fileid) != fileids_cold_.end());
+  }
+
+  std::set<uint32_t> GetFileidsCold() {
+    std::unique_lock<std::mutex> lock(mutex_cold_);
+    return fileids_cold_;
+  }
+
+  void ClearFileCold(uint32_t fileid) {
+    std::unique_lock<std::mutex> lock(mutex_cold_);
+    fileids_cold_.erase(fileid);
+  }
+
+  // Copies a file to the cold directory, and serves it from there once the
+  // copy is durable. The hot copy is left for the caller to remove, once no
+  // reader can still be using a filepath built before the switch.
+  Status MoveFileToColdTier(uint32_t fileid) {
+    std::string filepath_hot = GetFilepath(fileid);
+    std::string filepath_tmp = dirpath_cold_ + "/" + prefix_tiering_ + HSTableManager::num_to_hex(fileid);
+    std::string filepath_cold = dirpath_cold_ + "/" + prefix_ + HSTableManager::num_to_hex(fileid);
+    Status s = FileUtil::copy_file(filepath_hot.c_str(), filepath_tmp.c_str());
+    if (s.IsOK() && std::rename(filepath_tmp.c_str(), filepath_cold.c_str()) != 0) {
+      s = Status::IOError("Could not rename file", strerror(errno));
+    }
+    if (s.IsOK()) s = FileUtil::sync_directory(dirpath_cold_.c_str());
+    if (!s.IsOK()) {
+      std::remove(filepath_tmp.c_str());
+      return s;
+    }
+    std::unique_lock<std::mutex> lock(mutex_cold_);
+    fileids_cold_.insert(fileid);
+    return Status::OK();
+  }
+
   std::string GetFilepath(uint32_t fileid) {
-    return dbname_ + "/" + prefix_ + HSTableManager::num_to_hex(fileid); // TODO: optimize here
+    return GetDirpath(fileid) + "/" + prefix_ + HSTableManager::num_to_hex(fileid); // TODO: optimize here
+  }
+
+  // Same as above, but builds the filepath into a buffer provided by the
+  // caller, for the read paths that need to avoid allocating memory
+  bool GetFilepath(uint32_t fileid, char *buffer, uint64_t size_buffer) {
+    int ret = snprintf(buffer, size_buffer, "%s/%s%08x", GetDirpath(fileid).c_str(), prefix_.c_str(), fileid);
+    return (ret >= 0 && (uint64_t)ret < size_buffer);
+  }
+
+  Status RemoveFilesWithPrefix(const std::string& prefix) {
+    for (auto& dirpath: dirpaths_) {
+      Status s = FileUtil::remove_files_with_prefix(dirpath.c_str(), prefix);
+      if (!s.IsOK()) return s;
+    }
+    return Status::OK();
   }
 
   std::string GetLockFilepath(uint32_t fileid) {
@@ -137,6 +238,17 @@ class HSTableManager {
     return sequence_fileid_;
   }
 
+  // Reserves 'inc' fileids after an offset that is a multiple of the number
+  // of data directories, and returns the offset: a file whose id is shifted
+  // by that offset stays in the same data directory.
+  uint32_t ReserveSequenceFileIdsAligned(uint32_t inc) {
+    std::unique_lock<std::mutex> lock(mutex_sequence_fileid_);
+    uint32_t num_dirpaths = dirpaths_.size();
+    uint32_t offset = (sequence_fileid_ + num_dirpaths - 1) / num_dirpaths * num_dirpaths;
+    sequence_fileid_ = offset + inc;
+    return offset;
+  }
+
 
   // Timestamp sequence helpers
   void SetSequenceTimestamp(uint32_t seq) {
@@ -212,7 +324,14 @@ class HSTableManager {
     filepath_ = GetFilepath(GetSequenceFileId());
     log::trace("HSTableManager::OpenNewFile()", "Opening file [%s]: %u", filepath_.c_str(), GetSequenceFileId());
     while (true) {
-      if ((fd_ = open(filepath_.c_str(), O_WRONLY|O_CREAT, 0644)) < 0) {
+      int flags = O_WRONLY|O_CREAT;
+      if (is_direct_io_) flags |= O_DIRECT;
+      if ((fd_ = open(filepath_.c_str(), flags, 0644)) < 0) {
+        if (is_direct_io_ && errno == EINVAL) {
+          log::warn("HSTableManager::OpenNewFile()", "The file system does not support O_DIRECT, falling back to regular I/O");
+          is_direct_io_ = false;
+          continue;
+        }
         log::emerg("HSTableManager::OpenNewFile()", "Could not open file [%s]: %s", filepath_.c_str(), strerror(errno));
         wait_until_can_open_new_files_ = true;
         std::this_thread::sleep_for(std::chrono::milliseconds(5000));
@@ -229,6 +348,7 @@ class HSTableManager {
     // Reserving space for header
     offset_start_ = 0;
     offset_end_ = db_options_.internal__hstable_header_size;
+    offset_cache_dropped_ = 0;
 
     // Filling in default header
     struct HSTableHeader hstheader;
@@ -237,6 +357,12 @@ class HSTableManager {
     HSTableHeader::EncodeTo(&hstheader, buffer_raw_);
   }
 
+  // Size of the buffers allocated for writing HSTables
+  uint64_t GetSizeBuffers() {
+    if (is_read_only_) return 0;
+    return 2 * (size_block_*2 + FileUtil::direct_io_alignment());
+  }
+
   bool CanOpenNewFiles() {
     return !wait_until_can_open_new_files_;
   }
@@ -263,13 +389,14 @@ class HSTableManager {
     log::trace("HSTableManager::FlushCurrentFile()", "ENTER - fileid_:%d, has_file_:%d, buffer_has_items_:%d", fileid_, has_file_, buffer_has_items_);
     if (has_file_ && buffer_has_items_) {
       log::trace("HSTableManager::FlushCurrentFile()", "has_files && buffer_has_items_ - fileid_:%d", fileid_);
-      if (write(fd_, buffer_raw_ + offset_start_, offset_end_ - offset_start_) < 0) {
+      if (!WriteBufferToFile()) {
         log::emerg("HSTableManager::FlushCurrentFile()", "Error write(): %s", strerror(errno));
         return 0;
       }
       file_resource_manager.SetFileSize(fileid_, offset_end_);
       offset_start_ = offset_end_;
       buffer_has_items_ = false;
+      DropCacheWritten();
       log::trace("HSTableManager::FlushCurrentFile()", "items written - offset_end_:%d | size_block_:%d | force_new_file:%d", offset_end_, size_block_, force_new_file);
     }
 
@@ -300,6 +427,44 @@ class HSTableManager {
   }
 
 
+  // Writes the bytes [offset_start_, offset_end_) of buffer_raw_ to the
+  // current file. With direct I/O, the write is extended to the blocks that
+  // hold these bytes. buffer_raw_ mirrors the whole file, thus the bytes of
+  // the first block that precede offset_start_ are already in the buffer, and
+  // the bytes of the last block that follow offset_end_ are zeroes, which the
+  // next flush will overwrite.
+  bool WriteBufferToFile() {
+    if (!is_direct_io_) {
+      return (write(fd_, buffer_raw_ + offset_start_, offset_end_ - offset_start_) >= 0);
+    }
+    uint64_t begin = FileUtil::align_down(offset_start_);
+    uint64_t end = FileUtil::align_up(offset_end_);
+    memset(buffer_raw_ + offset_end_, 0, end - offset_end_);
+    return (pwrite(fd_, buffer_raw_ + begin, end - begin, begin) == (ssize_t)(end - begin));
+  }
+
+  // Removes from the page cache what was written to the current file before
+  // its last 'db.storage.drop_cache_keep_size' bytes. This is done by steps
+  // of at least kSizeDropCacheMin bytes, to keep the system calls infrequent.
+  void DropCacheWritten() {
+    static const uint64_t kSizeDropCacheMin = 1024*1024;
+    if (!db_options_.storage__drop_cache_written || is_direct_io_) return;
+    uint64_t size_keep = db_options_.storage__drop_cache_keep_size;
+    if (offset_end_ < offset_cache_dropped_ + size_keep + kSizeDropCacheMin) return;
+    uint64_t offset_drop_end = FileUtil::align_down(offset_end_ - size_keep);
+    FileUtil::drop_cache(fd_, offset_cache_dropped_, offset_drop_end - offset_cache_dropped_, true);
+    offset_cache_dropped_ = offset_drop_end;
+  }
+
+  // With direct I/O, the chunks of medium entries that are written to the
+  // current file after their first chunk must also be copied to buffer_raw_,
+  // as the next flush may write the block they are in again.
+  void MirrorInBuffer(uint32_t fileid, uint64_t offset, const char *data, uint64_t size) {
+    if (!is_direct_io_ || !has_file_ || fileid != fileid_) return;
+    if (offset + size > (uint64_t)size_block_ * 2) return;
+    memcpy(buffer_raw_ + offset, data, size);
+  }
+
   Status FlushOffsetArray() {
     if (!has_file_) return Status::OK();
     uint32_t num = file_resource_manager.GetNumWritesInProgress(fileid_);
@@ -310,7 +475,12 @@ class HSTableManager {
       if (ftruncate(fd_, offset_end_) < 0) {
         return Status::IOError("HSTableManager::FlushOffsetArray()", strerror(errno));
       }
-      Status s = WriteOffsetArray(fd_, file_resource_manager.GetOffsetArray(fileid_), &size_offarray, filetype_default_, file_resource_manager.HasPaddingInValues(fileid_), false);
+      Status s;
+      if (is_direct_io_) {
+        s = WriteOffsetArrayDirect(file_resource_manager.GetOffsetArray(fileid_), &size_offarray, filetype_default_, file_resource_manager.HasPaddingInValues(fileid_));
+      } else {
+        s = WriteOffsetArray(fd_, file_resource_manager.GetOffsetArray(fileid_), &size_offarray, filetype_default_, file_resource_manager.HasPaddingInValues(fileid_), false);
+      }
       uint64_t filesize = file_resource_manager.GetFileSize(fileid_);
       file_resource_manager.SetFileSize(fileid_, filesize + size_offarray);
       return s;
@@ -325,35 +495,13 @@ class HSTableManager {
                           FileType filetype,
                           bool has_padding_in_values,
                           bool has_invalid_entries) {
-    uint64_t offset = 0;
-    struct HSTableFooterIndex hstfindex;
-    for (auto& p: offarray_current) {
-      hstfindex.hashed_key = p.first;
-      hstfindex.offset_entry = p.second;
-      uint32_t length = HSTableFooterIndex::EncodeTo(&hstfindex, buffer_index_ + offset);
-      offset += length;
-      log::trace("HSTableManager::WriteOffsetArray()", "hashed_key:[%" PRIu64 "] offset:[%08x]", p.first, p.second);
-    }
-
     int64_t position = lseek(fd, 0, SEEK_END);
     if (position < 0) {
       return Status::IOError("HSTableManager::WriteOffsetArray()", strerror(errno));
     }
     log::trace("HSTableManager::WriteOffsetArray()", "file position:[%" PRIu64 "]", position);
 
-    struct HSTableFooter footer;
-    footer.filetype = filetype;
-    footer.offset_indexes = position;
-    footer.num_entries = offarray_current.size();
-    footer.magic_number = get_magic_number();
-    if (has_padding_in_values) footer.SetFlagHasPaddingInValues();
-    if (has_invalid_entries) footer.SetFlagHasInvalidEntries();
-    uint32_t length = HSTableFooter::EncodeTo(&footer, buffer_index_ + offset);
-    offset += length;
-
-    uint32_t crc32 = crc32c::Value(buffer_index_, offset - 4);
-    EncodeFixed32(buffer_index_ + offset - 4, crc32);
-
+    uint64_t offset = EncodeOffsetArray(buffer_index_, position, offarray_current, filetype, has_padding_in_values, has_invalid_entries);
     if (write(fd, buffer_index_, offset) < 0) {
       log::trace("HSTableManager::WriteOffsetArray()", "Error write(): %s", strerror(errno));
     }
@@ -368,7 +516,64 @@ class HSTableManager {
     return Status::OK();
   }
 
+  // Same as WriteOffsetArray(), for the current file when it is opened with
+  // direct I/O: the offset array is written along with the bytes of the block
+  // it starts in, which are taken from buffer_raw_.
+  Status WriteOffsetArrayDirect(const std::vector< std::pair<uint64_t, uint32_t> >& offarray_current,
+                                uint64_t* size_out,
+                                FileType filetype,
+                                bool has_padding_in_values) {
+    uint64_t begin = FileUtil::align_down(offset_end_);
+    uint64_t size_prefix = offset_end_ - begin;
+    memcpy(buffer_index_, buffer_raw_ + begin, size_prefix);
+    uint64_t size_offarray = EncodeOffsetArray(buffer_index_ + size_prefix, offset_end_, offarray_current, filetype, has_padding_in_values, false);
+    uint64_t size_write = FileUtil::align_up(size_prefix + size_offarray);
+    memset(buffer_index_ + size_prefix + size_offarray, 0, size_write - size_prefix - size_offarray);
+    if (pwrite(fd_, buffer_index_, size_write, begin) != (ssize_t)size_write) {
+      return Status::IOError("HSTableManager::WriteOffsetArrayDirect()", strerror(errno));
+    }
+    if (ftruncate(fd_, offset_end_ + size_offarray) < 0) {
+      return Status::IOError("HSTableManager::WriteOffsetArrayDirect()", strerror(errno));
+    }
+    *size_out = size_offarray;
+    return Status::OK();
+  }
+
+  // Serializes the offset array and the footer of a file into 'buffer', for
+  // an offset array starting at 'position' in the file, and returns its size
+  static uint64_t EncodeOffsetArray(char *buffer,
+                                    uint64_t position,
+                                    const std::vector< std::pair<uint64_t, uint32_t> >& offarray_current,
+                                    FileType filetype,
+                                    bool has_padding_in_values,
+                                    bool has_invalid_entries) {
+    uint64_t offset = 0;
+    struct HSTableFooterIndex hstfindex;
+    for (auto& p: offarray_current) {
+      hstfindex.hashed_key = p.first;
+      hstfindex.offset_entry = p.second;
+      uint32_t length = HSTableFooterIndex::EncodeTo(&hstfindex, buffer + offset);
+      offset += length;
+      log::trace("HSTableManager::EncodeOffsetArray()", "hashed_key:[%" PRIu64 "] offset:[%08x]", p.first, p.second);
+    }
+
+    struct HSTableFooter footer;
+    footer.filetype = filetype;
+    footer.offset_indexes = position;
+    footer.num_entries = offarray_current.size();
+    footer.magic_number = get_magic_number();
+    if (has_padding_in_values) footer.SetFlagHasPaddingInValues();
+    if (has_invalid_entries) footer.SetFlagHasInvalidEntries();
+    uint32_t length = HSTableFooter::EncodeTo(&footer, buffer + offset);
+    offset += length;
+
+    uint32_t crc32 = crc32c::Value(buffer, offset - 4);
+    EncodeFixed32(buffer + offset - 4, crc32);
+    return offset;
+  }
+
 
+  template<bool kHasCompressedSize>
   uint64_t WriteFirstChunkLargeOrder(Order& order, uint64_t hashed_key) {
     // If a large order is self-contained, it will still be split into chunks,
     // and therefore the opearations on the first and last chunks will be done
@@ -408,7 +613,8 @@ class HSTableManager {
     entry_header.hash = hashed_key;
     entry_header.crc32 = 0;
     entry_header.SetHasPadding(false);
-    uint32_t size_header = EntryHeader::EncodeTo(db_options_, &entry_header, buffer);
+    entry_header.SetVersion(order.version);
+    uint32_t size_header = EntryHeader::EncodeTo<kHasCompressedSize>(&entry_header, buffer);
     key_to_headersize[order.tid][order.key->ToString()] = size_header;
     if (write(fd, buffer, size_header) < 0) {
       log::emerg("HSTableManager::FlushLargeOrder()", "Error write(): %s", strerror(errno));
@@ -443,6 +649,7 @@ class HSTableManager {
   }
 
 
+  template<bool kHasCompressedSize>
   uint64_t WriteMiddleOrLastChunk(Order& order, uint64_t hashed_key, uint64_t location) {
     uint32_t fileid = (location & 0xFFFFFFFF00000000) >> 32;
     uint32_t offset_file = location & 0x00000000FFFFFFFF;
@@ -475,6 +682,7 @@ class HSTableManager {
                offset_file + size_header + order.key->size() + order.offset_chunk) < 0) {
       log::trace("HSTableManager::WriteMiddleOrLastChunk()", "Error pwrite(): %s", strerror(errno));
     }
+    MirrorInBuffer(fileid, offset_file + size_header + order.key->size() + order.offset_chunk, order.chunk->data(), order.chunk->size());
 
     // If this is a last chunk, the header is written again to save the right size of compressed value,
     // and the crc32 is saved too
@@ -494,16 +702,19 @@ class HSTableManager {
         file_resource_manager.SetHasPaddingInValues(fileid_, true);
       }
       entry_header.hash = hashed_key;
+      // The entry takes the version of its last chunk, which keeps the size
+      // of the header unchanged, as all chunks have a version
+      entry_header.SetVersion(order.version);
 
       // Compute the header a first time to get the data serialized
       char buffer[sizeof(struct EntryHeader)*2];
-      uint32_t size_header_new = EntryHeader::EncodeTo(db_options_, &entry_header, buffer);
+      uint32_t size_header_new = EntryHeader::EncodeTo<kHasCompressedSize>(&entry_header, buffer);
 
       // Compute the checksum for the header and combine it with the one for the
       // key and value, then recompute the header to save the checksum
       uint32_t crc32_header = crc32c::Value(buffer + 4, size_header_new - 4);
       entry_header.crc32 = crc32c::Combine(crc32_header, order.crc32, entry_header.size_key + entry_header.size_value_used());
-      size_header_new = EntryHeader::EncodeTo(db_options_, &entry_header, buffer);
+      size_header_new = EntryHeader::EncodeTo<kHasCompressedSize>(&entry_header, buffer);
       if (size_header_new != size_header) {
         log::emerg("HSTableManager::WriteMiddleOrLastChunk()", "Error of encoding: the initial header had a size of %u, and it is now %u. The entry is now corrupted.", size_header, size_header_new);
         return 0;
@@ -513,6 +724,7 @@ class HSTableManager {
         log::emerg("HSTableManager::WriteMiddleOrLastChunk()", "Error pwrite(): %s", strerror(errno));
         return 0;
       }
+      MirrorInBuffer(fileid, offset_file, buffer, size_header);
  
       if (order.IsLarge() && entry_header.IsCompressed()) {
         uint64_t filesize = db_options_.internal__hstable_header_size + size_header + order.key->size() + order.size_value_compressed;
@@ -540,6 +752,12 @@ class HSTableManager {
         if (order.IsLarge()) file_resource_manager.SetFileLarge(fileid);
         file_resource_manager.ClearTemporaryDataForFileId(fileid);
       }
+
+      // Large entries are rarely read right after they are written, thus
+      // their files are removed from the page cache entirely
+      if (order.IsLarge() && db_options_.storage__drop_cache_written) {
+        FileUtil::drop_cache(fd, 0, 0, true);
+      }
     }
 
     close(fd);
@@ -548,6 +766,7 @@ class HSTableManager {
   }
 
 
+  template<bool kHasCompressedSize>
   uint64_t WriteFirstChunkOrSmallOrder(Order& order, uint64_t hashed_key) {
     uint64_t location_out = 0;
     struct EntryHeader entry_header;
@@ -559,6 +778,8 @@ class HSTableManager {
       entry_header.size_value_compressed = order.size_value_compressed;
       entry_header.hash = hashed_key;
       entry_header.crc32 = order.crc32;
+      entry_header.SetVersion(order.version);
+      if (order.IsInBatch()) entry_header.SetInBatch(order.IsBatchLast());
       if (order.IsSelfContained()) {
         entry_header.SetHasPadding(false);
       } else {
@@ -566,14 +787,14 @@ class HSTableManager {
         file_resource_manager.SetHasPaddingInValues(fileid_, true);
         // TODO: check that the has_padding_in_values field in fields is used during compaction
       }
-      uint32_t size_header = EntryHeader::EncodeTo(db_options_, &entry_header, buffer_raw_ + offset_end_);
+      uint32_t size_header = EntryHeader::EncodeTo<kHasCompressedSize>(&entry_header, buffer_raw_ + offset_end_);
 
       if (order.IsSelfContained()) {
         // Compute the checksum for the header and combine it with the one for the
         // key and value, then recompute the header to save the checksum
         uint32_t crc32_header = crc32c::Value(buffer_raw_ + offset_end_ + 4, size_header - 4);
         entry_header.crc32 = crc32c::Combine(crc32_header, order.crc32, entry_header.size_key + entry_header.size_value_used());
-        size_header = EntryHeader::EncodeTo(db_options_, &entry_header, buffer_raw_ + offset_end_);
+        size_header = EntryHeader::EncodeTo<kHasCompressedSize>(&entry_header, buffer_raw_ + offset_end_);
         log::trace("HSTableManager::WriteFirstChunkOrSmallOrder()", "IsSelfContained():true - crc32 [0x%08x]", entry_header.crc32);
       }
 
@@ -614,8 +835,16 @@ class HSTableManager {
       entry_header.size_value = 0;
       entry_header.size_value_compressed = 0;
       entry_header.crc32 = 0;
-      uint32_t size_header = EntryHeader::EncodeTo(db_options_, &entry_header, buffer_raw_ + offset_end_);
+      entry_header.SetVersion(order.version);
+      if (order.IsInBatch()) entry_header.SetInBatch(order.IsBatchLast());
+      uint32_t size_header = EntryHeader::EncodeTo<kHasCompressedSize>(&entry_header, buffer_raw_ + offset_end_);
       memcpy(buffer_raw_ + offset_end_ + size_header, order.key->data(), order.key->size());
+      if (order.IsInBatch()) {
+        // The checksums of the entries in a batch are verified during
+        // recovery, thus the removes in a batch need one as well
+        entry_header.crc32 = crc32c::Value(buffer_raw_ + offset_end_ + 4, size_header - 4 + order.key->size());
+        EntryHeader::EncodeTo<kHasCompressedSize>(&entry_header, buffer_raw_ + offset_end_);
+      }
 
       uint64_t fileid_shifted = fileid_;
       fileid_shifted <<= 32;
@@ -626,7 +855,31 @@ class HSTableManager {
     return location_out;
   }
 
-  void WriteOrdersAndFlushFile(std::vector<Order>& orders, std::multimap<uint64_t, uint64_t>& map_index_out) {
+  Status WriteOrdersAndFlushFile(std::vector<Order>& orders, std::multimap<uint64_t, uint64_t>& map_index_out) {
+    return (this->*write_orders_)(orders, map_index_out);
+  }
+
+  // The hashing function and the compression type are fixed for the lifetime
+  // of a database, thus the flushing path is specialized on them once in the
+  // constructor, and the per-order hashing and header encoding are inlined.
+  void SelectHotPaths() {
+    bool c = (db_options_.compression.type != kNoCompression);
+    if (db_options_.hash == kMurmurHash3_64) {
+      write_orders_ = c ? &HSTableManager::WriteOrdersAndFlushFileT<MurmurHash3, true>
+                        : &HSTableManager::WriteOrdersAndFlushFileT<MurmurHash3, false>;
+    } else if (db_options_.hash == kxxHash_64) {
+      write_orders_ = c ? &HSTableManager::WriteOrdersAndFlushFileT<xxHash, true>
+                        : &HSTableManager::WriteOrdersAndFlushFileT<xxHash, false>;
+    } else {
+      log::emerg("HSTableManager", "Unknown hashing function: [%d]", db_options_.hash);
+      exit(-1);
+    }
+  }
+
+  template<class HashT, bool kHasCompressedSize>
+  Status WriteOrdersAndFlushFileT(std::vector<Order>& orders, std::multimap<uint64_t, uint64_t>& map_index_out) {
+    bool is_sync = false;
+    std::set<uint32_t> fileids_written;
     for (auto& order: orders) {
 
       if (offset_end_ > size_block_) {
@@ -634,9 +887,24 @@ class HSTableManager {
         FlushCurrentFile(true, 0);
       }
 
+      // The orders of a WriteBatch are written contiguously in the same
+      // HSTable, so that the recovery process can apply all of them or none.
+      // The WriteBatch is never larger than a HSTable, thus if it does not
+      // fit in the current file, it will fit in a new one.
+      if (   has_file_
+          && order.IsInBatch()
+          && (&order == &orders.front() || !(&order)[-1].IsInBatch() || (&order)[-1].IsBatchLast())) {
+        uint64_t size_batch = 0;
+        for (uint32_t i = 0; i < order.num_batch_remaining; i++) {
+          Order& order_batch = (&order)[i];
+          size_batch += EntryHeader::GetMaxSize() + order_batch.key->size() + order_batch.chunk->size();
+        }
+        if (offset_end_ + size_batch > (uint64_t)size_block_) FlushCurrentFile(true, 0);
+      }
+
       if (!has_file_) OpenNewFile();
 
-      uint64_t hashed_key = hash_->HashFunction(order.key->data(), order.key->size());
+      uint64_t hashed_key = HashT::Compute(order.key->data(), order.key->size());
       // TODO-13: if the item is self-contained (unique chunk), then no need to
       //       have size_value space, size_value_compressed is enough.
 
@@ -692,7 +960,7 @@ class HSTableManager {
         // TODO-11: shouldn't this be testing size_value_compressed as well? -- yes, only if the order
         // is a full entry by itself (will happen when the kvstore will be embedded and not accessed
         // through the network), otherwise we don't know yet what the total compressed size will be.
-        location = WriteFirstChunkLargeOrder(order, hashed_key);
+        location = WriteFirstChunkLargeOrder<kHasCompressedSize>(order, hashed_key);
 
       // 2. The order is a middle or last chunk, so we open the HSTable,
       //    pwrite() the chunk, and close the HSTable
@@ -705,7 +973,7 @@ class HSTableManager {
           location = key_to_location[order.tid][order.key->ToString()];
         }
         if (location != 0) {
-          WriteMiddleOrLastChunk(order, hashed_key, location);
+          WriteMiddleOrLastChunk<kHasCompressedSize>(order, hashed_key, location);
         } else {
           log::emerg("HSTableManager", "Avoided catastrophic location error (in case 2) key:[%s] tid:[0x%08" PRIx64 "]", order.key->ToString().c_str(), order.tid); 
           for (auto& p: key_to_location[order.tid]) {
@@ -718,9 +986,12 @@ class HSTableManager {
       //    is written to the latest on-going HSTable
       } else {
         buffer_has_items_ = true;
-        location = WriteFirstChunkOrSmallOrder(order, hashed_key);
+        location = WriteFirstChunkOrSmallOrder<kHasCompressedSize>(order, hashed_key);
       }
 
+      if (order.IsSync()) is_sync = true;
+      if (location != 0) fileids_written.insert(location >> 32);
+
       // Traces
       int caseid = 0;
       if (order.IsLarge() && order.IsFirstChunk()) { caseid = 1; }
@@ -759,11 +1030,50 @@ class HSTableManager {
     }
     log::trace("HSTableManager::WriteOrdersAndFlushFile()", "end flush");
     FlushCurrentFile(0, 0);
+    if (!is_sync) return Status::OK();
+    return SyncFiles(fileids_written);
+  }
+
+  // Makes the data written to the files in 'fileids' durable. All the orders
+  // of a flush are synced together, so that a single fdatasync() per file is
+  // shared by all the writers that asked for a synchronous write. The
+  // directory is synced as well if any of the files was created since the
+  // last sync, as otherwise the files themselves could be lost in a crash.
+  Status SyncFiles(const std::set<uint32_t>& fileids) {
+    bool has_new_files = false;
+    for (auto fileid: fileids) {
+      if (fileid > fileid_synced_max_) has_new_files = true;
+      int ret;
+      if (has_file_ && fileid == fileid_) {
+        ret = fdatasync(fd_);
+      } else {
+        int fd;
+        if ((fd = open(GetFilepath(fileid).c_str(), O_RDONLY)) < 0) {
+          return Status::IOError("HSTableManager::SyncFiles() - open()", strerror(errno));
+        }
+        ret = fdatasync(fd);
+        close(fd);
+      }
+      if (ret != 0) {
+        return Status::IOError("HSTableManager::SyncFiles() - fdatasync()", strerror(errno));
+      }
+    }
+    if (has_new_files) {
+      std::set<std::string> dirpaths_new;
+      for (auto fileid: fileids) {
+        if (fileid > fileid_synced_max_) dirpaths_new.insert(GetDirpath(fileid));
+      }
+      for (auto& dirpath: dirpaths_new) {
+        Status s = FileUtil::sync_directory(dirpath.c_str());
+        if (!s.IsOK()) return s;
+      }
+      fileid_synced_max_ = std::max(fileid_synced_max_, *fileids.rbegin());
+    }
+    return Status::OK();
   }
 
 
-  Status LoadDatabase(std::string& dbname,
-                      std::multimap<uint64_t, uint64_t>& index_se,
+  Status LoadDatabase(IndexMap& index_se,
                       std::set<uint32_t>* fileids_ignore=nullptr,
                       uint32_t fileid_end=0,
                       std::vector<uint32_t>* fileids_iterator=nullptr) {
@@ -782,9 +1092,25 @@ class HSTableManager {
       }
       */
 
-      s = FileUtil::remove_files_with_prefix(dbname_.c_str(), prefix_compaction_);
+      for (size_t i = 1; i < dirpaths_.size(); i++) {
+        if (   stat(dirpaths_[i].c_str(), &info) != 0
+            && mkdir(dirpaths_[i].c_str(), 0755) < 0) {
+          return Status::IOError("Could not create data directory", dirpaths_[i].c_str());
+        }
+      }
+
+      s = RemoveFilesWithPrefix(prefix_compaction_);
       if (!s.IsOK()) return Status::IOError("Could not clean up previous compaction");
 
+      if (HasColdTier()) {
+        if (   stat(dirpath_cold_.c_str(), &info) != 0
+            && mkdir(dirpath_cold_.c_str(), 0755) < 0) {
+          return Status::IOError("Could not create cold directory", dirpath_cold_.c_str());
+        }
+        s = FileUtil::remove_files_with_prefix(dirpath_cold_.c_str(), prefix_tiering_);
+        if (!s.IsOK()) return Status::IOError("Could not clean up previous moves to the cold directory");
+      }
+
       s = RemoveAllLockedFiles(dbname_);
       if (!s.IsOK()) return Status::IOError("Could not clean up snapshots");
 
@@ -792,12 +1118,6 @@ class HSTableManager {
       if (!s.IsOK()) return Status::IOError("Could not clean up locks");
     }
 
-    DIR *directory;
-    struct dirent *entry;
-    if ((directory = opendir(dbname.c_str())) == NULL) {
-      return Status::IOError("Could not open database directory", dbname.c_str());
-    }
-
     // Sort the fileids by <timestamp, fileid>, so that puts and removes can be
     // applied in the right order.
     // Indeed, imagine that we have files with ids from 1 to 100, and a
@@ -821,53 +1141,84 @@ class HSTableManager {
     uint32_t fileid_max = 0;
     uint64_t timestamp_max = 0;
     uint32_t fileid = 0;
-    while ((entry = readdir(directory)) != NULL) {
-      if (strcmp(entry->d_name, DatabaseOptions::GetFilename().c_str()) == 0) continue;
-      if (strcmp(entry->d_name, prefix_compaction_.c_str()) == 0) continue;
-      int ret = snprintf(filepath, FileUtil::maximum_path_size(), "%s/%s", dbname.c_str(), entry->d_name);
-      if (ret < 0 || ret >= FileUtil::maximum_path_size()) {
-        log::emerg("HsTableManager::LoadDatabase()",
-                  "Filepath buffer is too small, could not build the filepath string for file [%s]", entry->d_name); 
-        continue;
+    // The cold directory is scanned first: a file that was being moved when
+    // the database was closed is in both tiers, and the cold copy is the one
+    // kept, as it is only used once it is complete.
+    std::vector<std::string> dirpaths_scan;
+    if (HasColdTier()) dirpaths_scan.push_back(dirpath_cold_);
+    dirpaths_scan.insert(dirpaths_scan.end(), dirpaths_.begin(), dirpaths_.end());
+    for (size_t i = 0; i < dirpaths_scan.size(); i++) {
+      const std::string& dirpath = dirpaths_scan[i];
+      bool is_cold = (HasColdTier() && i == 0);
+      DIR *directory;
+      struct dirent *entry;
+      if ((directory = opendir(dirpath.c_str())) == NULL) {
+        return Status::IOError("Could not open data directory", dirpath.c_str());
       }
-      if (stat(filepath, &info) != 0 || !(info.st_mode & S_IFREG)) continue;
-      fileid = HSTableManager::hex_to_num(entry->d_name);
-      if (   fileids_ignore != nullptr
-          && fileids_ignore->find(fileid) != fileids_ignore->end()) {
-        log::trace("HSTableManager::LoadDatabase()",
-                  "Skipping file in fileids_ignore:: [%s] [%lld] [%u]\n",
-                  entry->d_name, info.st_size, fileid);
-        continue;
-      }
-      if (fileid_end != 0 && fileid > fileid_end) {
-        log::trace("HSTableManager::LoadDatabase()",
-                  "Skipping file with id larger than fileid_end (%u): [%s] [%lld] [%u]\n",
-                  fileid, entry->d_name, info.st_size, fileid);
-        continue;
-      }
-      log::trace("HSTableManager::LoadDatabase()",
-                "file: [%s] [%lld] [%u]\n", entry->d_name, info.st_size, fileid);
-      if (info.st_size <= db_options_.internal__hstable_header_size) {
+      while ((entry = readdir(directory)) != NULL) {
+        if (strcmp(entry->d_name, DatabaseOptions::GetFilename().c_str()) == 0) continue;
+        if (strcmp(entry->d_name, prefix_compaction_.c_str()) == 0) continue;
+        if (is_cold && strncmp(entry->d_name, prefix_tiering_.c_str(), prefix_tiering_.size()) == 0) continue;
+        int ret = snprintf(filepath, FileUtil::maximum_path_size(), "%s/%s", dirpath.c_str(), entry->d_name);
+        if (ret < 0 || ret >= FileUtil::maximum_path_size()) {
+          log::emerg("HsTableManager::LoadDatabase()",
+                    "Filepath buffer is too small, could not build the filepath string for file [%s]", entry->d_name); 
+          continue;
+        }
+        if (stat(filepath, &info) != 0 || !(info.st_mode & S_IFREG)) continue;
+        fileid = HSTableManager::hex_to_num(entry->d_name);
+        if (!is_cold && HasColdTier() && IsFileCold(fileid)) {
+          log::trace("HSTableManager::LoadDatabase()",
+                    "file: [%s] is already in the cold directory, skipping\n", entry->d_name);
+          if (!is_read_only_) std::remove(filepath);
+          continue;
+        }
+        if (   fileids_ignore != nullptr
+            && fileids_ignore->find(fileid) != fileids_ignore->end()) {
+          log::trace("HSTableManager::LoadDatabase()",
+                    "Skipping file in fileids_ignore:: [%s] [%lld] [%u]\n",
+                    entry->d_name, info.st_size, fileid);
+          continue;
+        }
+        if (fileid_end != 0 && fileid > fileid_end) {
+          log::trace("HSTableManager::LoadDatabase()",
+                    "Skipping file with id larger than fileid_end (%u): [%s] [%lld] [%u]\n",
+                    fileid, entry->d_name, info.st_size, fileid);
+          continue;
+        }
         log::trace("HSTableManager::LoadDatabase()",
-                  "file: [%s] only has a header or less, skipping\n", entry->d_name);
-        continue;
-      }
+                  "file: [%s] [%lld] [%u]\n", entry->d_name, info.st_size, fileid);
+        if (info.st_size <= db_options_.internal__hstable_header_size) {
+          log::trace("HSTableManager::LoadDatabase()",
+                    "file: [%s] only has a header or less, skipping\n", entry->d_name);
+          continue;
+        }
 
-      Mmap mmap(filepath, info.st_size);
-      if (!mmap.is_valid()) return Status::IOError("Mmap constructor failed");
-      struct HSTableHeader hstheader;
-      Status s = HSTableHeader::DecodeFrom(mmap.datafile(), mmap.filesize(), &hstheader);
-      if (!s.IsOK()) {
-        log::trace("HSTableManager::LoadDatabase()",
-                  "file: [%s] has an invalid header, skipping\n", entry->d_name);
-        continue;
-      }
+        Mmap mmap(filepath, info.st_size);
+        if (!mmap.is_valid()) return Status::IOError("Mmap constructor failed");
+        struct HSTableHeader hstheader;
+        Status s = HSTableHeader::DecodeFrom(mmap.datafile(), mmap.filesize(), &hstheader);
+        if (!s.IsOK()) {
+          log::trace("HSTableManager::LoadDatabase()",
+                    "file: [%s] has an invalid header, skipping\n", entry->d_name);
+          continue;
+        }
 
-      sprintf(buffer_key, "%016" PRIx64 "-%016x", hstheader.timestamp, fileid);
-      std::string key(buffer_key);
-      timestamp_fileid_to_fileid[key] = fileid;
-      fileid_max = std::max(fileid_max, fileid);
-      timestamp_max = std::max(timestamp_max, hstheader.timestamp);
+        if (is_cold) {
+          std::unique_lock<std::mutex> lock(mutex_cold_);
+          fileids_cold_.insert(fileid);
+        } else if (GetDirpathHot(fileid) != dirpath) {
+          closedir(directory);
+          return Status::IOError("HSTable found in the wrong data directory: the data directories cannot be changed once the database is created", filepath);
+        }
+
+        sprintf(buffer_key, "%016" PRIx64 "-%016x", hstheader.timestamp, fileid);
+        std::string key(buffer_key);
+        timestamp_fileid_to_fileid[key] = fileid;
+        fileid_max = std::max(fileid_max, fileid);
+        timestamp_max = std::max(timestamp_max, hstheader.timestamp);
+      }
+      closedir(directory);
     }
 
     for (auto& p: timestamp_fileid_to_fileid) {
@@ -901,13 +1252,12 @@ class HSTableManager {
       SetSequenceFileId(fileid_max);
       SetSequenceTimestamp(timestamp_max);
     }
-    closedir(directory);
     return Status::OK();
   }
 
   static Status LoadFile(Mmap& mmap,
                   uint32_t fileid,
-                  std::multimap<uint64_t, uint64_t>& index_se,
+                  IndexMap& index_se,
                   uint64_t *filesize_out=nullptr,
                   bool *is_file_large_out=nullptr,
                   bool *is_file_compacted_out=nullptr) {
@@ -959,9 +1309,11 @@ class HSTableManager {
 
   Status RecoverFile(Mmap& mmap,
                      uint32_t fileid,
-                     std::multimap<uint64_t, uint64_t>& index_se) {
+                     IndexMap& index_se) {
     uint32_t offset = db_options_.internal__hstable_header_size;
     std::vector< std::pair<uint64_t, uint32_t> > offarray_current;
+    std::vector< std::pair<uint64_t, uint32_t> > offarray_batch;
+    uint32_t offset_batch = 0;
     bool has_padding_in_values = false;
     bool has_invalid_entries   = false;
 
@@ -993,12 +1345,32 @@ class HSTableManager {
       // for the entries with invalid checksums.
       const bool do_crc32_verification = false; // this boolean is here just to toggle the verification
       bool is_crc32_valid = true;
-      if (do_crc32_verification) {
+      if (do_crc32_verification || entry_header.IsInBatch()) {
         crc32_.ResetThreadLocalStorage();
         crc32_.stream(mmap.datafile() + offset + 4, size_header + entry_header.size_key + entry_header.size_value_used() - 4);
         is_crc32_valid = (entry_header.crc32 == crc32_.get());
       }
-      if (!do_crc32_verification || is_crc32_valid) {
+
+      // The entries of a WriteBatch are held back until the last entry of the
+      // batch is found. An invalid entry in a batch can only be the result of
+      // a write that was interrupted, and is therefore treated as the end of
+      // the file: the batch is dropped along with everything after it.
+      if (entry_header.IsInBatch()) {
+        if (!is_crc32_valid) break;
+        if (offarray_batch.empty()) offset_batch = offset;
+        offarray_batch.push_back(std::pair<uint64_t, uint32_t>(entry_header.hash, offset));
+        if (entry_header.IsBatchLast()) {
+          uint64_t fileid_shifted = fileid;
+          fileid_shifted <<= 32;
+          for (auto& p: offarray_batch) {
+            offarray_current.push_back(p);
+            index_se.insert(std::pair<uint64_t, uint64_t>(p.first, fileid_shifted | p.second));
+          }
+          offarray_batch.clear();
+        }
+      } else if (!offarray_batch.empty()) {
+        break;
+      } else if (!do_crc32_verification || is_crc32_valid) {
         // Valid content, add to index
         offarray_current.push_back(std::pair<uint64_t, uint32_t>(entry_header.hash, offset));
         uint64_t fileid_shifted = fileid;
@@ -1015,6 +1387,11 @@ class HSTableManager {
                 entry_header.hash, offset, do_crc32_verification ? (is_crc32_valid?"OK":"ERROR") : "UNKNOWN", entry_header.crc32, crc32_.get());
     }
 
+    if (!offarray_batch.empty()) {
+      log::warn("HSTableManager::RecoverFile", "Dropping incomplete batch of %zu entries in file [%s]", offarray_batch.size(), mmap.filepath());
+      offset = offset_batch;
+    }
+
     // 3. Write a new index at the end of the file with whatever entries could be save
     if (offset > db_options_.internal__hstable_header_size) {
       mmap.Close();
@@ -1028,7 +1405,7 @@ class HSTableManager {
       }
       uint64_t size_offarray;
       WriteOffsetArray(fd, offarray_current, &size_offarray, hstheader.GetFileType(), has_padding_in_values, has_invalid_entries);
-      file_resource_manager.SetFileSize(fileid, mmap.filesize() + size_offarray);
+      file_resource_manager.SetFileSize(fileid, offset + size_offarray);
       close(fd);
     } else {
       return Status::IOError("Could not recover file");
@@ -1055,8 +1432,11 @@ class HSTableManager {
 
     closedir(directory);
 
+    // The data files are not loaded yet, thus a file may be in either tier
     for (auto& fileid: fileids) {
-      if (std::remove(GetFilepath(fileid).c_str()) != 0) {
+      std::string filepath_cold = dirpath_cold_ + "/" + prefix_ + HSTableManager::num_to_hex(fileid);
+      if (   std::remove(GetFilepath(fileid).c_str()) != 0
+          && (!HasColdTier() || std::remove(filepath_cold.c_str()) != 0)) {
         log::emerg("RemoveAllLockedFiles()", "Could not remove data file [%s]", GetFilepath(fileid).c_str());
       }
     }
@@ -1070,13 +1450,14 @@ class HSTableManager {
  private:
   // Options
   DatabaseOptions db_options_;
-  Hash *hash_;
+  Status (HSTableManager::*write_orders_)(std::vector<Order>&, std::multimap<uint64_t, uint64_t>&);
   bool is_read_only_;
   bool is_closed_;
   FileType filetype_default_;
   std::mutex mutex_close_;
 
   uint32_t fileid_;
+  uint32_t fileid_synced_max_;
   uint32_t sequence_fileid_;
   std::mutex mutex_sequence_fileid_;
 
@@ -1087,17 +1468,24 @@ class HSTableManager {
 
   int size_block_;
   bool has_file_;
+  bool is_direct_io_;
   int fd_;
   std::string filepath_;
   uint64_t offset_start_;
   uint64_t offset_end_;
+  uint64_t offset_cache_dropped_;
   std::string dbname_;
+  std::vector<std::string> dirpaths_;
+  std::string dirpath_cold_;
+  std::set<uint32_t> fileids_cold_;
+  std::mutex mutex_cold_;
   char *buffer_raw_;
   char *buffer_index_;
   bool buffer_has_items_;
   kdb::CRC32 crc32_;
   std::string prefix_;
   std::string prefix_compaction_;
+  std::string prefix_tiering_;
   std::string dirpath_locks_;
   bool wait_until_can_open_new_files_;
 
@@ -0,0 +1,147 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_RANGE_INTENT_H_
+#define KINGDB_RANGE_INTENT_H_
+
+#include "util/debug.h"
+#include <string>
+#include <vector>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#include "util/status.h"
+#include "util/file.h"
+#include "algorithm/coding.h"
+#include "algorithm/crc32c.h"
+
+namespace kdb {
+
+// A RangeIntent describes an in-place overwrite of a range of bytes inside an
+// entry of a large HSTable, along with the new checksum and the new version
+// of that entry.
+//
+// In-place writes are made crash-safe by writing the intent to its own file
+// and syncing it before the HSTable is modified. If a crash occurs while the
+// HSTable is being modified, the intent file is found when the database is
+// opened, and applied again: applying an intent only writes bytes at fixed
+// offsets, thus it can be repeated any number of times. An intent file that
+// was not entirely written has an invalid checksum, which means that the
+// HSTable was never modified, and the intent is simply discarded.
+//
+// Format of an intent file:
+//   [fileid:fixed32][offset_crc32:fixed64][crc32:fixed32]
+//   [offset_version:fixed64][version:fixed64]
+//   [offset_data:fixed64][size_data:fixed64][data:size_data bytes]
+//   [checksum:fixed32]
+// The checksum is the crc32c of all the bytes that precede it.
+struct RangeIntent {
+  uint32_t fileid;
+  uint64_t offset_crc32;  // offset in the HSTable of the crc32 of the entry
+  uint32_t crc32;         // new crc32 of the entry
+  uint64_t offset_version;// offset in the HSTable of the version of the entry
+  uint64_t version;       // new version of the entry
+  uint64_t offset_data;   // offset in the HSTable of the range to overwrite
+  std::string data;
+
+  static const uint64_t kSizeHeader = 4 + 8 + 4 + 8 + 8 + 8 + 8;
+
+  // Writes the intent to 'filepath', and makes it durable
+  Status WriteTo(const std::string& filepath, const std::string& dirpath) const {
+    std::string buffer;
+    buffer.reserve(kSizeHeader + data.size() + 4);
+    PutFixed32(&buffer, fileid);
+    PutFixed64(&buffer, offset_crc32);
+    PutFixed32(&buffer, crc32);
+    PutFixed64(&buffer, offset_version);
+    PutFixed64(&buffer, version);
+    PutFixed64(&buffer, offset_data);
+    PutFixed64(&buffer, data.size());
+    buffer.append(data);
+    PutFixed32(&buffer, crc32c::Value(buffer.data(), buffer.size()));
+
+    int fd;
+    if ((fd = open(filepath.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+      return Status::IOError("RangeIntent::WriteTo() - open()", strerror(errno));
+    }
+    Status s;
+    if (write(fd, buffer.data(), buffer.size()) != (ssize_t)buffer.size()) {
+      s = Status::IOError("RangeIntent::WriteTo() - write()", strerror(errno));
+    } else if (fdatasync(fd) != 0) {
+      s = Status::IOError("RangeIntent::WriteTo() - fdatasync()", strerror(errno));
+    }
+    close(fd);
+    if (!s.IsOK()) return s;
+    return FileUtil::sync_directory(dirpath.c_str());
+  }
+
+  // Returns NotFound if there is no intent at 'filepath', and IOError if the
+  // intent was not entirely written.
+  static Status ReadFrom(const std::string& filepath, RangeIntent* intent) {
+    int fd;
+    if ((fd = open(filepath.c_str(), O_RDONLY)) < 0) {
+      if (errno == ENOENT) return Status::NotFound("No intent");
+      return Status::IOError("RangeIntent::ReadFrom() - open()", strerror(errno));
+    }
+    std::vector<char> buffer;
+    char chunk[4096];
+    ssize_t ret;
+    while ((ret = read(fd, chunk, sizeof(chunk))) > 0) {
+      buffer.insert(buffer.end(), chunk, chunk + ret);
+    }
+    close(fd);
+    if (ret < 0) return Status::IOError("RangeIntent::ReadFrom() - read()", strerror(errno));
+
+    if (buffer.size() < kSizeHeader + 4) return Status::IOError("Intent is truncated");
+    const char *ptr = buffer.data();
+    uint64_t size_data;
+    GetFixed32(ptr,      &intent->fileid);
+    GetFixed64(ptr + 4,  &intent->offset_crc32);
+    GetFixed32(ptr + 12, &intent->crc32);
+    GetFixed64(ptr + 16, &intent->offset_version);
+    GetFixed64(ptr + 24, &intent->version);
+    GetFixed64(ptr + 32, &intent->offset_data);
+    GetFixed64(ptr + 40, &size_data);
+    if (buffer.size() != kSizeHeader + size_data + 4) return Status::IOError("Intent is truncated");
+    uint32_t checksum;
+    GetFixed32(ptr + kSizeHeader + size_data, &checksum);
+    if (checksum != crc32c::Value(ptr, kSizeHeader + size_data)) {
+      return Status::IOError("Intent has an invalid checksum");
+    }
+    intent->data.assign(ptr + kSizeHeader, size_data);
+    return Status::OK();
+  }
+
+  // Overwrites the range, the version and the checksum of the entry in the
+  // HSTable at 'filepath', and makes the changes durable.
+  Status ApplyTo(const std::string& filepath) const {
+    int fd;
+    if ((fd = open(filepath.c_str(), O_WRONLY)) < 0) {
+      return Status::IOError("RangeIntent::ApplyTo() - open()", strerror(errno));
+    }
+    char buffer_crc32[4];
+    char buffer_version[8];
+    EncodeFixed32(buffer_crc32, crc32);
+    EncodeFixed64(buffer_version, version);
+    Status s;
+    if (pwrite(fd, data.data(), data.size(), offset_data) != (ssize_t)data.size()) {
+      s = Status::IOError("RangeIntent::ApplyTo() - pwrite()", strerror(errno));
+    } else if (pwrite(fd, buffer_version, 8, offset_version) != 8) {
+      s = Status::IOError("RangeIntent::ApplyTo() - pwrite()", strerror(errno));
+    } else if (pwrite(fd, buffer_crc32, 4, offset_crc32) != 4) {
+      s = Status::IOError("RangeIntent::ApplyTo() - pwrite()", strerror(errno));
+    } else if (fdatasync(fd) != 0) {
+      s = Status::IOError("RangeIntent::ApplyTo() - fdatasync()", strerror(errno));
+    }
+    close(fd);
+    return s;
+  }
+};
+
+} // namespace kdb
+
+#endif // KINGDB_RANGE_INTENT_H_
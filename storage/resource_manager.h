@@ -52,6 +52,7 @@ class FileResourceManager {
     offarrays_.clear();
     has_padding_in_values_.clear();
     epoch_last_activity_.clear();
+    epoch_last_read_.clear();
   }
 
   void ClearTemporaryDataForFileId(uint32_t fileid) {
@@ -76,6 +77,7 @@ class FileResourceManager {
     filesizes_.erase(fileid);
     largefiles_.erase(fileid);
     compactedfiles_.erase(fileid);
+    epoch_last_read_.erase(fileid);
   }
 
   uint64_t GetFileSize(uint32_t fileid) {
@@ -83,6 +85,24 @@ class FileResourceManager {
     return filesizes_[fileid];
   }
 
+  // Same as above, and also records the time of the read, which is how the
+  // files that are no longer accessed are found
+  uint64_t GetFileSizeForRead(uint32_t fileid) {
+    uint64_t epoch_now = GetEpochNow();
+    std::unique_lock<std::mutex> lock(mutex_);
+    epoch_last_read_[fileid] = epoch_now;
+    return filesizes_[fileid];
+  }
+
+  std::vector<uint32_t> GetFileids() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<uint32_t> fileids;
+    for (auto& p: filesizes_) {
+      if (p.second > 0) fileids.push_back(p.first);
+    }
+    return fileids;
+  }
+
   void SetFileSize(uint32_t fileid, uint64_t filesize) {
     std::unique_lock<std::mutex> lock(mutex_);
 
@@ -157,6 +177,12 @@ class FileResourceManager {
     return epoch_last_activity_[fileid];
   }
 
+  uint64_t GetEpochLastRead(uint32_t fileid) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = epoch_last_read_.find(fileid);
+    return (it == epoch_last_read_.end()) ? 0 : it->second;
+  }
+
   const std::vector< std::pair<uint64_t, uint32_t> > GetOffsetArray(uint32_t fileid) {
     return offarrays_[fileid];
   }
@@ -212,6 +238,7 @@ class FileResourceManager {
   std::map<uint32_t, std::vector< std::pair<uint64_t, uint32_t> > > offarrays_;
   std::set<uint32_t> has_padding_in_values_;
   std::map<uint32_t, uint64_t> epoch_last_activity_;
+  std::map<uint32_t, uint64_t> epoch_last_read_;
   uint64_t dbsize_total_;
   uint64_t dbsize_uncompacted_;
 };
@@ -28,17 +28,263 @@
 #include "kingdb/kdb.h"
 #include "util/options.h"
 #include "algorithm/hash.h"
+#include "algorithm/key_filter.h"
 #include "util/order.h"
 #include "util/byte_array.h"
+#include "util/slice.h"
+#include "util/value.h"
+#include "util/buffer_pool.h"
+#include "util/memory_budget.h"
 #include "algorithm/crc32c.h"
+#include "algorithm/compressor.h"
 #include "util/file.h"
 #include "storage/format.h"
 #include "storage/resource_manager.h"
 #include "storage/hstable_manager.h"
+#include "storage/frame_index.h"
+#include "storage/range_intent.h"
 
 
 namespace kdb {
 
+// EntryReader holds an entry being read by the value-type read path of the
+// storage engine: the open HSTable, and the head of the entry, which was read
+// into a pooled buffer and holds at least the header and the key. The value
+// is then read either from the head when it fits there, or with pread() into
+// the destination buffer, which avoids any intermediate copy for large
+// uncompressed values. Compressed values are read one LZ4 frame at a time,
+// and each frame is uncompressed into the destination buffer.
+// With direct I/O, all reads are aligned to the blocks of the file: the head
+// then starts at 'offset_head' in its buffer, and the parts of the value that
+// are not in the head go through an aligned bounce buffer.
+class EntryReader {
+ public:
+  EntryReader() : fd(-1), is_direct(false), offset_file(0), offset_head(0), size_header(0), pool(nullptr) {}
+  ~EntryReader() { Reset(); }
+
+  void Reset() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+    is_direct = false;
+    offset_head = 0;
+    head.Reset();
+  }
+
+  uint64_t offset_value() { return size_header + header.size_key; }
+
+  Status ReadValue(BufferPool* pool, Value* value_out) {
+    uint64_t size_entry = offset_value() + header.size_value_used();
+    if (!header.IsCompressed() && size_entry <= head.size()) {
+      // The value is returned straight from the buffer it was read into
+      if (crc32c::Value(head.data() + 4, size_entry - 4) != header.crc32) {
+        return Status::IOError("Bad CRC32");
+      }
+      head.SetWindow(offset_head + offset_value(), header.size_value);
+      *value_out = std::move(head);
+      return Status::OK();
+    }
+    char *dest = value_out->Allocate(pool, header.size_value);
+    Status s = ReadValueInto(pool, dest, header.size_value);
+    if (!s.IsOK()) value_out->Reset();
+    return s;
+  }
+
+  Status ReadValueInto(BufferPool* pool, char *dest, uint64_t size_dest) {
+    if (header.size_value > size_dest) return Status::InvalidArgument("Buffer is too small");
+
+    // The checksum covers the header, minus the checksum itself, the key, and
+    // the value as it is stored
+    uint32_t crc32 = crc32c::Value(head.data() + 4, offset_value() - 4);
+    Status s;
+    if (!header.IsCompressed()) {
+      s = ReadStored(0, header.size_value, dest);
+      if (!s.IsOK()) return s;
+      crc32 = crc32c::Extend(crc32, dest, header.size_value);
+    } else {
+      Value scratch;
+      uint64_t offset = 0, size_uncompressed_total = 0;
+      while (offset < header.size_value_compressed) {
+        char header_frame[8];
+        s = ReadStored(offset, 8, header_frame);
+        if (!s.IsOK()) return s;
+        uint32_t size_frame;
+        GetFixed32(header_frame, &size_frame);
+        if (size_frame < 8 || size_frame > header.size_value_compressed - offset) {
+          return Status::IOError("Invalid LZ4 frame: invalid compressed size");
+        }
+        const char *frame = StoredInHead(offset, size_frame);
+        if (frame == nullptr) {
+          if (scratch.capacity() < size_frame) scratch.Allocate(pool, size_frame);
+          s = ReadStored(offset, size_frame, scratch.buffer());
+          if (!s.IsOK()) return s;
+          frame = scratch.buffer();
+        }
+        crc32 = crc32c::Extend(crc32, frame, size_frame);
+        uint64_t size_frame_read, size_uncompressed;
+        s = CompressorLZ4::UncompressFrame(frame,
+                                           size_frame,
+                                           dest + size_uncompressed_total,
+                                           size_dest - size_uncompressed_total,
+                                           &size_frame_read,
+                                           &size_uncompressed);
+        if (!s.IsOK()) return s;
+        offset += size_frame;
+        size_uncompressed_total += size_uncompressed;
+      }
+      if (size_uncompressed_total != header.size_value) {
+        return Status::IOError("Uncompressed value has an invalid size");
+      }
+    }
+
+    if (crc32 != header.crc32) return Status::IOError("Bad CRC32");
+    return Status::OK();
+  }
+
+  // Builds the frame index of a compressed value by walking the headers of
+  // its LZ4 frames, which only reads eight bytes per frame.
+  Status BuildFrameIndex(FrameIndex* index) {
+    index->offsets_stored.clear();
+    index->offsets_uncompressed.clear();
+    uint64_t offset = 0, offset_uncompressed = 0;
+    while (offset < header.size_value_compressed) {
+      char header_frame[8];
+      Status s = ReadStored(offset, 8, header_frame);
+      if (!s.IsOK()) return s;
+      uint32_t size_frame, size_uncompressed;
+      GetFixed32(header_frame, &size_frame);
+      GetFixed32(header_frame + 4, &size_uncompressed);
+      if (size_frame < 8 || size_frame > header.size_value_compressed - offset) {
+        return Status::IOError("Invalid LZ4 frame: invalid compressed size");
+      }
+      index->offsets_stored.push_back(offset);
+      index->offsets_uncompressed.push_back(offset_uncompressed);
+      offset += size_frame;
+      offset_uncompressed += size_uncompressed;
+    }
+    if (offset_uncompressed != header.size_value) {
+      return Status::IOError("Uncompressed value has an invalid size");
+    }
+    index->offsets_stored.push_back(offset);
+    index->offsets_uncompressed.push_back(offset_uncompressed);
+    return Status::OK();
+  }
+
+  // Reads the bytes [offset, offset+size) of the value into 'dest'. For
+  // compressed values, 'index' must be the frame index of the value, and only
+  // the frames overlapping the range are read and uncompressed.
+  // NOTE: the checksum covers the entire entry, thus it cannot be verified
+  //       when only a range of the value is read. LZ4 still guarantees that
+  //       corrupted frames cannot cause reads or writes out of bounds.
+  Status ReadRangeInto(BufferPool* pool,
+                       const FrameIndex* index,
+                       uint64_t offset,
+                       uint64_t size,
+                       char *dest) {
+    if (!header.IsCompressed()) return ReadStored(offset, size, dest);
+
+    Value scratch_frame, scratch_uncompressed;
+    uint64_t pos = 0;
+    for (uint64_t frame = index->FindFrame(offset); pos < size; frame++) {
+      if (frame >= index->num_frames()) return Status::IOError("Range is beyond the last frame");
+      uint64_t size_frame = index->size_frame(frame);
+      const char *data_frame = StoredInHead(index->offsets_stored[frame], size_frame);
+      if (data_frame == nullptr) {
+        if (scratch_frame.capacity() < size_frame) scratch_frame.Allocate(pool, size_frame);
+        Status s = ReadStored(index->offsets_stored[frame], size_frame, scratch_frame.buffer());
+        if (!s.IsOK()) return s;
+        data_frame = scratch_frame.buffer();
+      }
+
+      // Frames entirely inside the range are uncompressed in place, the
+      // others go through a scratch buffer.
+      uint64_t size_uncompressed = index->size_uncompressed(frame);
+      uint64_t skip = offset + pos - index->offsets_uncompressed[frame];
+      uint64_t size_copy = std::min(size - pos, size_uncompressed - skip);
+      bool in_place = (skip == 0 && size_copy == size_uncompressed);
+      char *dest_frame = dest + pos;
+      if (!in_place) {
+        if (scratch_uncompressed.capacity() < size_uncompressed) {
+          scratch_uncompressed.Allocate(pool, size_uncompressed);
+        }
+        dest_frame = scratch_uncompressed.buffer();
+      }
+      uint64_t size_frame_read, size_uncompressed_read;
+      Status s = CompressorLZ4::UncompressFrame(data_frame,
+                                                size_frame,
+                                                dest_frame,
+                                                size_uncompressed,
+                                                &size_frame_read,
+                                                &size_uncompressed_read);
+      if (!s.IsOK()) return s;
+      if (size_uncompressed_read != size_uncompressed) {
+        return Status::IOError("Uncompressed frame has an invalid size");
+      }
+      if (!in_place) memcpy(dest + pos, dest_frame + skip, size_copy);
+      pos += size_copy;
+    }
+    return Status::OK();
+  }
+
+  int fd;
+  bool is_direct;
+  uint64_t offset_file;
+  uint64_t offset_head;
+  Value head;
+  struct EntryHeader header;
+  uint32_t size_header;
+  BufferPool* pool;
+
+ private:
+  // Returns a pointer to the bytes [offset, offset+size) of the stored value
+  // if they are all in the head, or nullptr otherwise.
+  const char* StoredInHead(uint64_t offset, uint64_t size) {
+    uint64_t begin = offset_value() + offset;
+    if (begin + size > head.size()) return nullptr;
+    return head.data() + begin;
+  }
+
+  // Copies the bytes [offset, offset+size) of the stored value into 'dest',
+  // taking from the head what is already there.
+  Status ReadStored(uint64_t offset, uint64_t size, char *dest) {
+    uint64_t begin = offset_value() + offset;
+    uint64_t size_head = 0;
+    if (begin < head.size()) {
+      size_head = std::min(size, head.size() - begin);
+      memcpy(dest, head.data() + begin, size_head);
+    }
+    if (size_head == size) return Status::OK();
+    uint64_t size_remaining = size - size_head;
+    if (is_direct) return ReadDirect(offset_file + begin + size_head, size_remaining, dest + size_head);
+    if (pread(fd, dest + size_head, size_remaining, offset_file + begin + size_head) != (ssize_t)size_remaining) {
+      return Status::IOError("Could not read entry", strerror(errno));
+    }
+    return Status::OK();
+  }
+
+  // Copies the bytes [offset, offset+size) of the file into 'dest', with
+  // aligned reads of at most kSizeReadDirectMax bytes.
+  Status ReadDirect(uint64_t offset, uint64_t size, char *dest) {
+    static const uint64_t kSizeReadDirectMax = 1024*1024;
+    Value bounce;
+    while (size > 0) {
+      uint64_t begin = FileUtil::align_down(offset);
+      uint64_t end = std::min(FileUtil::align_up(offset + size), begin + kSizeReadDirectMax);
+      if (bounce.capacity() < end - begin) bounce.Allocate(pool, end - begin);
+      ssize_t size_read = pread(fd, bounce.buffer(), end - begin, begin);
+      if (size_read < 0 || (uint64_t)size_read <= offset - begin) {
+        return Status::IOError("Could not read entry", strerror(errno));
+      }
+      uint64_t size_copy = std::min(size, (uint64_t)size_read - (offset - begin));
+      memcpy(dest, bounce.buffer() + (offset - begin), size_copy);
+      dest += size_copy;
+      offset += size_copy;
+      size -= size_copy;
+    }
+    return Status::OK();
+  }
+};
+
+
 class StorageEngine {
  public:
   StorageEngine(DatabaseOptions db_options,
@@ -46,39 +292,74 @@ class StorageEngine {
                 std::string dbname,
                 bool read_only=false, // TODO: this should be part of db_options -- sure about that? what options are stored on disk?
                 std::set<uint32_t>* fileids_ignore=nullptr,
-                uint32_t fileid_end=0)
+                uint32_t fileid_end=0,
+                MemoryBudget* memory_budget=nullptr)
       : db_options_(db_options),
         event_manager_(event_manager),
         is_read_only_(read_only),
         prefix_compaction_("compaction_"),
+        prefix_ingest_("ingest_"),
         dirpath_locks_(dbname + "/locks"),
+        dirpath_ranges_(dbname + "/ranges"),
+        filepath_range_intent_(dbname + "/ranges/intent"),
         hstable_manager_(db_options, dbname, "", prefix_compaction_, dirpath_locks_, kUncompactedRegularType, read_only),
-        hstable_manager_compaction_(db_options, dbname, prefix_compaction_, prefix_compaction_, dirpath_locks_, kCompactedRegularType, read_only) {
+        index_(IndexMap::key_compare(), IndexMap::allocator_type(&arena_index_)),
+        index_compaction_(IndexMap::key_compare(), IndexMap::allocator_type(&arena_index_)),
+        hstable_manager_compaction_(db_options, dbname, prefix_compaction_, prefix_compaction_, dirpath_locks_, kCompactedRegularType, read_only),
+        frame_indices_(db_options.storage__frame_index_cache_size, memory_budget),
+        memory_budget_(memory_budget),
+        size_index_charged_(0),
+        size_buffers_charged_(0),
+        id_reclaimer_(0) {
     log::trace("StorageEngine:StorageEngine()", "dbname: %s", dbname.c_str());
     dbname_ = dbname;
+    SelectHotPaths();
     fileids_ignore_ = fileids_ignore;
     num_readers_ = 0;
     is_compaction_in_progress_ = false;
     sequence_snapshot_ = 0;
+    sequence_change_pin_ = 0;
     stop_requested_ = false;
     is_closed_ = false;
-    fs_free_space_ = 0;
+    // The free space is known before the first writes arrive, otherwise they
+    // would be rejected until the statistics thread has run once
+    fs_free_space_ = is_read_only_ ? 0 : ComputeFreeSpace();
     if (!is_read_only_) {
       thread_index_ = std::thread(&StorageEngine::ProcessingLoopIndex, this);
       thread_data_ = std::thread(&StorageEngine::ProcessingLoopData, this);
       thread_compaction_ = std::thread(&StorageEngine::ProcessingLoopCompaction, this);
       thread_statistics_ = std::thread(&StorageEngine::ProcessingLoopStatistics, this);
     }
-    hash_ = MakeHash(db_options.hash);
     if (!is_read_only_) {
       fileids_iterator_ = nullptr;
     } else {
       fileids_iterator_ = new std::vector<uint32_t>();
     }
-    Status s = hstable_manager_.LoadDatabase(dbname, index_, fileids_ignore_, fileid_end, fileids_iterator_);
+    if (!is_read_only_) {
+      Status s = RecoverRangeIntent();
+      if (!s.IsOK()) {
+        log::emerg("StorageEngine", "Could not recover range intent: [%s]", s.ToString().c_str());
+      }
+      // Files of an ingestion that was interrupted
+      s = hstable_manager_.RemoveFilesWithPrefix(prefix_ingest_);
+      if (!s.IsOK()) {
+        log::emerg("StorageEngine", "Could not clean up previous ingestion: [%s]", s.ToString().c_str());
+      }
+    }
+    Status s = hstable_manager_.LoadDatabase(index_, fileids_ignore_, fileid_end, fileids_iterator_);
     if (!s.IsOK()) {
       log::emerg("StorageEngine", "Could not load database: [%s]", s.ToString().c_str());
       Close();
+      return;
+    }
+    RebuildFilter();
+    if (memory_budget_ != nullptr) {
+      ChargeIndex();
+      size_buffers_charged_ = hstable_manager_.GetSizeBuffers() + hstable_manager_compaction_.GetSizeBuffers();
+      memory_budget_->Charge(size_buffers_charged_);
+      if (!is_read_only_) {
+        id_reclaimer_ = memory_budget_->AddReclaimer([this]() { frame_indices_.Clear(); });
+      }
     }
   }
 
@@ -120,7 +401,13 @@ class StorageEngine {
       delete fileids_iterator_; 
     }
 
-    delete hash_;
+    if (memory_budget_ != nullptr) {
+      if (id_reclaimer_ != 0) memory_budget_->RemoveReclaimer(id_reclaimer_);
+      frame_indices_.Clear();
+      memory_budget_->Release(size_index_charged_ + size_buffers_charged_);
+      size_index_charged_ = 0;
+      size_buffers_charged_ = 0;
+    }
 
     log::trace("StorageEngine::Close()", "done");
   }
@@ -130,11 +417,21 @@ class StorageEngine {
     stop_requested_ = true;
   }
 
+  // With several data directories, the free space is the one of the fullest
+  // file system, as the HSTables are spread evenly over all of them
+  uint64_t ComputeFreeSpace() {
+    uint64_t free_space = std::numeric_limits<uint64_t>::max();
+    for (auto& dirpath: hstable_manager_.GetDirpaths()) {
+      free_space = std::min(free_space, (uint64_t)FileUtil::fs_free_space(dirpath.c_str()));
+    }
+    return free_space;
+  }
+
   void ProcessingLoopStatistics() {
     std::chrono::milliseconds duration(db_options_.compaction__check_interval);
     while (true) {
       std::unique_lock<std::mutex> lock(mutex_statistics_);
-      fs_free_space_ = FileUtil::fs_free_space(dbname_.c_str());
+      fs_free_space_ = ComputeFreeSpace();
       cv_statistics_.wait_for(lock, duration);
       if (IsStopRequested()) return;
     }
@@ -187,6 +484,10 @@ class StorageEngine {
     uint32_t fileid_out = 0;
 
     while (true) {
+      // Done before compactions, so that a file that was moved to the cold
+      // tier cannot be removed by a compaction while its hot copy remains
+      RemoveHotCopies();
+
       uint64_t size_compaction = 0;
       uint64_t fs_free_space = GetFreeSpace();
       if (fs_free_space > db_options_.compaction__filesystem__survival_mode_threshold) {
@@ -195,8 +496,14 @@ class StorageEngine {
         size_compaction = db_options_.compaction__filesystem__survival_batch_size;
       }
  
-      // Only files that are no longer taking incoming updates can be compacted
+      // Only files that are no longer taking incoming updates can be compacted,
+      // and that no change stream still has to read
       uint32_t fileid_end = hstable_manager_.GetHighestStableFileId(fileid_lastcompacted + 1);
+      mutex_change_pins_.lock();
+      for (auto& p: change_pins_) {
+        if (fileid_end >= p.second) fileid_end = (p.second > fileid_lastcompacted + 1) ? p.second - 1 : 0;
+      }
+      mutex_change_pins_.unlock();
       
       uint64_t dbsize_uncompacted = hstable_manager_.file_resource_manager.GetDbSizeUncompacted();
       log::trace("ProcessingLoopCompaction",
@@ -224,12 +531,664 @@ class StorageEngine {
         }
       }
 
+      if (   db_options_.cache__max_size > 0
+          && hstable_manager_.file_resource_manager.GetDbSizeTotal() > db_options_.cache__max_size) {
+        EvictFiles();
+      }
+
+      if (hstable_manager_.HasColdTier()) MoveColdFiles();
+
       std::unique_lock<std::mutex> lock(mutex_loop_compaction_);
       cv_loop_compaction_.wait_for(lock, duration);
       if (IsStopRequested()) return;
     }
   }
 
+  // Moves to the cold tier the files that have been neither written nor read
+  // for 'db.storage.cold_age'. Files are not moved while snapshots are in
+  // progress, as the storage engines of the snapshots have their own view of
+  // the tiers. Readers may still be opening the hot copies of the files that
+  // were moved, thus those are only removed at the next iteration of the
+  // compaction loop, by RemoveHotCopies().
+  void MoveColdFiles() {
+    uint64_t epoch_now = hstable_manager_.file_resource_manager.GetEpochNow();
+    uint64_t cold_age = db_options_.storage__cold_age;
+    uint32_t fileid_current = hstable_manager_.GetSequenceFileId();
+    for (auto fileid: hstable_manager_.file_resource_manager.GetFileids()) {
+      if (IsStopRequested()) return;
+      if (   fileid >= fileid_current
+          || hstable_manager_.IsFileCold(fileid)
+          || hstable_manager_.file_resource_manager.GetNumWritesInProgress(fileid) > 0
+          || epoch_now < hstable_manager_.file_resource_manager.GetEpochLastRead(fileid) + cold_age) {
+        continue;
+      }
+      struct stat info;
+      std::string filepath = hstable_manager_.GetFilepath(fileid);
+      if (   stat(filepath.c_str(), &info) != 0
+          || epoch_now < (uint64_t)info.st_mtime * 1000 + cold_age) {
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock_snapshot(mutex_snapshot_);
+      if (snapshotids_to_fileids_.size() > 0) return;
+      std::unique_lock<std::mutex> lock_put_range(mutex_put_range_);
+      Status s = hstable_manager_.MoveFileToColdTier(fileid);
+      if (!s.IsOK()) {
+        log::emerg("StorageEngine::MoveColdFiles()", "Could not move file [%s]: %s", filepath.c_str(), s.ToString().c_str());
+        return;
+      }
+      log::trace("StorageEngine::MoveColdFiles()", "Moved [%s] to the cold tier", filepath.c_str());
+      filepaths_hot_moved_.push_back(filepath);
+    }
+  }
+
+  // A reader builds the filepath of an entry and opens it while it is counted
+  // in 'num_readers_', thus the write lock, which waits for all the readers
+  // to be done, guarantees that no reader can still be about to open a hot
+  // copy. The readers that come after can only see the files as cold.
+  void RemoveHotCopies() {
+    if (filepaths_hot_moved_.empty()) return;
+    AcquireWriteLock();
+    for (auto& filepath: filepaths_hot_moved_) {
+      if (std::remove(filepath.c_str()) != 0) {
+        log::emerg("StorageEngine::RemoveHotCopies()", "Could not remove file [%s]", filepath.c_str());
+      }
+    }
+    ReleaseWriteLock();
+    filepaths_hot_moved_.clear();
+  }
+
+  // When the database is used as a cache, removes the oldest HSTables, in the
+  // order of <timestamp, fileid> that is used to replay them when the database
+  // is opened, until the database is back under 90% of 'db.cache.max_size'.
+  // Since a compaction gives its output files the highest timestamp of its
+  // inputs, the older versions of an entry are always evicted before the more
+  // recent ones, which is why the entries of the evicted files can simply be
+  // dropped from the index, without writing any tombstones.
+  void EvictFiles() {
+    uint64_t dbsize = hstable_manager_.file_resource_manager.GetDbSizeTotal();
+    uint64_t size_target = db_options_.cache__max_size - db_options_.cache__max_size / 10;
+    uint32_t fileid_current = hstable_manager_.GetSequenceFileId();
+    std::map<std::pair<uint64_t, uint32_t>, uint64_t> files;
+    for (auto fileid: hstable_manager_.file_resource_manager.GetFileids()) {
+      if (   fileid >= fileid_current
+          || hstable_manager_.file_resource_manager.GetNumWritesInProgress(fileid) > 0) {
+        continue;
+      }
+      uint64_t timestamp;
+      if (!GetFileTimestamp(fileid, &timestamp).IsOK()) continue;
+      files[std::make_pair(timestamp, fileid)] = hstable_manager_.file_resource_manager.GetFileSize(fileid);
+    }
+
+    std::set<uint32_t> fileids_evict;
+    for (auto& p: files) {
+      if (dbsize <= size_target) break;
+      fileids_evict.insert(p.first.second);
+      dbsize -= std::min(dbsize, p.second);
+    }
+    if (fileids_evict.empty() || IsStopRequested()) return;
+
+    // The index is scanned in steps so that the readers and the flushes are
+    // not blocked for the whole scan. Other threads only insert into the
+    // index, which does not invalidate the iterator.
+    static const uint64_t kNumEntriesPerLock = 65536;
+    log::trace("StorageEngine::EvictFiles()", "Evicting %zu files", fileids_evict.size());
+    std::unique_lock<std::mutex> lock_put_range(mutex_put_range_);
+    AcquireWriteLock();
+    uint64_t counter_iterations = 0;
+    for (auto it = index_.begin(); it != index_.end();) {
+      uint32_t fileid = (it->second & 0xFFFFFFFF00000000) >> 32;
+      if (fileids_evict.find(fileid) != fileids_evict.end()) {
+        it = index_.erase(it);
+      } else {
+        ++it;
+      }
+      if (++counter_iterations >= kNumEntriesPerLock) {
+        ReleaseWriteLock();
+        counter_iterations = 0;
+        AcquireWriteLock();
+      }
+    }
+    if (memory_budget_ != nullptr) ChargeIndex();
+    ReleaseWriteLock();
+
+    mutex_timestamps_.lock();
+    for (auto fileid: fileids_evict) timestamps_.erase(fileid);
+    mutex_timestamps_.unlock();
+    RemoveUnusedFiles(fileids_evict);
+  }
+
+  // Opens an HSTable for the reads that are not counted in 'num_readers_',
+  // thus that RemoveHotCopies() does not wait for: if the file was moved to
+  // the cold tier and its hot copy removed after its filepath was built, the
+  // open is retried with its new filepath.
+  int OpenFileOutsideReaders(uint32_t fileid, std::string* filepath_out) {
+    *filepath_out = hstable_manager_.GetFilepath(fileid);
+    int fd = open(filepath_out->c_str(), O_RDONLY);
+    if (fd < 0 && errno == ENOENT && hstable_manager_.HasColdTier()) {
+      std::string filepath_cold = hstable_manager_.GetFilepath(fileid);
+      if (filepath_cold != *filepath_out) {
+        *filepath_out = filepath_cold;
+        fd = open(filepath_out->c_str(), O_RDONLY);
+      }
+    }
+    return fd;
+  }
+
+  // Returns the timestamp in the header of an HSTable. The timestamps never
+  // change, thus they are only read once.
+  Status GetFileTimestamp(uint32_t fileid, uint64_t* timestamp) {
+    std::unique_lock<std::mutex> lock(mutex_timestamps_);
+    auto it = timestamps_.find(fileid);
+    if (it != timestamps_.end()) {
+      *timestamp = it->second;
+      return Status::OK();
+    }
+    std::string filepath;
+    int fd;
+    if ((fd = OpenFileOutsideReaders(fileid, &filepath)) < 0) {
+      return Status::IOError("Could not open file", strerror(errno));
+    }
+    char buffer[HSTableHeader::GetFixedSize()];
+    ssize_t ret = pread(fd, buffer, HSTableHeader::GetFixedSize(), 0);
+    close(fd);
+    if (ret != (ssize_t)HSTableHeader::GetFixedSize()) {
+      return Status::IOError("Could not read file header", filepath.c_str());
+    }
+    struct HSTableHeader hstheader;
+    Status s = HSTableHeader::DecodeFrom(buffer, HSTableHeader::GetFixedSize(), &hstheader);
+    if (!s.IsOK()) return s;
+    timestamps_[fileid] = hstheader.timestamp;
+    *timestamp = hstheader.timestamp;
+    return Status::OK();
+  }
+
+  // START: Helpers for ChangeStream
+  // The changes are the entries of the HSTables that were written by flushes,
+  // in the order of the <timestamp, fileid> of the HSTables, and in the order
+  // of their offsets inside each HSTable. Each such HSTable has a timestamp
+  // of its own, one more than the HSTable written before it, while the
+  // HSTables written by compactions take the timestamp of their most recent
+  // input. The HSTable with a given timestamp is therefore either found, or
+  // has been compacted or evicted if a more recent one exists, or has not
+  // been written yet.
+  bool IsChangeFile(uint32_t fileid) {
+    return (   !hstable_manager_.file_resource_manager.IsFileCompacted(fileid)
+            || hstable_manager_.file_resource_manager.IsFileLarge(fileid));
+  }
+
+  // Finds the HSTable with the given timestamp, or with the smallest
+  // timestamp if 'timestamp' is 0.
+  Status FindChangeFile(uint64_t timestamp, uint64_t* timestamp_out, uint32_t* fileid_out) {
+    bool has_file = false;
+    bool has_file_more_recent = false;
+    for (auto fileid: hstable_manager_.file_resource_manager.GetFileids()) {
+      uint64_t timestamp_file;
+      if (!IsChangeFile(fileid) || !GetFileTimestamp(fileid, &timestamp_file).IsOK()) continue;
+      if (timestamp == 0) {
+        if (!has_file || timestamp_file < *timestamp_out) {
+          *timestamp_out = timestamp_file;
+          *fileid_out = fileid;
+          has_file = true;
+        }
+      } else if (timestamp_file == timestamp) {
+        *timestamp_out = timestamp_file;
+        *fileid_out = fileid;
+        return Status::OK();
+      } else if (timestamp_file > timestamp) {
+        has_file_more_recent = true;
+      }
+    }
+    if (has_file) return Status::OK();
+    if (has_file_more_recent) return Status::IOError("The changes at the cursor are no longer available");
+    return Status::NotFound("No more changes");
+  }
+
+  // Returns the offset up to which the entries of an HSTable can be read as
+  // changes, and whether the HSTable is closed, in which case no entry will
+  // be added to it. While an entry is being written in several chunks, the
+  // HSTable it is in cannot be read any further.
+  Status GetChangeFileExtent(uint32_t fileid, uint64_t* offset_end, bool* is_closed) {
+    *is_closed = false;
+    *offset_end = 0;
+    if (hstable_manager_.file_resource_manager.GetNumWritesInProgress(fileid) > 0) return Status::OK();
+    uint64_t filesize = hstable_manager_.file_resource_manager.GetFileSize(fileid);
+    if (filesize < db_options_.internal__hstable_header_size + HSTableFooter::GetFixedSize()) {
+      *offset_end = filesize;
+      return Status::OK();
+    }
+
+    std::string filepath;
+    int fd;
+    if ((fd = OpenFileOutsideReaders(fileid, &filepath)) < 0) {
+      return Status::IOError("Could not open file", strerror(errno));
+    }
+    char buffer[HSTableFooter::GetFixedSize()];
+    ssize_t ret = pread(fd, buffer, HSTableFooter::GetFixedSize(), filesize - HSTableFooter::GetFixedSize());
+    close(fd);
+    if (ret != (ssize_t)HSTableFooter::GetFixedSize()) {
+      return Status::IOError("Could not read file footer", filepath.c_str());
+    }
+    struct HSTableFooter footer;
+    Status s = HSTableFooter::DecodeFrom(buffer, HSTableFooter::GetFixedSize(), &footer);
+    if (   s.IsOK()
+        && footer.magic_number == HSTableManager::get_magic_number()
+        && footer.offset_indexes <= filesize) {
+      *offset_end = footer.offset_indexes;
+      *is_closed = true;
+    } else {
+      *offset_end = filesize;
+    }
+    return Status::OK();
+  }
+
+  uint64_t GetHeaderSize() {
+    return db_options_.internal__hstable_header_size;
+  }
+
+  // Reads the entry at 'offset' in an HSTable, and returns in 'offset_next'
+  // the offset of the entry that follows it. For a remove, 'value_out' is
+  // set to nullptr, and for an entry that is invalid, such as an entry that
+  // was only partially written before a crash, both are set to nullptr.
+  // IMPORTANT: key_out and value_out must be deleted by the caller
+  Status GetChange(uint32_t fileid,
+                   uint64_t offset,
+                   uint64_t offset_end,
+                   ByteArray** key_out,
+                   ByteArray** value_out,
+                   uint64_t* offset_next) {
+    *key_out = nullptr;
+    *value_out = nullptr;
+    std::string filepath;
+    int fd;
+    if ((fd = OpenFileOutsideReaders(fileid, &filepath)) < 0) {
+      return Status::IOError("Could not open file", strerror(errno));
+    }
+    char buffer[EntryHeader::GetMaxSize()];
+    uint64_t size_read = std::min((uint64_t)EntryHeader::GetMaxSize(), offset_end - offset);
+    ssize_t ret = pread(fd, buffer, size_read, offset);
+    close(fd);
+    if (ret != (ssize_t)size_read) {
+      return Status::IOError("Could not read entry header", filepath.c_str());
+    }
+    struct EntryHeader entry_header;
+    uint32_t size_header;
+    Status s = EntryHeader::DecodeFrom(db_options_, buffer, size_read, &entry_header, &size_header);
+    if (!s.IsOK() || !entry_header.AreSizesValid(offset, offset_end)) {
+      return Status::IOError("Entry has invalid header");
+    }
+    *offset_next = offset + size_header + entry_header.size_key + entry_header.size_value_offset();
+
+    uint64_t fileid_shifted = fileid;
+    fileid_shifted <<= 32;
+    s = GetEntry(fileid_shifted | offset, key_out, value_out);
+    if (s.IsRemoveOrder()) {
+      *value_out = nullptr;
+    } else if (!s.IsOK()) {
+      delete *key_out;
+      delete *value_out;
+      *key_out = nullptr;
+      *value_out = nullptr;
+    }
+    return Status::OK();
+  }
+
+  // While a change stream is open, the compaction process does not compact
+  // the HSTables from the one the stream is reading, so that the stream
+  // does not lose its position. 'fileid' is the HSTable that the stream is
+  // reading, or 0 if it has read all the changes.
+  uint64_t AddChangePin() {
+    std::unique_lock<std::mutex> lock(mutex_change_pins_);
+    uint64_t id = ++sequence_change_pin_;
+    change_pins_[id] = 0;
+    return id;
+  }
+
+  void SetChangePin(uint64_t id, uint32_t fileid) {
+    if (fileid == 0) fileid = hstable_manager_.GetSequenceFileId();
+    std::unique_lock<std::mutex> lock(mutex_change_pins_);
+    change_pins_[id] = fileid;
+  }
+
+  void RemoveChangePin(uint64_t id) {
+    std::unique_lock<std::mutex> lock(mutex_change_pins_);
+    change_pins_.erase(id);
+  }
+  // END: Helpers for ChangeStream
+
+  // START: Helpers for Follower
+  // Brings a read-only storage engine up to date with the HSTables of another
+  // database, found in 'dirpaths_source'. The HSTables are immutable once
+  // closed, so they are shipped as they are: each new closed HSTable is
+  // hard-linked into the directory of this storage engine, or copied if the
+  // directories are on different file systems, and its offset array is
+  // loaded into the index. The HSTables that were removed from the source,
+  // because they were compacted, have their entries removed from the index.
+  // Since the compactions write their outputs with the timestamps of their
+  // inputs, the locations of each hashed key that was updated are ordered by
+  // the <timestamp, fileid> of their HSTables, as when a database is loaded,
+  // so that the most recent version is found last.
+  Status Follow(const std::vector<std::string>& dirpaths_source) {
+    // 1. List the HSTables of the source
+    std::map<uint32_t, std::string> filepaths_source;
+    for (auto& dirpath: dirpaths_source) {
+      DIR *directory;
+      struct dirent *entry;
+      if ((directory = opendir(dirpath.c_str())) == NULL) {
+        return Status::IOError("Could not open source directory", dirpath.c_str());
+      }
+      while ((entry = readdir(directory)) != NULL) {
+        if (   strlen(entry->d_name) != 8
+            || strspn(entry->d_name, "0123456789abcdef") != 8) {
+          continue;
+        }
+        std::string filepath = dirpath + "/" + entry->d_name;
+        struct stat info;
+        if (   stat(filepath.c_str(), &info) != 0
+            || !(info.st_mode & S_IFREG)
+            || info.st_size <= (int64_t)db_options_.internal__hstable_header_size) {
+          continue;
+        }
+        filepaths_source[HSTableManager::hex_to_num(entry->d_name)] = filepath;
+      }
+      closedir(directory);
+    }
+
+    // 2. Ship the new HSTables, which are only kept once they are closed,
+    //    that is to say once their offset array has been written
+    std::vector<uint32_t> fileids_local = hstable_manager_.file_resource_manager.GetFileids();
+    std::set<uint32_t> fileids_known(fileids_local.begin(), fileids_local.end());
+    IndexMap index_new;
+    for (auto& p: filepaths_source) {
+      uint32_t fileid = p.first;
+      if (fileids_known.find(fileid) != fileids_known.end()) continue;
+      std::string filepath = hstable_manager_.GetFilepath(fileid);
+      std::remove(filepath.c_str());
+      if (link(p.second.c_str(), filepath.c_str()) != 0) {
+        if (errno == ENOENT) continue; // removed from the source in the meantime
+        if (!FileUtil::copy_file(p.second.c_str(), filepath.c_str()).IsOK()) continue;
+      }
+      struct stat info;
+      if (stat(filepath.c_str(), &info) != 0) continue;
+      Mmap mmap(filepath, info.st_size);
+      if (!mmap.is_valid()) return Status::IOError("Mmap constructor failed");
+      IndexMap index_file;
+      uint64_t filesize;
+      bool is_file_large, is_file_compacted;
+      Status s = HSTableManager::LoadFile(mmap, fileid, index_file, &filesize, &is_file_large, &is_file_compacted);
+      mmap.Close();
+      if (!s.IsOK()) {
+        std::remove(filepath.c_str());
+        continue;
+      }
+      hstable_manager_.file_resource_manager.SetFileSize(fileid, filesize);
+      if (is_file_large) hstable_manager_.file_resource_manager.SetFileLarge(fileid);
+      if (is_file_compacted) hstable_manager_.file_resource_manager.SetFileCompacted(fileid);
+      index_new.insert(index_file.begin(), index_file.end());
+      log::trace("StorageEngine::Follow()", "Shipped [%s]", p.second.c_str());
+    }
+
+    std::set<uint32_t> fileids_removed;
+    for (auto fileid: fileids_local) {
+      if (filepaths_source.find(fileid) == filepaths_source.end()) fileids_removed.insert(fileid);
+    }
+    if (index_new.empty() && fileids_removed.empty()) return Status::OK();
+
+    // 3. Update the index
+    AcquireWriteLock();
+    if (!fileids_removed.empty()) {
+      for (auto it = index_.begin(); it != index_.end();) {
+        uint32_t fileid = (it->second & 0xFFFFFFFF00000000) >> 32;
+        if (fileids_removed.find(fileid) != fileids_removed.end()) {
+          it = index_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    for (auto it = index_new.begin(); it != index_new.end(); it = index_new.upper_bound(it->first)) {
+      const uint64_t& hashedkey = it->first;
+      // Pairs of <timestamp, location>, and since the fileid is in the upper
+      // bits of a location, sorting them gives the <timestamp, fileid> order
+      std::vector< std::pair<uint64_t, uint64_t> > locations;
+      auto range_index = index_.equal_range(hashedkey);
+      for (auto it_bucket = range_index.first; it_bucket != range_index.second; ++it_bucket) {
+        locations.push_back(std::make_pair(0, it_bucket->second));
+      }
+      auto range_new = index_new.equal_range(hashedkey);
+      for (auto it_bucket = range_new.first; it_bucket != range_new.second; ++it_bucket) {
+        locations.push_back(std::make_pair(0, it_bucket->second));
+      }
+      for (auto& p: locations) {
+        GetFileTimestamp((p.second & 0xFFFFFFFF00000000) >> 32, &p.first);
+      }
+      std::sort(locations.begin(), locations.end());
+      index_.erase(hashedkey);
+      for (auto& p: locations) {
+        index_.insert(std::pair<uint64_t, uint64_t>(hashedkey, p.second));
+      }
+      filter_.Add(hashedkey);
+    }
+    // The keys of the HSTables removed by the compactions of the primary
+    // are only dropped from the filter by a rebuild
+    if (!fileids_removed.empty()) RebuildFilter();
+    if (memory_budget_ != nullptr) ChargeIndex();
+    ReleaseWriteLock();
+
+    // 4. Remove the HSTables that are no longer referenced
+    for (auto fileid: fileids_removed) {
+      log::trace("StorageEngine::Follow()", "Removing [%s]", hstable_manager_.GetFilepath(fileid).c_str());
+      if (std::remove(hstable_manager_.GetFilepath(fileid).c_str()) != 0) {
+        log::emerg("StorageEngine::Follow()", "Could not remove file [%s]", hstable_manager_.GetFilepath(fileid).c_str());
+      }
+      hstable_manager_.file_resource_manager.ClearAllDataForFileId(fileid);
+      std::unique_lock<std::mutex> lock(mutex_timestamps_);
+      timestamps_.erase(fileid);
+    }
+    return Status::OK();
+  }
+  // END: Helpers for Follower
+
+  // START: Helpers for IngestFiles
+  // Checks that a file written by HSTableBuilder can be ingested with the
+  // options of this database, and returns the partition, out of
+  // 'num_partitions', that all its entries belong to.
+  Status CheckFileForIngestion(const std::string& filepath,
+                               uint32_t num_partitions,
+                               uint32_t* index_partition_out) {
+    struct stat info;
+    if (stat(filepath.c_str(), &info) != 0) {
+      return Status::IOError("Could not find file", filepath.c_str());
+    }
+    if (info.st_size <= (int64_t)(db_options_.internal__hstable_header_size + HSTableFooter::GetFixedSize())) {
+      return Status::InvalidArgument("File is too small to be a HSTable", filepath.c_str());
+    }
+    Mmap mmap(filepath, info.st_size);
+    if (!mmap.is_valid()) return Status::IOError("Mmap constructor failed");
+    struct HSTableHeader hstheader;
+    Status s = HSTableHeader::DecodeFrom(mmap.datafile(), mmap.filesize(), &hstheader);
+    if (!s.IsOK()) return Status::InvalidArgument("Invalid HSTable header", filepath.c_str());
+    IndexMap index_file;
+    s = HSTableManager::LoadFile(mmap, 0, index_file);
+    if (!s.IsOK() || index_file.empty()) {
+      return Status::InvalidArgument("Invalid or empty HSTable", filepath.c_str());
+    }
+
+    // A mismatch in the hashing function or in the compression shows as a
+    // first entry that cannot be decoded, or whose key has another hash
+    struct HSTableFooter footer;
+    HSTableFooter::DecodeFrom(mmap.datafile() + mmap.filesize() - HSTableFooter::GetFixedSize(), HSTableFooter::GetFixedSize(), &footer);
+    struct HSTableFooterIndex hstfindex;
+    uint32_t length;
+    s = HSTableFooterIndex::DecodeFrom(mmap.datafile() + footer.offset_indexes, mmap.filesize() - footer.offset_indexes, &hstfindex, &length);
+    if (!s.IsOK()) return s;
+    struct EntryHeader entry_header;
+    uint32_t size_header;
+    s = EntryHeader::DecodeFrom(db_options_, mmap.datafile() + hstfindex.offset_entry, footer.offset_indexes - hstfindex.offset_entry, &entry_header, &size_header);
+    if (   !s.IsOK()
+        || !entry_header.AreSizesValid(hstfindex.offset_entry, footer.offset_indexes)
+        || entry_header.hash != hstfindex.hashed_key) {
+      return Status::InvalidArgument("HSTable was not built with the options of the database", filepath.c_str());
+    }
+    const char *key = mmap.datafile() + hstfindex.offset_entry + size_header;
+    std::unique_ptr<Hash> hash(MakeHash(db_options_.hash));
+    if (hash == nullptr || hash->HashFunction(key, entry_header.size_key) != entry_header.hash) {
+      return Status::InvalidArgument("HSTable was not built with the hashing function of the database", filepath.c_str());
+    }
+
+    // A file built for another number of partitions has entries from several
+    // partitions, which would not be found once ingested
+    uint32_t index_partition = HashPartition(key, entry_header.size_key, num_partitions);
+    for (auto& p: index_file) {
+      uint32_t offset_entry = p.second & 0x00000000FFFFFFFF;
+      if (offset_entry >= footer.offset_indexes) {
+        return Status::InvalidArgument("Invalid HSTable", filepath.c_str());
+      }
+      s = EntryHeader::DecodeFrom(db_options_, mmap.datafile() + offset_entry, footer.offset_indexes - offset_entry, &entry_header, &size_header);
+      if (!s.IsOK() || !entry_header.AreSizesValid(offset_entry, footer.offset_indexes)) {
+        return Status::InvalidArgument("Invalid HSTable", filepath.c_str());
+      }
+      key = mmap.datafile() + offset_entry + size_header;
+      if (HashPartition(key, entry_header.size_key, num_partitions) != index_partition) {
+        return Status::InvalidArgument("HSTable has entries from several partitions", filepath.c_str());
+      }
+    }
+    *index_partition_out = index_partition;
+    return Status::OK();
+  }
+
+  // Adds the files written by HSTableBuilder to the database, all at once:
+  // readers see either none or all of their entries. The files are moved,
+  // by hard links or by copies if they are on another file system, and get
+  // fresh fileids and timestamps, thus their entries take precedence over
+  // the ones already in the database. Writes made before the ingestion must
+  // have been flushed, otherwise they would take precedence instead.
+  Status IngestFiles(const std::vector<std::string>& filepaths) {
+    if (is_read_only_) return Status::IOError("Cannot write to a read-only database");
+
+    // 1. Stage the files under temporary names, which are removed if the
+    //    database is restarted before the ingestion is complete
+    std::vector<uint32_t> fileids;
+    std::vector<std::string> filepaths_staged;
+    IndexMap index_new;
+    Status s;
+    for (auto& filepath: filepaths) {
+      uint32_t fileid = hstable_manager_.IncrementSequenceFileId(1);
+      std::string filepath_staged = hstable_manager_.GetDirpathHot(fileid) + "/" + prefix_ingest_ + HSTableManager::num_to_hex(fileid);
+      if (link(filepath.c_str(), filepath_staged.c_str()) != 0) {
+        if (errno != EXDEV) {
+          s = Status::IOError("Could not link file", strerror(errno));
+          break;
+        }
+        s = FileUtil::copy_file(filepath.c_str(), filepath_staged.c_str());
+        if (!s.IsOK()) break;
+      }
+      fileids.push_back(fileid);
+      filepaths_staged.push_back(filepath_staged);
+
+      struct stat info;
+      if (stat(filepath_staged.c_str(), &info) != 0) {
+        s = Status::IOError("Could not stat file", strerror(errno));
+        break;
+      }
+      Mmap mmap(filepath_staged, info.st_size);
+      if (!mmap.is_valid()) {
+        s = Status::IOError("Mmap constructor failed");
+        break;
+      }
+      uint64_t filesize;
+      bool is_file_large, is_file_compacted;
+      s = HSTableManager::LoadFile(mmap, fileid, index_new, &filesize, &is_file_large, &is_file_compacted);
+      if (!s.IsOK()) break;
+      hstable_manager_.file_resource_manager.SetFileSize(fileid, filesize);
+      if (is_file_large) hstable_manager_.file_resource_manager.SetFileLarge(fileid);
+      if (is_file_compacted) hstable_manager_.file_resource_manager.SetFileCompacted(fileid);
+      int fd;
+      if ((fd = open(filepath_staged.c_str(), O_RDONLY)) < 0 || fdatasync(fd) != 0) {
+        s = Status::IOError("Could not sync file", strerror(errno));
+      }
+      if (fd >= 0) close(fd);
+      if (!s.IsOK()) break;
+    }
+
+    // 2. Give the files their timestamps and their final names, and index
+    //    them, while no flush can take place. The current HSTable is closed
+    //    first, so that the writes that follow go to a file with a greater
+    //    timestamp than the ingested ones.
+    if (s.IsOK()) {
+      AcquireWriteLock();
+      hstable_manager_.FlushCurrentFile(1, 0);
+      for (size_t i = 0; i < fileids.size() && s.IsOK(); i++) {
+        char buffer[HSTableHeader::GetFixedSize()];
+        struct HSTableHeader hstheader;
+        int fd;
+        if ((fd = open(filepaths_staged[i].c_str(), O_RDWR)) < 0) {
+          s = Status::IOError("Could not open file", strerror(errno));
+          break;
+        }
+        if (pread(fd, buffer, HSTableHeader::GetFixedSize(), 0) != (ssize_t)HSTableHeader::GetFixedSize()) {
+          s = Status::IOError("Could not read file", strerror(errno));
+        }
+        if (s.IsOK()) s = HSTableHeader::DecodeFrom(buffer, HSTableHeader::GetFixedSize(), &hstheader);
+        if (s.IsOK()) {
+          hstheader.timestamp = hstable_manager_.IncrementSequenceTimestamp(1);
+          HSTableHeader::EncodeTo(&hstheader, buffer);
+          if (   pwrite(fd, buffer, HSTableHeader::GetFixedSize(), 0) != (ssize_t)HSTableHeader::GetFixedSize()
+              || fdatasync(fd) != 0) {
+            s = Status::IOError("Could not write file", strerror(errno));
+          }
+        }
+        close(fd);
+      }
+      for (size_t i = 0; i < fileids.size() && s.IsOK(); i++) {
+        if (std::rename(filepaths_staged[i].c_str(), hstable_manager_.GetFilepath(fileids[i]).c_str()) != 0) {
+          s = Status::IOError("Could not rename file", strerror(errno));
+        }
+      }
+      if (s.IsOK()) {
+        std::set<std::string> dirpaths;
+        for (auto fileid: fileids) dirpaths.insert(hstable_manager_.GetDirpathHot(fileid));
+        for (auto& dirpath: dirpaths) FileUtil::sync_directory(dirpath.c_str());
+        mutex_compaction_.lock();
+        IndexMap& index = is_compaction_in_progress_ ? index_compaction_ : index_;
+        mutex_compaction_.unlock();
+        index.insert(index_new.begin(), index_new.end());
+        for (auto& p: index_new) filter_.Add(p.first);
+        if (memory_budget_ != nullptr) ChargeIndex();
+      }
+      ReleaseWriteLock();
+    }
+
+    if (!s.IsOK()) {
+      for (size_t i = 0; i < fileids.size(); i++) {
+        std::remove(filepaths_staged[i].c_str());
+        std::remove(hstable_manager_.GetFilepath(fileids[i]).c_str());
+        hstable_manager_.file_resource_manager.ClearAllDataForFileId(fileids[i]);
+      }
+      return s;
+    }
+    for (auto& filepath: filepaths) std::remove(filepath.c_str());
+    log::trace("StorageEngine::IngestFiles()", "Ingested %zu files", filepaths.size());
+    return Status::OK();
+  }
+  // END: Helpers for IngestFiles
+
+  // Sizes and numbers of the HSTables in each tier
+  void GetTierUsage(uint64_t* size_hot, uint64_t* size_cold, uint64_t* num_hot, uint64_t* num_cold) {
+    std::set<uint32_t> fileids_cold = hstable_manager_.GetFileidsCold();
+    *size_hot = *size_cold = *num_hot = *num_cold = 0;
+    for (auto fileid: hstable_manager_.file_resource_manager.GetFileids()) {
+      uint64_t filesize = hstable_manager_.file_resource_manager.GetFileSize(fileid);
+      if (fileids_cold.find(fileid) != fileids_cold.end()) {
+        *size_cold += filesize;
+        *num_cold += 1;
+      } else {
+        *size_hot += filesize;
+        *num_hot += 1;
+      }
+    }
+  }
+
   void ProcessingLoopData() {
     while(true) {
       // Wait for orders to process
@@ -241,10 +1200,10 @@ class StorageEngine {
       // Process orders, and create update map for the index
       AcquireWriteLock();
       std::multimap<uint64_t, uint64_t> map_index;
-      hstable_manager_.WriteOrdersAndFlushFile(orders, map_index);
+      Status s = hstable_manager_.WriteOrdersAndFlushFile(orders, map_index);
       ReleaseWriteLock();
 
-      event_manager_->flush_buffer.Done();
+      event_manager_->flush_buffer.Done(s);
       event_manager_->update_index.StartAndBlockUntilDone(map_index);
     }
   }
@@ -268,7 +1227,7 @@ class StorageEngine {
       }
       */
 
-      std::multimap<uint64_t, uint64_t> *index;
+      IndexMap *index;
       mutex_compaction_.lock();
       if (is_compaction_in_progress_) {
         index = &index_compaction_;
@@ -281,9 +1240,14 @@ class StorageEngine {
       int num_iterations_per_lock = db_options_.storage__num_index_iterations_per_lock;
       int counter_iterations = 0;
 
+      AcquireWriteLock();
       for (auto& p: index_updates) {
-        if (counter_iterations == 0) {
+        if (counter_iterations >= num_iterations_per_lock) {
+          // Throttling the index updates, and allows other processes
+          // to acquire the write lock if they need it
+          ReleaseWriteLock();
           AcquireWriteLock();
+          counter_iterations = 0;
         }
         counter_iterations += 1;
 
@@ -291,16 +1255,15 @@ class StorageEngine {
         //log::trace("StorageEngine::ProcessingLoopIndex()", "hash [%" PRIu64 "] location [%" PRIu64 "]", p.first, p.second);
         //mutex_index_.lock();
         index->insert(std::pair<uint64_t,uint64_t>(p.first, p.second));
+        filter_.Add(p.first);
         //mutex_index_.unlock();
-
-        // Throttling the index updates, and allows other processes
-        // to acquire the write lock if they need it
-        if (counter_iterations >= num_iterations_per_lock) {
-          ReleaseWriteLock();
-          counter_iterations = 0;
-        }
       }
-      if (counter_iterations) ReleaseWriteLock();
+
+      // The filter is kept within its false positive rate by rebuilding it
+      // larger once it has been filled
+      if (filter_.IsFull()) RebuildFilter();
+      if (memory_budget_ != nullptr) ChargeIndex();
+      ReleaseWriteLock();
 
       /*
       for (auto& p: index_) {
@@ -345,11 +1308,437 @@ class StorageEngine {
     return s;
   }
 
+  // Value-type version of Get(): the value is read into a buffer from 'pool'
+  // and returned through 'value_out'.
+  Status Get(const Slice& key, BufferPool* pool, Value* value_out, uint64_t *location_out=nullptr) {
+    EntryReader reader;
+    Status s = FindEntry(key, pool, &reader, location_out);
+    if (s.IsOK()) s = reader.ReadValue(pool, value_out);
+    ExitFindEntry();
+    return s;
+  }
+
+  // Same as above, and also returns the version of the entry
+  Status GetWithVersion(const Slice& key, BufferPool* pool, Value* value_out, uint64_t *version_out) {
+    EntryReader reader;
+    uint64_t location;
+    Status s = FindEntry(key, pool, &reader, &location);
+    if (s.IsOK()) {
+      *version_out = reader.header.GetVersion(location);
+      s = reader.ReadValue(pool, value_out);
+    }
+    ExitFindEntry();
+    return s;
+  }
+
+  // Returns the sizes and the version of the entry for 'key' from its header:
+  // the lookup stops once the key has been compared, and the value is neither
+  // read nor uncompressed. Any of the outputs can be null.
+  Status GetMetadata(const Slice& key,
+                     BufferPool* pool,
+                     uint64_t *size_value_out,
+                     uint64_t *size_value_compressed_out,
+                     uint64_t *version_out) {
+    EntryReader reader;
+    uint64_t location;
+    Status s = FindEntry(key, pool, &reader, &location);
+    if (s.IsOK()) {
+      if (size_value_out != nullptr) *size_value_out = reader.header.size_value;
+      if (size_value_compressed_out != nullptr) *size_value_compressed_out = reader.header.size_value_compressed;
+      if (version_out != nullptr) *version_out = reader.header.GetVersion(location);
+    }
+    ExitFindEntry();
+    return s;
+  }
+
+  // Reads the value for 'key' directly into the buffer of the caller. If the
+  // buffer is too small, InvalidArgument is returned and 'size_out' is set to
+  // the size of the value, so that the call can be retried.
+  Status GetInto(const Slice& key, BufferPool* pool, char *buffer, uint64_t size_buffer, uint64_t *size_out) {
+    EntryReader reader;
+    Status s = FindEntry(key, pool, &reader, nullptr);
+    if (s.IsOK()) {
+      *size_out = reader.header.size_value;
+      s = reader.ReadValueInto(pool, buffer, size_buffer);
+    }
+    ExitFindEntry();
+    return s;
+  }
+
+  // Reads the bytes [offset, offset+size) of the value for 'key'. The range
+  // is truncated at the end of the value, and InvalidArgument is returned if
+  // 'offset' is beyond the end of the value. The frame index of compressed
+  // values is built on the first range read and kept in a cache, so that the
+  // following reads can seek directly to the frames they need.
+  Status GetRange(const Slice& key, BufferPool* pool, uint64_t offset, uint64_t size, Value* value_out) {
+    EntryReader reader;
+    uint64_t location;
+    Status s = FindEntry(key, pool, &reader, &location);
+    if (s.IsOK()) s = ReadRange(&reader, location, pool, offset, size, value_out);
+    ExitFindEntry();
+    return s;
+  }
+
+  Status ReadRange(EntryReader* reader,
+                   uint64_t location,
+                   BufferPool* pool,
+                   uint64_t offset,
+                   uint64_t size,
+                   Value* value_out) {
+    uint64_t size_value = reader->header.size_value;
+    if (offset > size_value) return Status::InvalidArgument("Offset is beyond the end of the value");
+    size = std::min(size, size_value - offset);
+
+    std::shared_ptr<FrameIndex> index;
+    if (reader->header.IsCompressed()) {
+      index = frame_indices_.Get(location);
+      if (index == nullptr) {
+        index = std::make_shared<FrameIndex>();
+        Status s = reader->BuildFrameIndex(index.get());
+        if (!s.IsOK()) return s;
+        frame_indices_.Put(location, index);
+      }
+    }
+
+    char *dest = value_out->Allocate(pool, size);
+    Status s = reader->ReadRangeInto(pool, index.get(), offset, size, dest);
+    if (!s.IsOK()) value_out->Reset();
+    return s;
+  }
+
+  // Overwrites the bytes [offset, offset+data.size()) of the value of 'key' in
+  // place, without rewriting the rest of the value. Only the uncompressed
+  // entries of large HSTables can be modified in place, since regular
+  // HSTables are rewritten by the compaction process. The range cannot go
+  // beyond the end of the value.
+  // The change is made crash-safe with a RangeIntent, and the crc32 of the
+  // entry is updated from the bytes of the range alone: see PrepareRange().
+  // The entry is also given 'version', for a compare-and-swap based on the
+  // previous version to fail. Only the entries that have their version stored
+  // in their header can be modified, since the size of the header is fixed.
+  // The readers are excluded while the entry is modified, thus they see
+  // either the old or the new range, never a mix of both.
+  // The snapshots, the iterators and the change streams read the HSTables
+  // without being counted as readers, and rely on closed HSTables never
+  // changing: no range can be written while any of them is open, and Conflict
+  // is returned instead. None can be opened while a range is written either.
+  Status PutRange(const Slice& key,
+                  BufferPool* pool,
+                  uint64_t offset,
+                  const Slice& data,
+                  uint64_t version) {
+    if (is_read_only_) return Status::IOError("Cannot write to a read-only database");
+    // Same lock order as MoveColdFiles()
+    std::unique_lock<std::mutex> lock_snapshot(mutex_snapshot_);
+    std::unique_lock<std::mutex> lock(mutex_put_range_);
+    std::unique_lock<std::mutex> lock_pins(mutex_change_pins_);
+    if (!snapshotids_to_fileids_.empty() || !change_pins_.empty()) {
+      return Status::Conflict("Cannot write a range while snapshots, iterators or change streams are open");
+    }
+
+    EntryReader reader;
+    uint64_t location;
+    RangeIntent intent;
+    Status s = FindEntry(key, pool, &reader, &location);
+    if (s.IsOK()) s = PrepareRange(&reader, location, pool, offset, data, version, &intent);
+    ExitFindEntry();
+    if (!s.IsOK() || intent.data.empty()) return s;
+
+    s = intent.WriteTo(filepath_range_intent_, dirpath_ranges_);
+    if (!s.IsOK()) return s;
+
+    // If the intent cannot be applied, it is left on disk and will be applied
+    // again the next time the database is opened.
+    AcquireWriteLock();
+    s = intent.ApplyTo(hstable_manager_.GetFilepath(intent.fileid));
+    ReleaseWriteLock();
+    if (!s.IsOK()) return s;
+    return RemoveRangeIntent();
+  }
+
+  // Checks that the range can be written to the entry open in 'reader', and
+  // fills 'intent' with the changes to make to the HSTable. 'intent' is left
+  // empty if there is nothing to write.
+  Status PrepareRange(EntryReader* reader,
+                      uint64_t location,
+                      BufferPool* pool,
+                      uint64_t offset,
+                      const Slice& data,
+                      uint64_t version,
+                      RangeIntent* intent) {
+    uint32_t fileid = (location & 0xFFFFFFFF00000000) >> 32;
+    if (!hstable_manager_.file_resource_manager.IsFileLarge(fileid)) {
+      return Status::InvalidArgument("Only the values of large entries can be overwritten in place");
+    }
+    if (reader->header.IsCompressed()) {
+      return Status::InvalidArgument("Compressed values cannot be overwritten in place");
+    }
+    if (!reader->header.HasVersion()) {
+      return Status::InvalidArgument("Entries without a version cannot be overwritten in place");
+    }
+    uint64_t size_value = reader->header.size_value;
+    if (offset > size_value || data.size() > size_value - offset) {
+      return Status::InvalidArgument("Range is beyond the end of the value");
+    }
+    if (data.size() == 0) return Status::OK();
+
+    // The crc32 of the entry covers [header, key, before, range, after]. Since
+    // crc32(A|B) = shift(crc32(A), size(B)) ^ crc32(B), the crc32 of the entry
+    // only changes by shift(crc32(range_old) ^ crc32(range_new), size(after)),
+    // and the shift is what crc32c::Combine() applies when the crc32 of the
+    // second segment is zero. The version, which is the last field of the
+    // header, changes the crc32 in the same way.
+    Value range_old;
+    char *buffer = range_old.Allocate(pool, data.size());
+    Status s = reader->ReadRangeInto(pool, nullptr, offset, data.size(), buffer);
+    if (!s.IsOK()) return s;
+    uint32_t crc32_delta = crc32c::Value(buffer, data.size()) ^ crc32c::Value(data.data(), data.size());
+    uint64_t size_after = size_value - offset - data.size();
+    while (size_after > 0) {
+      // Combine() takes 32-bit lengths
+      uint64_t size_shift = std::min(size_after, (uint64_t)1 << 30);
+      crc32_delta = crc32c::Combine(crc32_delta, 0, size_shift);
+      size_after -= size_shift;
+    }
+    char version_old[8], version_new[8];
+    EncodeFixed64(version_old, reader->header.version);
+    EncodeFixed64(version_new, version);
+    uint32_t crc32_delta_version = crc32c::Value(version_old, 8) ^ crc32c::Value(version_new, 8);
+    size_after = reader->header.size_key + size_value;
+    while (size_after > 0) {
+      uint64_t size_shift = std::min(size_after, (uint64_t)1 << 30);
+      crc32_delta_version = crc32c::Combine(crc32_delta_version, 0, size_shift);
+      size_after -= size_shift;
+    }
+    crc32_delta ^= crc32_delta_version;
+
+    intent->fileid = fileid;
+    intent->offset_crc32 = reader->offset_file;
+    intent->crc32 = reader->header.crc32 ^ crc32_delta;
+    intent->offset_version = reader->offset_file + reader->size_header - 8;
+    intent->version = version;
+    intent->offset_data = reader->offset_file + reader->offset_value() + offset;
+    intent->data.assign(data.data(), data.size());
+    return Status::OK();
+  }
+
+  // Applies the intent of a PutRange() that was interrupted by a crash.
+  Status RecoverRangeIntent() {
+    struct stat info;
+    if (   stat(dirpath_ranges_.c_str(), &info) != 0
+        && mkdir(dirpath_ranges_.c_str(), 0755) < 0) {
+      return Status::IOError("Could not create range intent directory", strerror(errno));
+    }
+    RangeIntent intent;
+    Status s = RangeIntent::ReadFrom(filepath_range_intent_, &intent);
+    if (s.IsNotFound()) return Status::OK();
+    if (s.IsOK()) {
+      log::warn("StorageEngine::RecoverRangeIntent()", "Applying range intent on file [%u]", intent.fileid);
+      s = intent.ApplyTo(hstable_manager_.GetFilepath(intent.fileid));
+      if (!s.IsOK()) return s;
+    } else {
+      // The intent was not entirely written, thus the HSTable was not modified
+      log::warn("StorageEngine::RecoverRangeIntent()", "Discarding range intent: %s", s.ToString().c_str());
+    }
+    return RemoveRangeIntent();
+  }
+
+  Status RemoveRangeIntent() {
+    if (std::remove(filepath_range_intent_.c_str()) != 0) {
+      return Status::IOError("Could not remove range intent", strerror(errno));
+    }
+    return FileUtil::sync_directory(dirpath_ranges_.c_str());
+  }
+
+  // Locates the entry for 'key' and leaves it open in 'reader'. The files are
+  // protected from compactions until ExitFindEntry() is called, which must be
+  // done once the value has been read, whatever the returned status.
+  Status FindEntry(const Slice& key, BufferPool* pool, EntryReader* reader, uint64_t *location_out) {
+    mutex_write_.lock();
+    mutex_read_.lock();
+    num_readers_ += 1;
+    mutex_read_.unlock();
+    mutex_write_.unlock();
+
+    bool has_compaction_index = false;
+    mutex_compaction_.lock();
+    has_compaction_index = is_compaction_in_progress_;
+    mutex_compaction_.unlock();
+
+    Status s;
+    if (!has_compaction_index) {
+      s = FindEntryWithIndex(index_, key, pool, reader, location_out);
+    } else {
+      s = FindEntryWithIndex(index_compaction_, key, pool, reader, location_out);
+      if (!s.IsOK()) s = FindEntryWithIndex(index_, key, pool, reader, location_out);
+    }
+    return s;
+  }
+
+  void ExitFindEntry() {
+    mutex_read_.lock();
+    num_readers_ -= 1;
+    mutex_read_.unlock();
+    cv_read_.notify_one();
+  }
+
   // IMPORTANT: value_out must be deleled by the caller
-  Status GetWithIndex(std::multimap<uint64_t, uint64_t>& index,
+  Status GetWithIndex(IndexMap& index,
                       ByteArray* key,
                       ByteArray** value_out,
                       uint64_t *location_out=nullptr) {
+    return (this->*get_with_index_)(index, key, value_out, location_out);
+  }
+
+  Status FindEntryWithIndex(IndexMap& index,
+                            const Slice& key,
+                            BufferPool* pool,
+                            EntryReader* reader,
+                            uint64_t *location_out=nullptr) {
+    return (this->*find_entry_with_index_)(index, key, pool, reader, location_out);
+  }
+
+  // IMPORTANT: key_out and value_out must be deleted by the caller
+  Status GetEntry(uint64_t location,
+                  ByteArray **key_out,
+                  ByteArray **value_out) {
+    return (this->*get_entry_)(location, key_out, value_out);
+  }
+
+  // The hashing function and the compression type are fixed when a database
+  // is created, thus the read path is specialized on them once when the
+  // storage engine is opened: the hashing and the decoding of entry headers
+  // are then inlined, with no virtual call nor branching on the options.
+  void SelectHotPaths() {
+    bool c = (db_options_.compression.type != kNoCompression);
+    if (db_options_.hash == kMurmurHash3_64) {
+      get_with_index_ = c ? &StorageEngine::GetWithIndexT<MurmurHash3, true>
+                          : &StorageEngine::GetWithIndexT<MurmurHash3, false>;
+    } else if (db_options_.hash == kxxHash_64) {
+      get_with_index_ = c ? &StorageEngine::GetWithIndexT<xxHash, true>
+                          : &StorageEngine::GetWithIndexT<xxHash, false>;
+    } else {
+      log::emerg("StorageEngine", "Unknown hashing function: [%d]", db_options_.hash);
+      exit(-1);
+    }
+    if (db_options_.hash == kMurmurHash3_64) {
+      find_entry_with_index_ = c ? &StorageEngine::FindEntryWithIndexT<MurmurHash3, true>
+                                 : &StorageEngine::FindEntryWithIndexT<MurmurHash3, false>;
+    } else {
+      find_entry_with_index_ = c ? &StorageEngine::FindEntryWithIndexT<xxHash, true>
+                                 : &StorageEngine::FindEntryWithIndexT<xxHash, false>;
+    }
+    get_entry_ = c ? &StorageEngine::GetEntryT<true> : &StorageEngine::GetEntryT<false>;
+  }
+
+  template<class HashT, bool kHasCompressedSize>
+  Status FindEntryWithIndexT(IndexMap& index,
+                             const Slice& key,
+                             BufferPool* pool,
+                             EntryReader* reader,
+                             uint64_t *location_out) {
+    uint64_t hashed_key = HashT::Compute(key.data(), key.size());
+    if (!filter_.MayContain(hashed_key)) {
+      return Status::NotFound("Unable to find the entry in the storage engine");
+    }
+    auto range = index.equal_range(hashed_key);
+    // Iterating from the most recent entry to the oldest one, with reverse
+    // iterators since decrementing begin() is undefined.
+    IndexMap::reverse_iterator rbegin(range.second), rend(range.first);
+    for (auto it = rbegin; it != rend; ++it) {
+      reader->Reset();
+      Status s = ReadEntryHeadT<kHasCompressedSize>(it->second, key, pool, reader);
+      if (s.IsNotFound()) continue; // hashed key collision
+      if (s.IsRemoveOrder()) {
+        return Status::NotFound("Unable to find the entry in the storage engine (remove order)");
+      }
+      if (!s.IsOK()) {
+        log::emerg("StorageEngine::FindEntryWithIndex()", "Could not read entry at location %" PRIu64 ": %s", it->second, s.ToString().c_str());
+        continue;
+      }
+      if (location_out != nullptr) *location_out = it->second;
+      return s;
+    }
+    reader->Reset();
+    return Status::NotFound("Unable to find the entry in the storage engine");
+  }
+
+  // Reads the head of the entry at 'location' with pread() into a pooled
+  // buffer, and leaves the HSTable open in 'reader' for the value to be read.
+  // This is the read path of the value-type API: unlike GetEntry(), it doesn't
+  // mmap() the HSTable or allocate any ByteArray.
+  // Returns NotFound if the key of the entry is not 'key'.
+  template<bool kHasCompressedSize>
+  Status ReadEntryHeadT(uint64_t location,
+                        const Slice& key,
+                        BufferPool* pool,
+                        EntryReader* reader) {
+    uint32_t fileid = (location & 0xFFFFFFFF00000000) >> 32;
+    uint32_t offset_file = location & 0x00000000FFFFFFFF;
+    uint64_t filesize = hstable_manager_.HasColdTier() ? hstable_manager_.file_resource_manager.GetFileSizeForRead(fileid)
+                                                       : hstable_manager_.file_resource_manager.GetFileSize(fileid);
+    if (offset_file >= filesize) return Status::IOError("Invalid location");
+
+    char filepath[FileUtil::maximum_path_size()];
+    if (!hstable_manager_.GetFilepath(fileid, filepath, FileUtil::maximum_path_size())) {
+      return Status::IOError("Filepath buffer is too small");
+    }
+    reader->is_direct = db_options_.storage__direct_io;
+    if (reader->is_direct) {
+      reader->fd = open(filepath, O_RDONLY|O_DIRECT);
+      if (reader->fd < 0 && errno == EINVAL) reader->is_direct = false;
+    }
+    if (!reader->is_direct) reader->fd = open(filepath, O_RDONLY);
+    if (reader->fd < 0) {
+      return Status::IOError("Could not open file", strerror(errno));
+    }
+    reader->offset_file = offset_file;
+    reader->pool = pool;
+
+    // Most entries are small, thus the first read is large enough for the
+    // header, the key and a small value.
+    uint64_t size_read = std::min(filesize - offset_file, kSizeReadEntryFirst + key.size());
+    char *buffer;
+    if (!reader->is_direct) {
+      buffer = reader->head.Allocate(pool, size_read);
+      if (pread(reader->fd, buffer, size_read, offset_file) != (ssize_t)size_read) {
+        return Status::IOError("Could not read entry", strerror(errno));
+      }
+    } else {
+      uint64_t begin = FileUtil::align_down(offset_file);
+      uint64_t end = FileUtil::align_up(offset_file + size_read);
+      reader->offset_head = offset_file - begin;
+      char *buffer_aligned = reader->head.Allocate(pool, end - begin);
+      ssize_t size_read_aligned = pread(reader->fd, buffer_aligned, end - begin, begin);
+      if (size_read_aligned < (ssize_t)(reader->offset_head + size_read)) {
+        return Status::IOError("Could not read entry", strerror(errno));
+      }
+      reader->head.SetWindow(reader->offset_head, size_read);
+      buffer = buffer_aligned + reader->offset_head;
+    }
+
+    struct EntryHeader& entry_header = reader->header;
+    Status s = EntryHeader::DecodeFrom<kHasCompressedSize>(buffer, size_read, &entry_header, &reader->size_header);
+    if (   !s.IsOK()
+        || !entry_header.AreSizesValid(offset_file, filesize)
+        || !entry_header.IsEntryFull()) {
+      return Status::IOError("Entry has invalid header");
+    }
+
+    if (   entry_header.size_key != key.size()
+        || reader->size_header + key.size() > size_read
+        || memcmp(buffer + reader->size_header, key.data(), key.size()) != 0) {
+      return Status::NotFound("");
+    }
+    if (entry_header.IsTypeRemove()) return Status::RemoveOrder();
+    return Status::OK();
+  }
+
+  template<class HashT, bool kHasCompressedSize>
+  Status GetWithIndexT(IndexMap& index,
+                       ByteArray* key,
+                       ByteArray** value_out,
+                       uint64_t *location_out) {
     //std::unique_lock<std::mutex> lock(mutex_index_);
     // TODO-26: should not be locking here, instead, should store the hashed key
     // and location from the index and release the lock right away -- should not
@@ -359,13 +1748,17 @@ class StorageEngine {
 
     // NOTE: Since C++11, the relative ordering of elements with equivalent keys
     //       in a multimap is preserved.
-    uint64_t hashed_key = hash_->HashFunction(key->data(), key->size());
+    uint64_t hashed_key = HashT::Compute(key->data(), key->size());
+    if (!filter_.MayContain(hashed_key)) {
+      return Status::NotFound("Unable to find the entry in the storage engine");
+    }
     auto range = index.equal_range(hashed_key);
-    auto rbegin = --range.second;
-    auto rend  = --range.first;
-    for (auto it = rbegin; it != rend; --it) {
+    // Iterating from the most recent entry to the oldest one, with reverse
+    // iterators since decrementing begin() is undefined.
+    IndexMap::reverse_iterator rbegin(range.second), rend(range.first);
+    for (auto it = rbegin; it != rend; ++it) {
       ByteArray *key_temp = nullptr;
-      Status s = GetEntry(it->second, &key_temp, value_out);
+      Status s = GetEntryT<kHasCompressedSize>(it->second, &key_temp, value_out);
       log::trace("StorageEngine::GetWithIndex()", "key ptr:[%p]", key);
       //log::trace("StorageEngine::GetWithIndex()", "key:[%s] key_temp:[%s] hashed_key:[%" PRIu64 "] hashed_key_temp:[%" PRIu64 "] size_key:[%" PRIu64 "] size_key_temp:[%" PRIu64 "]", key->ToString().c_str(), key_temp->ToString().c_str(), hashed_key, it->first, key->size(), key_temp->size());
       //std::string temp(key_temp->data(), key_temp->size());
@@ -386,10 +1779,10 @@ class StorageEngine {
     return Status::NotFound("Unable to find the entry in the storage engine");
   }
 
-  // IMPORTANT: key_out and value_out must be deleted by the caller
-  Status GetEntry(uint64_t location,
-                  ByteArray **key_out,
-                  ByteArray **value_out) {
+  template<bool kHasCompressedSize>
+  Status GetEntryT(uint64_t location,
+                   ByteArray **key_out,
+                   ByteArray **value_out) {
     log::trace("StorageEngine::GetEntry()", "start");
     Status s = Status::OK();
     // TODO: check that the offset falls into the
@@ -403,7 +1796,8 @@ class StorageEngine {
     uint64_t filesize = 0;
     // NOTE: used to be in mutex_write_ and mutex_read_ -- if crashing, put the
     //       mutexes back
-    filesize = hstable_manager_.file_resource_manager.GetFileSize(fileid);
+    filesize = hstable_manager_.HasColdTier() ? hstable_manager_.file_resource_manager.GetFileSizeForRead(fileid)
+                                              : hstable_manager_.file_resource_manager.GetFileSize(fileid);
 
     log::trace("StorageEngine::GetEntry()", "location:%" PRIu64 " fileid:%u offset_file:%u filesize:%" PRIu64, location, fileid, offset_file, filesize);
     std::string filepath = hstable_manager_.GetFilepath(fileid); // TODO: optimize here
@@ -417,7 +1811,7 @@ class StorageEngine {
 
     struct EntryHeader entry_header;
     uint32_t size_header;
-    s = EntryHeader::DecodeFrom(db_options_, value_temp->datafile() + offset_file, filesize - offset_file, &entry_header, &size_header);
+    s = EntryHeader::DecodeFrom<kHasCompressedSize>(value_temp->datafile() + offset_file, filesize - offset_file, &entry_header, &size_header);
     if (!s.IsOK()) return s;
 
     if (   !entry_header.AreSizesValid(offset_file, filesize)
@@ -433,15 +1827,15 @@ class StorageEngine {
     uint32_t crc32_headerkey = crc32c::Value(value_temp->datafile() + offset_file + 4, size_header + entry_header.size_key - 4);
     value_temp->SetInitialCRC32(crc32_headerkey);
 
+    log::debug("StorageEngine::GetEntry()", "mmap() out - type remove:%d", entry_header.IsTypeRemove());
+    log::trace("StorageEngine::GetEntry()", "Sizes: key_temp:%" PRIu64 " value_temp:%" PRIu64 " size_value_compressed:%" PRIu64 " filesize:%" PRIu64, key_temp->size(), value_temp->size(), value_temp->size_compressed(), filesize);
+
     if (entry_header.IsTypeRemove()) {
       s = Status::RemoveOrder();
       delete value_temp;
       value_temp = nullptr;
     }
 
-    log::debug("StorageEngine::GetEntry()", "mmap() out - type remove:%d", entry_header.IsTypeRemove());
-    log::trace("StorageEngine::GetEntry()", "Sizes: key_temp:%" PRIu64 " value_temp:%" PRIu64 " size_value_compressed:%" PRIu64 " filesize:%" PRIu64, key_temp->size(), value_temp->size(), value_temp->size_compressed(), filesize);
-
     *key_out = key_temp;
     *value_out = value_temp;
     return s;
@@ -481,7 +1875,7 @@ class StorageEngine {
 
     // Before the compaction starts, make sure all compaction-related files are removed
     Status s;
-    s = FileUtil::remove_files_with_prefix(dbname.c_str(), prefix_compaction_);
+    s = hstable_manager_.RemoveFilesWithPrefix(prefix_compaction_);
     if (!s.IsOK()) return Status::IOError("Could not clean up previous compaction", dbname.c_str());
 
     // 1a. Get *all* the files that are candidates for compaction
@@ -489,7 +1883,7 @@ class StorageEngine {
     //       through all the files. Fix that to be only the latest non-handled
     //       uncompacted files
     log::trace("Compaction()", "Step 1: Get files between fileids %u and %u", fileid_start, fileid_end_target);
-    std::multimap<uint64_t, uint64_t> index_compaction;
+    IndexMap index_compaction;
     DIR *directory;
     struct dirent *entry;
     if ((directory = opendir(dbname.c_str())) == NULL) {
@@ -675,7 +2069,7 @@ class StorageEngine {
       if (!s.IsOK()) {
         // TODO: the cleanup of the compaction (removals, etc.) should be
         //       mutualized in the processing loop
-        FileUtil::remove_files_with_prefix(dbname.c_str(), prefix_compaction_);
+        hstable_manager_.RemoveFilesWithPrefix(prefix_compaction_);
         return s;
       }
       fileid_compaction += 1;
@@ -812,7 +2206,11 @@ class StorageEngine {
                                  entry_header.size_value,
                                  entry_header.size_value_compressed,
                                  crc32,
-                                 is_large});
+                                 is_large,
+                                 false,
+                                 0,
+                                 false,
+                                 entry_header.version});
         }
         offset += size_header + entry_header.size_key + entry_header.size_value_offset();
       }
@@ -832,13 +2230,27 @@ class StorageEngine {
     hstable_manager_compaction_.WriteOrdersAndFlushFile(orders, map_index);
     hstable_manager_compaction_.CloseCurrentFile();
     orders.clear();
+    for (auto& p: mmaps) {
+      std::string filepath = p.second->filepath();
+      delete p.second;
+      // The files compacted are only removed once no snapshot or iterator
+      // holds them, which can take a while. Their pages can only be dropped
+      // once they are unmapped, hence the files are opened again.
+      int fd;
+      if (   db_options_.compaction__drop_cache_inputs
+          && (fd = open(filepath.c_str(), O_RDONLY)) >= 0) {
+        FileUtil::drop_cache(fd, 0, 0, false);
+        close(fd);
+      }
+    }
     mmaps.clear();
     if (IsStopRequested()) return Status::IOError("Stop was requested");
 
 
-    // 8. Get fileid range from hstable_manager_
+    // 8. Get fileid range from hstable_manager_. The offset keeps each file in
+    //    the data directory it was written to, so that it can be renamed.
     uint32_t num_files_compacted = hstable_manager_compaction_.GetSequenceFileId();
-    uint32_t offset_fileid = hstable_manager_.IncrementSequenceFileId(num_files_compacted) - num_files_compacted;
+    uint32_t offset_fileid = hstable_manager_.ReserveSequenceFileIdsAligned(num_files_compacted);
     log::trace("Compaction()", "Step 8: num_files_compacted:%u offset_fileid:%u", num_files_compacted, offset_fileid);
     if (IsStopRequested()) return Status::IOError("Stop was requested");
 
@@ -945,29 +2357,50 @@ class StorageEngine {
     mutex_compaction_.lock();
     is_compaction_in_progress_ = false;
     mutex_compaction_.unlock();
+    // The filter still has the keys that were compacted away, thus a new
+    // one is built for the index that comes out of the compaction
+    RebuildFilter();
+    if (memory_budget_ != nullptr) ChargeIndex();
     ReleaseWriteLock();
     if (IsStopRequested()) return Status::IOError("Stop was requested");
 
 
     // 14. Remove compacted files
     log::trace("Compaction()", "Step 14: Remove compacted files");
-    mutex_snapshot_.lock();
+    std::set<uint32_t> fileids_remove;
+    for (auto& fileid: fileids_compaction) {
+      if (fileids_largefiles_keep.find(fileid) != fileids_largefiles_keep.end()) continue;
+      fileids_remove.insert(fileid);
+    }
+    RemoveUnusedFiles(fileids_remove);
+    if (IsStopRequested()) return Status::IOError("Stop was requested");
+
+    // Cleanup pre-allocated files
+    hstable_manager_.RemoveFilesWithPrefix(prefix_compaction_);
+ 
+    return Status::OK();
+  }
+
+  // Removes files that are no longer referenced by the index. If snapshots are
+  // in progress, the files are only marked, and they are removed when the
+  // snapshots are released.
+  void RemoveUnusedFiles(const std::set<uint32_t>& fileids) {
+    std::unique_lock<std::mutex> lock(mutex_snapshot_);
     if (snapshotids_to_fileids_.size() == 0) {
       // No snapshots are in progress, remove the files on the spot
-      for (auto& fileid: fileids_compaction) {
-        if (fileids_largefiles_keep.find(fileid) != fileids_largefiles_keep.end()) continue;
-        log::trace("Compaction()", "Removing [%s]", hstable_manager_.GetFilepath(fileid).c_str());
+      for (auto& fileid: fileids) {
+        log::trace("StorageEngine::RemoveUnusedFiles()", "Removing [%s]", hstable_manager_.GetFilepath(fileid).c_str());
         // TODO: free memory associated with the removed file in the file resource manager
         if (std::remove(hstable_manager_.GetFilepath(fileid).c_str()) != 0) {
-          log::emerg("Compaction()", "Could not remove file [%s]", hstable_manager_.GetFilepath(fileid).c_str());
+          log::emerg("StorageEngine::RemoveUnusedFiles()", "Could not remove file [%s]", hstable_manager_.GetFilepath(fileid).c_str());
         }
         hstable_manager_.file_resource_manager.ClearAllDataForFileId(fileid);
+        hstable_manager_.ClearFileCold(fileid);
       }
     } else {
       // Snapshots are in progress, therefore mark the files and they will be removed when the snapshots are released
       int num_snapshots = snapshotids_to_fileids_.size();
-      for (auto& fileid: fileids_compaction) {
-        if (fileids_largefiles_keep.find(fileid) != fileids_largefiles_keep.end()) continue;
+      for (auto& fileid: fileids) {
         for (auto& p: snapshotids_to_fileids_) {
           snapshotids_to_fileids_[p.first].insert(fileid);
         }
@@ -980,18 +2413,11 @@ class StorageEngine {
         std::string filepath_lock = hstable_manager_.GetLockFilepath(fileid);
         int fd;
         if ((fd = open(filepath_lock.c_str(), O_WRONLY|O_CREAT, 0644)) < 0) {
-          log::emerg("StorageEngine::Compaction()", "Could not open file [%s]: %s", filepath_lock.c_str(), strerror(errno));
+          log::emerg("StorageEngine::RemoveUnusedFiles()", "Could not open file [%s]: %s", filepath_lock.c_str(), strerror(errno));
         }
         close(fd);
       }
     }
-    mutex_snapshot_.unlock();
-    if (IsStopRequested()) return Status::IOError("Stop was requested");
-
-    // Cleanup pre-allocated files
-    FileUtil::remove_files_with_prefix(dbname.c_str(), prefix_compaction_);
- 
-    return Status::OK();
   }
 
   // START: Helpers for Snapshots
@@ -999,6 +2425,9 @@ class StorageEngine {
   Status GetNewSnapshotData(uint32_t *snapshot_id, std::set<uint32_t> **fileids_ignore) {
     std::unique_lock<std::mutex> lock(mutex_snapshot_);
     *snapshot_id = IncrementSequenceSnapshot(1);
+    // The snapshot is registered for the files it may read to be kept until
+    // it is released
+    snapshotids_to_fileids_[*snapshot_id];
     *fileids_ignore = new std::set<uint32_t>();
     for (auto& p: num_references_to_unused_files_) {
       (*fileids_ignore)->insert(p.first);
@@ -1022,6 +2451,7 @@ class StorageEngine {
           log::emerg("ReleaseSnapshot()", "Could not lock file [%s]", hstable_manager_.GetLockFilepath(fileid).c_str());
         }
         hstable_manager_.file_resource_manager.ClearAllDataForFileId(fileid);
+        hstable_manager_.ClearFileCold(fileid);
         num_references_to_unused_files_.erase(fileid);
       } else {
         num_references_to_unused_files_[fileid] -= 1;
@@ -1033,8 +2463,15 @@ class StorageEngine {
   }
 
   Status ReleaseAllSnapshots() {
-    for (auto& p: snapshotids_to_fileids_) {
-      Status s = ReleaseSnapshot(p.first);
+    // ReleaseSnapshot() erases the snapshots from the map
+    while (true) {
+      uint32_t snapshot_id;
+      {
+        std::unique_lock<std::mutex> lock(mutex_snapshot_);
+        if (snapshotids_to_fileids_.empty()) break;
+        snapshot_id = snapshotids_to_fileids_.begin()->first;
+      }
+      Status s = ReleaseSnapshot(snapshot_id);
       if (!s.IsOK()) return s;
     }
     return Status::OK();
@@ -1067,6 +2504,30 @@ class StorageEngine {
   // END: Helpers for Snapshots
 
  private:
+  // Adjusts what the index is charged to the memory budget to its current
+  // size, which is the size of the huge pages its arena holds on to, not the
+  // one of its nodes. Must be called with the write lock held, or before the
+  // threads start.
+  void ChargeIndex() {
+    uint64_t size_index = arena_index_.GetSizeRetained() + filter_.size();
+    if (size_index > size_index_charged_) {
+      memory_budget_->Charge(size_index - size_index_charged_);
+    } else {
+      memory_budget_->Release(size_index_charged_ - size_index);
+    }
+    size_index_charged_ = size_index;
+  }
+
+  // Rebuilds the key filter from the index, with room for the index to double
+  // in size. Must be called with the write lock held, or before the threads
+  // start.
+  void RebuildFilter() {
+    filter_.Reset(2 * (index_.size() + index_compaction_.size()));
+    for (IndexMap* index: {&index_, &index_compaction_}) {
+      for (auto& p: *index) filter_.Add(p.first);
+    }
+  }
+
   void AcquireWriteLock() {
     // Also waits for readers to finish
     // NOTE: should this be made its own templated class?
@@ -1085,11 +2546,17 @@ class StorageEngine {
   // Options
   DatabaseOptions db_options_;
   EventManager *event_manager_;
-  Hash *hash_;
+  Status (StorageEngine::*get_with_index_)(IndexMap&, ByteArray*, ByteArray**, uint64_t*);
+  Status (StorageEngine::*get_entry_)(uint64_t, ByteArray**, ByteArray**);
+  Status (StorageEngine::*find_entry_with_index_)(IndexMap&, const Slice&, BufferPool*, EntryReader*, uint64_t*);
+  static const uint64_t kSizeReadEntryFirst = 4096;
   bool is_read_only_;
   std::set<uint32_t>* fileids_ignore_;
   std::string prefix_compaction_;
+  std::string prefix_ingest_;
   std::string dirpath_locks_;
+  std::string dirpath_ranges_;
+  std::string filepath_range_intent_;
 
   // Data
   std::string dbname_;
@@ -1101,9 +2568,15 @@ class StorageEngine {
   std::mutex mutex_write_;
   int num_readers_;
 
-  // Index
-  std::multimap<uint64_t, uint64_t> index_;
-  std::multimap<uint64_t, uint64_t> index_compaction_;
+  // Index: the nodes of both indexes are allocated from the arena of the
+  // storage engine, which must be declared before them
+  HugePageArena arena_index_;
+  IndexMap index_;
+  IndexMap index_compaction_;
+  // Filter over the hashed keys of both indexes, which lets the lookups of
+  // missing keys return without searching them. Protected by the write lock,
+  // as the indexes are.
+  KeyFilter filter_;
   std::thread thread_index_;
   //std::mutex mutex_index_;
 
@@ -1122,6 +2595,26 @@ class StorageEngine {
   std::condition_variable cv_statistics_;
   uint64_t fs_free_space_; // in bytes
 
+  // Range reads and writes
+  FrameIndexCache frame_indices_;
+  std::mutex mutex_put_range_;
+
+  // Tiered storage
+  std::vector<std::string> filepaths_hot_moved_;
+
+  // Cache mode and change streams
+  std::mutex mutex_timestamps_;
+  std::map<uint32_t, uint64_t> timestamps_;
+  std::mutex mutex_change_pins_;
+  std::map<uint64_t, uint32_t> change_pins_;
+  uint64_t sequence_change_pin_;
+
+  // Memory budget
+  MemoryBudget* memory_budget_;
+  uint64_t size_index_charged_;
+  uint64_t size_buffers_charged_;
+  uint64_t id_reclaimer_;
+
   // Snapshot
   std::mutex mutex_snapshot_;
   std::map< uint32_t, std::set<uint32_t> > snapshotids_to_fileids_;
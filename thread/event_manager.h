@@ -19,13 +19,15 @@ class Event {
  public:
   Event() { has_data = false; }
 
-  void StartAndBlockUntilDone(T& data) {
+  // Returns the status passed to Done() by the thread that handled the event
+  Status StartAndBlockUntilDone(T& data) {
     std::unique_lock<std::mutex> lock_start(mutex_unique_);
     std::unique_lock<std::mutex> lock(mutex_);
     data_ = data;
     has_data = true;
     cv_ready_.notify_one();
     cv_done_.wait(lock);
+    return status_;
   }
 
   T Wait() {
@@ -36,8 +38,9 @@ class Event {
     return data_;
   }
 
-  void Done() {
+  void Done(const Status& status=Status::OK()) {
     std::unique_lock<std::mutex> lock(mutex_);
+    status_ = status;
     has_data = false;
     cv_done_.notify_one();
   }
@@ -48,6 +51,7 @@ class Event {
 
  private:
   T data_;
+  Status status_;
   bool has_data;
   std::mutex mutex_;        // protect the data held in the object
   std::mutex mutex_unique_; // make sure only one thread can enter the Start method
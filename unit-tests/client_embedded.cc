@@ -98,19 +98,17 @@ int main() {
     //std::cout << "value: ";
 
     kdb::ByteArray *value = iterator->GetValue();
-    char *chunk;
+    char chunk[4096];
     uint64_t size_chunk;
     kdb::Status s;
     while (true) {
-      s = value->data_chunk(&chunk, &size_chunk);
+      s = value->ReadInto(chunk, sizeof(chunk), &size_chunk);
       if (s.IsDone()) break;
       if (!s.IsOK()) {
-        delete[] chunk;
-        fprintf(stderr, "ClientEmbedded - Error - data_chunk(): %s", s.ToString().c_str());
+        fprintf(stderr, "ClientEmbedded - Error - ReadInto(): %s", s.ToString().c_str());
         break;
       }
       //std::cout << std::string(chunk, size_chunk);
-      delete[] chunk;
     }
     //std::cout << std::endl;
     //std::cout << std::endl;
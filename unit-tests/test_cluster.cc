@@ -0,0 +1,192 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include <thread>
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "network/cluster_client.h"
+#include "util/status.h"
+
+#include "unit-tests/testharness.h"
+
+namespace kdb {
+
+// Starts local server processes, with the binary given by the environment
+// variable KINGDB_SERVER, or ./server by default.
+class ClusterTest {
+ public:
+  ClusterTest() {
+    const char* path = getenv("KINGDB_SERVER");
+    path_server_ = (path != nullptr) ? path : "./server";
+  }
+
+  ~ClusterTest() {
+    StopServers();
+  }
+
+  void StartServers(int num_servers, int port_first) {
+    for (int i = 0; i < num_servers; i++) {
+      std::string dbname = "db_test_cluster_" + std::to_string(i);
+      std::string command = "rm -rf " + dbname;
+      if (system(command.c_str()) != 0) fprintf(stderr, "Could not remove %s\n", dbname.c_str());
+      std::string arg_dbname = "--db.path=" + dbname;
+      std::string arg_port = "--server.interface.memcached_port=" + std::to_string(port_first + i);
+      pid_t pid = fork();
+      if (pid == 0) {
+        execl(path_server_.c_str(), path_server_.c_str(), arg_dbname.c_str(), arg_port.c_str(), "--log_level=emerg", (char*)nullptr);
+        fprintf(stderr, "Could not start server [%s]: %s\n", path_server_.c_str(), strerror(errno));
+        _exit(1);
+      }
+      pids_.push_back(pid);
+      servers_.push_back("127.0.0.1:" + std::to_string(port_first + i));
+    }
+  }
+
+  void StopServers() {
+    for (auto pid: pids_) kill(pid, SIGTERM);
+    for (auto pid: pids_) waitpid(pid, nullptr, 0);
+    pids_.clear();
+    servers_.clear();
+  }
+
+  // Waits until every server accepts writes
+  Status WaitForServers(ClusterClient& client) {
+    for (size_t i = 0; i < servers_.size(); i++) {
+      Status s;
+      for (int k = 0; k < 100; k++) {
+        std::string key = "wait-" + std::to_string(k);
+        if (client.GetServer(key) != servers_[i]) continue;
+        for (int retry = 0; retry < 50; retry++) {
+          s = client.Put(key, "ready");
+          if (s.IsOK()) break;
+          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        break;
+      }
+      if (!s.IsOK()) return s;
+    }
+    return Status::OK();
+  }
+
+  std::string path_server_;
+  std::vector<pid_t> pids_;
+  std::vector<std::string> servers_;
+};
+
+
+TEST(ClusterTest, HashRing) {
+  std::vector<std::string> servers;
+  for (int i = 0; i < 4; i++) servers.push_back("10.0.0." + std::to_string(i+1) + ":3490");
+  HashRing ring;
+  HashRing ring_reversed;
+  for (auto& server: servers) ring.AddServer(server);
+  for (auto it = servers.rbegin(); it != servers.rend(); ++it) ring_reversed.AddServer(*it);
+
+  int num_keys = 100000;
+  std::vector<std::string> keys;
+  std::map<std::string, int> counts;
+  for (int i = 0; i < num_keys; i++) {
+    keys.push_back("key" + std::to_string(i));
+    const std::string& server = ring.GetServer(keys[i].c_str(), keys[i].size());
+    ASSERT_EQ(server, ring_reversed.GetServer(keys[i].c_str(), keys[i].size()));
+    counts[server] += 1;
+  }
+  for (auto& server: servers) {
+    ASSERT_GT(counts[server], num_keys / 8);
+    ASSERT_LT(counts[server], num_keys * 3 / 8);
+  }
+
+  // Adding a server only moves keys to that server
+  HashRing ring_added = ring;
+  ring_added.AddServer("10.0.0.5:3490");
+  int num_moved = 0;
+  for (auto& key: keys) {
+    const std::string& server_before = ring.GetServer(key.c_str(), key.size());
+    const std::string& server_after = ring_added.GetServer(key.c_str(), key.size());
+    if (server_before == server_after) continue;
+    ASSERT_EQ(server_after, std::string("10.0.0.5:3490"));
+    num_moved += 1;
+  }
+  ASSERT_GT(num_moved, num_keys / 10);
+  ASSERT_LT(num_moved, num_keys * 3 / 10);
+
+  // Removing a server only moves the keys of that server
+  HashRing ring_removed = ring;
+  ring_removed.RemoveServer(servers[0]);
+  for (auto& key: keys) {
+    const std::string& server_before = ring.GetServer(key.c_str(), key.size());
+    const std::string& server_after = ring_removed.GetServer(key.c_str(), key.size());
+    ASSERT_NE(server_after, servers[0]);
+    if (server_before != servers[0]) ASSERT_EQ(server_before, server_after);
+  }
+}
+
+
+TEST(ClusterTest, Servers) {
+  StartServers(3, 3590);
+  // The connections of the client must be closed for the servers to stop
+  {
+    ClusterClient client(servers_, 4);
+    ASSERT_OK(WaitForServers(client));
+
+    int num_threads = 4;
+    int num_keys_per_thread = 500;
+    std::vector<std::thread> threads;
+    std::vector<Status> statuses(num_threads);
+    for (int t = 0; t < num_threads; t++) {
+      threads.push_back(std::thread([&, t]() {
+        for (int i = 0; i < num_keys_per_thread; i++) {
+          std::string key = "key" + std::to_string(t * num_keys_per_thread + i);
+          Status s = client.Put(key, "value-" + key);
+          if (!s.IsOK()) statuses[t] = s;
+        }
+      }));
+    }
+    for (auto& thread: threads) thread.join();
+    for (auto& s: statuses) ASSERT_OK(s);
+
+    int num_keys = num_threads * num_keys_per_thread;
+    std::vector<std::string> keys;
+    for (int i = 0; i < num_keys; i++) keys.push_back("key" + std::to_string(i));
+    for (int i = 0; i < 10; i++) keys.push_back("missing" + std::to_string(i));
+
+    std::map<std::string, std::string> values;
+    ASSERT_OK(client.MultiGet(keys, &values));
+    ASSERT_EQ(values.size(), (size_t)num_keys);
+    for (int i = 0; i < num_keys; i++) {
+      std::string key = "key" + std::to_string(i);
+      ASSERT_EQ(values[key], "value-" + key);
+    }
+
+    std::string value;
+    ASSERT_OK(client.Get("key42", &value));
+    ASSERT_EQ(value, std::string("value-key42"));
+    ASSERT_TRUE(client.Get("missing0", &value).IsNotFound());
+
+    for (int i = 0; i < num_keys; i += 2) {
+      ASSERT_OK(client.Remove("key" + std::to_string(i)));
+    }
+    values.clear();
+    ASSERT_OK(client.MultiGet(keys, &values));
+    ASSERT_EQ(values.size(), (size_t)num_keys / 2);
+    for (auto& p: values) {
+      ASSERT_EQ(p.second, "value-" + p.first);
+    }
+  }
+  StopServers();
+}
+
+} // namespace kdb
+
+int main() {
+  return kdb::test::RunAllTests();
+}
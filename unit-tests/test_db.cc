@@ -5,6 +5,7 @@
 #include <iostream>
 #include <iomanip>
 #include <thread>
+#include <atomic>
 #include <regex>
 #include <queue>
 #include <vector>
@@ -15,13 +16,17 @@
 #include <chrono>
 #include <sstream>
 #include <csignal>
+#include <sys/wait.h>
 
 #include "interface/kingdb.h"
+#include "interface/memorydb.h"
+#include "interface/follower.h"
 #include "kingdb/kdb.h"
 #include "util/status.h"
 #include "util/order.h"
 #include "util/byte_array.h"
 #include "util/file.h"
+#include "algorithm/key_filter.h"
 
 #include "interface/snapshot.h"
 #include "interface/iterator.h"
@@ -38,6 +43,11 @@ class DBTest {
     db_ = nullptr;
   }
 
+  void Open(const DatabaseOptions& db_options) {
+    db_options_ = db_options;
+    Open();
+  }
+
   void Open() {
     EraseDB();
     db_ = new kdb::KingDB(db_options_, dbname_);
@@ -48,6 +58,16 @@ class DBTest {
     }
   }
 
+  // Closes the database and opens it again without erasing it
+  void Reopen(const DatabaseOptions& db_options) {
+    db_->Close();
+    delete db_;
+    db_options_ = db_options;
+    db_ = new kdb::KingDB(db_options_, dbname_);
+    Status s = db_->Open();
+    if (!s.IsOK()) log::emerg("Server", s.ToString().c_str());
+  }
+
   void Close() {
     db_->Close();
     delete db_;
@@ -56,19 +76,35 @@ class DBTest {
   }
 
   void EraseDB() {
+    for (auto& dirpath: HSTableManager::GetDataDirectories(db_options_, dbname_)) {
+      EraseDirectory(dirpath);
+    }
+    if (!db_options_.storage__cold_directory.empty()) {
+      EraseDirectory(db_options_.storage__cold_directory);
+    }
+  }
+
+  // Removes a directory and its files, including the partition directories
+  void EraseDirectory(const std::string& dirpath) {
     struct dirent *entry;
     DIR *dir;
     char filepath[FileUtil::maximum_path_size()];
 
     struct stat info;
-    if (stat(dbname_.c_str(), &info) != 0) return;
+    if (stat(dirpath.c_str(), &info) != 0) return;
 
-    dir = opendir(dbname_.c_str());
+    dir = opendir(dirpath.c_str());
     while ((entry = readdir(dir)) != nullptr) {
-      sprintf(filepath, "%s/%s", dbname_.c_str(), entry->d_name);
-      std::remove(filepath);
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+      sprintf(filepath, "%s/%s", dirpath.c_str(), entry->d_name);
+      if (stat(filepath, &info) == 0 && S_ISDIR(info.st_mode)) {
+        EraseDirectory(filepath);
+      } else {
+        std::remove(filepath);
+      }
     }
-    rmdir(dbname_.c_str());
+    closedir(dir);
+    rmdir(dirpath.c_str());
   }
 
   kdb::Status Get(const std::string& key, std::string *value_out) {
@@ -130,18 +166,16 @@ TEST(DBTest, SingleThreadSmallItems) {
 
   for (iterator->Begin(); iterator->IsValid(); iterator->Next()) {
     kdb::ByteArray *value = iterator->GetValue();
-    char *chunk;
+    char chunk[4096];
     uint64_t size_chunk;
     kdb::Status s;
     while (true) {
-      s = value->data_chunk(&chunk, &size_chunk);
+      s = value->ReadInto(chunk, sizeof(chunk), &size_chunk);
       if (s.IsDone()) break;
       if (!s.IsOK()) {
-        delete[] chunk;
-        fprintf(stderr, "ClientEmbedded - Error - data_chunk(): %s", s.ToString().c_str());
+        fprintf(stderr, "ClientEmbedded - Error - ReadInto(): %s", s.ToString().c_str());
         break;
       }
-      delete[] chunk;
     }
     count_items_end += 1;
   }
@@ -157,6 +191,1525 @@ TEST(DBTest, SingleThreadSmallItems) {
 }
 
 
+TEST(DBTest, SliceValueAPI) {
+  Open();
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  // Values of various sizes, including values smaller than an LZ4 frame
+  // header and values with null bytes, to make sure they are copied properly
+  int num_items = 1000;
+  std::vector<std::string> keys, values;
+  for (auto i = 0; i < num_items; i++) {
+    std::stringstream ss;
+    ss << std::setfill ('0') << std::setw (16) << i;
+    keys.push_back(ss.str());
+    std::string value(i % 200, 'a' + (i % 26));
+    if (value.size() > 2) value[1] = '\0';
+    values.push_back(value);
+    kdb::Status s = db_->Put(write_options, keys[i], values[i]);
+    ASSERT_TRUE(s.IsOK());
+  }
+
+  for (auto i = 0; i < num_items; i += 2) {
+    kdb::Status s = db_->Remove(write_options, keys[i]);
+    ASSERT_TRUE(s.IsOK());
+  }
+
+  // A value spanning several chunks, and therefore several LZ4 frames
+  std::string key_large("large-value");
+  std::string value_large;
+  for (auto i = 0; i < 5 * 512 * 1024; i++) value_large.push_back('a' + (i * 7 + i / 13) % 26);
+  ASSERT_TRUE(db_->Put(write_options, key_large, value_large).IsOK());
+  std::vector<char> buffer(value_large.size());
+
+  // Reads are served from the write buffer or from the HSTables, depending on
+  // how far the flushing went, both must return the same results
+  for (auto pass = 0; pass < 2; pass++) {
+    for (auto i = 0; i < num_items; i++) {
+      kdb::Value value;
+      kdb::Status s = db_->Get(read_options, keys[i], &value);
+      if (i % 2 == 0) {
+        ASSERT_TRUE(s.IsNotFound());
+      } else {
+        ASSERT_TRUE(s.IsOK());
+        ASSERT_EQ(value.ToString(), values[i]);
+      }
+
+      uint64_t size_value;
+      s = db_->GetInto(read_options, keys[i], buffer.data(), buffer.size(), &size_value);
+      if (i % 2 == 0) {
+        ASSERT_TRUE(s.IsNotFound());
+      } else {
+        ASSERT_TRUE(s.IsOK());
+        ASSERT_EQ(std::string(buffer.data(), size_value), values[i]);
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  }
+
+  // Values made of several chunks are only readable once they are flushed,
+  // which is the case by now. A buffer too small is reported along with the
+  // size of the value.
+  uint64_t size_value;
+  kdb::Status s = db_->GetInto(read_options, key_large, buffer.data(), 16, &size_value);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  ASSERT_EQ(size_value, value_large.size());
+  s = db_->GetInto(read_options, key_large, buffer.data(), buffer.size(), &size_value);
+  ASSERT_TRUE(s.IsOK());
+  ASSERT_EQ(std::string(buffer.data(), size_value), value_large);
+
+  // Ranges within a chunk, across chunks, and truncated at the end
+  uint64_t ranges[][2] = { {0, 100},
+                           {1024 * 1024 - 10, 20},
+                           {100, 2 * 1024 * 1024},
+                           {value_large.size() - 5, 100},
+                           {value_large.size(), 10} };
+  for (auto& range: ranges) {
+    kdb::Value value;
+    s = db_->GetRange(read_options, key_large, range[0], range[1], &value);
+    ASSERT_TRUE(s.IsOK());
+    ASSERT_EQ(value.ToString(), value_large.substr(range[0], range[1]));
+  }
+  kdb::Value value_range;
+  s = db_->GetRange(read_options, key_large, value_large.size() + 1, 10, &value_range);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  s = db_->GetRange(read_options, keys[199], 10, 5, &value_range);
+  ASSERT_TRUE(s.IsOK());
+  ASSERT_EQ(value_range.ToString(), values[199].substr(10, 5));
+  value_range.Reset();
+
+  // The frame indices of the ranges that were read last are kept
+  kdb::FrameIndexCache frame_indices(2);
+  for (uint64_t location = 1; location <= 2; location++) {
+    frame_indices.Put(location, std::make_shared<kdb::FrameIndex>());
+  }
+  ASSERT_TRUE(frame_indices.Get(1) != nullptr);
+  frame_indices.Put(3, std::make_shared<kdb::FrameIndex>());
+  ASSERT_TRUE(frame_indices.Get(1) != nullptr);
+  ASSERT_TRUE(frame_indices.Get(2) == nullptr);
+  ASSERT_TRUE(frame_indices.Get(3) != nullptr);
+
+  // Values can be moved, and give their buffers back to the pool
+  kdb::Value value;
+  ASSERT_TRUE(db_->Get(read_options, keys[1], &value).IsOK());
+  kdb::Value value_moved(std::move(value));
+  ASSERT_TRUE(value.size() == 0);
+  ASSERT_EQ(value_moved.ToString(), values[1]);
+  value_moved.Reset();
+  ASSERT_TRUE(value_moved.size() == 0);
+
+  Close();
+}
+
+
+TEST(DBTest, PutRange) {
+  // Large entries are written to their own HSTable, and only the ones that
+  // are not compressed can be modified in place
+  DatabaseOptions db_options;
+  db_options.compression.type = kNoCompression;
+  db_options.storage__hstable_size = 1024 * 1024;
+  db_options.storage__maximum_chunk_size = 256 * 1024;
+  Open(db_options);
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  std::string value_small("small value");
+  std::string value_large;
+  for (auto i = 0; i < 3 * 1024 * 1024; i++) value_large.push_back('a' + (i * 7 + i / 13) % 26);
+  ASSERT_TRUE(db_->Put(write_options, "small", value_small).IsOK());
+  ASSERT_TRUE(db_->Put(write_options, "large", value_large).IsOK());
+  std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+
+  // Ranges inside a chunk, across chunks, and at the end of the value. The
+  // values read back have their checksum verified.
+  uint64_t offsets[] = {0, 1024 * 1024 - 100, value_large.size() - 4096};
+  for (auto offset: offsets) {
+    std::string data(4096, 'Z' - (offset % 26));
+    ASSERT_TRUE(db_->PutRange(write_options, "large", offset, data).IsOK());
+    value_large.replace(offset, data.size(), data);
+    kdb::Value value;
+    ASSERT_TRUE(db_->Get(read_options, "large", &value).IsOK());
+    ASSERT_TRUE(value.ToString() == value_large);
+  }
+
+  ASSERT_TRUE(db_->PutRange(write_options, "large", value_large.size() - 10, std::string(20, 'x')).IsInvalidArgument());
+  ASSERT_TRUE(db_->PutRange(write_options, "small", 0, "x").IsInvalidArgument());
+  ASSERT_TRUE(db_->PutRange(write_options, "missing", 0, "x").IsNotFound());
+
+  // Writing a range gives the entry a new version, thus a compare-and-swap
+  // based on the version read before fails
+  uint64_t version, version_range;
+  ASSERT_TRUE(db_->GetMetadata(read_options, "large", nullptr, nullptr, &version).IsOK());
+  ASSERT_TRUE(db_->PutRange(write_options, "large", 10, "abc").IsOK());
+  value_large.replace(10, 3, "abc");
+  ASSERT_TRUE(db_->GetMetadata(read_options, "large", nullptr, nullptr, &version_range).IsOK());
+  ASSERT_TRUE(version_range > version);
+  ASSERT_TRUE(db_->CompareAndSwap(write_options, "large", version, "x").IsConflict());
+
+  // The entries read by snapshots, change streams and followers must not
+  // change, thus no range is written while any of them is open
+  kdb::Interface *snapshot = db_->NewSnapshot();
+  ASSERT_TRUE(db_->PutRange(write_options, "large", 10, "def").IsConflict());
+  delete snapshot;
+  kdb::ChangeStream *stream;
+  ASSERT_TRUE(db_->NewChangeStream("", &stream).IsOK());
+  ASSERT_TRUE(db_->PutRange(write_options, "large", 10, "def").IsConflict());
+  delete stream;
+  std::string dbname_follower = "db_test_follower";
+  EraseDirectory(dbname_follower);
+  kdb::DatabaseOptions db_options_follower;
+  db_options_follower.storage__follow = "db_test";
+  kdb::Follower* follower = new kdb::Follower(db_options_follower, dbname_follower);
+  ASSERT_TRUE(follower->Open().IsOK());
+  ASSERT_TRUE(db_->PutRange(write_options, "large", 10, "def").IsConflict());
+  follower->Close();
+  delete follower;
+  EraseDirectory(dbname_follower);
+  ASSERT_TRUE(db_->PutRange(write_options, "large", 10, "def").IsOK());
+  value_large.replace(10, 3, "def");
+
+  // The readers never see a range partially written
+  for (auto i = 0; i < 4096; i++) value_large[8192 + i] = 'A';
+  ASSERT_TRUE(db_->PutRange(write_options, "large", 8192, value_large.substr(8192, 4096)).IsOK());
+  std::atomic<bool> is_done(false);
+  std::atomic<int> num_errors(0);
+  size_t size_large = value_large.size();
+  std::thread reader([&]() {
+    while (!is_done) {
+      kdb::Value value;
+      kdb::ReadOptions read_options_reader;
+      if (!db_->Get(read_options_reader, "large", &value).IsOK()) { num_errors++; continue; }
+      std::string str = value.ToString();
+      if (str.size() != size_large) { num_errors++; continue; }
+      for (auto i = 1; i < 4096; i++) {
+        if (str[8192 + i] != str[8192]) { num_errors++; break; }
+      }
+    }
+  });
+  for (auto i = 0; i < 50; i++) {
+    std::string data(4096, 'A' + i % 26);
+    ASSERT_TRUE(db_->PutRange(write_options, "large", 8192, data).IsOK());
+    value_large.replace(8192, data.size(), data);
+  }
+  is_done = true;
+  reader.join();
+  ASSERT_TRUE(num_errors == 0);
+
+  // An intent that was not entirely written is discarded when the database
+  // is opened, and leaves the entry untouched
+  db_->Close();
+  delete db_;
+  int fd = open("db_test/ranges/intent", O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  ASSERT_TRUE(write(fd, "torn", 4) == 4);
+  close(fd);
+  db_ = new kdb::KingDB(db_options, "db_test");
+  ASSERT_TRUE(db_->Open().IsOK());
+  struct stat info;
+  ASSERT_TRUE(stat("db_test/ranges/intent", &info) != 0);
+  kdb::Value value;
+  ASSERT_TRUE(db_->Get(read_options, "large", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == value_large);
+  value.Reset();
+
+  // The orders still in the write buffer take precedence over the entry on
+  // disk: a buffered put is flushed first, and the range is written to it
+  for (auto& c: value_large) c = (c == 'z') ? 'a' : c + 1;
+  ASSERT_TRUE(db_->Put(write_options, "large", value_large).IsOK());
+  ASSERT_TRUE(db_->PutRange(write_options, "large", 100, "new range").IsOK());
+  value_large.replace(100, 9, "new range");
+  ASSERT_TRUE(db_->Get(read_options, "large", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == value_large);
+  value.Reset();
+
+  ASSERT_TRUE(db_->Put(write_options, "large", value_small).IsOK());
+  ASSERT_TRUE(db_->PutRange(write_options, "large", 0, "x").IsInvalidArgument());
+  ASSERT_TRUE(db_->Get(read_options, "large", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == value_small);
+  value.Reset();
+
+  ASSERT_TRUE(db_->Put(write_options, "large", value_large).IsOK());
+  ASSERT_TRUE(db_->Remove(write_options, "large").IsOK());
+  ASSERT_TRUE(db_->PutRange(write_options, "large", 0, "x").IsNotFound());
+  ASSERT_TRUE(db_->Get(read_options, "large", &value).IsNotFound());
+
+  Close();
+}
+
+
+TEST(DBTest, SyncWrites) {
+  // A synchronous write only returns once its entry is on secondary storage
+  // and in the index, thus it can be read right away, without waiting for
+  // the write buffer to be flushed
+  Open();
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+  write_options.sync = true;
+
+  // The concurrent writers share the flushes, and thus the syncs
+  std::string num_flushes_before, num_flushes_after;
+  ASSERT_TRUE(db_->GetProperty("kingdb.write_buffer.flushes", &num_flushes_before));
+  int num_threads = 4;
+  int num_items = 50;
+  std::vector<std::thread> threads;
+  std::vector<int> num_errors(num_threads, 0);
+  for (auto t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&, t]() {
+      for (auto i = 0; i < num_items; i++) {
+        std::string key = "key" + std::to_string(t) + "-" + std::to_string(i);
+        if (!db_->Put(write_options, key, "value" + key).IsOK()) num_errors[t]++;
+      }
+    }));
+  }
+  for (auto& thread: threads) thread.join();
+  ASSERT_TRUE(db_->GetProperty("kingdb.write_buffer.flushes", &num_flushes_after));
+  uint64_t num_flushes = std::stoull(num_flushes_after) - std::stoull(num_flushes_before);
+  ASSERT_TRUE(num_flushes > 0);
+  ASSERT_TRUE(num_flushes < (uint64_t)(num_threads * num_items));
+
+  for (auto t = 0; t < num_threads; t++) {
+    ASSERT_EQ(num_errors[t], 0);
+    for (auto i = 0; i < num_items; i++) {
+      std::string key = "key" + std::to_string(t) + "-" + std::to_string(i);
+      kdb::Value value;
+      ASSERT_TRUE(db_->Get(read_options, key, &value).IsOK());
+      ASSERT_TRUE(value.ToString() == "value" + key);
+    }
+  }
+
+  ASSERT_TRUE(db_->Remove(write_options, "key0-0").IsOK());
+  kdb::Value value;
+  ASSERT_TRUE(db_->Get(read_options, "key0-0", &value).IsNotFound());
+  Close();
+
+  // A synchronous write is durable once it returns: the writer is killed
+  // right after, without the database being closed, and the entries are
+  // found when the database is opened again
+  int fds_ready[2];
+  ASSERT_TRUE(pipe(fds_ready) == 0);
+  pid_t pid = fork();
+  ASSERT_TRUE(pid >= 0);
+  if (pid == 0) {
+    close(fds_ready[0]);
+    kdb::KingDB db(kdb::DatabaseOptions(), "db_test");
+    if (!db.Open().IsOK()) _exit(1);
+    for (auto i = 0; i < num_items; i++) {
+      std::string key = "durable" + std::to_string(i);
+      if (!db.Put(write_options, key, "value" + key).IsOK()) _exit(1);
+    }
+    if (write(fds_ready[1], "r", 1) != 1) _exit(1);
+    while (true) pause();
+  }
+  close(fds_ready[1]);
+  char c;
+  ASSERT_TRUE(read(fds_ready[0], &c, 1) == 1);
+  ASSERT_TRUE(kill(pid, SIGKILL) == 0);
+  ASSERT_TRUE(waitpid(pid, nullptr, 0) == pid);
+  close(fds_ready[0]);
+
+  db_ = new kdb::KingDB(kdb::DatabaseOptions(), "db_test");
+  ASSERT_TRUE(db_->Open().IsOK());
+  for (auto i = 0; i < num_items; i++) {
+    std::string key = "durable" + std::to_string(i);
+    ASSERT_TRUE(db_->Get(read_options, key, &value).IsOK());
+    ASSERT_TRUE(value.ToString() == "value" + key);
+  }
+  value.Reset();
+  Close();
+}
+
+
+TEST(DBTest, WriteBatch) {
+  Open();
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+  write_options.sync = true;
+
+  kdb::WriteBatch batch1;
+  batch1.Put("a", "value-a");
+  batch1.Put("b", "value-b");
+  batch1.Put("c", "value-c");
+  ASSERT_TRUE(db_->Write(write_options, &batch1).IsOK());
+
+  kdb::WriteBatch batch2;
+  batch2.Put("d", "value-d");
+  batch2.Remove("a");
+  batch2.Put("e", "value-e");
+  ASSERT_TRUE(db_->Write(write_options, &batch2).IsOK());
+
+  kdb::Value value;
+  ASSERT_TRUE(db_->Get(read_options, "a", &value).IsNotFound());
+  ASSERT_TRUE(db_->Get(read_options, "e", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == "value-e");
+
+  kdb::WriteBatch batch_large;
+  batch_large.Put("large", std::string(kdb::DatabaseOptions().storage__maximum_chunk_size, 'x'));
+  ASSERT_TRUE(db_->Write(write_options, &batch_large).IsInvalidArgument());
+
+  // Cutting the last entry of the second batch, and removing the offset
+  // array, forces the recovery of the file when the database is opened:
+  // the second batch must then be dropped entirely
+  value.Reset();
+  db_->Close();
+  delete db_;
+  std::string filepath = "db_test/" + HSTableManager::num_to_hex(1);
+  struct stat info;
+  ASSERT_TRUE(stat(filepath.c_str(), &info) == 0);
+  int fd = open(filepath.c_str(), O_RDWR);
+  char buffer_footer[256];
+  uint64_t size_footer = HSTableFooter::GetFixedSize();
+  ASSERT_TRUE(pread(fd, buffer_footer, size_footer, info.st_size - size_footer) == (ssize_t)size_footer);
+  struct HSTableFooter footer;
+  ASSERT_TRUE(HSTableFooter::DecodeFrom(buffer_footer, size_footer, &footer).IsOK());
+  ASSERT_TRUE(ftruncate(fd, footer.offset_indexes - 1) == 0);
+  close(fd);
+
+  db_ = new kdb::KingDB(DatabaseOptions(), "db_test");
+  ASSERT_TRUE(db_->Open().IsOK());
+  ASSERT_TRUE(db_->Get(read_options, "a", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == "value-a");
+  ASSERT_TRUE(db_->Get(read_options, "c", &value).IsOK());
+  ASSERT_TRUE(db_->Get(read_options, "d", &value).IsNotFound());
+  ASSERT_TRUE(db_->Get(read_options, "e", &value).IsNotFound());
+  value.Reset();
+
+  Close();
+}
+
+
+TEST(DBTest, Merge) {
+  // Merges on the same counter from several threads must not lose any update
+  Open();
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  int num_threads = 4;
+  int num_items = 2000;
+  std::vector<std::thread> threads;
+  std::vector<int> num_errors(num_threads, 0);
+  for (auto t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&, t]() {
+      for (auto i = 0; i < num_items; i++) {
+        if (!db_->Merge(write_options, "counter", "2", kdb::IncrementOperator(), nullptr).IsOK()) num_errors[t]++;
+        if (!db_->Merge(write_options, "list", "x", kdb::AppendOperator(), nullptr).IsOK()) num_errors[t]++;
+      }
+    }));
+  }
+  for (auto& thread: threads) thread.join();
+  for (auto t = 0; t < num_threads; t++) ASSERT_EQ(num_errors[t], 0);
+
+  kdb::Value value;
+  ASSERT_TRUE(db_->Get(read_options, "counter", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == std::to_string(2 * num_threads * num_items));
+  ASSERT_TRUE(db_->Get(read_options, "list", &value).IsOK());
+  ASSERT_TRUE(value.size() == (uint64_t)num_threads * num_items);
+
+  std::string value_new;
+  ASSERT_TRUE(db_->Merge(write_options, "counter", "100000", kdb::DecrementOperator(), &value_new).IsOK());
+  ASSERT_TRUE(value_new == "0");
+  ASSERT_TRUE(db_->Merge(write_options, "list", "y", kdb::PrependOperator(), &value_new).IsOK());
+  ASSERT_TRUE(value_new == "y" + std::string(num_threads * num_items, 'x'));
+
+  // Memcached semantics: missing entries are not created, and only numeric
+  // values can be incremented
+  ASSERT_TRUE(db_->Merge(write_options, "missing", "1", kdb::IncrementOperator(false), nullptr).IsNotFound());
+  ASSERT_TRUE(db_->Merge(write_options, "missing", "a", kdb::AppendOperator(false), nullptr).IsNotFound());
+  ASSERT_TRUE(db_->Get(read_options, "missing", &value).IsNotFound());
+  ASSERT_TRUE(db_->Put(write_options, "text", "abc").IsOK());
+  ASSERT_TRUE(db_->Merge(write_options, "text", "1", kdb::IncrementOperator(), nullptr).IsInvalidArgument());
+  ASSERT_TRUE(db_->Merge(write_options, "text", "-1", kdb::IncrementOperator(), nullptr).IsInvalidArgument());
+  value.Reset();
+  Close();
+
+  kdb::MemoryDB db(kdb::DatabaseOptions(), "db_test");
+  ASSERT_TRUE(db.Open().IsOK());
+  ASSERT_TRUE(db.Merge(write_options, "counter", "5", kdb::IncrementOperator(), nullptr).IsOK());
+  ASSERT_TRUE(db.Merge(write_options, "counter", "3", kdb::DecrementOperator(), &value_new).IsOK());
+  ASSERT_TRUE(value_new == "2");
+  db.Close();
+}
+
+
+TEST(DBTest, CompareAndSwap) {
+  Open();
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  // Counters incremented with compare-and-swap loops from several threads
+  // must not lose any update
+  ASSERT_TRUE(db_->Put(write_options, "counter", "0").IsOK());
+  int num_threads = 4;
+  int num_items = 500;
+  std::vector<std::thread> threads;
+  std::vector<int> num_errors(num_threads, 0);
+  for (auto t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&, t]() {
+      for (auto i = 0; i < num_items; i++) {
+        while (true) {
+          kdb::Value value;
+          uint64_t version;
+          if (!db_->GetWithVersion(read_options, "counter", &value, &version).IsOK()) {
+            num_errors[t]++;
+            break;
+          }
+          std::string value_new = std::to_string(std::stoull(value.ToString()) + 1);
+          kdb::Status s = db_->CompareAndSwap(write_options, "counter", version, value_new);
+          if (s.IsOK()) break;
+          if (!s.IsConflict()) {
+            num_errors[t]++;
+            break;
+          }
+        }
+      }
+    }));
+  }
+  for (auto& thread: threads) thread.join();
+  for (auto t = 0; t < num_threads; t++) ASSERT_EQ(num_errors[t], 0);
+
+  kdb::Value value;
+  uint64_t version, version_old;
+  ASSERT_TRUE(db_->GetWithVersion(read_options, "counter", &value, &version).IsOK());
+  ASSERT_TRUE(value.ToString() == std::to_string(num_threads * num_items));
+
+  ASSERT_TRUE(db_->CompareAndSwap(write_options, "missing", version, "a").IsNotFound());
+  ASSERT_TRUE(db_->CompareAndSwap(write_options, "counter", version, "a").IsOK());
+  ASSERT_TRUE(db_->CompareAndSwap(write_options, "counter", version, "b").IsConflict());
+  version_old = version;
+  ASSERT_TRUE(db_->GetWithVersion(read_options, "counter", &value, &version).IsOK());
+  ASSERT_TRUE(version > version_old);
+
+  // The versions are stored in the entries, thus they are the same once the
+  // entries are flushed, and after the database is opened again
+  value.Reset();
+  db_->Close();
+  delete db_;
+  db_ = new kdb::KingDB(DatabaseOptions(), "db_test");
+  ASSERT_TRUE(db_->Open().IsOK());
+  ASSERT_TRUE(db_->GetWithVersion(read_options, "counter", &value, &version_old).IsOK());
+  ASSERT_TRUE(value.ToString() == "a");
+  ASSERT_EQ(version_old, version);
+  ASSERT_TRUE(db_->CompareAndSwap(write_options, "counter", version, "c").IsOK());
+  ASSERT_TRUE(db_->Remove(write_options, "counter").IsOK());
+  ASSERT_TRUE(db_->CompareAndSwap(write_options, "counter", version, "d").IsNotFound());
+
+  // A value written by several calls to PutChunk() is incomplete until its
+  // last chunk, and cannot be read-modified-written in the meantime
+  std::string chunk1(1000, 'a'), chunk2(1000, 'b');
+  ASSERT_TRUE(db_->Put(write_options, "chunked", "123").IsOK());
+  ASSERT_TRUE(db_->GetWithVersion(read_options, "chunked", &value, &version).IsOK());
+  ByteArray *key = new AllocatedByteArray("chunked", 7);
+  ByteArray *chunk = new AllocatedByteArray(chunk1.data(), chunk1.size());
+  ASSERT_TRUE(db_->PutChunk(write_options, key, chunk, 0, 2000).IsOK());
+  ASSERT_TRUE(db_->Merge(write_options, "chunked", "x", kdb::AppendOperator(), nullptr).IsConflict());
+  ASSERT_TRUE(db_->CompareAndSwap(write_options, "chunked", version, "d").IsConflict());
+  ASSERT_TRUE(db_->PutRange(write_options, "chunked", 0, "d").IsConflict());
+  key = new AllocatedByteArray("chunked", 7);
+  chunk = new AllocatedByteArray(chunk2.data(), chunk2.size());
+  ASSERT_TRUE(db_->PutChunk(write_options, key, chunk, 1000, 2000).IsOK());
+  ASSERT_TRUE(db_->Merge(write_options, "chunked", "x", kdb::AppendOperator(), nullptr).IsOK());
+  ASSERT_TRUE(db_->Get(read_options, "chunked", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == chunk1 + chunk2 + "x");
+
+  // A value abandoned after its first chunk is replaced by a Put()
+  key = new AllocatedByteArray("chunked", 7);
+  chunk = new AllocatedByteArray(chunk1.data(), chunk1.size());
+  ASSERT_TRUE(db_->PutChunk(write_options, key, chunk, 0, 2000).IsOK());
+  ASSERT_TRUE(db_->Merge(write_options, "chunked", "x", kdb::AppendOperator(), nullptr).IsConflict());
+  ASSERT_TRUE(db_->Put(write_options, "chunked", "ghi").IsOK());
+  ASSERT_TRUE(db_->Merge(write_options, "chunked", "x", kdb::AppendOperator(), nullptr).IsOK());
+
+  // The synchronous writes wait for their flush once the key is unlocked
+  kdb::WriteOptions write_options_sync;
+  write_options_sync.sync = true;
+  ASSERT_TRUE(db_->Merge(write_options_sync, "chunked", "y", kdb::AppendOperator(), nullptr).IsOK());
+  ASSERT_TRUE(db_->GetWithVersion(read_options, "chunked", &value, &version).IsOK());
+  ASSERT_TRUE(value.ToString() == "ghixy");
+  ASSERT_TRUE(db_->CompareAndSwap(write_options_sync, "chunked", version, "z").IsOK());
+  ASSERT_TRUE(db_->Get(read_options, "chunked", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == "z");
+  ASSERT_TRUE(db_->Remove(write_options_sync, "chunked").IsOK());
+  ASSERT_TRUE(db_->Get(read_options, "chunked", &value).IsNotFound());
+  value.Reset();
+  Close();
+
+  kdb::MemoryDB db(kdb::DatabaseOptions(), "db_test");
+  ASSERT_TRUE(db.Open().IsOK());
+  ASSERT_TRUE(db.Put(write_options, "key", "a").IsOK());
+  ASSERT_TRUE(db.GetWithVersion(read_options, "key", &value, &version).IsOK());
+  ASSERT_TRUE(db.CompareAndSwap(write_options, "key", version, "b").IsOK());
+  ASSERT_TRUE(db.CompareAndSwap(write_options, "key", version, "c").IsConflict());
+  ASSERT_TRUE(db.Get(read_options, "key", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == "b");
+  value.Reset();
+  db.Close();
+}
+
+
+TEST(DBTest, Metadata) {
+  Open();
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  // The metadata is first answered by the write buffer, and then by the
+  // headers of the entries once they have been flushed
+  std::string value_large(10000, 'a');
+  ASSERT_TRUE(db_->Put(write_options, "small", "abc").IsOK());
+  ASSERT_TRUE(db_->Put(write_options, "large", value_large).IsOK());
+  ASSERT_TRUE(db_->Put(write_options, "removed", "abc").IsOK());
+  ASSERT_TRUE(db_->Remove(write_options, "removed").IsOK());
+
+  kdb::Value value;
+  uint64_t size_value, size_value_compressed, version, version_get;
+  for (auto i = 0; i < 2; i++) {
+    ASSERT_TRUE(db_->Exists(read_options, "small").IsOK());
+    ASSERT_TRUE(db_->Exists(read_options, "missing").IsNotFound());
+    ASSERT_TRUE(db_->Exists(read_options, "removed").IsNotFound());
+    ASSERT_TRUE(db_->GetMetadata(read_options, "missing", &size_value, nullptr, nullptr).IsNotFound());
+    ASSERT_TRUE(db_->GetMetadata(read_options, "large", &size_value, &size_value_compressed, &version).IsOK());
+    ASSERT_EQ(size_value, value_large.size());
+    ASSERT_TRUE(size_value_compressed > 0 && size_value_compressed < size_value);
+    ASSERT_TRUE(db_->GetWithVersion(read_options, "large", &value, &version_get).IsOK());
+    ASSERT_EQ(version, version_get);
+    ASSERT_TRUE(db_->GetMetadata(read_options, "small", &size_value, nullptr, nullptr).IsOK());
+    ASSERT_TRUE(size_value == 3);
+    value.Reset();
+    db_->Close();
+    delete db_;
+    db_ = new kdb::KingDB(DatabaseOptions(), "db_test");
+    ASSERT_TRUE(db_->Open().IsOK());
+  }
+  Close();
+
+  kdb::MemoryDB db(kdb::DatabaseOptions(), "db_test");
+  ASSERT_TRUE(db.Open().IsOK());
+  ASSERT_TRUE(db.Put(write_options, "key", value_large).IsOK());
+  ASSERT_TRUE(db.Exists(read_options, "key").IsOK());
+  ASSERT_TRUE(db.Exists(read_options, "missing").IsNotFound());
+  ASSERT_TRUE(db.GetMetadata(read_options, "key", &size_value, nullptr, &version).IsOK());
+  ASSERT_EQ(size_value, value_large.size());
+  ASSERT_TRUE(db.GetWithVersion(read_options, "key", &value, &version_get).IsOK());
+  ASSERT_EQ(version, version_get);
+  value.Reset();
+  db.Close();
+}
+
+
+TEST(DBTest, KeyFilter) {
+  // No false negatives, and few false positives
+  kdb::KeyFilter filter;
+  ASSERT_TRUE(filter.MayContain(0));
+  int num_keys = 10000;
+  filter.Reset(num_keys);
+  for (auto i = 0; i < num_keys; i++) {
+    std::string key = "key" + std::to_string(i);
+    filter.Add(kdb::KeyFilter::HashKey(key.c_str(), key.size()));
+  }
+  ASSERT_TRUE(filter.IsFull());
+  int num_false_positives = 0;
+  for (auto i = 0; i < num_keys; i++) {
+    std::string key = "key" + std::to_string(i);
+    ASSERT_TRUE(filter.MayContain(kdb::KeyFilter::HashKey(key.c_str(), key.size())));
+    key = "missing" + std::to_string(i);
+    if (filter.MayContain(kdb::KeyFilter::HashKey(key.c_str(), key.size()))) num_false_positives++;
+  }
+  ASSERT_TRUE(num_false_positives < num_keys / 33);
+
+  // The filters of the write buffer and of the storage engine grow with the
+  // number of keys, and the removes in the write buffer still hide the
+  // entries already flushed
+  Open();
+  kdb::Logger::set_current_level("warn");
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+  num_keys = 5000;
+  for (auto i = 0; i < num_keys; i++) {
+    ASSERT_TRUE(db_->Put(write_options, "key" + std::to_string(i), "value" + std::to_string(i)).IsOK());
+  }
+  kdb::Value value;
+  for (auto j = 0; j < 2; j++) {
+    for (auto i = 0; i < num_keys; i++) {
+      ASSERT_TRUE(db_->Get(read_options, "key" + std::to_string(i), &value).IsOK());
+      ASSERT_TRUE(value.ToString() == "value" + std::to_string(i));
+      ASSERT_TRUE(db_->Get(read_options, "missing" + std::to_string(i), &value).IsNotFound());
+    }
+    value.Reset();
+    db_->Close();
+    delete db_;
+    db_ = new kdb::KingDB(DatabaseOptions(), "db_test");
+    ASSERT_TRUE(db_->Open().IsOK());
+  }
+  ASSERT_TRUE(db_->Remove(write_options, "key0").IsOK());
+  ASSERT_TRUE(db_->Get(read_options, "key0", &value).IsNotFound());
+  ASSERT_TRUE(db_->Put(write_options, "missing0", "value").IsOK());
+  ASSERT_TRUE(db_->Get(read_options, "missing0", &value).IsOK());
+  value.Reset();
+  Close();
+}
+
+
+TEST(DBTest, HugePageArena) {
+  // The huge pages of an index are returned once all their nodes are freed,
+  // and what the arena retains is what the index is charged for
+  kdb::HugePageArena arena;
+  {
+    IndexMap index{IndexMap::key_compare(), IndexMap::allocator_type(&arena)};
+    int num_items = 200000;
+    for (auto i = 0; i < num_items; i++) {
+      index.insert(std::pair<uint64_t, uint64_t>(i, i));
+    }
+    uint64_t size_retained = arena.GetSizeRetained();
+    ASSERT_TRUE(size_retained >= num_items * 2 * sizeof(uint64_t));
+    ASSERT_TRUE(size_retained % kdb::HugePageArena::kSizeHugePage == 0);
+
+    // Erasing the nodes from the end drains the last pages entirely
+    index.erase(index.lower_bound(num_items / 2), index.end());
+    ASSERT_TRUE(arena.GetSizeRetained() < size_retained);
+    index.clear();
+    ASSERT_EQ(arena.GetSizeRetained(), 0);
+
+    // The pages that were returned can be used again
+    for (auto i = 0; i < num_items; i++) {
+      index.insert(std::pair<uint64_t, uint64_t>(i, i));
+    }
+    ASSERT_EQ(arena.GetSizeRetained(), size_retained);
+    ASSERT_EQ(index.size(), num_items);
+  }
+  ASSERT_EQ(arena.GetSizeRetained(), 0);
+}
+
+
+TEST(DBTest, DirectIO) {
+  // Synchronous writes flush the buffer after each entry, thus the block at
+  // the end of the file gets written again by every flush
+  kdb::DatabaseOptions db_options;
+  db_options.storage__direct_io = true;
+  Open(db_options);
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+  write_options.sync = true;
+
+  int num_items = 200;
+  for (auto i = 0; i < num_items; i++) {
+    std::string key = "key" + std::to_string(i);
+    ASSERT_TRUE(db_->Put(write_options, key, std::string(i * 37, 'a' + i % 26)).IsOK());
+  }
+  std::string value_medium(db_options.storage__maximum_chunk_size * 3 + 123, 'm');
+  for (size_t i = 0; i < value_medium.size(); i += 4099) value_medium[i] = 'a' + i % 26;
+  ASSERT_TRUE(db_->Put(write_options, "medium", value_medium).IsOK());
+  ASSERT_TRUE(db_->Put(write_options, "last", "value-last").IsOK());
+
+  for (auto pass = 0; pass < 2; pass++) {
+    kdb::Value value;
+    for (auto i = 0; i < num_items; i++) {
+      std::string key = "key" + std::to_string(i);
+      ASSERT_TRUE(db_->Get(read_options, key, &value).IsOK());
+      ASSERT_TRUE(value.ToString() == std::string(i * 37, 'a' + i % 26));
+    }
+    ASSERT_TRUE(db_->Get(read_options, "medium", &value).IsOK());
+    ASSERT_TRUE(value.ToString() == value_medium);
+    ASSERT_TRUE(db_->Get(read_options, "last", &value).IsOK());
+    ASSERT_TRUE(value.ToString() == "value-last");
+
+    // The files written with direct I/O must be readable after a restart
+    value.Reset();
+    db_->Close();
+    delete db_;
+    db_ = new kdb::KingDB(db_options, "db_test");
+    ASSERT_TRUE(db_->Open().IsOK());
+  }
+
+  Close();
+}
+
+
+TEST(DBTest, MemoryLimit) {
+  // The limit is barely above what the HSTable buffers use, thus the writers
+  // are held back by almost every flush, and must never be blocked for good
+  kdb::DatabaseOptions db_options;
+  db_options.storage__hstable_size = 4 * 1024 * 1024;
+  db_options.memory_limit = 40 * 1024 * 1024;
+  Open(db_options);
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  int num_threads = 4;
+  int num_items = 2000;
+  std::string value(8192, 'v');
+  std::vector<std::thread> threads;
+  for (auto t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&, t]() {
+      for (auto i = 0; i < num_items; i++) {
+        db_->Put(write_options, "key" + std::to_string(t) + "-" + std::to_string(i), value);
+      }
+    }));
+  }
+  for (auto& thread: threads) thread.join();
+
+  for (auto t = 0; t < num_threads; t++) {
+    for (auto i = 0; i < num_items; i++) {
+      kdb::Value value_read;
+      ASSERT_TRUE(db_->Get(read_options, "key" + std::to_string(t) + "-" + std::to_string(i), &value_read).IsOK());
+      ASSERT_TRUE(value_read.ToString() == value);
+    }
+  }
+
+  Close();
+
+  // Below what the HSTable buffers use, no flush can make room, thus the
+  // writes are rejected instead of waiting for flushes
+  db_options.memory_limit = 1024 * 1024;
+  Open(db_options);
+  for (auto i = 0; i < 10; i++) {
+    ASSERT_TRUE(db_->Put(write_options, "key" + std::to_string(i), value).IsIOError());
+  }
+  Close();
+}
+
+
+TEST(DBTest, Partitions) {
+  kdb::DatabaseOptions db_options;
+  db_options.storage__num_partitions = 4;
+  Open(db_options);
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  int num_items = 1000;
+  for (auto i = 0; i < num_items; i++) {
+    ASSERT_TRUE(db_->Put(write_options, "key" + std::to_string(i), "value" + std::to_string(i)).IsOK());
+  }
+  for (auto i = 0; i < num_items; i += 10) {
+    ASSERT_TRUE(db_->Remove(write_options, "key" + std::to_string(i)).IsOK());
+  }
+
+  struct stat info;
+  for (uint32_t i = 0; i < db_options.storage__num_partitions; i++) {
+    ASSERT_EQ(stat(DatabaseOptions::GetPartitionPath("db_test", i).c_str(), &info), 0);
+  }
+
+  // The number of partitions is the one the database was created with
+  Reopen(kdb::DatabaseOptions());
+  for (auto i = 0; i < num_items; i++) {
+    kdb::Value value;
+    kdb::Status s = db_->Get(read_options, "key" + std::to_string(i), &value);
+    if (i % 10 == 0) {
+      ASSERT_TRUE(s.IsNotFound());
+    } else {
+      ASSERT_TRUE(s.IsOK());
+      ASSERT_TRUE(value.ToString() == "value" + std::to_string(i));
+    }
+  }
+
+  kdb::Interface *snapshot = db_->NewSnapshot();
+  kdb::Value value;
+  ASSERT_TRUE(snapshot->Get(read_options, "key1", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == "value1");
+  value.Reset();
+  delete snapshot;
+
+  // A snapshot is the same point in time in all the partitions: each step
+  // writes a key to a first partition, then to a second one, then to the
+  // first one again, thus a snapshot that has a key of a step also has the
+  // keys written before it, whichever partition the snapshot is taken first
+  std::string tag_a = "a", tag_b = "b";
+  while (   kdb::HashPartition(tag_a.data(), tag_a.size(), 4)
+         == kdb::HashPartition(tag_b.data(), tag_b.size(), 4)) {
+    tag_b += "b";
+  }
+  std::vector<std::string> tags = {tag_a, tag_b, tag_a};
+  std::atomic<bool> is_done(false);
+  std::atomic<int> num_steps(0);
+  std::thread writer([&]() {
+    kdb::WriteOptions write_options_writer;
+    for (auto i = 0; i < 20000 && !is_done; i++) {
+      for (size_t k = 0; k < tags.size(); k++) {
+        db_->Put(write_options_writer, "point" + std::to_string(i) + "-" + std::to_string(k) + "{" + tags[k] + "}", "value");
+      }
+      num_steps = i + 1;
+    }
+  });
+  for (auto n = 0; n < 10; n++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    snapshot = db_->NewSnapshot();
+    int num_steps_snapshot = num_steps;
+    for (auto i = 0; i < num_steps_snapshot; i++) {
+      bool has_next = false;
+      for (int k = tags.size() - 1; k >= 0; k--) {
+        kdb::Value value_point;
+        bool has = snapshot->Get(read_options, "point" + std::to_string(i) + "-" + std::to_string(k) + "{" + tags[k] + "}", &value_point).IsOK();
+        ASSERT_TRUE(has || !has_next);
+        has_next = has;
+      }
+    }
+    delete snapshot;
+  }
+  is_done = true;
+  writer.join();
+
+  // A batch cannot span several partitions, since it could not be recovered
+  // atomically, and nothing is written if it does
+  kdb::WriteBatch batch;
+  for (auto i = 0; i < 20; i++) {
+    batch.Put("batch" + std::to_string(i), "value" + std::to_string(i));
+  }
+  ASSERT_TRUE(db_->Write(write_options, &batch).IsInvalidArgument());
+  for (auto i = 0; i < 20; i++) {
+    ASSERT_TRUE(db_->Get(read_options, "batch" + std::to_string(i), &value).IsNotFound());
+  }
+
+  // The keys that share a tag belong to the same partition, whatever the
+  // rest of the key is
+  batch.Clear();
+  for (auto i = 0; i < 20; i++) {
+    std::string key = "batch" + std::to_string(i) + "{tag}";
+    ASSERT_EQ(kdb::HashPartition(key.data(), key.size(), 4), kdb::HashPartition("tag", 3, 4));
+    batch.Put(key, "value" + std::to_string(i));
+  }
+  ASSERT_TRUE(db_->Write(write_options, &batch).IsOK());
+  batch.Clear();
+  for (auto i = 0; i < 20; i += 2) {
+    batch.Remove("batch" + std::to_string(i) + "{tag}");
+  }
+  kdb::WriteOptions write_options_sync;
+  write_options_sync.sync = true;
+  ASSERT_TRUE(db_->Write(write_options_sync, &batch).IsOK());
+
+  for (auto k = 0; k < 2; k++) {
+    for (auto i = 0; i < 20; i++) {
+      kdb::Status s = db_->Get(read_options, "batch" + std::to_string(i) + "{tag}", &value);
+      if (i % 2 == 0) {
+        ASSERT_TRUE(s.IsNotFound());
+      } else {
+        ASSERT_TRUE(s.IsOK());
+        ASSERT_TRUE(value.ToString() == "value" + std::to_string(i));
+      }
+    }
+    value.Reset();
+    if (k == 0) Reopen(kdb::DatabaseOptions());
+  }
+
+  Close();
+}
+
+
+TEST(DBTest, DataDirectories) {
+  kdb::DatabaseOptions db_options;
+  db_options.storage__data_directories = "db_test_data1, db_test_data2";
+  db_options.storage__hstable_size = 256*1024;
+  db_options.storage__maximum_chunk_size = 64*1024;
+  db_options.compression.type = kNoCompression;
+  Open(db_options);
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  int num_items = 3000;
+  std::string data(1024, 'a');
+  for (auto i = 0; i < num_items; i++) {
+    ASSERT_TRUE(db_->Put(write_options, "key" + std::to_string(i), data + std::to_string(i)).IsOK());
+  }
+
+  // The HSTables are striped over all the data directories
+  Reopen(db_options);
+  for (auto& dirpath: HSTableManager::GetDataDirectories(db_options, "db_test")) {
+    int num_files = 0;
+    DIR *dir = opendir(dirpath.c_str());
+    ASSERT_TRUE(dir != nullptr);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (strlen(entry->d_name) == 8 && strspn(entry->d_name, "0123456789abcdef") == 8) num_files += 1;
+    }
+    closedir(dir);
+    ASSERT_TRUE(num_files > 0);
+  }
+
+  for (auto i = 0; i < num_items; i++) {
+    kdb::Value value;
+    ASSERT_TRUE(db_->Get(read_options, "key" + std::to_string(i), &value).IsOK());
+    ASSERT_TRUE(value.ToString() == data + std::to_string(i));
+  }
+
+  // The database cannot be opened with other data directories than the ones
+  // it was created with, which are stored along with its options
+  db_->Close();
+  delete db_;
+  std::vector<std::string> data_directories_others = {"", "db_test_data1", "db_test_data2, db_test_data1", "db_test_data1, db_test_data2, db_test_data3"};
+  for (auto& data_directories: data_directories_others) {
+    kdb::DatabaseOptions db_options_other = db_options;
+    db_options_other.storage__data_directories = data_directories;
+    kdb::KingDB db_other(db_options_other, "db_test");
+    ASSERT_TRUE(db_other.Open().IsIOError());
+  }
+  db_options.storage__data_directories = " db_test_data1,db_test_data2 ";
+  db_ = new kdb::KingDB(db_options, "db_test");
+  ASSERT_TRUE(db_->Open().IsOK());
+  kdb::Value value;
+  ASSERT_TRUE(db_->Get(read_options, "key0", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == data + "0");
+  value.Reset();
+
+  Close();
+}
+
+
+TEST(DBTest, ColdTier) {
+  kdb::DatabaseOptions db_options;
+  db_options.storage__cold_directory = "db_test_cold";
+  db_options.storage__cold_age = 0;
+  db_options.storage__statistics_polling_interval = 100;
+  Open(db_options);
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  int num_items = 1000;
+  for (auto i = 0; i < num_items; i++) {
+    ASSERT_TRUE(db_->Put(write_options, "key" + std::to_string(i), "value" + std::to_string(i)).IsOK());
+  }
+
+  // The latest HSTable is never moved, as it may still be written to
+  Reopen(db_options);
+  ASSERT_TRUE(db_->Put(write_options, "key_last", "value_last").IsOK());
+  Reopen(db_options);
+  std::string num_cold;
+  for (auto i = 0; i < 50; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_TRUE(db_->GetProperty("kingdb.storage.cold_files", &num_cold));
+    if (num_cold != "0") break;
+  }
+  ASSERT_TRUE(num_cold != "0");
+  ASSERT_TRUE(!db_->GetProperty("kingdb.unknown", &num_cold));
+
+  // The reads find the files in either tier, also after a restart
+  for (auto k = 0; k < 2; k++) {
+    for (auto i = 0; i < num_items; i++) {
+      kdb::Value value;
+      ASSERT_TRUE(db_->Get(read_options, "key" + std::to_string(i), &value).IsOK());
+      ASSERT_TRUE(value.ToString() == "value" + std::to_string(i));
+    }
+    Reopen(db_options);
+  }
+  ASSERT_TRUE(db_->GetProperty("kingdb.storage.cold_files", &num_cold));
+  ASSERT_TRUE(num_cold != "0");
+
+  Close();
+}
+
+
+TEST(DBTest, CacheMode) {
+  kdb::DatabaseOptions db_options;
+  db_options.storage__hstable_size = 256*1024;
+  db_options.storage__maximum_chunk_size = 64*1024;
+  db_options.storage__statistics_polling_interval = 100;
+  db_options.compression.type = kdb::kNoCompression;
+  db_options.cache__max_size = 2*1024*1024;
+  Open(db_options);
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  int num_items = 8000;
+  std::string data(1024, 'a');
+  for (auto i = 0; i < num_items; i++) {
+    ASSERT_TRUE(db_->Put(write_options, "key" + std::to_string(i), data + std::to_string(i)).IsOK());
+  }
+
+  // The oldest HSTables are removed until the database fits in its size
+  Reopen(db_options);
+  uint64_t size_db = 0;
+  for (auto i = 0; i < 50; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::string size_hot;
+    ASSERT_TRUE(db_->GetProperty("kingdb.storage.hot_size", &size_hot));
+    size_db = std::stoull(size_hot);
+    if (size_db <= db_options.cache__max_size) break;
+  }
+  ASSERT_TRUE(size_db <= db_options.cache__max_size);
+
+  // The oldest entries are gone, also after a restart, and the most recent
+  // ones are still there
+  for (auto k = 0; k < 2; k++) {
+    {
+      kdb::Value value;
+      ASSERT_TRUE(db_->Get(read_options, "key0", &value).IsNotFound());
+      for (auto i = num_items - 1000; i < num_items; i++) {
+        ASSERT_TRUE(db_->Get(read_options, "key" + std::to_string(i), &value).IsOK());
+        ASSERT_TRUE(value.ToString() == data + std::to_string(i));
+      }
+    }
+    Reopen(db_options);
+  }
+
+  Close();
+}
+
+
+TEST(DBTest, ChangeStream) {
+  kdb::DatabaseOptions db_options;
+  db_options.storage__hstable_size = 256*1024;
+  db_options.storage__maximum_chunk_size = 64*1024;
+  Open(db_options);
+  kdb::Logger::set_current_level("warn");
+
+  kdb::WriteOptions write_options;
+
+  // Puts over several HSTables, followed by removes
+  int num_items = 1000;
+  std::string data(512, 'a');
+  std::vector<std::string> keys, values;
+  for (auto i = 0; i < num_items; i++) {
+    keys.push_back("key" + std::to_string(i));
+    values.push_back(data + std::to_string(i));
+    ASSERT_TRUE(db_->Put(write_options, keys.back(), values.back()).IsOK());
+  }
+  for (auto i = 0; i < num_items; i += 10) {
+    keys.push_back("key" + std::to_string(i));
+    values.push_back("");
+    ASSERT_TRUE(db_->Remove(write_options, keys.back()).IsOK());
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+
+  // The values are read as they are stored, compressed or not
+  auto read_value = [](kdb::ByteArray* value) {
+    std::string out;
+    char chunk[4096];
+    uint64_t size_chunk;
+    while (value->ReadInto(chunk, sizeof(chunk), &size_chunk).IsOK()) {
+      out.append(chunk, size_chunk);
+    }
+    return out;
+  };
+
+  // Reads half of the changes, and keeps the cursor
+  kdb::ChangeStream* stream;
+  ASSERT_TRUE(db_->NewChangeStream("", &stream).IsOK());
+  int num_changes = 0;
+  for (; num_changes < num_items / 2; num_changes++) {
+    ASSERT_TRUE(stream->Next().IsOK());
+    ASSERT_EQ(stream->GetKey()->ToString(), keys[num_changes]);
+    ASSERT_TRUE(!stream->IsRemove());
+    ASSERT_EQ(read_value(stream->GetValue()), values[num_changes]);
+  }
+  std::string cursor = stream->GetCursor();
+  delete stream;
+
+  // Resumes from the cursor after a restart, and tails the new writes
+  Reopen(db_options);
+  ASSERT_TRUE(db_->NewChangeStream(cursor, &stream).IsOK());
+  for (; num_changes < (int)keys.size(); num_changes++) {
+    ASSERT_TRUE(stream->Next().IsOK());
+    ASSERT_EQ(stream->GetKey()->ToString(), keys[num_changes]);
+    ASSERT_EQ(stream->IsRemove(), values[num_changes].empty());
+    if (!stream->IsRemove()) ASSERT_EQ(read_value(stream->GetValue()), values[num_changes]);
+  }
+  ASSERT_TRUE(stream->Next().IsNotFound());
+  ASSERT_TRUE(db_->Put(write_options, "key_last", "value_last").IsOK());
+  kdb::Status s;
+  for (auto i = 0; i < 50; i++) {
+    s = stream->Next();
+    if (!s.IsNotFound()) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  ASSERT_TRUE(s.IsOK());
+  ASSERT_EQ(stream->GetKey()->ToString(), "key_last");
+  delete stream;
+
+  ASSERT_TRUE(db_->NewChangeStream("invalid", &stream).IsInvalidArgument());
+  Close();
+}
+
+
+TEST(DBTest, Follower) {
+  kdb::DatabaseOptions db_options;
+  db_options.storage__hstable_size = 256*1024;
+  db_options.storage__maximum_chunk_size = 64*1024;
+  db_options.storage__statistics_polling_interval = 100;
+  db_options.compression.type = kdb::kNoCompression;
+  db_options.compaction__filesystem__free_space_required = 1024*1024;
+  db_options.compaction__filesystem__normal_batch_size = 1024*1024;
+  Open(db_options);
+  kdb::Logger::set_current_level("warn");
+
+  std::string dbname_follower = "db_test_follower";
+  EraseDirectory(dbname_follower);
+  kdb::DatabaseOptions db_options_follower;
+  db_options_follower.storage__follow = "db_test";
+  db_options_follower.storage__statistics_polling_interval = 100;
+  kdb::Follower follower(db_options_follower, dbname_follower);
+  ASSERT_TRUE(follower.Open().IsOK());
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+  ASSERT_TRUE(follower.Put(write_options, "key", "value").IsIOError());
+
+  // Every round overwrites the entries of the previous one, and the last
+  // round removes some of them. The follower sees the changes once the
+  // primary has closed its HSTables, and the compactions of the primary
+  // do not bring back older versions.
+  int num_items = 1000;
+  int num_rounds = 4;
+  std::string data(1024, 'a');
+  for (auto k = 0; k < num_rounds; k++) {
+    data[0] = 'a' + k;
+    for (auto i = 0; i < num_items; i++) {
+      ASSERT_TRUE(db_->Put(write_options, "key" + std::to_string(i), data + std::to_string(i)).IsOK());
+    }
+    if (k == num_rounds - 1) {
+      for (auto i = 0; i < num_items; i += 10) {
+        ASSERT_TRUE(db_->Remove(write_options, "key" + std::to_string(i)).IsOK());
+      }
+    }
+    Reopen(db_options);
+
+    std::string value_last = data + std::to_string(num_items - 1);
+    bool is_shipped = false;
+    for (auto j = 0; j < 50 && !is_shipped; j++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      kdb::Value value;
+      is_shipped =    follower.Get(read_options, "key" + std::to_string(num_items - 1), &value).IsOK()
+                   && value.ToString() == value_last;
+    }
+    ASSERT_TRUE(is_shipped);
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  ASSERT_TRUE(follower.Follow().IsOK());
+  {
+    kdb::Value value;
+    for (auto i = 0; i < num_items; i++) {
+      kdb::Status s = follower.Get(read_options, "key" + std::to_string(i), &value);
+      if (i % 10 == 0) {
+        ASSERT_TRUE(s.IsNotFound());
+      } else {
+        ASSERT_TRUE(s.IsOK());
+        ASSERT_TRUE(value.ToString() == data + std::to_string(i));
+      }
+    }
+  }
+
+  follower.Close();
+  EraseDirectory(dbname_follower);
+  Close();
+}
+
+
+TEST(DBTest, FollowerProcess) {
+  // The primary runs in a child process, and tells the parent through a pipe
+  // every time it has closed its HSTables. It exits once the other pipe is
+  // closed, which also happens if the parent fails.
+  kdb::DatabaseOptions db_options;
+  db_options.storage__hstable_size = 256*1024;
+  db_options.storage__maximum_chunk_size = 64*1024;
+  db_options.compression.type = kdb::kNoCompression;
+  std::string dbname_primary = "db_test";
+  EraseDirectory(dbname_primary);
+  kdb::Logger::set_current_level("warn");
+
+  int num_items = 1000;
+  int num_rounds = 2;
+  std::string data(1024, 'a');
+  int fds_ready[2], fds_stop[2];
+  ASSERT_TRUE(pipe(fds_ready) == 0);
+  ASSERT_TRUE(pipe(fds_stop) == 0);
+  pid_t pid = fork();
+  ASSERT_TRUE(pid >= 0);
+  if (pid == 0) {
+    close(fds_ready[0]);
+    close(fds_stop[1]);
+    kdb::WriteOptions write_options;
+    kdb::KingDB *db = nullptr;
+    for (auto k = 0; k < num_rounds; k++) {
+      db = new kdb::KingDB(db_options, dbname_primary);
+      if (!db->Open().IsOK()) _exit(1);
+      data[0] = 'a' + k;
+      for (auto i = 0; i < num_items; i++) {
+        if (!db->Put(write_options, "key" + std::to_string(i), data + std::to_string(i)).IsOK()) _exit(1);
+      }
+      if (k == num_rounds - 1) {
+        for (auto i = 0; i < num_items; i += 10) {
+          if (!db->Remove(write_options, "key" + std::to_string(i)).IsOK()) _exit(1);
+        }
+      }
+      // Closing the database closes its HSTables, and the primary then
+      // keeps running while the follower reads them
+      db->Close();
+      delete db;
+      db = new kdb::KingDB(db_options, dbname_primary);
+      if (!db->Open().IsOK()) _exit(1);
+      if (write(fds_ready[1], "r", 1) != 1) _exit(1);
+      char c;
+      if (k == num_rounds - 1) while (read(fds_stop[0], &c, 1) > 0);
+      db->Close();
+      delete db;
+    }
+    _exit(0);
+  }
+  close(fds_ready[1]);
+  close(fds_stop[0]);
+
+  std::string dbname_follower = "db_test_follower";
+  EraseDirectory(dbname_follower);
+  kdb::DatabaseOptions db_options_follower;
+  db_options_follower.storage__follow = dbname_primary;
+  db_options_follower.storage__statistics_polling_interval = 100;
+  kdb::Follower follower(db_options_follower, dbname_follower);
+  kdb::ReadOptions read_options;
+  char c;
+  for (auto k = 0; k < num_rounds; k++) {
+    ASSERT_TRUE(read(fds_ready[0], &c, 1) == 1);
+    if (k == 0) ASSERT_TRUE(follower.Open().IsOK());
+    data[0] = 'a' + k;
+    std::string value_last = data + std::to_string(num_items - 1);
+    bool is_shipped = false;
+    for (auto j = 0; j < 50 && !is_shipped; j++) {
+      kdb::Value value;
+      is_shipped =    follower.Get(read_options, "key" + std::to_string(num_items - 1), &value).IsOK()
+                   && value.ToString() == value_last;
+      if (!is_shipped) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_TRUE(is_shipped);
+  }
+
+  ASSERT_TRUE(follower.Follow().IsOK());
+  {
+    kdb::Value value;
+    for (auto i = 0; i < num_items; i++) {
+      kdb::Status s = follower.Get(read_options, "key" + std::to_string(i), &value);
+      if (i % 10 == 0) {
+        ASSERT_TRUE(s.IsNotFound());
+      } else {
+        ASSERT_TRUE(s.IsOK());
+        ASSERT_TRUE(value.ToString() == data + std::to_string(i));
+      }
+    }
+  }
+
+  close(fds_stop[1]);
+  int status;
+  ASSERT_TRUE(waitpid(pid, &status, 0) == pid);
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  close(fds_ready[0]);
+  follower.Close();
+  EraseDirectory(dbname_follower);
+  EraseDirectory(dbname_primary);
+}
+
+
+TEST(DBTest, IngestFiles) {
+  kdb::DatabaseOptions db_options;
+  db_options.storage__hstable_size = 256*1024;
+  db_options.storage__maximum_chunk_size = 64*1024;
+  db_options.storage__num_partitions = 2;
+  Open(db_options);
+  kdb::Logger::set_current_level("warn");
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  int num_items = 3000;
+  for (auto i = 0; i < num_items; i += 100) {
+    ASSERT_TRUE(db_->Put(write_options, "key" + std::to_string(i), "old").IsOK());
+  }
+  ASSERT_TRUE(db_->Put(write_options, "removed", "old").IsOK());
+
+  // Two builders write in parallel, one of them with a large entry
+  std::string dirpath_bulk = "db_test_bulk";
+  EraseDirectory(dirpath_bulk);
+  ASSERT_EQ(mkdir(dirpath_bulk.c_str(), 0755), 0);
+  std::string data(1024, 'a');
+  // Random data, so that the large entry is still large once compressed
+  std::string data_large(600*1024, 'b');
+  uint32_t seed = 0;
+  for (size_t i = 0; i < data_large.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    data_large[i] = (char)(seed >> 16);
+  }
+  std::vector<std::string> filepaths;
+  std::mutex mutex_filepaths;
+  std::vector<std::thread> threads;
+  for (auto t = 0; t < 2; t++) {
+    threads.push_back(std::thread([&, t]() {
+      kdb::HSTableBuilder builder(db_options, dirpath_bulk, "bulk" + std::to_string(t));
+      for (auto i = t; i < num_items; i += 2) {
+        ASSERT_TRUE(builder.Put("key" + std::to_string(i), data + std::to_string(i)).IsOK());
+      }
+      if (t == 0) ASSERT_TRUE(builder.Put("large", data_large).IsOK());
+      if (t == 1) ASSERT_TRUE(builder.Remove("removed").IsOK());
+      ASSERT_TRUE(builder.Finish().IsOK());
+      std::unique_lock<std::mutex> lock(mutex_filepaths);
+      filepaths.insert(filepaths.end(), builder.GetFilepaths().begin(), builder.GetFilepaths().end());
+    }));
+  }
+  for (auto& thread: threads) thread.join();
+
+  // A file built with other options is rejected, and nothing is ingested
+  kdb::DatabaseOptions db_options_other = db_options;
+  db_options_other.hash = kdb::kMurmurHash3_64;
+  {
+    kdb::HSTableBuilder builder(db_options_other, dirpath_bulk, "other");
+    ASSERT_TRUE(builder.Put("key0", "other").IsOK());
+    ASSERT_TRUE(builder.Finish().IsOK());
+    std::vector<std::string> filepaths_other = filepaths;
+    filepaths_other.push_back(builder.GetFilepaths().back());
+    ASSERT_TRUE(db_->IngestFiles(filepaths_other).IsInvalidArgument());
+  }
+
+  // So is a file built for another number of partitions, whose entries
+  // belong to several partitions of the database
+  db_options_other = db_options;
+  db_options_other.storage__num_partitions = 1;
+  {
+    kdb::HSTableBuilder builder(db_options_other, dirpath_bulk, "other");
+    for (auto i = 0; i < 100; i++) {
+      ASSERT_TRUE(builder.Put("key" + std::to_string(i), "other").IsOK());
+    }
+    ASSERT_TRUE(builder.Finish().IsOK());
+    std::vector<std::string> filepaths_other = filepaths;
+    filepaths_other.push_back(builder.GetFilepaths().back());
+    ASSERT_TRUE(db_->IngestFiles(filepaths_other).IsInvalidArgument());
+  }
+
+  ASSERT_TRUE(db_->IngestFiles(filepaths).IsOK());
+  struct stat info;
+  for (auto& filepath: filepaths) ASSERT_NE(stat(filepath.c_str(), &info), 0);
+
+  // The ingested entries take precedence over the ones written before, and
+  // the ones written after take precedence over them, also after a restart
+  ASSERT_TRUE(db_->Put(write_options, "key1", "new").IsOK());
+  for (auto k = 0; k < 2; k++) {
+    {
+      kdb::Value value;
+      for (auto i = 0; i < num_items; i++) {
+        ASSERT_TRUE(db_->Get(read_options, "key" + std::to_string(i), &value).IsOK());
+        ASSERT_TRUE(value.ToString() == (i == 1 ? "new" : data + std::to_string(i)));
+      }
+      ASSERT_TRUE(db_->Get(read_options, "large", &value).IsOK());
+      ASSERT_TRUE(value.ToString() == data_large);
+      ASSERT_TRUE(db_->Get(read_options, "removed", &value).IsNotFound());
+    }
+    Reopen(db_options);
+  }
+
+  EraseDirectory(dirpath_bulk);
+  Close();
+}
+
+
+TEST(DBTest, InMemory) {
+  kdb::DatabaseOptions db_options;
+  kdb::MemoryDB db(db_options, "db_test");
+  ASSERT_TRUE(db.Open().IsOK());
+
+  kdb::ReadOptions read_options;
+  kdb::WriteOptions write_options;
+
+  // Overwrites leave dead space, which is reclaimed as the data is written
+  int num_items = 2000;
+  int num_rounds = 40;
+  // Half of the data is random, so that the values are compressed but still
+  // take space
+  std::string data(16*1024, 'a');
+  uint32_t seed = 0;
+  for (size_t i = 0; i < data.size() / 2; i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = (char)(seed >> 16);
+  }
+  for (auto k = 0; k < num_rounds; k++) {
+    for (auto i = 0; i < num_items; i++) {
+      data[0] = 'a' + k % 26;
+      ASSERT_TRUE(db.Put(write_options, "key" + std::to_string(i), data + std::to_string(i)).IsOK());
+    }
+  }
+  std::string size_used;
+  ASSERT_TRUE(db.GetProperty("kingdb.storage.hot_size", &size_used));
+  ASSERT_TRUE(std::stoull(size_used) < (uint64_t)num_rounds * num_items * data.size() / 2);
+
+  for (auto i = 0; i < num_items; i += 2) {
+    ASSERT_TRUE(db.Remove(write_options, "key" + std::to_string(i)).IsOK());
+  }
+  for (auto i = 0; i < num_items; i++) {
+    kdb::Value value;
+    kdb::Status s = db.Get(read_options, "key" + std::to_string(i), &value);
+    if (i % 2 == 0) {
+      ASSERT_TRUE(s.IsNotFound());
+    } else {
+      data[0] = 'a' + (num_rounds - 1) % 26;
+      ASSERT_TRUE(s.IsOK());
+      ASSERT_TRUE(value.ToString() == data + std::to_string(i));
+    }
+  }
+
+  // Values written in several chunks are only visible once complete
+  ByteArray *key = new AllocatedByteArray("chunked", 7);
+  ByteArray *chunk = new AllocatedByteArray("abc", 3);
+  ASSERT_TRUE(db.PutChunk(write_options, key, chunk, 0, 6).IsOK());
+  kdb::Value value;
+  ASSERT_TRUE(db.Get(read_options, "chunked", &value).IsNotFound());
+  key = new AllocatedByteArray("chunked", 7);
+  chunk = new AllocatedByteArray("def", 3);
+  ASSERT_TRUE(db.PutChunk(write_options, key, chunk, 3, 6).IsOK());
+  ASSERT_TRUE(db.Get(read_options, "chunked", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == "abcdef");
+
+  uint64_t version;
+  ASSERT_TRUE(db.GetMetadata(read_options, "chunked", nullptr, nullptr, &version).IsOK());
+  ASSERT_TRUE(db.PutRange(write_options, "chunked", 2, "CD").IsOK());
+  ASSERT_TRUE(db.GetRange(read_options, "chunked", 1, 4, &value).IsOK());
+  ASSERT_TRUE(value.ToString() == "bCDe");
+  ASSERT_TRUE(db.CompareAndSwap(write_options, "chunked", version, "x").IsConflict());
+
+  kdb::WriteBatch batch;
+  batch.Put("batch0", "value0");
+  batch.Put("batch1", "value1");
+  batch.Remove("chunked");
+  ASSERT_TRUE(db.Write(write_options, &batch).IsOK());
+  ASSERT_TRUE(db.Get(read_options, "batch1", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == "value1");
+  ASSERT_TRUE(db.Get(read_options, "chunked", &value).IsNotFound());
+  value.Reset();
+  db.Close();
+
+  // Segments left with no live data when the current segment rolls over are
+  // freed, and are not picked again and again by the compactions
+  db_options.compression.type = kdb::kNoCompression;
+  kdb::MemoryDB db_uncompressed(db_options, "db_test");
+  ASSERT_TRUE(db_uncompressed.Open().IsOK());
+  std::string value_large(64*1024, 'a');
+  for (auto i = 0; i < 2000; i++) {
+    ASSERT_TRUE(db_uncompressed.Put(write_options, "key", value_large).IsOK());
+    ASSERT_TRUE(db_uncompressed.Remove(write_options, "key").IsOK());
+  }
+  ASSERT_TRUE(db_uncompressed.Get(read_options, "key", &value).IsNotFound());
+  ASSERT_TRUE(db_uncompressed.Put(write_options, "key", value_large).IsOK());
+  ASSERT_TRUE(db_uncompressed.Get(read_options, "key", &value).IsOK());
+  ASSERT_TRUE(value.ToString() == value_large);
+  value.Reset();
+  db_uncompressed.Close();
+}
+
+
 TEST(DBTest, FileUtil) {
   int fd = open("/tmp/allocate", O_WRONLY|O_CREAT, 0644);
   auto start = std::chrono::high_resolution_clock::now();
@@ -0,0 +1,81 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_ARENA_H_
+#define KINGDB_ARENA_H_
+
+#include "util/debug.h"
+#include <vector>
+#include <new>
+#include <inttypes.h>
+
+namespace kdb {
+
+// Arena is a bump allocator: memory is carved from large blocks, and is only
+// released all at once by Reset(), which makes allocating and freeing many
+// small objects cost nearly nothing. The first block is kept across resets so
+// that an arena reused in cycles does not go back to the system allocator.
+// An Arena is not thread-safe, the caller has to synchronize the accesses.
+class Arena {
+ public:
+  Arena(uint64_t size_block=kSizeBlockDefault)
+      : size_block_(size_block),
+        current_(nullptr),
+        size_left_(0),
+        size_allocated_(0) {
+  }
+
+  ~Arena() {
+    for (auto block: blocks_) delete[] block;
+  }
+
+  char* Allocate(uint64_t size) {
+    // Aligns on the size of a pointer, for the objects allocated in place
+    size = (size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+    if (size > size_left_) {
+      // Large allocations get a block of their own, so that they do not waste
+      // what is left of the current block
+      if (size > size_block_ / 4) return AllocateBlock(size);
+      current_ = AllocateBlock(size_block_);
+      size_left_ = size_block_;
+    }
+    char *ptr = current_;
+    current_ += size;
+    size_left_ -= size;
+    return ptr;
+  }
+
+  void Reset() {
+    if (blocks_.empty()) return;
+    for (size_t i = 1; i < blocks_.size(); i++) delete[] blocks_[i];
+    blocks_.resize(1);
+    current_ = blocks_[0];
+    size_left_ = size_block_;
+    size_allocated_ = size_block_;
+  }
+
+  uint64_t size_allocated() const { return size_allocated_; }
+
+  static const uint64_t kSizeBlockDefault = 1024 * 1024;
+
+ private:
+  char* AllocateBlock(uint64_t size) {
+    // The first block must have the regular size, as it is the one kept
+    if (blocks_.empty() && size < size_block_) size = size_block_;
+    char *block = new char[size];
+    blocks_.push_back(block);
+    size_allocated_ += size;
+    return block;
+  }
+
+  const uint64_t size_block_;
+  std::vector<char*> blocks_;
+  char *current_;
+  uint64_t size_left_;
+  uint64_t size_allocated_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_ARENA_H_
@@ -0,0 +1,142 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_BUFFER_POOL_H_
+#define KINGDB_BUFFER_POOL_H_
+
+#include "util/debug.h"
+#include <mutex>
+#include <vector>
+#include <new>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "util/memory_budget.h"
+
+namespace kdb {
+
+// BufferPool recycles the memory buffers used by the value-type API, so that
+// reading small entries does not hit the allocator once the pool is warm.
+// Buffers are grouped into power-of-two size classes, from 64 bytes up to
+// 1 MB, and each class has its own free list and mutex. Requests larger than
+// the largest class are served with new[] and are never cached.
+// The free lists are reserved up front, which guarantees that Release()
+// never allocates.
+// Buffers of 4KB and more are aligned on 4KB, so that they can be used
+// directly by reads done with O_DIRECT.
+// The buffers kept in the free lists are charged to the memory budget, if
+// any, and Shrink() frees them all when the budget is exceeded.
+class BufferPool {
+ public:
+  BufferPool(uint64_t size_cache_max=kSizeCacheMaxDefault,
+             MemoryBudget* memory_budget=nullptr)
+      : memory_budget_(memory_budget) {
+    for (int i = 0; i < kNumClasses; i++) {
+      uint64_t size_class = SizeOfClass(i);
+      uint64_t num_max = (size_cache_max / kNumClasses) / size_class;
+      if (num_max < 1) num_max = 1;
+      if (num_max > kNumBuffersPerClassMax) num_max = kNumBuffersPerClassMax;
+      num_buffers_max_[i] = num_max;
+      free_lists_[i].reserve(num_max);
+    }
+  }
+
+  ~BufferPool() {
+    Shrink();
+  }
+
+  // Frees all the buffers in the free lists
+  void Shrink() {
+    for (int i = 0; i < kNumClasses; i++) {
+      uint64_t num_buffers;
+      {
+        std::unique_lock<std::mutex> lock(mutexes_[i]);
+        num_buffers = free_lists_[i].size();
+        for (auto buffer: free_lists_[i]) FreeBuffer(buffer);
+        free_lists_[i].clear();
+      }
+      if (memory_budget_ != nullptr) memory_budget_->Release(num_buffers * SizeOfClass(i));
+    }
+  }
+
+  // Returns a buffer of at least 'size' bytes. The actual capacity of the
+  // buffer is returned in 'capacity_out', and must be passed back to Release().
+  char* Acquire(uint64_t size, uint64_t *capacity_out) {
+    int c = ClassOf(size);
+    if (c < 0) {
+      *capacity_out = size;
+      return AllocateBuffer(size);
+    }
+    *capacity_out = SizeOfClass(c);
+    char* buffer = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutexes_[c]);
+      if (!free_lists_[c].empty()) {
+        buffer = free_lists_[c].back();
+        free_lists_[c].pop_back();
+      }
+    }
+    if (buffer == nullptr) return AllocateBuffer(*capacity_out);
+    if (memory_budget_ != nullptr) memory_budget_->Release(*capacity_out);
+    return buffer;
+  }
+
+  void Release(char* buffer, uint64_t capacity) {
+    if (buffer == nullptr) return;
+    int c = ClassOf(capacity);
+    if (c >= 0 && SizeOfClass(c) == capacity) {
+      // Charged before the buffer enters the free list, as Shrink() may
+      // release it right away
+      if (memory_budget_ != nullptr) memory_budget_->Charge(capacity);
+      {
+        std::unique_lock<std::mutex> lock(mutexes_[c]);
+        if (free_lists_[c].size() < num_buffers_max_[c]) {
+          free_lists_[c].push_back(buffer);
+          return;
+        }
+      }
+      if (memory_budget_ != nullptr) memory_budget_->Release(capacity);
+    }
+    FreeBuffer(buffer);
+  }
+
+  static char* AllocateBuffer(uint64_t size) {
+    void *ptr;
+    uint64_t alignment = (size >= kSizeAlignmentMax) ? kSizeAlignmentMax : sizeof(void*);
+    if (posix_memalign(&ptr, alignment, size) != 0) throw std::bad_alloc();
+    return static_cast<char*>(ptr);
+  }
+
+  static void FreeBuffer(char* buffer) {
+    free(buffer);
+  }
+
+  static const uint64_t kSizeCacheMaxDefault = 16 * 1024 * 1024;
+
+ private:
+  static const int kNumClasses = 15;             // 64 bytes to 1 MB
+  static const int kLog2SizeClassMin = 6;
+  static const uint64_t kNumBuffersPerClassMax = 64;
+  static const uint64_t kSizeAlignmentMax = 4096;
+
+  static uint64_t SizeOfClass(int c) {
+    return (uint64_t)1 << (c + kLog2SizeClassMin);
+  }
+
+  static int ClassOf(uint64_t size) {
+    for (int c = 0; c < kNumClasses; c++) {
+      if (size <= SizeOfClass(c)) return c;
+    }
+    return -1;
+  }
+
+  MemoryBudget* memory_budget_;
+  std::mutex mutexes_[kNumClasses];
+  std::vector<char*> free_lists_[kNumClasses];
+  uint64_t num_buffers_max_[kNumClasses];
+};
+
+} // namespace kdb
+
+#endif // KINGDB_BUFFER_POOL_H_
@@ -13,8 +13,10 @@
 #include <fcntl.h>
 #include <errno.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <vector>
 #include <string.h>
 
 #include "util/logger.h"
@@ -36,7 +38,8 @@ class ByteArrayCommon: public ByteArray {
         size_(0),
         size_compressed_(0),
         off_(0),
-        crc32_value_(0)
+        crc32_value_(0),
+        offset_read_(0)
   {
   }
   virtual ~ByteArrayCommon() {}
@@ -79,11 +82,21 @@ class ByteArrayCommon: public ByteArray {
     return Status::Done();
   }
 
+  virtual Status ReadInto(char *buffer, uint64_t size_buffer, uint64_t *size_out) {
+    uint64_t size_remaining = size() - offset_read_;
+    *size_out = std::min(size_remaining, size_buffer);
+    if (size_remaining == 0) return Status::Done();
+    memcpy(buffer, data() + offset_read_, *size_out);
+    offset_read_ += *size_out;
+    return Status::OK();
+  }
+
   char *data_;
   uint64_t size_;
   uint64_t size_compressed_;
   uint64_t off_;
   uint32_t crc32_value_;
+  uint64_t offset_read_;
 };
 
 
@@ -190,8 +203,16 @@ class Mmap {
 
 class SharedMmappedByteArray: public ByteArrayCommon {
  public:
-  SharedMmappedByteArray() {}
-  SharedMmappedByteArray(std::string filepath, int64_t filesize) {
+  SharedMmappedByteArray()
+      : crc32_read_(0),
+        offset_scratch_(0),
+        size_scratch_(0) {
+  }
+
+  SharedMmappedByteArray(std::string filepath, int64_t filesize)
+      : crc32_read_(0),
+        offset_scratch_(0),
+        size_scratch_(0) {
     mmap_ = std::shared_ptr<Mmap>(new Mmap(filepath, filesize));
     data_ = mmap_->datafile();
     size_ = 0;
@@ -199,7 +220,10 @@ class SharedMmappedByteArray: public ByteArrayCommon {
     crc32_.ResetThreadLocalStorage();
   }
 
-  SharedMmappedByteArray(char *data, uint64_t size) {
+  SharedMmappedByteArray(char *data, uint64_t size)
+      : crc32_read_(0),
+        offset_scratch_(0),
+        size_scratch_(0) {
     data_ = data;
     size_ = size;
     compressor_.ResetThreadLocalStorage();
@@ -219,6 +243,62 @@ class SharedMmappedByteArray: public ByteArrayCommon {
 
   void SetInitialCRC32(uint32_t c32) {
     crc32_.put(c32); 
+    crc32_read_ = c32;
+  }
+
+  // For compressed values, the frames are uncompressed straight into the
+  // buffer of the caller whenever they fit, and otherwise into a scratch
+  // buffer which is kept for the lifetime of the stream and served over
+  // the following calls.
+  virtual Status ReadInto(char *buffer, uint64_t size_buffer, uint64_t *size_out) {
+    *size_out = 0;
+    if (offset_scratch_ < size_scratch_) {
+      *size_out = std::min(size_scratch_ - offset_scratch_, size_buffer);
+      memcpy(buffer, scratch_.data() + offset_scratch_, *size_out);
+      offset_scratch_ += *size_out;
+      return Status::OK();
+    }
+
+    uint64_t size_stored = is_compressed() ? size_compressed_ : size_;
+    if (offset_read_ == size_stored) {
+      if (crc32_read_ != crc32_value_) {
+        log::debug("SharedMmappedByteArray::ReadInto()", "Bad CRC32 - stored:0x%08x computed:0x%08x", crc32_value_, crc32_read_);
+        return Status::IOError("Bad CRC32");
+      }
+      return Status::Done();
+    }
+
+    if (!is_compressed()) {
+      *size_out = std::min(size_stored - offset_read_, size_buffer);
+      memcpy(buffer, data_ + offset_read_, *size_out);
+      crc32_read_ = crc32c::Extend(crc32_read_, data_ + offset_read_, *size_out);
+      offset_read_ += *size_out;
+      return Status::OK();
+    }
+
+    if (size_stored - offset_read_ < 8) return Status::IOError("Invalid LZ4 frame: truncated frame header");
+    uint32_t size_frame, size_uncompressed;
+    GetFixed32(data_ + offset_read_,     &size_frame);
+    GetFixed32(data_ + offset_read_ + 4, &size_uncompressed);
+    if (size_frame > size_stored - offset_read_) return Status::IOError("Invalid LZ4 frame: invalid compressed size");
+    crc32_read_ = crc32c::Extend(crc32_read_, data_ + offset_read_, size_frame);
+
+    uint64_t size_frame_read;
+    Status s;
+    if (size_uncompressed <= size_buffer) {
+      s = CompressorLZ4::UncompressFrame(data_ + offset_read_, size_frame, buffer, size_buffer, &size_frame_read, size_out);
+    } else {
+      if (scratch_.size() < size_uncompressed) scratch_.resize(size_uncompressed);
+      s = CompressorLZ4::UncompressFrame(data_ + offset_read_, size_frame, scratch_.data(), scratch_.size(), &size_frame_read, &size_scratch_);
+      if (s.IsOK()) {
+        *size_out = std::min(size_scratch_, size_buffer);
+        memcpy(buffer, scratch_.data(), *size_out);
+        offset_scratch_ = *size_out;
+      }
+    }
+    if (!s.IsOK()) return s;
+    offset_read_ += size_frame;
+    return Status::OK();
   }
 
   virtual Status data_chunk(char **data_out, uint64_t *size_out) {
@@ -271,6 +351,12 @@ class SharedMmappedByteArray: public ByteArrayCommon {
   CRC32 crc32_;
   std::shared_ptr<Mmap> mmap_;
   uint64_t offset_;
+
+  // State of the ReadInto() stream
+  uint32_t crc32_read_;
+  std::vector<char> scratch_;
+  uint64_t offset_scratch_;
+  uint64_t size_scratch_;
 };
 
 
@@ -279,7 +365,7 @@ class AllocatedByteArray: public ByteArrayCommon {
   AllocatedByteArray(const char* data_in, uint64_t size_in) {
     size_ = size_in;
     data_ = new char[size_];
-    strncpy(data_, data_in, size_);
+    memcpy(data_, data_in, size_);
   }
 
   AllocatedByteArray(uint64_t size_in) {
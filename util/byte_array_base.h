@@ -23,6 +23,13 @@ class ByteArray {
   virtual bool StartsWith(const char *substr, int n) = 0;
   virtual Status data_chunk(char **data, uint64_t *size) = 0;
 
+  // Copies the next bytes of the value into 'buffer', uncompressing them if
+  // needed, and returns the number of bytes copied in 'size_out'. Returns OK
+  // as long as bytes are being read, and Done once the whole value has been
+  // read and its checksum verified. Unlike data_chunk(), the memory is
+  // provided by the caller and nothing has to be deleted.
+  virtual Status ReadInto(char *buffer, uint64_t size_buffer, uint64_t *size_out) = 0;
+
   bool operator ==(const ByteArray &right) const {
     //fprintf(stderr, "ByteArray operator==() -- left: %p %" PRIu64 " [%s] right: %p %" PRIu64 " [%s]\n", data_, size_, std::string(data_, size_).c_str(), right.data_const(), right.size_const(), std::string(right.data_const(), right.size_const()).c_str());
     return (   size_const() == right.size_const()
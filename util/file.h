@@ -10,6 +10,9 @@
 #include <sys/resource.h>
 #include <sys/statvfs.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <memory>
 
 #include "util/status.h"
 
@@ -126,9 +129,99 @@ class FileUtil {
     return Status::OK();
   }
 
+  // Removes the range [offset, offset+size) of a file from the page cache, or
+  // the range from 'offset' to the end of the file if 'size' is 0. Dirty pages
+  // cannot be removed, thus if 'is_dirty' is true, the range is first written
+  // back with sync_file_range(), which unlike fdatasync() does not wait for
+  // the other ranges of the file or for its metadata.
+  // NOTE: this is only a hint, the errors are logged and otherwise ignored.
+  static void drop_cache(int fd, uint64_t offset, uint64_t size, bool is_dirty) {
+    if (   is_dirty
+        && sync_file_range(fd, offset, size, SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER) != 0) {
+      log::trace("drop_cache()", "sync_file_range() error: %s", strerror(errno));
+    }
+    int ret = posix_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
+    if (ret != 0) {
+      log::trace("drop_cache()", "posix_fadvise() error: %s", strerror(ret));
+    }
+  }
+
+  // Copies a file into a new file and makes the copy durable. The pages of
+  // both files are then dropped from the page cache, as a file is copied
+  // because it is no longer hot.
+  static Status copy_file(const char *filepath_src, const char *filepath_dst) {
+    int fd_src, fd_dst;
+    if ((fd_src = open(filepath_src, O_RDONLY)) < 0) {
+      return Status::IOError("copy_file() - open() source", strerror(errno));
+    }
+    if ((fd_dst = open(filepath_dst, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+      close(fd_src);
+      return Status::IOError("copy_file() - open() destination", strerror(errno));
+    }
+    const uint64_t size_buffer = 1024*1024;
+    std::unique_ptr<char[]> buffer(new char[size_buffer]);
+    Status s;
+    while (s.IsOK()) {
+      ssize_t size_read = read(fd_src, buffer.get(), size_buffer);
+      if (size_read < 0 && errno == EINTR) continue;
+      if (size_read < 0) s = Status::IOError("copy_file() - read()", strerror(errno));
+      if (size_read <= 0) break;
+      ssize_t size_written = 0;
+      while (size_written < size_read) {
+        ssize_t ret = write(fd_dst, buffer.get() + size_written, size_read - size_written);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) {
+          s = Status::IOError("copy_file() - write()", strerror(errno));
+          break;
+        }
+        size_written += ret;
+      }
+    }
+    if (s.IsOK() && fsync(fd_dst) != 0) s = Status::IOError("copy_file() - fsync()", strerror(errno));
+    drop_cache(fd_src, 0, 0, false);
+    if (s.IsOK()) drop_cache(fd_dst, 0, 0, false);
+    close(fd_src);
+    close(fd_dst);
+    return s;
+  }
+
+  // Makes the creation and removal of files in a directory durable
+  static Status sync_directory(const char *dirpath) {
+    int fd;
+    if ((fd = open(dirpath, O_RDONLY)) < 0) {
+      return Status::IOError("sync_directory() - open()", strerror(errno));
+    }
+    Status s;
+    if (fsync(fd) != 0) s = Status::IOError("sync_directory() - fsync()", strerror(errno));
+    close(fd);
+    return s;
+  }
+
   static uint64_t maximum_path_size() {
     return 4096;
   }
+
+  // Reads and writes done with O_DIRECT must have their offsets, sizes and
+  // memory addresses aligned on the logical block size of the device, which
+  // is at most 4KB on all the devices in use today.
+  static uint64_t direct_io_alignment() {
+    return 4096;
+  }
+
+  static uint64_t align_down(uint64_t n) {
+    return n & ~(direct_io_alignment() - 1);
+  }
+
+  static uint64_t align_up(uint64_t n) {
+    return align_down(n + direct_io_alignment() - 1);
+  }
+
+  // Memory allocated here must be released with free()
+  static char* allocate_aligned(uint64_t size) {
+    void *ptr;
+    if (posix_memalign(&ptr, direct_io_alignment(), size) != 0) return nullptr;
+    return static_cast<char*>(ptr);
+  }
 };
 
 } // namespace kdb
@@ -0,0 +1,183 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_HUGEPAGE_ALLOCATOR_H_
+#define KINGDB_HUGEPAGE_ALLOCATOR_H_
+
+#include "util/debug.h"
+#include <mutex>
+#include <new>
+#include <map>
+#include <set>
+#include <vector>
+#include <cstddef>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+namespace kdb {
+
+// HugePageArena hands out memory blocks of a single size, carved from large
+// regions backed by 2MB pages. A random lookup in a large tree touches nodes
+// spread all over memory: with 4KB pages, nearly every node visited is a TLB
+// miss, whereas 2MB pages cover 512 times more memory per TLB entry.
+// Regions are mapped with MAP_HUGETLB when the system has explicit huge pages
+// reserved, and otherwise with regular pages aligned on 2MB and flagged with
+// madvise(MADV_HUGEPAGE), so that transparent huge pages can back them.
+// The blocks are counted per huge page, and are always taken from the page
+// with the lowest address that has room, so that the other pages can drain.
+// A page whose blocks have all been freed is returned to the system with
+// madvise(MADV_DONTNEED), and the regions are unmapped with the arena.
+// The size of the blocks is the one of the first allocation: the allocations
+// of other sizes are not served by the arena.
+class HugePageArena {
+ public:
+  HugePageArena()
+      : size_block_(0),
+        size_retained_(0) {
+  }
+
+  ~HugePageArena() {
+    for (auto region: regions_) munmap(region, kSizeRegion);
+  }
+
+  // Returns nullptr if 'size' is not the size of the blocks of the arena
+  void* Allocate(uint64_t size) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (size_block_ == 0) size_block_ = RoundUp(size);
+    if (RoundUp(size) != size_block_) return nullptr;
+    if (pages_available_.empty()) MapRegion();
+    char* address = *pages_available_.begin();
+    Page& page = pages_[address];
+    void* block;
+    if (page.free_list != nullptr) {
+      block = page.free_list;
+      page.free_list = *static_cast<void**>(block);
+    } else {
+      if (page.num_blocks_carved == 0) size_retained_ += kSizeHugePage;
+      block = address + page.num_blocks_carved * size_block_;
+      page.num_blocks_carved += 1;
+    }
+    page.num_blocks_used += 1;
+    if (page.free_list == nullptr && page.num_blocks_carved == kSizeHugePage / size_block_) {
+      pages_available_.erase(pages_available_.begin());
+    }
+    return block;
+  }
+
+  void Free(void* block) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    char* address = reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(block) & ~(kSizeHugePage - 1));
+    Page& page = pages_[address];
+    *static_cast<void**>(block) = page.free_list;
+    page.free_list = block;
+    page.num_blocks_used -= 1;
+    pages_available_.insert(address);
+    if (page.num_blocks_used == 0) {
+      madvise(address, kSizeHugePage, MADV_DONTNEED);
+      page.free_list = nullptr;
+      page.num_blocks_carved = 0;
+      size_retained_ -= kSizeHugePage;
+    }
+  }
+
+  // Whether the allocations of 'size' are served by the arena
+  bool IsBlockSize(uint64_t size) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return (size_block_ != 0 && RoundUp(size) == size_block_);
+  }
+
+  // Size of the huge pages that hold at least one block
+  uint64_t GetSizeRetained() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return size_retained_;
+  }
+
+  static const uint64_t kSizeHugePage = 2 * 1024 * 1024;
+  static const uint64_t kSizeRegion = 16 * kSizeHugePage;
+
+ private:
+  struct Page {
+    Page() : free_list(nullptr), num_blocks_used(0), num_blocks_carved(0) {}
+    void* free_list;
+    uint64_t num_blocks_used;
+    uint64_t num_blocks_carved;
+  };
+
+  static uint64_t RoundUp(uint64_t size) {
+    return (size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+  }
+
+  void MapRegion() {
+    void* region = mmap(nullptr, kSizeRegion, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (region == MAP_FAILED) {
+      // Mapping one extra huge page leaves room to align the region
+      char* raw = static_cast<char*>(mmap(nullptr, kSizeRegion + kSizeHugePage, PROT_READ|PROT_WRITE,
+                                          MAP_PRIVATE|MAP_ANONYMOUS, -1, 0));
+      if (raw == MAP_FAILED) throw std::bad_alloc();
+      uint64_t head = (kSizeHugePage - (uint64_t)raw % kSizeHugePage) % kSizeHugePage;
+      if (head > 0) munmap(raw, head);
+      munmap(raw + head + kSizeRegion, kSizeHugePage - head);
+      region = raw + head;
+      madvise(region, kSizeRegion, MADV_HUGEPAGE);
+    }
+    regions_.push_back(static_cast<char*>(region));
+    for (uint64_t offset = 0; offset < kSizeRegion; offset += kSizeHugePage) {
+      char* address = static_cast<char*>(region) + offset;
+      pages_[address] = Page();
+      pages_available_.insert(address);
+    }
+  }
+
+  uint64_t size_block_;
+  uint64_t size_retained_;
+  std::mutex mutex_;
+  std::vector<char*> regions_;
+  std::map<char*, Page> pages_;
+  std::set<char*> pages_available_;
+};
+
+
+// STL allocator that takes single objects from a HugePageArena, which is what
+// node-based containers such as std::multimap allocate. Each container is
+// given its own arena, which must outlive it, thus the containers do not
+// share a lock, and the memory of a container can be accounted for. Arrays,
+// and the containers constructed without an arena, go to operator new.
+template<class T>
+class HugePageAllocator {
+ public:
+  typedef T value_type;
+
+  HugePageAllocator() : arena_(nullptr) {}
+  explicit HugePageAllocator(HugePageArena* arena) : arena_(arena) {}
+  template<class U> HugePageAllocator(const HugePageAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* allocate(std::size_t n) {
+    if (n == 1 && arena_ != nullptr) {
+      void* block = arena_->Allocate(sizeof(T));
+      if (block != nullptr) return static_cast<T*>(block);
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, std::size_t n) {
+    if (n == 1 && arena_ != nullptr && arena_->IsBlockSize(sizeof(T))) {
+      arena_->Free(ptr);
+    } else {
+      ::operator delete(ptr);
+    }
+  }
+
+  HugePageArena* arena() const { return arena_; }
+
+  template<class U> bool operator==(const HugePageAllocator<U>& other) const { return arena_ == other.arena(); }
+  template<class U> bool operator!=(const HugePageAllocator<U>& other) const { return arena_ != other.arena(); }
+
+ private:
+  HugePageArena* arena_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_HUGEPAGE_ALLOCATOR_H_
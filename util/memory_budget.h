@@ -0,0 +1,128 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_MEMORY_BUDGET_H_
+#define KINGDB_MEMORY_BUDGET_H_
+
+#include "util/debug.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <inttypes.h>
+
+#include "util/logger.h"
+
+namespace kdb {
+
+// MemoryBudget accounts for the memory held by the components of a database
+// against the single limit given by 'db.memory_limit'. Each component charges
+// the memory it allocates and releases it once freed. When a charge takes the
+// usage over the limit, the reclaimers registered by the caches are called so
+// that they shrink, and writers can wait in WaitForRoom() for the flushes to
+// release memory, which throttles them to the speed of secondary storage.
+// The write buffers charge their orders as flushable: when the memory that
+// flushes cannot release, such as the index, is over the limit by itself,
+// waiting is pointless and the writes are rejected instead.
+// A limit of 0 means no limit: the usage is tracked, but nothing is reclaimed
+// and nobody waits.
+// NOTE: Charge() may call the reclaimers, thus it must never be called while
+//       holding a lock that a reclaimer takes.
+class MemoryBudget {
+ public:
+  MemoryBudget(uint64_t limit)
+      : limit_(limit),
+        usage_(0),
+        usage_unflushable_(0),
+        sequence_reclaimer_(0) {
+  }
+
+  void Charge(uint64_t size, bool is_flushable=false) {
+    if (!is_flushable) usage_unflushable_.fetch_add(size);
+    uint64_t usage = usage_.fetch_add(size) + size;
+    if (limit_ > 0 && usage > limit_) {
+      Reclaim();
+      if (!is_flushable && usage_unflushable_.load() > limit_) NotifyRoom();
+    }
+  }
+
+  void Release(uint64_t size, bool is_flushable=false) {
+    if (!is_flushable) usage_unflushable_.fetch_sub(size);
+    uint64_t usage = usage_.fetch_sub(size) - size;
+    if (limit_ > 0 && (usage <= limit_ || is_flushable)) NotifyRoom();
+  }
+
+  bool IsOverLimit() const {
+    return limit_ > 0 && usage_.load() > limit_;
+  }
+
+  // Whether the memory that flushing the write buffers cannot release is
+  // over the limit by itself. The caches are reclaimed before deciding.
+  bool IsOverLimitUnflushable() {
+    if (limit_ == 0 || usage_unflushable_.load() <= limit_) return false;
+    Reclaim();
+    return usage_unflushable_.load() > limit_;
+  }
+
+  // Blocks until the usage goes back under the limit, until the memory that
+  // flushes cannot release is over the limit by itself, or until
+  // 'timeout_ms' milliseconds have passed. Returns true if the usage is
+  // under the limit.
+  bool WaitForRoom(uint64_t timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_room_);
+    cv_room_.wait_for(lock,
+                      std::chrono::milliseconds(timeout_ms),
+                      [this]() { return !IsOverLimit() || usage_unflushable_.load() > limit_; });
+    return !IsOverLimit();
+  }
+
+  // A reclaimer frees as much memory as it can from a cache, and releases it
+  // from the budget. The id returned is used to remove the reclaimer.
+  uint64_t AddReclaimer(std::function<void()> reclaimer) {
+    std::unique_lock<std::mutex> lock(mutex_reclaimers_);
+    uint64_t id = ++sequence_reclaimer_;
+    reclaimers_[id] = reclaimer;
+    return id;
+  }
+
+  void RemoveReclaimer(uint64_t id) {
+    std::unique_lock<std::mutex> lock(mutex_reclaimers_);
+    reclaimers_.erase(id);
+  }
+
+  uint64_t usage() const { return usage_.load(); }
+  uint64_t limit() const { return limit_; }
+
+ private:
+  void NotifyRoom() {
+    std::unique_lock<std::mutex> lock(mutex_room_);
+    cv_room_.notify_all();
+  }
+
+  void Reclaim() {
+    // Only one thread reclaims at a time, the others carry on
+    std::unique_lock<std::mutex> lock(mutex_reclaimers_, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+    log::trace("MemoryBudget::Reclaim()", "usage:%" PRIu64 " limit:%" PRIu64, usage_.load(), limit_);
+    for (auto& p: reclaimers_) {
+      if (!IsOverLimit()) break;
+      p.second();
+    }
+  }
+
+  const uint64_t limit_;
+  std::atomic<uint64_t> usage_;
+  std::atomic<uint64_t> usage_unflushable_;
+  std::mutex mutex_room_;
+  std::condition_variable cv_room_;
+  std::mutex mutex_reclaimers_;
+  uint64_t sequence_reclaimer_;
+  std::map<uint64_t, std::function<void()>> reclaimers_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_MEMORY_BUDGET_H_
@@ -0,0 +1,152 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_MERGE_OPERATOR_H_
+#define KINGDB_MERGE_OPERATOR_H_
+
+#include "util/debug.h"
+#include <string>
+#include <limits>
+#include <inttypes.h>
+
+#include "util/status.h"
+#include "util/slice.h"
+
+namespace kdb {
+
+// A MergeOperator computes the new value of an entry from its current value
+// and an operand, for the read-modify-write operations of Merge(). The
+// current value is nullptr if the key has no value, in which case the
+// operator can either create the entry, or return NotFound to leave it
+// missing. Operators are called concurrently, thus they must be stateless.
+class MergeOperator {
+ public:
+  virtual ~MergeOperator() {}
+  virtual const char* Name() const = 0;
+  virtual Status Merge(const Slice& key,
+                       const Slice* value,
+                       const Slice& operand,
+                       std::string* value_out) const = 0;
+};
+
+
+// Counters are stored as decimal strings, as in Memcached. The operand is the
+// decimal amount to add or subtract: increments wrap around at 2^64, and
+// decrements stop at zero. A missing counter starts at zero, unless the
+// operator was created with 'create_if_missing' set to false.
+class CounterOperator: public MergeOperator {
+ public:
+  CounterOperator(bool is_decrement, bool create_if_missing)
+      : is_decrement_(is_decrement),
+        create_if_missing_(create_if_missing) {
+  }
+
+  virtual const char* Name() const override {
+    return is_decrement_ ? "decr" : "incr";
+  }
+
+  virtual Status Merge(const Slice& key,
+                       const Slice* value,
+                       const Slice& operand,
+                       std::string* value_out) const override {
+    uint64_t counter = 0, delta;
+    if (value == nullptr && !create_if_missing_) return Status::NotFound("Unable to find entry");
+    if (!ParseNumber(operand, &delta)) {
+      return Status::InvalidArgument("Invalid numeric delta argument");
+    }
+    if (value != nullptr && !ParseNumber(*value, &counter)) {
+      return Status::InvalidArgument("Cannot increment or decrement non-numeric value");
+    }
+    if (!is_decrement_) {
+      counter += delta;
+    } else {
+      counter = (delta > counter) ? 0 : counter - delta;
+    }
+    *value_out = std::to_string(counter);
+    return Status::OK();
+  }
+
+  static bool ParseNumber(const Slice& s, uint64_t *number) {
+    if (s.empty() || s.size() > 20) return false;
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < s.size(); i++) {
+      char c = s.data()[i];
+      if (c < '0' || c > '9') return false;
+      uint64_t digit = c - '0';
+      if (n > (std::numeric_limits<uint64_t>::max() - digit) / 10) return false;
+      n = n * 10 + digit;
+    }
+    *number = n;
+    return true;
+  }
+
+ private:
+  bool is_decrement_;
+  bool create_if_missing_;
+};
+
+class IncrementOperator: public CounterOperator {
+ public:
+  IncrementOperator(bool create_if_missing=true)
+      : CounterOperator(false, create_if_missing) {
+  }
+};
+
+class DecrementOperator: public CounterOperator {
+ public:
+  DecrementOperator(bool create_if_missing=true)
+      : CounterOperator(true, create_if_missing) {
+  }
+};
+
+
+// Adds the operand at the end of the value, or at its beginning for a
+// prepend. A missing value is created from the operand alone, unless the
+// operator was created with 'create_if_missing' set to false.
+class ConcatOperator: public MergeOperator {
+ public:
+  ConcatOperator(bool is_prepend, bool create_if_missing)
+      : is_prepend_(is_prepend),
+        create_if_missing_(create_if_missing) {
+  }
+
+  virtual const char* Name() const override {
+    return is_prepend_ ? "prepend" : "append";
+  }
+
+  virtual Status Merge(const Slice& key,
+                       const Slice* value,
+                       const Slice& operand,
+                       std::string* value_out) const override {
+    if (value == nullptr && !create_if_missing_) return Status::NotFound("Unable to find entry");
+    value_out->clear();
+    value_out->reserve(operand.size() + (value != nullptr ? value->size() : 0));
+    if (is_prepend_) value_out->append(operand.data(), operand.size());
+    if (value != nullptr) value_out->append(value->data(), value->size());
+    if (!is_prepend_) value_out->append(operand.data(), operand.size());
+    return Status::OK();
+  }
+
+ private:
+  bool is_prepend_;
+  bool create_if_missing_;
+};
+
+class AppendOperator: public ConcatOperator {
+ public:
+  AppendOperator(bool create_if_missing=true)
+      : ConcatOperator(false, create_if_missing) {
+  }
+};
+
+class PrependOperator: public ConcatOperator {
+ public:
+  PrependOperator(bool create_if_missing=true)
+      : ConcatOperator(true, create_if_missing) {
+  }
+};
+
+} // namespace kdb
+
+#endif // KINGDB_MERGE_OPERATOR_H_
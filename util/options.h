@@ -6,6 +6,9 @@
 #define KINGDB_OPTIONS_H_
 
 #include "util/debug.h"
+#include <sstream>
+#include <string>
+#include <vector>
 #include "config_parser.h"
 
 namespace kdb {
@@ -46,6 +49,9 @@ struct DatabaseOptions {
   HashType hash;
   CompressionOptions compression;
   uint64_t storage__hstable_size;
+  uint32_t storage__num_partitions;
+  std::string storage__data_directories;
+  std::string storage__cold_directory;
   std::string storage__compression_algorithm;
   std::string storage__hashing_algorithm;
 
@@ -53,22 +59,34 @@ struct DatabaseOptions {
   bool create_if_missing;
   bool error_if_exists;
   uint32_t max_open_files; // TODO: this parameter is ignored: use it
+  uint64_t memory_limit;
 
   uint64_t write_buffer__size;
   uint64_t write_buffer__flush_timeout;
   uint64_t write_buffer__close_timeout;
+  uint64_t write_buffer__arena_max_size;
 
   uint64_t storage__streaming_timeout;
   uint64_t storage__statistics_polling_interval;
   uint64_t storage__free_space_reject_orders;
   uint64_t storage__maximum_chunk_size;
   uint64_t storage__num_index_iterations_per_lock;
+  uint64_t storage__frame_index_cache_size;
+  bool storage__direct_io;
+  bool storage__in_memory;
+  std::string storage__follow;
+  bool storage__drop_cache_written;
+  uint64_t storage__drop_cache_keep_size;
+  uint64_t storage__cold_age;
 
   uint64_t compaction__check_interval;
   uint64_t compaction__filesystem__survival_mode_threshold;
   uint64_t compaction__filesystem__normal_batch_size;
   uint64_t compaction__filesystem__survival_batch_size;
   uint64_t compaction__filesystem__free_space_required;
+  bool compaction__drop_cache_inputs;
+
+  uint64_t cache__max_size;
 
   static std::string GetPath(const std::string &dirpath) {
     return dirpath + "/db_options";
@@ -78,6 +96,31 @@ struct DatabaseOptions {
     return "db_options";
   }
 
+  // The followers of a database hold a shared lock on this file for as long
+  // as they are open, thus the primary can tell whether any is attached
+  static std::string GetFollowersLockPath(const std::string &dirpath) {
+    return dirpath + "/followers";
+  }
+
+  // Splits the comma-separated list of 'db.storage.data_directories'
+  static std::vector<std::string> GetDataDirectoryList(const std::string &data_directories) {
+    std::vector<std::string> dirpaths;
+    std::stringstream ss(data_directories);
+    std::string dirpath;
+    while (std::getline(ss, dirpath, ',')) {
+      dirpath.erase(0, dirpath.find_first_not_of(" \t"));
+      dirpath.erase(dirpath.find_last_not_of(" \t") + 1);
+      if (!dirpath.empty()) dirpaths.push_back(dirpath);
+    }
+    return dirpaths;
+  }
+
+  static std::string GetPartitionPath(const std::string &dirpath, uint32_t index) {
+    char name[32];
+    snprintf(name, sizeof(name), "/partition-%03u", index);
+    return dirpath + name;
+  }
+
   static void AddParametersToConfigParser(DatabaseOptions& db_options, ConfigParser& parser) {
 
     // Database options
@@ -87,6 +130,9 @@ struct DatabaseOptions {
     parser.AddParameter(new kdb::BooleanParameter(
                          "db.error_if_exists", false, &db_options.error_if_exists, false,
                          "Will exit if the database already exists"));
+    parser.AddParameter(new kdb::UnsignedInt64Parameter(
+                         "db.memory_limit", "0", &db_options.memory_limit, false,
+                         "Maximum amount of memory used by the database: write buffers, HSTable buffers, index and caches. When the limit is reached, the caches are shrunk and the writes are slowed down until the write buffers have been flushed, or rejected if what flushes cannot release, such as the index, is over the limit by itself. Should be well above (8 * 'db.storage.hstable_size'), which is what the HSTable buffers use. 0 means no limit."));
     parser.AddParameter(new kdb::UnsignedInt64Parameter(
                          "db.write_buffer.size", "32MB", &db_options.write_buffer__size, false,
                          "Size of the Write Buffer. The database has two of these buffers."));
@@ -96,9 +142,21 @@ struct DatabaseOptions {
     parser.AddParameter(new kdb::UnsignedInt64Parameter(
                          "db.write_buffer.close_timeout", "5 seconds", &db_options.write_buffer__close_timeout, false,
                          "in milliseconds, the time that a closing process will ahave to wait when flushing the vectors in the Writer Buffer."));
+    parser.AddParameter(new kdb::UnsignedInt64Parameter(
+                         "db.write_buffer.arena_max_size", "64KB", &db_options.write_buffer__arena_max_size, false,
+                         "Chunks written through the Slice API up to that size are copied into the arena of the Write Buffer, which releases them all at once when the buffer is cleared. Larger chunks are allocated one by one."));
     parser.AddParameter(new kdb::UnsignedInt64Parameter(
                          "db.storage.hstable_size", "32MB", &db_options.storage__hstable_size, false,
                          "Maximum size a HSTable can have. Entries with keys and values beyond that size are considered to be large entries."));
+    parser.AddParameter(new kdb::UnsignedInt32Parameter(
+                         "db.storage.num_partitions", "1", &db_options.storage__num_partitions, false,
+                         "Number of partitions the keys are distributed over by hashing. Each partition is a storage engine of its own, with its own write buffers, HSTables, index and compaction, in a sub-directory of the database, so that flushing and compaction can use several cores. With more than one partition, the entries of a WriteBatch must all belong to the same partition: only the tag of a key is hashed if it has one, which is the part between its first '{' and the next '}', thus the keys that share a tag belong to the same partition."));
+    parser.AddParameter(new kdb::StringParameter(
+                         "db.storage.data_directories", "", &db_options.storage__data_directories, false,
+                         "Comma-separated list of additional directories, typically on other disks, over which the HSTables are striped in round-robin with the database directory, so that flushes, compactions and reads are spread over several devices. The list is stored when the database is created, and the database cannot be opened with any other list."));
+    parser.AddParameter(new kdb::StringParameter(
+                         "db.storage.cold_directory", "", &db_options.storage__cold_directory, false,
+                         "Directory of the cold tier, typically on a slower and cheaper disk. When set, the HSTables that have been neither written nor read for 'db.storage.cold_age' are moved there, and are read from there transparently. Once files have been moved, the cold directory must be set every time the database is opened."));
     parser.AddParameter(new kdb::StringParameter(
                          "db.storage.compression", "lz4", &db_options.storage__compression_algorithm, false,
                          "Compression algorithm used by the storage engine. Can be 'disabled' or 'lz4'."));
@@ -120,6 +178,27 @@ struct DatabaseOptions {
     parser.AddParameter(new kdb::UnsignedInt64Parameter(
                          "db.storage.num_index_iterations_per_lock", "10", &db_options.storage__num_index_iterations_per_lock, false,
                          "Number of entries merged into the Storage Engine index for each locking of the dedicated mutex. This parameter throttles index updates."));
+    parser.AddParameter(new kdb::UnsignedInt64Parameter(
+                         "db.storage.frame_index_cache_size", "1024", &db_options.storage__frame_index_cache_size, false,
+                         "Number of entries for which the offsets of the compressed frames are kept in memory, so that range reads inside large values can seek directly to the frames they need."));
+    parser.AddParameter(new kdb::BooleanParameter(
+                         "db.storage.in_memory", false, &db_options.storage__in_memory, false,
+                         "If true, the server uses the in-memory engine instead of KingDB: the entries are only kept in memory, and are lost when the server stops. Writes are rejected once 'db.memory_limit' is reached, if it is set."));
+    parser.AddParameter(new kdb::StringParameter(
+                         "db.storage.follow", "", &db_options.storage__follow, false,
+                         "Directory of a primary database on the same machine. When set, the server is a read-only follower of that database: the HSTables of the primary are shipped to the follower's own database directory once they are closed, by hard links or by copies if the directories are on different file systems, and are indexed as they arrive. The primary is checked every 'db.storage.statistics_polling_interval'. 'db.storage.cold_directory' must be the one of the primary, and the data directories are those stored by the primary."));
+    parser.AddParameter(new kdb::BooleanParameter(
+                         "db.storage.direct_io", false, &db_options.storage__direct_io, false,
+                         "If true, the HSTables written by flushes and compactions are written with O_DIRECT, and the reads that do not use mmap() are done with O_DIRECT, so that they do not go through the page cache. Large entries are still written through the page cache. Falls back to regular I/O if the file system does not support O_DIRECT."));
+    parser.AddParameter(new kdb::BooleanParameter(
+                         "db.storage.drop_cache_written", false, &db_options.storage__drop_cache_written, false,
+                         "If true, the data written to the HSTables, by flushes and compactions, is written back and removed from the page cache once it is older than 'db.storage.drop_cache_keep_size', and large entries are removed from the page cache once they are entirely written. Has no effect when 'db.storage.direct_io' is true."));
+    parser.AddParameter(new kdb::UnsignedInt64Parameter(
+                         "db.storage.drop_cache_keep_size", "8MB", &db_options.storage__drop_cache_keep_size, false,
+                         "When 'db.storage.drop_cache_written' is true, size of the most recently written data of each HSTable that is kept in the page cache, as it is the most likely to be read again soon."));
+    parser.AddParameter(new kdb::UnsignedInt64Parameter(
+                         "db.storage.cold_age", "24 hours", &db_options.storage__cold_age, false,
+                         "In milliseconds, when 'db.storage.cold_directory' is set, time after which an HSTable that has been neither written nor read is moved to the cold directory. The files are checked every 'db.storage.statistics_polling_interval', and the reads are only tracked while the database is open."));
 
     // Compaction options
     parser.AddParameter(new kdb::UnsignedInt64Parameter(
@@ -137,7 +216,14 @@ struct DatabaseOptions {
     parser.AddParameter(new kdb::UnsignedInt64Parameter(
                          "db.compaction.filesystem.survival_batch_size", "256MB", &db_options.compaction__filesystem__survival_batch_size, false,
                          "If the compaction is in survival mode and the amount of uncompacted data is above that value of 'survival_batch_size', then the compaction will start when the compaction conditions are checked."));
+    parser.AddParameter(new kdb::BooleanParameter(
+                         "db.compaction.drop_cache_inputs", false, &db_options.compaction__drop_cache_inputs, false,
+                         "If true, the files read by a compaction process are removed from the page cache once they have been compacted, so that the compaction does not evict data that is being read by the users of the database."));
 
+    // Cache options
+    parser.AddParameter(new kdb::UnsignedInt64Parameter(
+                         "db.cache.max_size", "0", &db_options.cache__max_size, false,
+                         "Maximum size of the database on secondary storage, for databases used as a cache. When the HSTables add up to more than that size, the oldest ones are removed, along with their entries in the index, until the database is back under 90% of that size. Entries are evicted by age of write, not of read, and the check is done every 'db.storage.statistics_polling_interval'. With several partitions, each partition gets an equal share of the size. 0 means no limit."));
 
   }
     
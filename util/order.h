@@ -8,6 +8,8 @@
 #include "util/debug.h"
 
 #include <set>
+#include <chrono>
+#include <algorithm>
 
 #include <thread>
 #include <unistd.h>
@@ -40,6 +42,13 @@ struct Order {
   uint64_t size_value_compressed;
   uint32_t crc32;
   bool is_large;
+  bool is_sync;
+  uint32_t num_batch_remaining; // number of orders left in the WriteBatch the
+                                // order is part of, including this one, or 0
+  bool is_in_arena;             // key and chunk are owned by the arena of the
+                                // write buffer, and are not deleted one by one
+  uint64_t version;             // given by the write buffer, or 0 if the entry
+                                // has no version
 
   bool IsFirstChunk() {
     return (offset_chunk == 0);
@@ -61,6 +70,43 @@ struct Order {
   bool IsLarge() {
     return is_large; 
   }
+
+  bool IsSync() {
+    return is_sync;
+  }
+
+  bool IsInBatch() {
+    return (num_batch_remaining > 0);
+  }
+
+  bool IsBatchLast() {
+    return (num_batch_remaining == 1);
+  }
+
+  bool IsInArena() {
+    return is_in_arena;
+  }
+};
+
+
+// The versions of the entries are taken from the wall clock in nanoseconds,
+// and incremented when several entries are written within the same
+// nanosecond. They therefore keep increasing across restarts without being
+// persisted anywhere but in the entries themselves. The callers serialize the
+// calls to Next().
+class VersionClock {
+ public:
+  VersionClock() : version_last_(0) {}
+
+  uint64_t Next() {
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    version_last_ = std::max(version_last_ + 1, now);
+    return version_last_;
+  }
+
+ private:
+  uint64_t version_last_;
 };
 
 } // namespace kdb
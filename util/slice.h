@@ -0,0 +1,56 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_SLICE_H_
+#define KINGDB_SLICE_H_
+
+#include "util/debug.h"
+#include <string>
+#include <string.h>
+#include <inttypes.h>
+
+#include "util/status.h"
+#include "util/byte_array_base.h"
+
+namespace kdb {
+
+// A Slice is a non-owning view over a sequence of bytes. It is the type used
+// for the inputs of the value-type API: the caller keeps ownership of the
+// memory, which only needs to remain valid for the duration of the call.
+// Unlike ByteArray, a Slice is never allocated on the heap nor deleted by
+// the database.
+class Slice {
+ public:
+  Slice() : data_(""), size_(0) {}
+  Slice(const char* data, uint64_t size) : data_(data), size_(size) {}
+  Slice(const std::string& s) : data_(s.data()), size_(s.size()) {}
+  Slice(const char* s) : data_(s), size_(strlen(s)) {}
+
+  const char* data() const { return data_; }
+  uint64_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  std::string ToString() const { return std::string(data_, size_); }
+
+  bool operator ==(const Slice& right) const {
+    return (   size_ == right.size()
+            && memcmp(data_, right.data(), size_) == 0);
+  }
+
+  bool operator !=(const Slice& right) const {
+    return !(*this == right);
+  }
+
+  bool operator ==(const ByteArray& right) const {
+    return (   size_ == right.size_const()
+            && memcmp(data_, right.data_const(), size_) == 0);
+  }
+
+ private:
+  const char* data_;
+  uint64_t size_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_SLICE_H_
@@ -28,6 +28,9 @@ std::string Status::ToString() const {
       case kIOError:
         type = "IO error: ";
         break;
+      case kConflict:
+        type = "Conflict: ";
+        break;
       default:
         snprintf(tmp, sizeof(tmp), "Unknown code (%d): ",
                  static_cast<int>(code()));
@@ -41,6 +41,10 @@ class Status {
     return Status(kNotFound, message1, message2);
   }
 
+  // Message-less version, for the internal lookups that miss routinely and
+  // must not allocate, such as the lookups in the write buffer
+  static Status NotFound() { return Status(kNotFound); }
+
   static Status InvalidArgument(const std::string& message1, const std::string& message2="") {
     return Status(kInvalidArgument, message1, message2);
   }
@@ -49,12 +53,18 @@ class Status {
     return Status(kIOError, message1, message2);
   }
 
+  // The entry was modified since the version given to a compare-and-swap
+  static Status Conflict(const std::string& message1, const std::string& message2="") {
+    return Status(kConflict, message1, message2);
+  }
+
   bool IsOK() const { return (code() == kOK); }
   bool IsNotFound() const { return code() == kNotFound; }
   bool IsRemoveOrder() const { return code() == kRemoveOrder; }
   bool IsInvalidArgument() const { return code() == kInvalidArgument; }
   bool IsIOError() const { return code() == kIOError; }
   bool IsDone() const { return code() == kDone; }
+  bool IsConflict() const { return code() == kConflict; }
 
   std::string ToString() const;
 
@@ -72,7 +82,8 @@ class Status {
     kRemoveOrder = 2,
     kInvalidArgument = 3,
     kIOError = 4,
-    kDone = 5
+    kDone = 5,
+    kConflict = 6
   };
 };
 
@@ -0,0 +1,122 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_VALUE_H_
+#define KINGDB_VALUE_H_
+
+#include "util/debug.h"
+#include <string>
+#include <inttypes.h>
+
+#include "util/slice.h"
+#include "util/buffer_pool.h"
+
+namespace kdb {
+
+// A Value is the output type of the value-type API. It owns a buffer taken
+// from a BufferPool, and gives the buffer back to the pool when it is
+// destroyed or reset. A Value can be moved but not copied, so that exactly
+// one handle is responsible for the buffer at any time.
+// The data of a Value may start anywhere inside its buffer, which allows
+// an entry to be read from disk with a single pread() and its value to be
+// returned without any extra copy.
+// IMPORTANT: Values must be destroyed before the database or snapshot that
+//            produced them is closed.
+class Value {
+ public:
+  Value()
+      : pool_(nullptr),
+        buffer_(nullptr),
+        capacity_(0),
+        data_(nullptr),
+        size_(0) {
+  }
+
+  Value(Value&& v)
+      : pool_(v.pool_),
+        buffer_(v.buffer_),
+        capacity_(v.capacity_),
+        data_(v.data_),
+        size_(v.size_) {
+    v.Forget();
+  }
+
+  Value& operator=(Value&& v) {
+    if (&v == this) return *this;
+    Reset();
+    pool_ = v.pool_;
+    buffer_ = v.buffer_;
+    capacity_ = v.capacity_;
+    data_ = v.data_;
+    size_ = v.size_;
+    v.Forget();
+    return *this;
+  }
+
+  Value(const Value&) = delete;
+  Value& operator=(const Value&) = delete;
+
+  ~Value() { Reset(); }
+
+  const char* data() const { return data_; }
+  uint64_t size() const { return size_; }
+  Slice ToSlice() const { return Slice(data_, size_); }
+  std::string ToString() const { return std::string(data_, size_); }
+
+  void Reset() {
+    if (buffer_ != nullptr) {
+      if (pool_ != nullptr) {
+        pool_->Release(buffer_, capacity_);
+      } else {
+        BufferPool::FreeBuffer(buffer_);
+      }
+    }
+    Forget();
+  }
+
+  // Replaces the content of the Value with a buffer of at least 'size' bytes
+  // taken from 'pool', and returns a pointer to it. The data of the Value
+  // is set to the first 'size' bytes of the buffer.
+  char* Allocate(BufferPool* pool, uint64_t size) {
+    Reset();
+    pool_ = pool;
+    if (pool_ != nullptr) {
+      buffer_ = pool_->Acquire(size, &capacity_);
+    } else {
+      buffer_ = BufferPool::AllocateBuffer(size);
+      capacity_ = size;
+    }
+    data_ = buffer_;
+    size_ = size;
+    return buffer_;
+  }
+
+  // Sets the data of the Value to a window of its own buffer
+  void SetWindow(uint64_t offset, uint64_t size) {
+    data_ = buffer_ + offset;
+    size_ = size;
+  }
+
+  char* buffer() { return buffer_; }
+  uint64_t capacity() const { return capacity_; }
+
+ private:
+  void Forget() {
+    pool_ = nullptr;
+    buffer_ = nullptr;
+    capacity_ = 0;
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  BufferPool* pool_;
+  char* buffer_;
+  uint64_t capacity_;
+  char* data_;
+  uint64_t size_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_VALUE_H_
@@ -0,0 +1,65 @@
+// Copyright (c) 2014, Emmanuel Goossaert. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#ifndef KINGDB_WRITE_BATCH_H_
+#define KINGDB_WRITE_BATCH_H_
+
+#include "util/debug.h"
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+#include "util/slice.h"
+#include "util/order.h"
+
+namespace kdb {
+
+// A WriteBatch holds a sequence of puts and removes that are applied
+// atomically: either all of them are visible after a crash, or none of them.
+// The keys and values are copied into the batch, thus the slices passed to
+// Put() and Remove() only need to remain valid for the duration of the calls.
+// The entries of a batch must each fit in a single chunk, and the whole batch
+// must fit in a single HSTable. With several partitions, all the entries must
+// belong to the same partition, which the keys that share a tag always do:
+// see HashPartition().
+class WriteBatch {
+ public:
+  struct Operation {
+    OrderType type;
+    std::string key;
+    std::string value;
+  };
+
+  WriteBatch() : size_(0) {}
+
+  void Put(const Slice& key, const Slice& value) {
+    operations_.push_back(Operation{OrderType::Put, key.ToString(), value.ToString()});
+    size_ += key.size() + value.size();
+  }
+
+  void Remove(const Slice& key) {
+    operations_.push_back(Operation{OrderType::Remove, key.ToString(), std::string()});
+    size_ += key.size();
+  }
+
+  void Clear() {
+    operations_.clear();
+    size_ = 0;
+  }
+
+  uint64_t Count() const { return operations_.size(); }
+
+  // Total size of the keys and values in the batch
+  uint64_t size() const { return size_; }
+
+  const std::vector<Operation>& operations() const { return operations_; }
+
+ private:
+  std::vector<Operation> operations_;
+  uint64_t size_;
+};
+
+} // namespace kdb
+
+#endif // KINGDB_WRITE_BATCH_H_